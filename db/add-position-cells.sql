@@ -0,0 +1,63 @@
+-- GPS Tracker: add the spatial cell column to an existing positions table
+--
+-- One-off migration for databases created before positions.cell existed.
+-- Adds the column and the (cell, timestamp) index used by
+-- /api/positions/within and /near, then backfills cell for stored rows in
+-- batches of 50000. Rows without a cell are invisible to area queries until
+-- the backfill reaches them; new fixes get one from the ingest path.
+--
+-- The ALTER rebuilds the table. Run it in a maintenance window or with an
+-- online schema change tool for large tables. The backfill can run with the
+-- server up and may be re-run; it only touches rows where cell IS NULL.
+--
+--   mysql -u root -p tracker_gps < db/add-position-cells.sql
+
+USE tracker_gps;
+
+ALTER TABLE positions
+    ADD COLUMN cell BIGINT UNSIGNED AFTER lng,
+    ADD INDEX idx_cell_timestamp (cell, timestamp);
+
+-- Same numbering as cellId() in server/lib/geo.js: a 2^24 x 2^24 lat/lng
+-- grid, x (longitude) bits on even and y (latitude) bits on odd positions
+DROP FUNCTION IF EXISTS position_cell;
+
+DELIMITER //
+
+CREATE FUNCTION position_cell(lat DOUBLE, lng DOUBLE)
+RETURNS BIGINT UNSIGNED
+DETERMINISTIC
+BEGIN
+    DECLARE x BIGINT UNSIGNED;
+    DECLARE y BIGINT UNSIGNED;
+    DECLARE code BIGINT UNSIGNED DEFAULT 0;
+    DECLARE i INT DEFAULT 0;
+
+    SET x = LEAST(16777215, GREATEST(0, FLOOR((lng + 180) / 360 * 16777216)));
+    SET y = LEAST(16777215, GREATEST(0, FLOOR((lat + 90) / 180 * 16777216)));
+
+    WHILE i < 24 DO
+        SET code = code | (((x >> i) & 1) << (2 * i)) | (((y >> i) & 1) << (2 * i + 1));
+        SET i = i + 1;
+    END WHILE;
+
+    RETURN code;
+END //
+
+DROP PROCEDURE IF EXISTS backfill_position_cells //
+
+CREATE PROCEDURE backfill_position_cells()
+BEGIN
+    DECLARE updated INT DEFAULT 1;
+
+    WHILE updated > 0 DO
+        UPDATE positions SET cell = position_cell(lat, lng) WHERE cell IS NULL LIMIT 50000;
+        SET updated = ROW_COUNT();
+    END WHILE;
+END //
+
+DELIMITER ;
+
+CALL backfill_position_cells();
+
+DROP PROCEDURE backfill_position_cells;
@@ -0,0 +1,19 @@
+-- GPS Tracker: add the firmware sequence number to an existing positions table
+--
+-- One-off migration for databases created before positions.seq existed.
+-- Adds the column and the (device_id, seq, timestamp) unique key the ingest
+-- path relies on to turn replayed and retransmitted fixes into no-ops.
+-- Stored rows keep seq NULL, which never collides, so no backfill is needed.
+-- Until this runs the server drops repeats only in memory
+-- (the per-device window, DEDUP_WINDOW).
+--
+-- The ALTER rebuilds the table. Run it in a maintenance window or with an
+-- online schema change tool for large tables.
+--
+--   mysql -u root -p tracker_gps < db/add-position-seq.sql
+
+USE tracker_gps;
+
+ALTER TABLE positions
+    ADD COLUMN seq INT UNSIGNED AFTER received_at,
+    ADD UNIQUE KEY uniq_device_seq (device_id, seq, timestamp);
@@ -11,26 +11,78 @@ USE tracker_gps;
 -- =============================================================================
 -- POSITIONS TABLE
 -- =============================================================================
--- Stores GPS position data from tracking devices
+-- Stores GPS position data from tracking devices.
+-- Range partitioned by timestamp (epoch ms): the server's partition manager
+-- splits daily (or weekly) partitions off pmax ahead of time and drops whole
+-- partitions past POSITIONS_RETENTION_DAYS. The partition column must be part
+-- of every unique key, hence the (id, timestamp) primary key. Existing
+-- unpartitioned tables are converted with db/partition-positions.sql.
+--
+-- cell is the Z-order grid cell of (lat, lng) written by the ingest path
+-- (server/lib/geo.js). idx_cell_timestamp serves area queries, since a
+-- partitioned table cannot carry a SPATIAL index. Tables created before the
+-- column existed are upgraded with db/add-position-cells.sql.
+--
+-- seq is the firmware's per-device sequence number (NULL from older
+-- firmware, and NULLs never collide). uniq_device_seq makes a replayed or
+-- retransmitted fix a no-op. It includes timestamp because it must, and
+-- firmware stamps fixes with GPS time so a resend carries the same one.
+-- Tables created before the column existed are upgraded with
+-- db/add-position-seq.sql.
 CREATE TABLE IF NOT EXISTS positions (
-    id INT AUTO_INCREMENT PRIMARY KEY,
+    id BIGINT NOT NULL AUTO_INCREMENT,
     device_id VARCHAR(255) NOT NULL,
     lat DECIMAL(10, 8) NOT NULL,
     lng DECIMAL(11, 8) NOT NULL,
+    cell BIGINT UNSIGNED,
     speed DECIMAL(5, 2) DEFAULT 0,
     heading DECIMAL(5, 2) DEFAULT 0,
     satellites INT DEFAULT 0,
     source VARCHAR(50) DEFAULT 'unknown',
     timestamp BIGINT NOT NULL,
     received_at BIGINT NOT NULL,
+    seq INT UNSIGNED,
     created_at TIMESTAMP DEFAULT CURRENT_TIMESTAMP,
-    INDEX idx_device_id (device_id),
-    INDEX idx_timestamp (timestamp),
+    PRIMARY KEY (id, timestamp),
+    UNIQUE KEY uniq_device_seq (device_id, seq, timestamp),
     INDEX idx_received_at (received_at),
     INDEX idx_device_timestamp (device_id, timestamp),
+    INDEX idx_cell_timestamp (cell, timestamp),
     INDEX idx_source (source)
+)
+PARTITION BY RANGE (timestamp) (
+    PARTITION pmax VALUES LESS THAN MAXVALUE
+);
+
+-- =============================================================================
+-- DEVICE_LATEST TABLE
+-- =============================================================================
+-- Newest fix (by device timestamp) per device, upserted by the ingest pipeline
+-- in the same transaction as the positions insert. Backs the latest_positions
+-- and device_summary views and the server's warm start.
+CREATE TABLE IF NOT EXISTS device_latest (
+    device_id VARCHAR(255) PRIMARY KEY,
+    lat DECIMAL(10, 8) NOT NULL,
+    lng DECIMAL(11, 8) NOT NULL,
+    speed DECIMAL(5, 2) DEFAULT 0,
+    heading DECIMAL(5, 2) DEFAULT 0,
+    satellites INT DEFAULT 0,
+    source VARCHAR(50) DEFAULT 'unknown',
+    timestamp BIGINT NOT NULL,
+    received_at BIGINT NOT NULL,
+    INDEX idx_received_at (received_at)
 );
 
+-- Seed from existing history (one lookup per device on idx_device_timestamp)
+INSERT IGNORE INTO device_latest (device_id, lat, lng, speed, heading, satellites, source, timestamp, received_at)
+SELECT p.device_id, p.lat, p.lng, p.speed, p.heading, p.satellites, p.source, p.timestamp, p.received_at
+FROM positions p
+JOIN (
+    SELECT device_id, MAX(timestamp) AS timestamp
+    FROM positions
+    GROUP BY device_id
+) newest ON newest.device_id = p.device_id AND newest.timestamp = p.timestamp;
+
 -- =============================================================================
 -- DEVICES TABLE
 -- =============================================================================
@@ -58,8 +110,8 @@ CREATE TABLE IF NOT EXISTS device_stats (
     date DATE NOT NULL,
     total_positions INT DEFAULT 0,
     max_speed DECIMAL(5, 2) DEFAULT 0,
-    total_distance DECIMAL(10, 2) DEFAULT 0,
-    online_time INT DEFAULT 0,
+    total_distance DECIMAL(10, 2) DEFAULT 0, -- meters
+    online_time INT DEFAULT 0, -- seconds
     created_at TIMESTAMP DEFAULT CURRENT_TIMESTAMP,
     UNIQUE KEY unique_device_date (device_id, date),
     INDEX idx_device_id (device_id),
@@ -88,6 +140,20 @@ CREATE TABLE IF NOT EXISTS heartbeats (
     INDEX idx_device_timestamp (device_id, timestamp)
 );
 
+-- =============================================================================
+-- DEVICE_CREDENTIALS TABLE
+-- =============================================================================
+-- Per-device tokens for /api/track and MQTT logins. Only
+-- HMAC-SHA256(DEVICE_TOKEN_SECRET, token) is kept. The token itself is shown
+-- once by POST /api/devices/:device_id/token. Devices without a row may use
+-- the shared DEVICE_TOKEN while DEVICE_SHARED_TOKEN is on.
+CREATE TABLE IF NOT EXISTS device_credentials (
+    device_id VARCHAR(255) PRIMARY KEY,
+    token_hash BINARY(32) NOT NULL,
+    created_at TIMESTAMP DEFAULT CURRENT_TIMESTAMP,
+    updated_at TIMESTAMP DEFAULT CURRENT_TIMESTAMP ON UPDATE CURRENT_TIMESTAMP
+);
+
 -- =============================================================================
 -- ADDITIONAL INDEXES FOR PERFORMANCE
 -- =============================================================================
@@ -100,7 +166,7 @@ CREATE TABLE IF NOT EXISTS heartbeats (
 -- =============================================================================
 
 -- Latest position for each device
-CREATE VIEW IF NOT EXISTS latest_positions AS
+CREATE OR REPLACE VIEW latest_positions AS
 SELECT 
     p.device_id,
     d.name,
@@ -119,16 +185,11 @@ SELECT
         WHEN (UNIX_TIMESTAMP(NOW()) * 1000 - p.received_at) <= 300000 THEN 'recent'
         ELSE 'offline'
     END as status
-FROM positions p
-LEFT JOIN devices d ON p.device_id = d.device_id
-WHERE p.id IN (
-    SELECT MAX(id) 
-    FROM positions 
-    GROUP BY device_id
-);
+FROM device_latest p
+LEFT JOIN devices d ON p.device_id = d.device_id;
 
 -- Device summary statistics
-CREATE VIEW IF NOT EXISTS device_summary AS
+CREATE OR REPLACE VIEW device_summary AS
 SELECT 
     d.device_id,
     d.name,
@@ -154,54 +215,18 @@ LEFT JOIN latest_positions lp ON d.device_id = lp.device_id;
 -- TRIGGERS FOR DATA INTEGRITY
 -- =============================================================================
 
--- Update device last_seen when position is inserted
--- Drop trigger if it exists, then create it
+-- devices.last_seen and total_positions are maintained by the server's
+-- ingest pipeline (one upsert per device per batch, in the positions
+-- transaction). The old update_device_last_seen trigger ran an UPDATE and an
+-- INSERT IGNORE for every inserted row, so drop it from databases that
+-- still have it.
 DROP TRIGGER IF EXISTS update_device_last_seen;
-DELIMITER $$
-CREATE TRIGGER update_device_last_seen
-AFTER INSERT ON positions
-FOR EACH ROW
-BEGIN
-    UPDATE devices 
-    SET 
-        last_seen = NEW.received_at,
-        total_positions = total_positions + 1,
-        updated_at = CURRENT_TIMESTAMP
-    WHERE device_id = NEW.device_id;
-    
-    -- Insert device if it doesn't exist
-    INSERT IGNORE INTO devices (device_id, last_seen, total_positions)
-    VALUES (NEW.device_id, NEW.received_at, 1);
-END$$
-DELIMITER ;
 
--- Update device stats when position is inserted
--- Drop trigger if it exists, then create it
+-- device_stats is maintained incrementally by the server's ingest pipeline
+-- (one upsert of per-device deltas per batch). The old update_device_stats
+-- trigger re-counted the whole day of positions on every insert, so drop it
+-- from databases that still have it.
 DROP TRIGGER IF EXISTS update_device_stats;
-DELIMITER $$
-CREATE TRIGGER update_device_stats
-AFTER INSERT ON positions
-FOR EACH ROW
-BEGIN
-    INSERT INTO device_stats (
-        device_id, 
-        date, 
-        total_positions, 
-        max_speed
-    )
-    SELECT 
-        NEW.device_id,
-        CURDATE(),
-        COUNT(*),
-        MAX(speed)
-    FROM positions 
-    WHERE device_id = NEW.device_id 
-    AND DATE(FROM_UNIXTIME(timestamp/1000)) = CURDATE()
-    ON DUPLICATE KEY UPDATE
-        total_positions = VALUES(total_positions),
-        max_speed = GREATEST(max_speed, VALUES(max_speed));
-END$$
-DELIMITER ;
 
 -- =============================================================================
 -- SAMPLE DATA (Optional - for testing)
@@ -256,11 +281,11 @@ INSERT IGNORE INTO devices (device_id, name, description, device_type) VALUES
 -- CLEANUP PROCEDURES
 -- =============================================================================
 
--- Function to clean up old positions (called by application)
--- DELETE FROM positions WHERE received_at < (strftime('%s', 'now') * 1000 - ?);
+-- Old positions are removed by dropping expired partitions (see above),
+-- never by row-wise DELETE.
 
--- Function to clean up old heartbeats (called by application)
--- DELETE FROM heartbeats WHERE timestamp < (strftime('%s', 'now') * 1000 - ?);
+-- Clean up old heartbeats
+-- DELETE FROM heartbeats WHERE timestamp < (UNIX_TIMESTAMP(NOW()) * 1000 - ?);
 
 -- =============================================================================
 -- MIGRATION COMPLETE
@@ -0,0 +1,34 @@
+-- GPS Tracker: convert an existing positions table to range partitions
+--
+-- One-off migration for databases created before positions was partitioned.
+-- Everything older than today (UTC) goes into p_history. The server's
+-- partition manager then adds daily partitions ahead of time and drops
+-- p_history once it is past the retention window.
+--
+-- Both ALTERs rebuild the table. Run this in a maintenance window with the
+-- server stopped, or use an online schema change tool for large tables.
+--
+--   mysql -u root -p tracker_gps < db/partition-positions.sql
+
+USE tracker_gps;
+
+-- The partition column must be part of every unique key
+ALTER TABLE positions
+    MODIFY id BIGINT NOT NULL AUTO_INCREMENT,
+    DROP PRIMARY KEY,
+    ADD PRIMARY KEY (id, timestamp),
+    DROP INDEX idx_device_id,
+    DROP INDEX idx_timestamp;
+
+-- Partition bounds must be literals, so build the statement for today's UTC midnight
+SET time_zone = '+00:00';
+SET @history_end = UNIX_TIMESTAMP(UTC_DATE()) * 1000;
+SET @partition_sql = CONCAT(
+    'ALTER TABLE positions PARTITION BY RANGE (timestamp) (',
+    'PARTITION p_history VALUES LESS THAN (', @history_end, '), ',
+    'PARTITION pmax VALUES LESS THAN MAXVALUE)'
+);
+
+PREPARE partition_stmt FROM @partition_sql;
+EXECUTE partition_stmt;
+DEALLOCATE PREPARE partition_stmt;
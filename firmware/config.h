@@ -21,12 +21,12 @@
 // MQTT Configuration (ESP32 only)
 #define MQTT_BROKER_HOST "<MQTT_BROKER_HOST>"
 #define MQTT_PORT 1883
-#define MQTT_USERNAME "<MQTT_USERNAME>"
-#define MQTT_PASSWORD "<MQTT_PASSWORD>"
+#define MQTT_KEEPALIVE_S 20         // Broker publishes the Last Will after 1.5x this with no traffic
 
 // Device Configuration
+// The MQTT broker login is DEVICE_ID / DEVICE_TOKEN as well
 #define DEVICE_ID "<DEVICE_ID>"
-#define DEVICE_TOKEN "<DEVICE_TOKEN>"
+#define DEVICE_TOKEN "<DEVICE_TOKEN>"  // From POST /api/devices/<DEVICE_ID>/token
 
 // =============================================================================
 // HARDWARE PIN CONFIGURATION
@@ -65,9 +65,17 @@
 #define IDLE_INTERVAL_MS 60000      // 60 seconds when idle
 #define HEARTBEAT_INTERVAL_MS 60000 // 1 minute heartbeat
 #define RECONNECT_DELAY_MS 10000    // 10 seconds between reconnection attempts
+#define CELL_FIX_INTERVAL_MS 15000  // Serving-cell fix while GNSS has none (cold start, tunnels)
+#define LAST_POSITION_INTERVAL_MS 300000 // Retained last/<id> refresh (ESP32 only); also sent before going offline
 
 // GPS Configuration
 #define GPS_BAUD_RATE 9600
+#define MODEM_BAUD_RATE 115200
+#define UART_RX_BUFFER_SIZE 4096    // ESP32: driver ring buffer per UART (uart_lines.h)
+#define UART_EVENT_QUEUE_LEN 32     // ESP32: line events queued per UART
+#define GNSS_MODE 15                // SIM7600 constellations: 1 GPS + 2 GLONASS + 4 Galileo + 8 BeiDou
+#define GNSS_NMEA_RATE_HZ 10        // SIM7600 NMEA output rate: 1 or 10
+#define GNSS_NMEA_MASK 3            // SIM7600 sentences: 1 GGA + 2 RMC (all TinyGPSPlus needs)
 #define GPS_TIMEOUT_MS 30000        // 30 seconds GPS timeout
 #define MOVEMENT_THRESHOLD_M 10.0   // 10 meters movement threshold
 
@@ -80,6 +88,13 @@
 #define MAX_OFFLINE_RECORDS 50      // Maximum offline records to store
 #define OFFLINE_BUFFER_SIZE 8192    // 8KB buffer size
 
+// Fix sequence numbers (server-side deduplication)
+#define SEQ_RESERVE_BLOCK 256       // Persist the counter once per 256 fixes
+#define SEQ_EEPROM_ADDR 0           // Mega: EEPROM address of the counter
+
+// Delta OTA over MQTT (ESP32 only, see ota_delta.h)
+#define OTA_MAX_CHUNK 1024          // Largest patch chunk accepted; sizes the MQTT buffer
+
 // =============================================================================
 // SIM CARD CONFIGURATION
 // =============================================================================
@@ -175,14 +190,6 @@
   #if MQTT_BROKER_HOST == "<MQTT_BROKER_HOST>"
     #error "Please set MQTT_BROKER_HOST in config.h"
   #endif
-  
-  #if MQTT_USERNAME == "<MQTT_USERNAME>"
-    #error "Please set MQTT_USERNAME in config.h"
-  #endif
-  
-  #if MQTT_PASSWORD == "<MQTT_PASSWORD>"
-    #error "Please set MQTT_PASSWORD in config.h"
-  #endif
 #endif
 
 #endif // CONFIG_H
@@ -8,6 +8,10 @@
  * - Wi-Fi to LTE failover
  * - MQTT publishing with offline buffering
  * - Power management and reconnection logic
+ * - Delta OTA updates over MQTT (ota_delta.h)
+ * - Interrupt-driven, line-framed UART input for modem and GPS (uart_lines.h)
+ * - SIM7600 GNSS at up to 10 Hz with RMC+GGA only, restored after modem resets (gnss_config.h)
+ * - Serving-cell fixes (AT+CPSI?) while GNSS has no fix, resolved by the server
  * 
  * Dependencies:
  * - TinyGPSPlus library
@@ -20,14 +24,20 @@
 #include <TinyGPSPlus.h>
 #include <SPIFFS.h>
 #include <ArduinoJson.h>
+#include <Preferences.h>
 #include "config.h"
+#include "ota_delta.h"
+#include "uart_lines.h"
+#include "gnss_config.h"
 
-// Hardware Serial for SIM7600
-HardwareSerial sim7600(2);
+// SIM7600 on UART2: AT responses, URCs and GNSS NMEA share the line
+UartLines sim7600;
 
-// Optional external GPS via SoftwareSerial
-#include <SoftwareSerial.h>
-SoftwareSerial neo6m(NEO6M_RX_PIN, NEO6M_TX_PIN);
+// Optional external GPS on UART1 (remapped to the NEO-6M pins)
+UartLines neo6m;
+
+// SIM7600 GNSS rate, constellations and sentence mask
+GnssConfig gnssConfig;
 
 // GPS objects
 TinyGPSPlus sim7600_gps;
@@ -44,11 +54,29 @@ bool gpsValid = false;
 bool mqttConnected = false;
 unsigned long lastGpsUpdate = 0;
 unsigned long lastMqttPublish = 0;
+unsigned long lastCellFix = 0;
+bool cellFixSent = false;
+unsigned long lastRetainedPublish = 0;
+uint64_t retainedTimestamp = 0; // ts of the fix last/<id> holds
 unsigned long lastHeartbeat = 0;
 unsigned long wifiReconnectAttempt = 0;
 unsigned long lteReconnectAttempt = 0;
 unsigned long mqttReconnectAttempt = 0;
 
+// Delta OTA transfer in progress, if any
+OtaDelta ota;
+void publishOtaStatus(const char *status, const char *error = nullptr, const char *patchId = nullptr);
+
+// Retained presence payloads on status/<id>
+#define STATUS_ONLINE "{\"online\":true}"
+#define STATUS_OFFLINE "{\"online\":false}"
+void publishLastPosition(bool force = false);
+
+// Per-device fix sequence number, persisted across reboots in NVS
+Preferences prefs;
+uint32_t nextSeq = 0;
+uint32_t seqReserved = 0;
+
 // GPS data
 struct GpsData {
   double lat = 0.0;
@@ -57,11 +85,21 @@ struct GpsData {
   float heading = 0.0;
   int satellites = 0;
   String source = "unknown";
-  unsigned long timestamp = 0;
+  uint64_t timestamp = 0; // GPS UTC time in epoch ms, 0 until the receiver has date and time
 };
 
 GpsData currentGpsData;
 
+// Serving cell as AT+CPSI? reports it (OpenCelliD naming)
+struct CellInfo {
+  const char *radio = nullptr; // GSM, UMTS or LTE
+  int mcc = 0;
+  int mnc = 0;
+  uint32_t area = 0; // LAC or TAC
+  uint32_t cid = 0;
+  int signal = 0; // dBm: RxLev (GSM), RSCP (UMTS), RSRP (LTE)
+};
+
 // Movement detection
 bool isMoving = false;
 float lastLat = 0.0;
@@ -78,6 +116,9 @@ void setup() {
   if (!SPIFFS.begin(true)) {
     Serial.println("SPIFFS Mount Failed");
   }
+
+  // Restore the fix sequence counter
+  initSequence();
   
   // Initialize SIM7600
   initSIM7600();
@@ -103,6 +144,11 @@ void setup() {
 void loop() {
   // Update GPS data
   updateGPS();
+
+  // Restore GNSS settings after a modem restart
+  if (gnssConfig.due()) {
+    gnssConfig.apply(sendATCommand);
+  }
   
   // Check network connections
   checkConnections();
@@ -124,7 +170,10 @@ void loop() {
 
 void initSIM7600() {
   Serial.println("Initializing SIM7600...");
-  sim7600.begin(115200, SERIAL_8N1, SIM7600_RX_PIN, SIM7600_TX_PIN);
+  if (!sim7600.begin(UART_NUM_2, MODEM_BAUD_RATE, SIM7600_RX_PIN, SIM7600_TX_PIN,
+                     UART_RX_BUFFER_SIZE, UART_EVENT_QUEUE_LEN)) {
+    DEBUG_ERROR("SIM7600 UART driver install failed");
+  }
   delay(2000);
   
   // Power on sequence
@@ -144,16 +193,19 @@ void initSIM7600() {
   delay(1000);
   
   // Enable GNSS
-  sendATCommand("AT+CGNSPWR=1");
-  delay(2000);
-  sendATCommand("AT+CGNSINF");
+  if (!gnssConfig.apply(sendATCommand)) {
+    DEBUG_WARN("GNSS configuration incomplete, retrying shortly");
+  }
   
   Serial.println("SIM7600 initialized");
 }
 
 void initNEO6M() {
   Serial.println("Initializing NEO-6M GPS...");
-  neo6m.begin(9600);
+  if (!neo6m.begin(UART_NUM_1, GPS_BAUD_RATE, NEO6M_RX_PIN, NEO6M_TX_PIN,
+                   UART_RX_BUFFER_SIZE, UART_EVENT_QUEUE_LEN)) {
+    DEBUG_ERROR("NEO-6M UART driver install failed");
+  }
   delay(1000);
   Serial.println("NEO-6M GPS initialized");
 }
@@ -207,8 +259,10 @@ void connectToLTE() {
 void setupMQTT() {
   mqttClient.setServer(MQTT_BROKER_HOST, MQTT_PORT);
   mqttClient.setCallback(mqttCallback);
-  mqttClient.setKeepAlive(60);
+  mqttClient.setKeepAlive(MQTT_KEEPALIVE_S);
   mqttClient.setSocketTimeout(30);
+  // Room for an OTA chunk plus its topic and offset
+  mqttClient.setBufferSize(OTA_MAX_CHUNK + 128);
   
   connectMQTT();
 }
@@ -217,15 +271,30 @@ void connectMQTT() {
   if (!mqttConnected) {
     Serial.println("Connecting to MQTT broker...");
     
-    String clientId = "ESP32_" + String(DEVICE_ID) + "_" + String(random(0xffff), HEX);
-    
-    if (mqttClient.connect(clientId.c_str(), MQTT_USERNAME, MQTT_PASSWORD)) {
+    // Stable per device, so a reconnect after a silent drop takes over the
+    // old session. The broker then publishes that session's will before this
+    // one's online status, instead of up to 1.5x keepalive after it.
+    String clientId = "ESP32_" + String(DEVICE_ID);
+
+    // The broker checks the device's own token (same credential as /api/track).
+    // If the link dies without a DISCONNECT, the broker publishes the will
+    // (retained offline status) for us.
+    String statusTopic = "status/" + String(DEVICE_ID);
+    if (mqttClient.connect(clientId.c_str(), DEVICE_ID, DEVICE_TOKEN,
+                           statusTopic.c_str(), 1, true, STATUS_OFFLINE)) {
       mqttConnected = true;
       Serial.println("MQTT connected!");
+      publishStatus(true);
       
       // Subscribe to any control topics if needed
       String controlTopic = "control/" + String(DEVICE_ID);
       mqttClient.subscribe(controlTopic.c_str());
+      mqttClient.subscribe((controlTopic + "/ota").c_str());
+
+      // Tell the sender where an interrupted update left off
+      if (ota.active()) {
+        publishOtaStatus("ready");
+      }
       
     } else {
       mqttConnected = false;
@@ -235,46 +304,124 @@ void connectMQTT() {
   }
 }
 
+// Retained presence on status/<id>; replaces the will or an earlier status
+void publishStatus(bool online) {
+  String topic = "status/" + String(DEVICE_ID);
+  mqttClient.publish(topic.c_str(), online ? STATUS_ONLINE : STATUS_OFFLINE, true);
+}
+
+// Going down on purpose: say so, then disconnect cleanly (which discards the will)
+void goOffline() {
+  if (!mqttConnected) return;
+  publishLastPosition(true);
+  publishStatus(false);
+  mqttClient.loop();
+  mqttClient.disconnect();
+  mqttConnected = false;
+}
+
 void updateGPS() {
   // Try SIM7600 GPS first
-  while (sim7600.available()) {
-    if (sim7600_gps.encode(sim7600.read())) {
-      if (sim7600_gps.location.isValid()) {
-        currentGpsData.lat = sim7600_gps.location.lat();
-        currentGpsData.lng = sim7600_gps.location.lng();
-        currentGpsData.speed = sim7600_gps.speed.kmph();
-        currentGpsData.heading = sim7600_gps.course.deg();
-        currentGpsData.satellites = sim7600_gps.satellites.value();
-        currentGpsData.source = "sim7600";
-        currentGpsData.timestamp = millis();
-        gpsValid = true;
-        lastGpsUpdate = millis();
-        
-        checkMovement();
-        return;
-      }
+  bool simFix = false;
+  sim7600.poll([&](const LineSpan &line) {
+    if (handleModemLine(line)) {
+      simFix = true;
     }
-  }
-  
-  // Fallback to NEO-6M
-  while (neo6m.available()) {
-    if (neo6m_gps.encode(neo6m.read())) {
-      if (neo6m_gps.location.isValid()) {
-        currentGpsData.lat = neo6m_gps.location.lat();
-        currentGpsData.lng = neo6m_gps.location.lng();
-        currentGpsData.speed = neo6m_gps.speed.kmph();
-        currentGpsData.heading = neo6m_gps.course.deg();
-        currentGpsData.satellites = neo6m_gps.satellites.value();
-        currentGpsData.source = "neo6m";
-        currentGpsData.timestamp = millis();
-        gpsValid = true;
-        lastGpsUpdate = millis();
-        
-        checkMovement();
-        return;
-      }
+  });
+
+  // Fallback to NEO-6M; its lines are drained either way so the buffer stays short
+  neo6m.poll([&](const LineSpan &line) {
+    if (encodeLine(neo6m_gps, line) && !simFix) {
+      useFix(neo6m_gps, "neo6m");
     }
+  });
+}
+
+// Modem line outside an AT exchange: NMEA goes to the parser, the rest is a URC.
+// Returns true when it completed a SIM7600 fix.
+bool handleModemLine(const LineSpan &line) {
+  if (line.data[0] != '$') {
+    if (gnssConfig.onUrc(line)) {
+      DEBUG_WARN("Modem restarted, GNSS settings will be re-applied");
+    } else {
+      DEBUG_DEBUG("URC: " + line.toString());
+    }
+    return false;
+  }
+  if (!encodeLine(sim7600_gps, line)) {
+    return false;
+  }
+  useFix(sim7600_gps, "sim7600");
+  return true;
+}
+
+// Feed one NMEA line to gps; true when it completed a sentence with a new location
+bool encodeLine(TinyGPSPlus &gps, const LineSpan &line) {
+  for (uint16_t i = 0; i < line.len; i++) {
+    gps.encode(line.data[i]);
+  }
+  // isUpdated, not isValid: a receiver that lost its fix still reports the old location as valid
+  return gps.encode('\n') && gps.location.isUpdated();
+}
+
+// A GNSS fix recent enough to publish
+bool gpsFresh() {
+  return gpsValid && millis() - lastGpsUpdate < GPS_TIMEOUT_MS;
+}
+
+void useFix(TinyGPSPlus &gps, const char *source) {
+  currentGpsData.lat = gps.location.lat();
+  currentGpsData.lng = gps.location.lng();
+  currentGpsData.speed = gps.speed.kmph();
+  currentGpsData.heading = gps.course.deg();
+  currentGpsData.satellites = gps.satellites.value();
+  currentGpsData.source = source;
+  currentGpsData.timestamp = gpsEpochMs(gps);
+  gpsValid = true;
+  lastGpsUpdate = millis();
+
+  checkMovement();
+}
+
+// Fix time from the GPS date/time fields; the server dedups on (device, seq, ts),
+// so a replayed fix must carry the same ts as the original, which millis() cannot
+uint64_t gpsEpochMs(TinyGPSPlus &gps) {
+  if (!gps.date.isValid() || !gps.time.isValid() || gps.date.year() < 2000) {
+    return 0; // server falls back to its receive time
+  }
+
+  // Days since 1970-01-01 (civil calendar, March-based year)
+  uint32_t y = gps.date.year() - (gps.date.month() <= 2 ? 1 : 0);
+  uint32_t m = gps.date.month();
+  uint32_t era = y / 400;
+  uint32_t yoe = y - era * 400;
+  uint32_t doy = (153 * (m > 2 ? m - 3 : m + 9) + 2) / 5 + gps.date.day() - 1;
+  uint32_t doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+  uint32_t days = era * 146097 + doe - 719468;
+
+  uint64_t seconds = (uint64_t)days * 86400 + gps.time.hour() * 3600UL + gps.time.minute() * 60UL + gps.time.second();
+  return seconds * 1000 + gps.time.centisecond() * 10;
+}
+
+// Flash holds the end of the reserved block and is written once per
+// SEQ_RESERVE_BLOCK fixes; after a reboot numbering resumes past the block,
+// so seq only ever increases
+void initSequence() {
+  prefs.begin("tracker", false);
+  nextSeq = prefs.getUInt("seq", 0);
+  reserveSequence();
+}
+
+void reserveSequence() {
+  seqReserved = nextSeq + SEQ_RESERVE_BLOCK;
+  prefs.putUInt("seq", seqReserved);
+}
+
+uint32_t takeSequence() {
+  if (nextSeq >= seqReserved) {
+    reserveSequence();
   }
+  return nextSeq++;
 }
 
 void checkMovement() {
@@ -298,7 +445,12 @@ void checkMovement() {
 }
 
 void publishGPSData() {
-  if (!gpsValid || !mqttConnected) return;
+  if (!mqttConnected) return;
+  if (!gpsFresh()) {
+    publishCellFix();
+    return;
+  }
+  cellFixSent = false;
   
   unsigned long now = millis();
   unsigned long interval = isMoving ? MOVING_INTERVAL_MS : IDLE_INTERVAL_MS;
@@ -315,6 +467,7 @@ void publishGPSData() {
     doc["sats"] = currentGpsData.satellites;
     doc["ts"] = currentGpsData.timestamp;
     doc["src"] = currentGpsData.source;
+    doc["seq"] = takeSequence();
     
     String payload;
     serializeJson(doc, payload);
@@ -324,6 +477,7 @@ void publishGPSData() {
     if (mqttClient.publish(topic.c_str(), payload.c_str())) {
       Serial.println("GPS data published: " + payload);
       lastMqttPublish = now;
+      publishLastPosition();
     } else {
       Serial.println("Failed to publish GPS data");
       // Store in offline queue
@@ -332,6 +486,122 @@ void publishGPSData() {
   }
 }
 
+// Retained last/<id>: the latest fix as [lat,lng,speed,heading,sats,ts,src].
+// The broker keeps one per device and hands it to whoever subscribes, so a
+// restarted server has every position at once instead of waiting for the next
+// report. A retained publish is a broker store write, so it is refreshed every
+// LAST_POSITION_INTERVAL_MS (and when going offline), not with every fix; the
+// server's own database warm start covers anything newer. Fixes without GPS
+// time are skipped: ts is how the server orders them.
+void publishLastPosition(bool force) {
+  uint64_t ts = currentGpsData.timestamp;
+  if (ts == 0 || ts == retainedTimestamp) return;
+  if (!force && retainedTimestamp != 0 && millis() - lastRetainedPublish < LAST_POSITION_INTERVAL_MS) return;
+
+  JsonDocument doc;
+  JsonArray last = doc.to<JsonArray>();
+  last.add(currentGpsData.lat);
+  last.add(currentGpsData.lng);
+  last.add(currentGpsData.speed);
+  last.add(currentGpsData.heading);
+  last.add(currentGpsData.satellites);
+  last.add(ts);
+  last.add(currentGpsData.source);
+
+  String payload;
+  serializeJson(doc, payload);
+  String topic = "last/" + String(DEVICE_ID);
+  if (mqttClient.publish(topic.c_str(), payload.c_str(), true)) {
+    retainedTimestamp = ts;
+    lastRetainedPublish = millis();
+  }
+}
+
+// No GNSS fix (cold start, tunnel, car park): publish the serving cell so the
+// server can place the device coarsely. Not queued offline: a late cell fix has
+// no GPS time to order it by, and a GNSS fix will soon replace it anyway.
+void publishCellFix() {
+  unsigned long now = millis();
+  if (cellFixSent && now - lastCellFix < CELL_FIX_INTERVAL_MS) return;
+  lastCellFix = now;
+  cellFixSent = true;
+
+  CellInfo cell;
+  if (!readServingCell(cell)) {
+    DEBUG_DEBUG("No serving cell for a cell fix");
+    return;
+  }
+
+  JsonDocument doc;
+  doc["device_id"] = DEVICE_ID;
+  JsonObject serving = doc["cells"].add<JsonObject>();
+  serving["radio"] = cell.radio;
+  serving["mcc"] = cell.mcc;
+  serving["mnc"] = cell.mnc;
+  serving["area"] = cell.area;
+  serving["cid"] = cell.cid;
+  serving["sig"] = cell.signal;
+  doc["src"] = "cell";
+  doc["seq"] = takeSequence();
+
+  String payload;
+  serializeJson(doc, payload);
+
+  String topic = "track/" + String(DEVICE_ID);
+  if (mqttClient.publish(topic.c_str(), payload.c_str())) {
+    Serial.println("Cell fix published: " + payload);
+  }
+}
+
+// +CPSI: LTE,Online,310-260,0x2B0C,26564099,374,EUTRAN-BAND2,900,5,5,-94,-1023,-752,12
+// +CPSI: GSM,Online,460-00,0x182d,12401,27 EGSM 900,-64,2110,42-42
+// +CPSI: WCDMA,Online,001-01,0xFFFF,12345,WCDMA IMT 2000,10688,0,0,-10,-85,...
+bool readServingCell(CellInfo &cell) {
+  String response = sendATCommand("AT+CPSI?");
+  int start = response.indexOf("+CPSI: ");
+  if (start < 0) return false;
+  start += 7;
+  int end = response.indexOf('\n', start);
+  String line = response.substring(start, end < 0 ? response.length() : end);
+
+  String fields[14];
+  int count = 0;
+  int from = 0;
+  while (count < 14) {
+    int comma = line.indexOf(',', from);
+    fields[count++] = line.substring(from, comma < 0 ? line.length() : comma);
+    if (comma < 0) break;
+    from = comma + 1;
+  }
+  if (count < 5 || fields[1] != "Online") return false;
+
+  int signalField;
+  if (fields[0] == "LTE") {
+    cell.radio = "LTE";
+    signalField = 11; // RSRP in 0.1 dBm
+  } else if (fields[0] == "GSM") {
+    cell.radio = "GSM";
+    signalField = 6; // RxLev in dBm
+  } else if (fields[0] == "WCDMA") {
+    cell.radio = "UMTS";
+    signalField = 10; // RSCP in dBm
+  } else {
+    return false; // NO SERVICE, CDMA, ...
+  }
+
+  int dash = fields[2].indexOf('-');
+  if (dash < 0) return false;
+  cell.mcc = fields[2].substring(0, dash).toInt();
+  cell.mnc = fields[2].substring(dash + 1).toInt();
+  cell.area = strtoul(fields[3].c_str(), nullptr, 16);
+  cell.cid = strtoul(fields[4].c_str(), nullptr, 10);
+  if (signalField < count) {
+    cell.signal = fields[signalField].toInt();
+    if (cell.radio[0] == 'L') cell.signal /= 10;
+  }
+  return cell.mcc > 0 && cell.cid > 0;
+}
+
 void sendHeartbeat() {
   unsigned long now = millis();
   if (now - lastHeartbeat >= 60000) { // Every minute
@@ -342,7 +612,7 @@ void sendHeartbeat() {
     doc["timestamp"] = now;
     doc["wifi_connected"] = wifiConnected;
     doc["lte_connected"] = lteConnected;
-    doc["gps_valid"] = gpsValid;
+    doc["gps_valid"] = gpsFresh();
     doc["mqtt_connected"] = mqttConnected;
     doc["free_heap"] = ESP.getFreeHeap();
     
@@ -384,6 +654,13 @@ void checkConnections() {
 }
 
 void mqttCallback(char* topic, byte* payload, unsigned int length) {
+  // Binary OTA chunks: handled in place, never copied into a String
+  String topicName(topic);
+  if (topicName.endsWith("/ota")) {
+    handleOtaChunk(payload, length);
+    return;
+  }
+
   Serial.print("Message arrived [");
   Serial.print(topic);
   Serial.print("] ");
@@ -401,23 +678,106 @@ void mqttCallback(char* topic, byte* payload, unsigned int length) {
     
     if (doc["command"] == "reset") {
       Serial.println("Received reset command");
+      goOffline();
       ESP.restart();
+    } else if (doc["command"] == "ota") {
+      startOta(doc);
     }
   }
 }
 
+void startOta(JsonDocument &doc) {
+  const char *patchId = doc["patch"] | "";
+  uint32_t size = doc["size"] | 0;
+  uint32_t chunk = doc["chunk"] | 0;
+
+  if (strlen(patchId) == 0 || size == 0) return;
+  if (chunk > OTA_MAX_CHUNK) {
+    ota.abort();
+    publishOtaStatus("error", "chunk_too_large", patchId);
+    return;
+  }
+
+  Serial.printf("OTA: patch %s, %u bytes\n", patchId, size);
+  ota.begin(patchId, size);
+  publishOtaStatus("ready");
+}
+
+// Payload: 4-byte little-endian patch offset, then the chunk
+void handleOtaChunk(byte *payload, unsigned int length) {
+  if (!ota.active() || length < 4) return;
+
+  uint32_t offset = payload[0] | (payload[1] << 8) | (payload[2] << 16) | ((uint32_t)payload[3] << 24);
+  if (offset != ota.received()) {
+    // Lost or repeated chunk: ask for the next one we need
+    publishOtaStatus("progress");
+    return;
+  }
+
+  if (!ota.write(payload + 4, length - 4)) {
+    Serial.printf("OTA failed: %s\n", ota.error());
+    publishOtaStatus("error", ota.error());
+    return;
+  }
+
+  if (!ota.complete()) {
+    publishOtaStatus("progress");
+    return;
+  }
+
+  if (ota.finish()) {
+    Serial.println("OTA: new image verified, rebooting");
+    publishOtaStatus("done");
+    mqttClient.loop();
+    delay(500);
+    goOffline();
+    ESP.restart();
+  } else {
+    Serial.printf("OTA failed: %s\n", ota.error());
+    publishOtaStatus("error", ota.error());
+  }
+}
+
+void publishOtaStatus(const char *status, const char *error, const char *patchId) {
+  JsonDocument doc;
+  doc["patch"] = patchId ? patchId : ota.id();
+  doc["status"] = status;
+  doc["offset"] = ota.received();
+  if (error) {
+    doc["error"] = error;
+  }
+
+  String payload;
+  serializeJson(doc, payload);
+  String topic = "ota/" + String(DEVICE_ID);
+  mqttClient.publish(topic.c_str(), payload.c_str());
+}
+
+// Send command and collect its response lines until OK/ERROR or the timeout.
+// NMEA arriving meanwhile still reaches the GPS parser.
 String sendATCommand(String command) {
-  sim7600.println(command);
-  delay(1000);
-  
+  sim7600.writeLine(command.c_str());
+
   String response = "";
-  while (sim7600.available()) {
-    response += (char)sim7600.read();
+  bool done = false;
+  unsigned long start = millis();
+  while (!done && millis() - start < AT_COMMAND_TIMEOUT_MS) {
+    sim7600.poll([&](const LineSpan &line) {
+      if (done || line.data[0] == '$' || line.equals("RDY")) {
+        handleModemLine(line);
+        return;
+      }
+      response += line.toString();
+      response += '\n';
+      if (line.equals("OK") || line.equals("ERROR") || line.startsWith("+CME ERROR")) {
+        done = true;
+      }
+    }, pdMS_TO_TICKS(100));
   }
-  
+
   Serial.println("AT: " + command);
   Serial.println("Response: " + response);
-  
+
   return response;
 }
 
@@ -0,0 +1,98 @@
+/*
+ * SIM7600 GNSS configuration for the ESP32 tracker
+ *
+ * Out of the box the SIM7600 emits NMEA at 1 Hz with every sentence type
+ * on. With all four constellations that is GSV for each, GSA, VTG and the
+ * rest, about 1.2 KB per epoch. At 10 Hz that would be more than a
+ * 115200-baud UART carries. TinyGPSPlus needs only RMC (date, speed,
+ * course) and GGA (altitude, satellites). With just those two, 10 Hz
+ * costs about 1.5 KB/s, roughly an eighth of the line.
+ * tools/nmea-budget.js models both cases.
+ *
+ * apply() sends the settings. Mode and sentence mask can only be changed
+ * with the GNSS session stopped, so it stops the session, configures it and
+ * starts it again. The modem forgets all of this when it restarts (brown-out
+ * on an LTE burst, watchdog, PWRKEY), and the only sign is its boot URC. The
+ * sketch passes every URC to onUrc(). A "RDY" marks the settings lost, and
+ * due() turns true once the modem has had GNSS_SETTLE_MS to finish booting.
+ * A failed apply() is retried after the same delay.
+ *
+ * Command values follow the SIM7500/SIM7600 AT manual:
+ *   AT+CGNSSMODE=<mode>     constellations, 1 GPS + 2 GLONASS + 4 Galileo + 8 BeiDou
+ *   AT+CGPSNMEA=<mask>      1 GGA, 2 RMC, 4 GSV, 8 GSA, 16 VTG, ...
+ *   AT+CGPSNMEARATE=<rate>  0 = 1 Hz, 1 = 10 Hz
+ */
+
+#ifndef GNSS_CONFIG_H
+#define GNSS_CONFIG_H
+
+#include <Arduino.h>
+#include "uart_lines.h"
+
+#ifndef GNSS_SETTLE_MS
+#define GNSS_SETTLE_MS 5000 // after "RDY" the SIM and network stack are still starting
+#endif
+
+#if GNSS_NMEA_RATE_HZ != 1 && GNSS_NMEA_RATE_HZ != 10
+#error "GNSS_NMEA_RATE_HZ must be 1 or 10 (the rates the SIM7600 offers)"
+#endif
+
+class GnssConfig {
+public:
+  // Send the configuration with sendAT (String sendAT(String)); true when every step succeeded
+  template <typename SendAT>
+  bool apply(SendAT sendAT) {
+    pending = false;
+    attempts++;
+
+    sendAT("AT+CGPS=0"); // ERROR when no session is running; either way it is stopped
+    bool ok = succeeded(sendAT("AT+CGNSSMODE=" + String(GNSS_MODE)))
+           && succeeded(sendAT("AT+CGPSNMEA=" + String(GNSS_NMEA_MASK)))
+           && succeeded(sendAT(GNSS_NMEA_RATE_HZ == 10 ? "AT+CGPSNMEARATE=1" : "AT+CGPSNMEARATE=0"));
+    // Start the session even if a setting was refused, so there are still fixes
+    ok = succeeded(sendAT("AT+CGPS=1")) && ok;
+
+    if (!ok) {
+      failures++;
+      schedule();
+    }
+    return ok;
+  }
+
+  // A modem line that was not a response or NMEA; true when the modem restarted
+  bool onUrc(const LineSpan &line) {
+    if (!line.equals("RDY")) {
+      return false;
+    }
+    resets++;
+    schedule();
+    return true;
+  }
+
+  // True once the settings need sending again
+  bool due() const {
+    return pending && millis() - pendingSince >= GNSS_SETTLE_MS;
+  }
+
+  uint32_t resetCount() const { return resets; }
+  uint32_t failureCount() const { return failures; }
+  uint32_t attemptCount() const { return attempts; }
+
+private:
+  bool pending = false;
+  unsigned long pendingSince = 0;
+  uint32_t resets = 0;
+  uint32_t failures = 0;
+  uint32_t attempts = 0;
+
+  void schedule() {
+    pending = true;
+    pendingSince = millis();
+  }
+
+  static bool succeeded(const String &response) {
+    return response.indexOf("\nOK\n") >= 0 || response.startsWith("OK\n");
+  }
+};
+
+#endif // GNSS_CONFIG_H
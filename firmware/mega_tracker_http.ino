@@ -7,6 +7,7 @@
  * - SIM800L 2G module for HTTP communication
  * - Robust AT command handling with retries
  * - Offline data buffering
+ * - Serving-cell fixes (AT+CENG) while the GPS has no fix
  * - Power management and reconnection logic
  * 
  * Dependencies:
@@ -16,6 +17,7 @@
 
 #include <SoftwareSerial.h>
 #include <TinyGPSPlus.h>
+#include <EEPROM.h>
 #include "config.h"
 
 // GPS Module (NEO-6M)
@@ -31,9 +33,15 @@ bool sim800lReady = false;
 bool httpConnected = false;
 unsigned long lastGpsUpdate = 0;
 unsigned long lastHttpPost = 0;
+unsigned long lastCellFix = 0;
+bool cellFixSent = false;
 unsigned long lastHeartbeat = 0;
 unsigned long sim800lReconnectAttempt = 0;
 
+// Per-device fix sequence number, persisted across reboots in EEPROM
+uint32_t nextSeq = 0;
+uint32_t seqReserved = 0;
+
 // GPS data
 struct GpsData {
   double lat = 0.0;
@@ -41,7 +49,8 @@ struct GpsData {
   float speed = 0.0;
   float heading = 0.0;
   int satellites = 0;
-  unsigned long timestamp = 0;
+  uint32_t timestamp = 0; // GPS UTC time in epoch seconds, 0 until the receiver has date and time
+  uint16_t timestampMs = 0; // milliseconds within that second
 };
 
 GpsData currentGpsData;
@@ -62,6 +71,9 @@ void setup() {
   
   Serial.println("=== Arduino Mega GPS Tracker Starting ===");
   
+  // Restore the fix sequence counter
+  initSequence();
+  
   // Initialize GPS
   initGPS();
   
@@ -137,6 +149,9 @@ void initSIM800L() {
       if (sendATCommand("AT+CREG?", 5000)) {
         Serial.println("Network registered");
         sim800lReady = true;
+
+        // Engineering mode with cell IDs, for cell fixes while the GPS has none
+        sendATCommand("AT+CENG=1,1", 5000);
         
         // Setup GPRS connection
         setupGPRS();
@@ -169,13 +184,15 @@ void setupGPRS() {
 void updateGPS() {
   while (gpsSerial.available()) {
     if (gps.encode(gpsSerial.read())) {
-      if (gps.location.isValid()) {
+      // isUpdated, not isValid: after losing its fix the GPS still reports the old location as valid
+      if (gps.location.isUpdated()) {
         currentGpsData.lat = gps.location.lat();
         currentGpsData.lng = gps.location.lng();
         currentGpsData.speed = gps.speed.kmph();
         currentGpsData.heading = gps.course.deg();
         currentGpsData.satellites = gps.satellites.value();
-        currentGpsData.timestamp = millis();
+        currentGpsData.timestamp = gpsEpochSeconds();
+        currentGpsData.timestampMs = gps.time.centisecond() * 10;
         gpsValid = true;
         lastGpsUpdate = millis();
         
@@ -185,6 +202,60 @@ void updateGPS() {
   }
 }
 
+// Fix time from the GPS date/time fields; the server dedups on (device, seq, ts),
+// so a replayed fix must carry the same ts as the original, which millis() cannot
+uint32_t gpsEpochSeconds() {
+  if (!gps.date.isValid() || !gps.time.isValid() || gps.date.year() < 2000) {
+    return 0; // server falls back to its receive time
+  }
+
+  // Days since 1970-01-01 (civil calendar, March-based year)
+  uint32_t y = gps.date.year() - (gps.date.month() <= 2 ? 1 : 0);
+  uint32_t m = gps.date.month();
+  uint32_t era = y / 400;
+  uint32_t yoe = y - era * 400;
+  uint32_t doy = (153 * (m > 2 ? m - 3 : m + 9) + 2) / 5 + gps.date.day() - 1;
+  uint32_t doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+  uint32_t days = era * 146097 + doe - 719468;
+
+  return days * 86400UL + gps.time.hour() * 3600UL + gps.time.minute() * 60UL + gps.time.second();
+}
+
+// Epoch ms as text; String() has no 64-bit overload on AVR
+String gpsTimestamp() {
+  if (currentGpsData.timestamp == 0) {
+    return "0";
+  }
+  String ms = String(currentGpsData.timestampMs);
+  while (ms.length() < 3) {
+    ms = "0" + ms;
+  }
+  return String(currentGpsData.timestamp) + ms;
+}
+
+// EEPROM holds the end of the reserved block and is written once per
+// SEQ_RESERVE_BLOCK fixes; after a reboot numbering resumes past the block,
+// so seq only ever increases
+void initSequence() {
+  EEPROM.get(SEQ_EEPROM_ADDR, nextSeq);
+  if (nextSeq == 0xFFFFFFFF) {
+    nextSeq = 0; // erased EEPROM
+  }
+  reserveSequence();
+}
+
+void reserveSequence() {
+  seqReserved = nextSeq + SEQ_RESERVE_BLOCK;
+  EEPROM.put(SEQ_EEPROM_ADDR, seqReserved);
+}
+
+uint32_t takeSequence() {
+  if (nextSeq >= seqReserved) {
+    reserveSequence();
+  }
+  return nextSeq++;
+}
+
 void checkMovement() {
   unsigned long now = millis();
   if (now - lastMovementCheck > 5000) { // Check every 5 seconds
@@ -205,8 +276,18 @@ void checkMovement() {
   }
 }
 
+// A GPS fix recent enough to send
+bool gpsFresh() {
+  return gpsValid && millis() - lastGpsUpdate < GPS_TIMEOUT_MS;
+}
+
 void sendGPSData() {
-  if (!gpsValid || !httpConnected) return;
+  if (!httpConnected) return;
+  if (!gpsFresh()) {
+    sendCellFix();
+    return;
+  }
+  cellFixSent = false;
   
   unsigned long now = millis();
   unsigned long interval = isMoving ? MOVING_INTERVAL_MS : IDLE_INTERVAL_MS;
@@ -221,7 +302,8 @@ void sendGPSData() {
     payload += "\"speed\":" + String(currentGpsData.speed, 1) + ",";
     payload += "\"heading\":" + String(currentGpsData.heading, 1) + ",";
     payload += "\"sats\":" + String(currentGpsData.satellites) + ",";
-    payload += "\"ts\":" + String(currentGpsData.timestamp) + ",";
+    payload += "\"ts\":" + gpsTimestamp() + ",";
+    payload += "\"seq\":" + String(takeSequence()) + ",";
     payload += "\"src\":\"sim800l\"";
     payload += "}";
     
@@ -236,11 +318,72 @@ void sendGPSData() {
   }
 }
 
+// No GPS fix (cold start, tunnel, car park): send the serving cell so the
+// server can place the device coarsely. Not buffered offline: a late cell fix
+// has no GPS time to order it by.
+void sendCellFix() {
+  unsigned long now = millis();
+  if (cellFixSent && now - lastCellFix < CELL_FIX_INTERVAL_MS) return;
+  lastCellFix = now;
+  cellFixSent = true;
+
+  String cell = readServingCell();
+  if (cell.length() == 0) return;
+
+  String payload = "{";
+  payload += "\"device_id\":\"" + String(DEVICE_ID) + "\",";
+  payload += "\"cells\":[" + cell + "],";
+  payload += "\"seq\":" + String(takeSequence()) + ",";
+  payload += "\"src\":\"cell\"";
+  payload += "}";
+
+  if (sendHttpPost(payload)) {
+    Serial.println("Cell fix sent: " + payload);
+  }
+}
+
+// Serving cell as a JSON object, or "" when there is none.
+// +CENG: 0,"<arfcn>,<rxl>,<rxq>,<mcc>,<mnc>,<bsic>,<cellid>,<rla>,<txp>,<lac>,<TA>"
+// cellid and lac are hex; rxl is 0-63, roughly dBm + 110
+String readServingCell() {
+  String response = queryATCommand("AT+CENG?", 5000);
+  int start = response.indexOf("+CENG: 0,\"");
+  if (start < 0) return "";
+  start += 10;
+  int end = response.indexOf('"', start);
+  if (end < 0) return "";
+  String line = response.substring(start, end);
+
+  String fields[11];
+  int count = 0;
+  int from = 0;
+  while (count < 11) {
+    int comma = line.indexOf(',', from);
+    fields[count++] = line.substring(from, comma < 0 ? line.length() : comma);
+    if (comma < 0) break;
+    from = comma + 1;
+  }
+  if (count < 10) return "";
+
+  unsigned long cid = strtoul(fields[6].c_str(), NULL, 16);
+  unsigned long lac = strtoul(fields[9].c_str(), NULL, 16);
+  if (fields[3].toInt() <= 0 || cid == 0 || cid == 0xFFFF) return "";
+
+  String cell = "{\"radio\":\"GSM\",";
+  cell += "\"mcc\":" + String(fields[3].toInt()) + ",";
+  cell += "\"mnc\":" + String(fields[4].toInt()) + ",";
+  cell += "\"area\":" + String(lac) + ",";
+  cell += "\"cid\":" + String(cid) + ",";
+  cell += "\"sig\":" + String(fields[1].toInt() - 110) + "}";
+  return cell;
+}
+
 bool sendHttpPost(String payload) {
   if (!httpConnected) return false;
   
   // Prepare HTTP POST request
-  String url = "http://" + String(SERVER_HOST) + "/api/track?token=" + String(DEVICE_TOKEN);
+  // The token travels only in the X-Device-Token header, never in the URL
+  String url = "http://" + String(SERVER_HOST) + "/api/track";
   
   // Start HTTP session
   String httpCmd = "AT+HTTPINIT";
@@ -296,7 +439,7 @@ void sendHeartbeat() {
     payload += "\"device_id\":\"" + String(DEVICE_ID) + "\",";
     payload += "\"type\":\"heartbeat\",";
     payload += "\"timestamp\":" + String(now) + ",";
-    payload += "\"gps_valid\":" + String(gpsValid ? "true" : "false") + ",";
+    payload += "\"gps_valid\":" + String(gpsFresh() ? "true" : "false") + ",";
     payload += "\"sim800l_ready\":" + String(sim800lReady ? "true" : "false") + ",";
     payload += "\"http_connected\":" + String(httpConnected ? "true" : "false") + ",";
     payload += "\"offline_buffer_count\":" + String(offlineBufferCount);
@@ -377,6 +520,31 @@ bool sendATCommand(String command, unsigned long timeout) {
   return false;
 }
 
+// Like sendATCommand, but returns the response ("" on ERROR or timeout)
+String queryATCommand(String command, unsigned long timeout) {
+  Serial.println("AT: " + command);
+  sim800l.println(command);
+
+  unsigned long startTime = millis();
+  String response = "";
+
+  while (millis() - startTime < timeout) {
+    if (sim800l.available()) {
+      response += (char)sim800l.read();
+
+      if (response.endsWith("\r\nOK\r\n")) {
+        Serial.println("Response: " + response);
+        return response;
+      } else if (response.endsWith("ERROR\r\n")) {
+        break;
+      }
+    }
+  }
+
+  Serial.println("Response: " + response + " (failed)");
+  return "";
+}
+
 /*
  * WIRING DIAGRAM
  * 
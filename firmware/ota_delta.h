@@ -0,0 +1,325 @@
+/*
+ * Delta OTA updates for the ESP32 tracker
+ *
+ * A release is sent as a patch against the image the device is running
+ * (tools/ota-delta.js diff), usually a tenth of a full image. The patch
+ * arrives over MQTT in chunks and is decoded as it arrives. Bytes are read
+ * from the running app partition through a 256-byte cache and written to
+ * the inactive OTA partition in 512-byte blocks, so the decoder needs under
+ * 1 KB of RAM whatever the image size. The output is hashed while it is
+ * written, and the boot partition only switches if the SHA-256 matches the
+ * one in the patch header. The patch header also names the base image,
+ * which is checked before anything is erased.
+ *
+ * Transfer (see mqttCallback in esp32_tracker_mqtt.ino):
+ *   control/<id>      {"command":"ota","patch":"<id>","size":N,"chunk":1024}
+ *   control/<id>/ota  4-byte little-endian offset + chunk bytes
+ *   ota/<id>          {"patch":"<id>","status":"ready|progress|done|error","offset":N}
+ * A chunk at any offset other than received() is ignored and answered with
+ * the offset wanted, so a sender that lost chunks or reconnected resumes
+ * from there. State lives in RAM. A reboot mid-transfer starts over.
+ *
+ * Patch format: see tools/ota-delta.js.
+ */
+
+#ifndef OTA_DELTA_H
+#define OTA_DELTA_H
+
+#include <Arduino.h>
+#include <esp_ota_ops.h>
+#include <esp_partition.h>
+#include <mbedtls/sha256.h>
+#include <mbedtls/version.h>
+
+#if MBEDTLS_VERSION_NUMBER >= 0x03000000 // the _ret variants were renamed in mbedTLS 3
+#define mbedtls_sha256_starts_ret mbedtls_sha256_starts
+#define mbedtls_sha256_update_ret mbedtls_sha256_update
+#define mbedtls_sha256_finish_ret mbedtls_sha256_finish
+#endif
+
+#ifndef OTA_WITH_SEQUENTIAL_WRITES // IDF < 4.4: erase the whole image up front
+#define OTA_WITH_SEQUENTIAL_WRITES toSize
+#endif
+
+#define OTA_DELTA_HEADER_SIZE 80
+#define OTA_DELTA_FLASH_PAGE 256
+#define OTA_DELTA_OUT_BLOCK 512
+
+class OtaDelta {
+public:
+  bool active() const { return phase != IDLE && phase != FAILED; }
+  bool complete() const { return phase == END && patchReceived == patchSize; }
+  uint32_t received() const { return patchReceived; }
+  const char *id() const { return patchId; }
+  const char *error() const { return errorReason; }
+
+  // Start receiving patchId; a repeat of the transfer in progress keeps its offset
+  void begin(const char *newId, uint32_t size) {
+    if (active() && strcmp(newId, patchId) == 0 && size == patchSize) {
+      return;
+    }
+    abort();
+    strncpy(patchId, newId, sizeof(patchId) - 1);
+    patchId[sizeof(patchId) - 1] = '\0';
+    patchSize = size;
+    patchReceived = 0;
+    headerLen = 0;
+    varValue = 0;
+    varShift = 0;
+    fromPos = 0;
+    cacheLen = 0;
+    blockLen = 0;
+    written = 0;
+    errorReason = "";
+    phase = HEADER;
+  }
+
+  // Feed the next len patch bytes; false once the patch is rejected (see error())
+  bool write(const uint8_t *data, size_t len) {
+    if (!active()) return false;
+    if (patchReceived + len > patchSize) return fail("chunk_past_end");
+
+    for (size_t i = 0; i < len; i++) {
+      if (!step(data[i])) return false;
+    }
+    patchReceived += len;
+    return true;
+  }
+
+  // After the last chunk: verify the new image and make it the boot partition
+  bool finish() {
+    if (!complete()) return fail("truncated");
+    if (!flushBlock()) return false;
+
+    uint8_t digest[32];
+    mbedtls_sha256_finish_ret(&sha, digest);
+    mbedtls_sha256_free(&sha);
+    if (memcmp(digest, header + 48, 32) != 0) return fail("hash_mismatch");
+
+    esp_err_t err = esp_ota_end(handle);
+    handle = 0;
+    if (err != ESP_OK) return fail("invalid_image");
+    if (esp_ota_set_boot_partition(target) != ESP_OK) return fail("set_boot_failed");
+    phase = IDLE;
+    return true;
+  }
+
+  void abort() {
+    if (handle) {
+      esp_ota_abort(handle);
+      handle = 0;
+      mbedtls_sha256_free(&sha);
+    }
+    phase = IDLE;
+  }
+
+private:
+  enum Phase { IDLE, HEADER, DIFF_LEN, EXTRA_LEN, SEEK, ZEROS, LITERALS, LITERAL, EXTRA, END, FAILED };
+
+  Phase phase = IDLE;
+  char patchId[24] = "";
+  const char *errorReason = "";
+  uint32_t patchSize = 0;
+  uint32_t patchReceived = 0;
+
+  uint8_t header[OTA_DELTA_HEADER_SIZE];
+  uint8_t headerLen = 0;
+  uint32_t fromSize = 0;
+  uint32_t toSize = 0;
+
+  // Current record
+  uint32_t varValue = 0;
+  uint8_t varShift = 0;
+  uint32_t diffLeft = 0;
+  uint32_t extraLeft = 0;
+  uint32_t litLeft = 0;
+  int32_t seek = 0;
+
+  // Old image, read through a one-page cache
+  const esp_partition_t *running = nullptr;
+  uint32_t fromPos = 0;
+  uint32_t cacheStart = 0;
+  uint32_t cacheLen = 0;
+  uint8_t cache[OTA_DELTA_FLASH_PAGE];
+
+  // New image
+  const esp_partition_t *target = nullptr;
+  esp_ota_handle_t handle = 0;
+  uint8_t block[OTA_DELTA_OUT_BLOCK];
+  uint16_t blockLen = 0;
+  uint32_t written = 0;
+  mbedtls_sha256_context sha;
+
+  bool fail(const char *reason) {
+    errorReason = reason;
+    abort();
+    phase = FAILED;
+    return false;
+  }
+
+  // LEB128; true once value holds a complete varint
+  bool varint(uint8_t b, uint32_t &value) {
+    varValue |= (uint32_t)(b & 0x7f) << varShift;
+    varShift += 7;
+    if (b & 0x80) {
+      if (varShift > 28) fail("corrupt");
+      return false;
+    }
+    value = varValue;
+    varValue = 0;
+    varShift = 0;
+    return true;
+  }
+
+  bool fromByte(uint8_t &b) {
+    if (fromPos >= fromSize) return fail("corrupt");
+    if (fromPos < cacheStart || fromPos >= cacheStart + cacheLen) {
+      cacheStart = fromPos - fromPos % OTA_DELTA_FLASH_PAGE;
+      cacheLen = OTA_DELTA_FLASH_PAGE;
+      if (esp_partition_read(running, cacheStart, cache, cacheLen) != ESP_OK) return fail("flash_read");
+    }
+    b = cache[fromPos++ - cacheStart];
+    return true;
+  }
+
+  bool out(uint8_t b) {
+    if (written >= toSize) return fail("corrupt");
+    block[blockLen++] = b;
+    written++;
+    return blockLen < OTA_DELTA_OUT_BLOCK || flushBlock();
+  }
+
+  bool flushBlock() {
+    if (blockLen == 0) return true;
+    mbedtls_sha256_update_ret(&sha, block, blockLen);
+    if (esp_ota_write(handle, block, blockLen) != ESP_OK) return fail("flash_write");
+    blockLen = 0;
+    return true;
+  }
+
+  // Check the base image, then erase the target partition and start writing
+  bool startPatch() {
+    if (memcmp(header, "GOTA", 4) != 0 || header[4] != 1) return fail("bad_patch");
+    memcpy(&fromSize, header + 8, 4);
+    memcpy(&toSize, header + 12, 4);
+
+    running = esp_ota_get_running_partition();
+    target = esp_ota_get_next_update_partition(nullptr);
+    if (!running || !target) return fail("no_ota_partition");
+    if (fromSize > running->size || toSize > target->size) return fail("too_large");
+
+    // The patch only applies to the exact image it was made from
+    mbedtls_sha256_init(&sha);
+    mbedtls_sha256_starts_ret(&sha, 0);
+    for (uint32_t offset = 0; offset < fromSize; offset += OTA_DELTA_FLASH_PAGE) {
+      uint32_t len = min((uint32_t)OTA_DELTA_FLASH_PAGE, fromSize - offset);
+      if (esp_partition_read(running, offset, cache, len) != ESP_OK) {
+        mbedtls_sha256_free(&sha);
+        return fail("flash_read");
+      }
+      mbedtls_sha256_update_ret(&sha, cache, len);
+    }
+    uint8_t digest[32];
+    mbedtls_sha256_finish_ret(&sha, digest);
+    mbedtls_sha256_free(&sha);
+    cacheLen = 0;
+    if (memcmp(digest, header + 16, 32) != 0) return fail("base_mismatch");
+
+    // Erase sector by sector as blocks arrive rather than stalling here for seconds
+    if (esp_ota_begin(target, OTA_WITH_SEQUENTIAL_WRITES, &handle) != ESP_OK) {
+      handle = 0;
+      return fail("ota_begin");
+    }
+    mbedtls_sha256_init(&sha);
+    mbedtls_sha256_starts_ret(&sha, 0);
+    phase = toSize > 0 ? DIFF_LEN : END;
+    return true;
+  }
+
+  bool endRecord() {
+    fromPos += seek;
+    phase = written == toSize ? END : DIFF_LEN;
+    return true;
+  }
+
+  bool afterRun() {
+    if (diffLeft > 0) {
+      phase = ZEROS;
+    } else if (extraLeft > 0) {
+      phase = EXTRA;
+    } else {
+      return endRecord();
+    }
+    return true;
+  }
+
+  bool step(uint8_t b) {
+    uint32_t value;
+    uint8_t from;
+
+    switch (phase) {
+      case HEADER:
+        header[headerLen++] = b;
+        return headerLen < OTA_DELTA_HEADER_SIZE || startPatch();
+
+      case DIFF_LEN:
+        if (varint(b, value)) {
+          diffLeft = value;
+          phase = EXTRA_LEN;
+        }
+        return phase != FAILED;
+
+      case EXTRA_LEN:
+        if (varint(b, value)) {
+          extraLeft = value;
+          phase = SEEK;
+        }
+        return phase != FAILED;
+
+      case SEEK:
+        if (varint(b, value)) {
+          seek = (value & 1) ? -(int32_t)((value + 1) >> 1) : (int32_t)(value >> 1);
+          if (written + diffLeft + extraLeft > toSize) return fail("corrupt");
+          return afterRun();
+        }
+        return phase != FAILED;
+
+      case ZEROS:
+        if (varint(b, value)) {
+          if (value > diffLeft) return fail("corrupt");
+          diffLeft -= value;
+          while (value-- > 0) {
+            if (!fromByte(from) || !out(from)) return false;
+          }
+          phase = LITERALS;
+        }
+        return phase != FAILED;
+
+      case LITERALS:
+        if (varint(b, value)) {
+          if (value > diffLeft) return fail("corrupt");
+          litLeft = value;
+          if (value > 0) {
+            phase = LITERAL;
+          } else {
+            return afterRun();
+          }
+        }
+        return phase != FAILED;
+
+      case LITERAL:
+        if (!fromByte(from) || !out(from + b)) return false;
+        diffLeft--;
+        return --litLeft > 0 || afterRun();
+
+      case EXTRA:
+        if (!out(b)) return false;
+        return --extraLeft > 0 || endRecord();
+
+      default:
+        return fail("corrupt");
+    }
+  }
+};
+
+#endif // OTA_DELTA_H
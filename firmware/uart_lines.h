@@ -0,0 +1,163 @@
+/*
+ * Line-framed UART input for the ESP32 tracker
+ *
+ * The SIM7600 (AT responses, URCs and NMEA) and the NEO-6M (NMEA) both
+ * talk in CR/LF-terminated lines. Here each runs on a hardware UART under
+ * the ESP-IDF driver instead of HardwareSerial/SoftwareSerial. The UART
+ * interrupt moves bytes from the FIFO into a large ring buffer, and the
+ * driver's pattern detector flags every '\n', posting one event per line.
+ * poll() takes each complete line out of the ring buffer in one read and
+ * hands it to the caller as a span into a line buffer. Parsers loop over
+ * the span; nothing is read a byte at a time and no String is built.
+ * Waiting for input (e.g. an AT response) blocks on the event queue rather
+ * than sleeping and polling.
+ *
+ * The classic ESP32 UART has no DMA path in the IDF driver; the ISR-filled
+ * ring buffer is what takes bytes off the FIFO. Size it for the longest
+ * gap between polls: at 115200 baud, 100 ms is about 1.2 KB.
+ */
+
+#ifndef UART_LINES_H
+#define UART_LINES_H
+
+#include <Arduino.h>
+#include <driver/uart.h>
+
+#define UART_LINE_MAX 256 // longer lines are dropped (NMEA is at most 82)
+
+struct LineSpan {
+  const char *data; // not NUL-terminated, CR/LF stripped; valid until the next poll()
+  uint16_t len;
+
+  bool startsWith(const char *prefix) const {
+    size_t n = strlen(prefix);
+    return len >= n && memcmp(data, prefix, n) == 0;
+  }
+
+  bool equals(const char *text) const {
+    return strlen(text) == len && memcmp(data, text, len) == 0;
+  }
+
+  String toString() const {
+    String text;
+    text.concat(data, len);
+    return text;
+  }
+};
+
+class UartLines {
+public:
+  struct Stats {
+    uint32_t lines = 0;
+    uint32_t bytes = 0;
+    uint32_t overflows = 0; // ring buffer or FIFO full: pending input dropped
+    uint32_t longLines = 0;
+  };
+
+  bool begin(uart_port_t uartPort, int baud, int rxPin, int txPin,
+             size_t rxBufferSize = 4096, size_t eventQueueLen = 32) {
+    port = uartPort;
+    queueLen = eventQueueLen;
+
+    uart_config_t config = {};
+    config.baud_rate = baud;
+    config.data_bits = UART_DATA_8_BITS;
+    config.parity = UART_PARITY_DISABLE;
+    config.stop_bits = UART_STOP_BITS_1;
+    config.flow_ctrl = UART_HW_FLOWCTRL_DISABLE;
+    config.source_clk = UART_SCLK_APB;
+
+    if (uart_driver_install(port, rxBufferSize, 0, eventQueueLen, &events, 0) != ESP_OK) return false;
+    if (uart_param_config(port, &config) != ESP_OK) return false;
+    if (uart_set_pin(port, txPin, rxPin, UART_PIN_NO_CHANGE, UART_PIN_NO_CHANGE) != ESP_OK) return false;
+
+    // One pattern event per '\n'; the queue remembers where each one is
+    uart_enable_pattern_det_baud_intr(port, '\n', 1, 9, 0, 0);
+    uart_pattern_queue_reset(port, eventQueueLen);
+    return true;
+  }
+
+  // Pass each complete line to onLine(const LineSpan &). Waits up to wait
+  // ticks for the first event, then drains what is pending without waiting.
+  // Returns the number of lines delivered.
+  template <typename OnLine>
+  size_t poll(OnLine onLine, TickType_t wait = 0) {
+    size_t delivered = 0;
+    uart_event_t event;
+
+    while (xQueueReceive(events, &event, wait) == pdTRUE) {
+      wait = 0;
+      switch (event.type) {
+        case UART_PATTERN_DET:
+          delivered += readLine(onLine);
+          break;
+        case UART_FIFO_OVF:
+        case UART_BUFFER_FULL:
+          // Input was lost mid-line; start clean at the next line
+          stats.overflows++;
+          uart_flush_input(port);
+          xQueueReset(events);
+          uart_pattern_queue_reset(port, queueLen);
+          return delivered;
+        default:
+          break; // UART_DATA: bytes stay buffered until their '\n' arrives
+      }
+    }
+    return delivered;
+  }
+
+  void write(const char *data, size_t len) {
+    uart_write_bytes(port, data, len);
+  }
+
+  void writeLine(const char *text) {
+    write(text, strlen(text));
+    write("\r\n", 2);
+  }
+
+  const Stats &getStats() const { return stats; }
+
+private:
+  uart_port_t port = UART_NUM_MAX;
+  QueueHandle_t events = nullptr;
+  size_t queueLen = 0;
+  char line[UART_LINE_MAX];
+  Stats stats;
+
+  template <typename OnLine>
+  size_t readLine(OnLine onLine) {
+    int pos = uart_pattern_pop_pos(port);
+    if (pos < 0) {
+      // Pattern queue overran; the positions are gone, so resynchronise
+      stats.overflows++;
+      uart_flush_input(port);
+      return 0;
+    }
+
+    size_t len = pos + 1; // through the '\n'
+    if (len > sizeof(line)) {
+      // Too long for any parser here: drop it in line-sized pieces
+      stats.longLines++;
+      while (len > 0) {
+        int got = uart_read_bytes(port, (uint8_t *)line, min(len, sizeof(line)), 0);
+        if (got <= 0) break;
+        len -= got;
+      }
+      return 0;
+    }
+
+    int got = uart_read_bytes(port, (uint8_t *)line, len, 0);
+    if (got <= 0) return 0;
+    stats.bytes += got;
+
+    uint16_t end = got;
+    while (end > 0 && (line[end - 1] == '\n' || line[end - 1] == '\r')) end--;
+    if (end == 0) return 0; // blank line (AT responses are framed by them)
+
+    stats.lines++;
+    onLine(LineSpan{line, end});
+    return 1;
+  }
+};
+
+#endif // UART_LINES_H
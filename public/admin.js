@@ -36,7 +36,6 @@ class AdminDashboard extends GPSTrackerDashboard {
         this.setupAdminControls();
         await this.loadInitialData();
         this.connectWebSocket();
-        this.startPolling();
         console.log('Admin Dashboard initialized successfully');
     }
 
@@ -233,7 +232,8 @@ class AdminDashboard extends GPSTrackerDashboard {
         try {
             this.showNotification('Exporting system data...', 'info');
 
-            const response = await this.authenticatedFetch('/api/admin/export-data', {
+            // gzip'd CSV streamed by the server; ?format=geojsonseq|ndjson, ?from=&to=&devices= also work
+            const response = await this.authenticatedFetch('/api/admin/export-data?format=csv', {
                 method: 'GET'
             });
 
@@ -245,7 +245,7 @@ class AdminDashboard extends GPSTrackerDashboard {
             const url = window.URL.createObjectURL(blob);
             const a = document.createElement('a');
             a.href = url;
-            a.download = `gps-tracker-export-${new Date().toISOString().split('T')[0]}.json`;
+            a.download = this.exportFilename(response, 'gps-tracker-export.csv.gz');
             document.body.appendChild(a);
             a.click();
             window.URL.revokeObjectURL(url);
@@ -258,6 +258,12 @@ class AdminDashboard extends GPSTrackerDashboard {
         }
     }
 
+    exportFilename(response, fallback) {
+        const disposition = response.headers.get('Content-Disposition') || '';
+        const match = disposition.match(/filename="([^"]+)"/);
+        return match ? match[1] : fallback;
+    }
+
     showAddDeviceModal() {
         // Create a simple prompt for now
         const deviceId = prompt('Enter device ID:');
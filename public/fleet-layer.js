@@ -0,0 +1,661 @@
+/*
+ * Fleet Layer
+ * Single-canvas rendering of every device marker and trail
+ *
+ * A Leaflet layer that draws the whole fleet in one WebGL pass (Canvas 2D
+ * when WebGL is unavailable) instead of one DOM marker and one polyline per
+ * device. Device positions live in typed arrays in Web Mercator units and are
+ * uploaded in place: an update rewrites one slot and only the dirty range is
+ * sent to the GPU on the next frame. Trails are rings of line segments, so
+ * appending a fix writes a single segment. Clustering bins the same arrays
+ * into a screen-space grid each frame, and cluster badges and labels are
+ * drawn on a 2D overlay canvas.
+ */
+
+(function() {
+    const WORLD_SIZE = 256;
+    const MAX_LATITUDE = 85.0511287798;
+
+    const VERTEX_SHADER = `
+        attribute vec2 a_position;
+        attribute vec4 a_color;
+        uniform vec2 u_center_hi;
+        uniform vec2 u_center_lo;
+        uniform float u_scale;
+        uniform vec2 u_viewport;
+        uniform float u_point_size;
+        varying vec4 v_color;
+        void main() {
+            // Center split in two floats so panning stays smooth at street zoom
+            vec2 offset = ((a_position - u_center_hi) - u_center_lo) * u_scale;
+            gl_Position = vec4(offset.x / u_viewport.x * 2.0, -offset.y / u_viewport.y * 2.0, 0.0, 1.0);
+            gl_PointSize = u_point_size;
+            v_color = a_color;
+        }
+    `;
+
+    const FRAGMENT_SHADER = `
+        precision mediump float;
+        uniform float u_points;
+        varying vec4 v_color;
+        void main() {
+            if (u_points > 0.5) {
+                vec2 c = gl_PointCoord * 2.0 - 1.0;
+                float r = dot(c, c);
+                if (r > 1.0) discard;
+                gl_FragColor = r > 0.55 ? vec4(1.0, 1.0, 1.0, 1.0) : v_color;
+            } else {
+                gl_FragColor = v_color;
+            }
+        }
+    `;
+
+    function mercatorX(lng) {
+        return (lng + 180) / 360;
+    }
+
+    function mercatorY(lat) {
+        const clamped = Math.max(-MAX_LATITUDE, Math.min(MAX_LATITUDE, lat));
+        const sin = Math.sin(clamped * Math.PI / 180);
+        return 0.5 - Math.log((1 + sin) / (1 - sin)) / (4 * Math.PI);
+    }
+
+    function parseColor(hex) {
+        const value = parseInt(hex.slice(1), 16);
+        return [(value >> 16) & 255, (value >> 8) & 255, value & 255, 255];
+    }
+
+    L.FleetLayer = L.Layer.extend({
+        options: {
+            pointSize: 12,
+            trailPoints: 100,
+            clusterRadius: 50,
+            clusterMaxZoom: 15,
+            maxLabels: 500,
+            onlineColor: '#10b981',
+            offlineColor: '#6b7280',
+            trailColor: '#d4af37',
+            renderer: 'auto' // 'auto', 'webgl' or 'canvas'
+        },
+
+        initialize(options) {
+            L.setOptions(this, options);
+
+            this.ids = [];
+            this.slots = new Map(); // device_id -> slot
+            this.capacity = 1024;
+            this.positions = new Float32Array(this.capacity * 2);
+            this.colors = new Uint8Array(this.capacity * 4);
+            this.dirty = null; // [first, last] slot range pending upload
+
+            this.trailSlots = new Map(); // device_id -> trail slot
+            this.trailCapacity = 64;
+            this.trailCounts = new Int32Array(this.trailCapacity);
+            this.trailLast = new Float32Array(this.trailCapacity * 2);
+            this.trailVertices = new Float32Array(this.trailCapacity * this.segmentsPerTrail() * 4);
+            this.trailDirty = null;
+
+            this.trailsVisible = false;
+            this.clustering = false;
+            this.labels = false;
+            this.clusters = [];
+            this.frameRequested = false;
+
+            this.onlineColor = parseColor(this.options.onlineColor);
+            this.offlineColor = parseColor(this.options.offlineColor);
+            this.trailColor = parseColor(this.options.trailColor).map(value => value / 255);
+            this.trailColor[3] = 0.7;
+        },
+
+        segmentsPerTrail() {
+            return Math.max(1, this.options.trailPoints - 1);
+        },
+
+        onAdd(map) {
+            const container = map.getContainer();
+
+            this.canvas = L.DomUtil.create('canvas', 'fleet-layer');
+            this.overlay = L.DomUtil.create('canvas', 'fleet-layer-overlay');
+            [this.canvas, this.overlay].forEach((canvas, index) => {
+                canvas.style.position = 'absolute';
+                canvas.style.left = '0';
+                canvas.style.top = '0';
+                canvas.style.pointerEvents = 'none';
+                canvas.style.zIndex = String(450 + index);
+                container.appendChild(canvas);
+            });
+
+            this.overlayContext = this.overlay.getContext('2d');
+            if (this.options.renderer !== 'canvas') {
+                this.initWebGL();
+            }
+            if (!this.gl) {
+                this.context = this.canvas.getContext('2d');
+            }
+
+            map.on('move zoom viewreset', this.redraw, this);
+            map.on('resize', this.resize, this);
+            map.on('click', this.onClick, this);
+            this.resize();
+        },
+
+        onRemove(map) {
+            map.off('move zoom viewreset', this.redraw, this);
+            map.off('resize', this.resize, this);
+            map.off('click', this.onClick, this);
+            L.DomUtil.remove(this.canvas);
+            L.DomUtil.remove(this.overlay);
+            this.gl = null;
+            this.context = null;
+        },
+
+        getRenderer() {
+            return this.gl ? 'webgl' : 'canvas';
+        },
+
+        initWebGL() {
+            const gl = this.canvas.getContext('webgl', { antialias: true, premultipliedAlpha: false });
+            if (!gl) {
+                return;
+            }
+
+            const compile = (type, source) => {
+                const shader = gl.createShader(type);
+                gl.shaderSource(shader, source);
+                gl.compileShader(shader);
+                if (!gl.getShaderParameter(shader, gl.COMPILE_STATUS)) {
+                    throw new Error(gl.getShaderInfoLog(shader));
+                }
+                return shader;
+            };
+
+            try {
+                const program = gl.createProgram();
+                gl.attachShader(program, compile(gl.VERTEX_SHADER, VERTEX_SHADER));
+                gl.attachShader(program, compile(gl.FRAGMENT_SHADER, FRAGMENT_SHADER));
+                gl.linkProgram(program);
+                if (!gl.getProgramParameter(program, gl.LINK_STATUS)) {
+                    throw new Error(gl.getProgramInfoLog(program));
+                }
+
+                this.gl = gl;
+                this.program = program;
+                this.locations = {
+                    position: gl.getAttribLocation(program, 'a_position'),
+                    color: gl.getAttribLocation(program, 'a_color'),
+                    centerHi: gl.getUniformLocation(program, 'u_center_hi'),
+                    centerLo: gl.getUniformLocation(program, 'u_center_lo'),
+                    scale: gl.getUniformLocation(program, 'u_scale'),
+                    viewport: gl.getUniformLocation(program, 'u_viewport'),
+                    pointSize: gl.getUniformLocation(program, 'u_point_size'),
+                    points: gl.getUniformLocation(program, 'u_points')
+                };
+
+                this.positionBuffer = gl.createBuffer();
+                this.colorBuffer = gl.createBuffer();
+                this.trailBuffer = gl.createBuffer();
+                this.allocateDeviceBuffers();
+                this.allocateTrailBuffer();
+
+                gl.enable(gl.BLEND);
+                gl.blendFunc(gl.SRC_ALPHA, gl.ONE_MINUS_SRC_ALPHA);
+            } catch (error) {
+                console.warn('Fleet layer: WebGL unavailable, using canvas', error);
+                this.gl = null;
+            }
+        },
+
+        // Full (re)upload after the CPU arrays grew
+        allocateDeviceBuffers() {
+            const gl = this.gl;
+            gl.bindBuffer(gl.ARRAY_BUFFER, this.positionBuffer);
+            gl.bufferData(gl.ARRAY_BUFFER, this.positions, gl.DYNAMIC_DRAW);
+            gl.bindBuffer(gl.ARRAY_BUFFER, this.colorBuffer);
+            gl.bufferData(gl.ARRAY_BUFFER, this.colors, gl.DYNAMIC_DRAW);
+            this.dirty = null;
+        },
+
+        allocateTrailBuffer() {
+            const gl = this.gl;
+            gl.bindBuffer(gl.ARRAY_BUFFER, this.trailBuffer);
+            gl.bufferData(gl.ARRAY_BUFFER, this.trailVertices, gl.DYNAMIC_DRAW);
+            this.trailDirty = null;
+        },
+
+        resize() {
+            const size = this._map.getSize();
+            const ratio = window.devicePixelRatio || 1;
+            [this.canvas, this.overlay].forEach((canvas) => {
+                canvas.width = Math.round(size.x * ratio);
+                canvas.height = Math.round(size.y * ratio);
+                canvas.style.width = `${size.x}px`;
+                canvas.style.height = `${size.y}px`;
+            });
+            this.redraw();
+        },
+
+        // Device markers
+
+        setDevice(deviceId, lat, lng, online) {
+            let slot = this.slots.get(deviceId);
+            if (slot === undefined) {
+                slot = this.ids.length;
+                if (slot === this.capacity) {
+                    this.growDevices();
+                }
+                this.ids.push(deviceId);
+                this.slots.set(deviceId, slot);
+            }
+
+            this.positions[slot * 2] = mercatorX(lng);
+            this.positions[slot * 2 + 1] = mercatorY(lat);
+            this.colors.set(online ? this.onlineColor : this.offlineColor, slot * 4);
+            this.dirty = this.dirty ? [Math.min(this.dirty[0], slot), Math.max(this.dirty[1], slot)] : [slot, slot];
+            this.redraw();
+        },
+
+        growDevices() {
+            this.capacity *= 2;
+            const positions = new Float32Array(this.capacity * 2);
+            positions.set(this.positions);
+            const colors = new Uint8Array(this.capacity * 4);
+            colors.set(this.colors);
+            this.positions = positions;
+            this.colors = colors;
+            if (this.gl) {
+                this.allocateDeviceBuffers();
+            }
+        },
+
+        getLatLng(deviceId) {
+            const slot = this.slots.get(deviceId);
+            if (slot === undefined) {
+                return null;
+            }
+            const x = this.positions[slot * 2];
+            const y = this.positions[slot * 2 + 1];
+            const lat = (Math.atan(Math.exp((0.5 - y) * 2 * Math.PI)) * 360 / Math.PI) - 90;
+            return L.latLng(lat, x * 360 - 180);
+        },
+
+        // Trails
+
+        appendTrail(deviceId, lat, lng) {
+            let slot = this.trailSlots.get(deviceId);
+            if (slot === undefined) {
+                slot = this.trailSlots.size;
+                if (slot === this.trailCapacity) {
+                    this.growTrails();
+                }
+                this.trailSlots.set(deviceId, slot);
+            }
+
+            const x = mercatorX(lng);
+            const y = mercatorY(lat);
+            const count = this.trailCounts[slot];
+
+            if (count > 0) {
+                // Ring of segments: the newest overwrites the oldest
+                const segments = this.segmentsPerTrail();
+                const index = (slot * segments + (count - 1) % segments) * 4;
+                this.trailVertices[index] = this.trailLast[slot * 2];
+                this.trailVertices[index + 1] = this.trailLast[slot * 2 + 1];
+                this.trailVertices[index + 2] = x;
+                this.trailVertices[index + 3] = y;
+
+                const vertex = index / 4;
+                this.trailDirty = this.trailDirty
+                    ? [Math.min(this.trailDirty[0], vertex), Math.max(this.trailDirty[1], vertex)]
+                    : [vertex, vertex];
+            }
+
+            this.trailLast[slot * 2] = x;
+            this.trailLast[slot * 2 + 1] = y;
+            this.trailCounts[slot] = count + 1;
+            if (this.trailsVisible) {
+                this.redraw();
+            }
+        },
+
+        // Replace a device's trail, e.g. with trails seeded from the server
+        setTrail(deviceId, points) {
+            const slot = this.trailSlots.get(deviceId);
+            if (slot !== undefined) {
+                const segments = this.segmentsPerTrail();
+                this.trailVertices.fill(0, slot * segments * 4, (slot + 1) * segments * 4);
+                this.trailCounts[slot] = 0;
+                this.trailDirty = this.trailDirty
+                    ? [Math.min(this.trailDirty[0], slot * segments), Math.max(this.trailDirty[1], (slot + 1) * segments - 1)]
+                    : [slot * segments, (slot + 1) * segments - 1];
+            }
+            points.slice(-this.options.trailPoints).forEach(([lat, lng]) => this.appendTrail(deviceId, lat, lng));
+        },
+
+        growTrails() {
+            this.trailCapacity *= 2;
+            const counts = new Int32Array(this.trailCapacity);
+            counts.set(this.trailCounts);
+            const last = new Float32Array(this.trailCapacity * 2);
+            last.set(this.trailLast);
+            const vertices = new Float32Array(this.trailCapacity * this.segmentsPerTrail() * 4);
+            vertices.set(this.trailVertices);
+            this.trailCounts = counts;
+            this.trailLast = last;
+            this.trailVertices = vertices;
+            if (this.gl) {
+                this.allocateTrailBuffer();
+            }
+        },
+
+        setTrailsVisible(visible) {
+            this.trailsVisible = visible;
+            this.redraw();
+        },
+
+        setClustering(enabled) {
+            this.clustering = enabled;
+            this.redraw();
+        },
+
+        setLabels(enabled) {
+            this.labels = enabled;
+            this.redraw();
+        },
+
+        // Drawing
+
+        redraw() {
+            if (this.frameRequested || !this._map) {
+                return;
+            }
+            this.frameRequested = true;
+            L.Util.requestAnimFrame(() => {
+                this.frameRequested = false;
+                if (this._map) {
+                    this.draw();
+                }
+            });
+        },
+
+        // Map view in mercator units: center, world scale in px, container size
+        view() {
+            const map = this._map;
+            const center = map.getCenter();
+            const size = map.getSize();
+            return {
+                cx: mercatorX(center.lng),
+                cy: mercatorY(center.lat),
+                scale: WORLD_SIZE * Math.pow(2, map.getZoom()),
+                width: size.x,
+                height: size.y
+            };
+        },
+
+        draw() {
+            const view = this.view();
+            const clustered = this.clustering && this._map.getZoom() <= this.options.clusterMaxZoom;
+
+            if (this.gl) {
+                this.drawWebGL(view, clustered);
+            } else {
+                this.drawCanvas(view, clustered);
+            }
+            this.drawOverlay(view, clustered);
+        },
+
+        drawWebGL(view, clustered) {
+            const gl = this.gl;
+            const ratio = window.devicePixelRatio || 1;
+            const loc = this.locations;
+
+            gl.viewport(0, 0, this.canvas.width, this.canvas.height);
+            gl.clearColor(0, 0, 0, 0);
+            gl.clear(gl.COLOR_BUFFER_BIT);
+            gl.useProgram(this.program);
+
+            const hiX = Math.fround(view.cx);
+            const hiY = Math.fround(view.cy);
+            gl.uniform2f(loc.centerHi, hiX, hiY);
+            gl.uniform2f(loc.centerLo, view.cx - hiX, view.cy - hiY);
+            gl.uniform1f(loc.scale, view.scale);
+            gl.uniform2f(loc.viewport, view.width, view.height);
+            gl.uniform1f(loc.pointSize, this.options.pointSize * ratio);
+
+            // Upload only what changed since the last frame
+            if (this.dirty) {
+                const [first, last] = this.dirty;
+                gl.bindBuffer(gl.ARRAY_BUFFER, this.positionBuffer);
+                gl.bufferSubData(gl.ARRAY_BUFFER, first * 8, this.positions.subarray(first * 2, (last + 1) * 2));
+                gl.bindBuffer(gl.ARRAY_BUFFER, this.colorBuffer);
+                gl.bufferSubData(gl.ARRAY_BUFFER, first * 4, this.colors.subarray(first * 4, (last + 1) * 4));
+                this.dirty = null;
+            }
+            if (this.trailDirty) {
+                const [first, last] = this.trailDirty;
+                gl.bindBuffer(gl.ARRAY_BUFFER, this.trailBuffer);
+                gl.bufferSubData(gl.ARRAY_BUFFER, first * 16, this.trailVertices.subarray(first * 4, (last + 1) * 4));
+                this.trailDirty = null;
+            }
+
+            if (this.trailsVisible && this.trailSlots.size > 0) {
+                gl.uniform1f(loc.points, 0);
+                gl.bindBuffer(gl.ARRAY_BUFFER, this.trailBuffer);
+                gl.enableVertexAttribArray(loc.position);
+                gl.vertexAttribPointer(loc.position, 2, gl.FLOAT, false, 0, 0);
+                gl.disableVertexAttribArray(loc.color);
+                gl.vertexAttrib4fv(loc.color, this.trailColor);
+                gl.drawArrays(gl.LINES, 0, this.trailSlots.size * this.segmentsPerTrail() * 2);
+            }
+
+            if (!clustered && this.ids.length > 0) {
+                gl.uniform1f(loc.points, 1);
+                gl.bindBuffer(gl.ARRAY_BUFFER, this.positionBuffer);
+                gl.enableVertexAttribArray(loc.position);
+                gl.vertexAttribPointer(loc.position, 2, gl.FLOAT, false, 0, 0);
+                gl.bindBuffer(gl.ARRAY_BUFFER, this.colorBuffer);
+                gl.enableVertexAttribArray(loc.color);
+                gl.vertexAttribPointer(loc.color, 4, gl.UNSIGNED_BYTE, true, 0, 0);
+                gl.drawArrays(gl.POINTS, 0, this.ids.length);
+            }
+        },
+
+        drawCanvas(view, clustered) {
+            const ctx = this.context;
+            const ratio = window.devicePixelRatio || 1;
+            ctx.setTransform(ratio, 0, 0, ratio, 0, 0);
+            ctx.clearRect(0, 0, view.width, view.height);
+
+            const halfWidth = view.width / 2;
+            const halfHeight = view.height / 2;
+
+            if (this.trailsVisible && this.trailSlots.size > 0) {
+                const c = this.trailColor;
+                ctx.strokeStyle = `rgba(${c[0] * 255}, ${c[1] * 255}, ${c[2] * 255}, ${c[3]})`;
+                ctx.lineWidth = 2;
+                ctx.beginPath();
+                const vertices = this.trailVertices;
+                const end = this.trailSlots.size * this.segmentsPerTrail() * 4;
+                for (let i = 0; i < end; i += 4) {
+                    if (vertices[i] === vertices[i + 2] && vertices[i + 1] === vertices[i + 3]) {
+                        continue; // unused segment
+                    }
+                    ctx.moveTo((vertices[i] - view.cx) * view.scale + halfWidth, (vertices[i + 1] - view.cy) * view.scale + halfHeight);
+                    ctx.lineTo((vertices[i + 2] - view.cx) * view.scale + halfWidth, (vertices[i + 3] - view.cy) * view.scale + halfHeight);
+                }
+                ctx.stroke();
+            }
+
+            if (clustered) {
+                return;
+            }
+
+            const radius = this.options.pointSize / 2;
+            [this.onlineColor, this.offlineColor].forEach((color) => {
+                ctx.fillStyle = `rgb(${color[0]}, ${color[1]}, ${color[2]})`;
+                ctx.strokeStyle = '#ffffff';
+                ctx.lineWidth = 2;
+                ctx.beginPath();
+                for (let slot = 0; slot < this.ids.length; slot++) {
+                    if (this.colors[slot * 4] !== color[0] || this.colors[slot * 4 + 1] !== color[1]) {
+                        continue;
+                    }
+                    const x = (this.positions[slot * 2] - view.cx) * view.scale + halfWidth;
+                    const y = (this.positions[slot * 2 + 1] - view.cy) * view.scale + halfHeight;
+                    if (x < -radius || y < -radius || x > view.width + radius || y > view.height + radius) {
+                        continue;
+                    }
+                    ctx.moveTo(x + radius, y);
+                    ctx.arc(x, y, radius, 0, 2 * Math.PI);
+                }
+                ctx.fill();
+                ctx.stroke();
+            });
+        },
+
+        // Screen-space grid clustering over the position arrays
+        buildClusters(view) {
+            const cell = this.options.clusterRadius;
+            const halfWidth = view.width / 2;
+            const halfHeight = view.height / 2;
+            const cells = new Map();
+
+            for (let slot = 0; slot < this.ids.length; slot++) {
+                const x = (this.positions[slot * 2] - view.cx) * view.scale + halfWidth;
+                const y = (this.positions[slot * 2 + 1] - view.cy) * view.scale + halfHeight;
+                if (x < -cell || y < -cell || x > view.width + cell || y > view.height + cell) {
+                    continue;
+                }
+
+                const key = Math.floor(x / cell) * 100000 + Math.floor(y / cell);
+                let cluster = cells.get(key);
+                if (!cluster) {
+                    cluster = { x: 0, y: 0, count: 0, slot, online: 0 };
+                    cells.set(key, cluster);
+                }
+                cluster.x += x;
+                cluster.y += y;
+                cluster.count++;
+                if (this.colors[slot * 4] === this.onlineColor[0] && this.colors[slot * 4 + 1] === this.onlineColor[1]) {
+                    cluster.online++;
+                }
+            }
+
+            const clusters = [];
+            cells.forEach((cluster) => {
+                cluster.x /= cluster.count;
+                cluster.y /= cluster.count;
+                clusters.push(cluster);
+            });
+            return clusters;
+        },
+
+        drawOverlay(view, clustered) {
+            const ctx = this.overlayContext;
+            const ratio = window.devicePixelRatio || 1;
+            ctx.setTransform(ratio, 0, 0, ratio, 0, 0);
+            ctx.clearRect(0, 0, view.width, view.height);
+
+            this.clusters = clustered ? this.buildClusters(view) : [];
+            ctx.textAlign = 'center';
+            ctx.textBaseline = 'middle';
+            ctx.font = 'bold 12px sans-serif';
+
+            this.clusters.forEach((cluster) => {
+                if (cluster.count === 1) {
+                    const color = cluster.online > 0 ? this.onlineColor : this.offlineColor;
+                    ctx.fillStyle = `rgb(${color[0]}, ${color[1]}, ${color[2]})`;
+                    ctx.beginPath();
+                    ctx.arc(cluster.x, cluster.y, this.options.pointSize / 2, 0, 2 * Math.PI);
+                    ctx.fill();
+                    ctx.strokeStyle = '#ffffff';
+                    ctx.lineWidth = 2;
+                    ctx.stroke();
+                    return;
+                }
+
+                const radius = 14 + Math.min(12, Math.log10(cluster.count) * 6);
+                ctx.fillStyle = '#d4af37';
+                ctx.beginPath();
+                ctx.arc(cluster.x, cluster.y, radius, 0, 2 * Math.PI);
+                ctx.fill();
+                ctx.strokeStyle = '#ffffff';
+                ctx.lineWidth = 2;
+                ctx.stroke();
+                ctx.fillStyle = '#ffffff';
+                ctx.fillText(String(cluster.count), cluster.x, cluster.y);
+            });
+
+            if (this.labels && !clustered) {
+                this.drawLabels(ctx, view);
+            }
+        },
+
+        drawLabels(ctx, view) {
+            const halfWidth = view.width / 2;
+            const halfHeight = view.height / 2;
+            let drawn = 0;
+
+            ctx.font = '11px sans-serif';
+            ctx.textBaseline = 'bottom';
+            ctx.lineWidth = 3;
+            ctx.strokeStyle = '#ffffff';
+            ctx.fillStyle = '#1f2937';
+
+            for (let slot = 0; slot < this.ids.length && drawn < this.options.maxLabels; slot++) {
+                const x = (this.positions[slot * 2] - view.cx) * view.scale + halfWidth;
+                const y = (this.positions[slot * 2 + 1] - view.cy) * view.scale + halfHeight;
+                if (x < 0 || y < 0 || x > view.width || y > view.height) {
+                    continue;
+                }
+                const labelY = y - this.options.pointSize / 2 - 2;
+                ctx.strokeText(this.ids[slot], x, labelY);
+                ctx.fillText(this.ids[slot], x, labelY);
+                drawn++;
+            }
+        },
+
+        // Picking: clusters zoom in, single devices fire 'deviceclick'
+        onClick(event) {
+            const point = event.containerPoint;
+
+            if (this.clusters.length > 0) {
+                for (const cluster of this.clusters) {
+                    const hitRadius = cluster.count === 1 ? this.options.pointSize : 24;
+                    if (Math.abs(cluster.x - point.x) <= hitRadius && Math.abs(cluster.y - point.y) <= hitRadius) {
+                        if (cluster.count === 1) {
+                            this.fire('deviceclick', { deviceId: this.ids[cluster.slot], latlng: this.getLatLng(this.ids[cluster.slot]) });
+                        } else {
+                            this._map.setView(this._map.containerPointToLatLng([cluster.x, cluster.y]), this._map.getZoom() + 2);
+                        }
+                        return;
+                    }
+                }
+                return;
+            }
+
+            const view = this.view();
+            const halfWidth = view.width / 2;
+            const halfHeight = view.height / 2;
+            let nearest = -1;
+            let nearestDistance = this.options.pointSize * this.options.pointSize;
+
+            for (let slot = 0; slot < this.ids.length; slot++) {
+                const dx = (this.positions[slot * 2] - view.cx) * view.scale + halfWidth - point.x;
+                const dy = (this.positions[slot * 2 + 1] - view.cy) * view.scale + halfHeight - point.y;
+                const distance = dx * dx + dy * dy;
+                if (distance < nearestDistance) {
+                    nearestDistance = distance;
+                    nearest = slot;
+                }
+            }
+
+            if (nearest >= 0) {
+                this.fire('deviceclick', { deviceId: this.ids[nearest], latlng: this.getLatLng(this.ids[nearest]) });
+            }
+        }
+    });
+
+    L.fleetLayer = function(options) {
+        return new L.FleetLayer(options);
+    };
+})();
@@ -3,17 +3,24 @@
  * Real-time GPS tracking with WebSocket updates
  */
 
+// Binary frames this decoder understands (server/lib/update-frame.js)
+const UPDATE_FRAME_TYPE = 1;
+const UPDATE_FRAME_VERSION = 3;
+
 class GPSTrackerDashboard {
     constructor() {
         this.map = null;
         this.markers = new Map();
         this.trails = new Map();
+        this.watchedDevices = new Set(); // always streamed, even outside the map view
+        this.subscriptionTimer = null;
         this.clusterGroup = null;
         this.trailsLayer = null;
         this.ws = null;
         this.wsReconnectAttempts = 0;
-        this.maxReconnectAttempts = 5;
         this.reconnectDelay = 1000;
+        // Live stream position, so a reconnect only fetches what changed
+        this.stream = { epoch: null, seq: 0, query: null };
         this.authToken = null;
         this.currentUser = null;
         this.pollingInterval = null;
@@ -51,12 +58,9 @@ class GPSTrackerDashboard {
         // Load initial data
         await this.loadInitialData();
 
-        // Connect to WebSocket
+        // Connect to WebSocket (polls only while it is down)
         this.connectWebSocket();
 
-        // Start polling as fallback
-        this.startPolling();
-
         console.log('Dashboard initialized successfully');
     }
 
@@ -469,8 +473,19 @@ class GPSTrackerDashboard {
             maxZoom: 18
         }).addTo(this.map);
 
+        // One canvas for every marker and trail when fleet-layer.js is loaded
+        if (L.FleetLayer) {
+            this.fleetLayer = L.fleetLayer({
+                trailPoints: Math.min(this.config.historyPoints, 100)
+            }).addTo(this.map);
+            this.fleetLayer.on('deviceclick', (e) => this.openDevicePopup(e.deviceId));
+            this.map.on('moveend', () => this.updateSubscription());
+            console.log(`Map initialized (${this.fleetLayer.getRenderer()} fleet layer)`);
+            return;
+        }
+
         // Initialize marker cluster group
-        this.clusterGroup = L.markerClusterGroup({
+        this.clusterGroup = L.markerClusterGroup && L.markerClusterGroup({
             chunkedLoading: true,
             maxClusterRadius: 50,
             iconCreateFunction: function(cluster) {
@@ -486,6 +501,9 @@ class GPSTrackerDashboard {
         // Initialize trails layer
         this.trailsLayer = L.layerGroup().addTo(this.map);
 
+        // Live updates are limited to the visible area
+        this.map.on('moveend', () => this.updateSubscription());
+
         console.log('Map initialized');
     }
 
@@ -591,7 +609,7 @@ class GPSTrackerDashboard {
         try {
             console.log('Loading initial data...');
 
-            const response = await this.authenticatedFetch('/api/positions');
+            const response = await this.authenticatedFetch(`/api/positions?${this.subscriptionQuery()}`);
             if (!response || !response.ok) {
                 throw new Error(`HTTP ${response.status}: ${response.statusText}`);
             }
@@ -600,9 +618,8 @@ class GPSTrackerDashboard {
             console.log(`Loaded ${data.positions.length} positions`);
 
             // Process positions
-            data.positions.forEach(position => {
-                this.updateDevice(position);
-            });
+            this.applyUpdates(data.positions);
+            this.trackStream(data);
 
             // Update stats
             await this.updateStats();
@@ -620,18 +637,28 @@ class GPSTrackerDashboard {
 
             // Derive WebSocket URL from current location
             const protocol = location.protocol === 'https:' ? 'wss:' : 'ws:';
-            const wsUrl = `${protocol}//${location.host}/ws`;
+            const wsUrl = `${protocol}//${location.host}/ws?binary=1&${this.subscriptionQuery()}${this.resumeQuery()}`;
 
             this.ws = new WebSocket(wsUrl);
+            this.ws.binaryType = 'arraybuffer';
 
             this.ws.onopen = () => {
                 console.log('WebSocket connected');
                 this.updateConnectionStatus(true);
                 this.wsReconnectAttempts = 0;
+                this.stopPolling();
             };
 
             this.ws.onmessage = (event) => {
                 try {
+                    if (event.data instanceof ArrayBuffer) {
+                        const updates = this.decodeUpdateFrame(event.data);
+                        if (updates) {
+                            this.applyUpdates(updates);
+                            this.stream.seq = new DataView(event.data).getFloat64(16, true);
+                        }
+                        return;
+                    }
                     const data = JSON.parse(event.data);
                     this.handleWebSocketMessage(data);
                 } catch (error) {
@@ -642,6 +669,7 @@ class GPSTrackerDashboard {
             this.ws.onclose = (event) => {
                 console.log('WebSocket closed:', event.code, event.reason);
                 this.updateConnectionStatus(false);
+                this.startPolling();
                 this.scheduleReconnect();
             };
 
@@ -656,20 +684,69 @@ class GPSTrackerDashboard {
         }
     }
 
+    // "&epoch=..&since=.." when the last stream position still matches the current view
+    resumeQuery() {
+        const { epoch, seq, query } = this.stream;
+        return epoch && query === this.subscriptionQuery() ? `&epoch=${epoch}&since=${seq}` : '';
+    }
+
+    // Remember how far the live stream (or a REST snapshot) brought us
+    trackStream(data) {
+        // Snapshots (init, REST, the reply to a subscribe) are complete for the current view
+        if (data.epoch || data.type === 'positions') {
+            this.stream.epoch = data.epoch || this.stream.epoch;
+            this.stream.query = this.subscriptionQuery();
+        }
+        if (data.seq !== undefined) {
+            this.stream.seq = data.seq;
+        }
+    }
+
     handleWebSocketMessage(data) {
+        this.trackStream(data);
+
         switch (data.type) {
             case 'init':
-                console.log('Received initial data from WebSocket');
-                data.positions.forEach(position => {
-                    this.updateDevice(position);
+                console.log(`Received ${data.resync ? 'changes since last connection' : 'initial data'} from WebSocket`);
+                // Recent trails from the server's track cache
+                Object.entries(data.trails || {}).forEach(([deviceId, trail]) => {
+                    this.trails.set(deviceId, trail.slice(-this.config.historyPoints));
+                    if (this.fleetLayer) {
+                        this.fleetLayer.setTrail(deviceId, trail);
+                    }
                 });
+                this.applyUpdates(data.positions);
                 break;
 
             case 'update':
-                console.log('Received position update:', data.device);
                 this.updateDevice(data.device);
                 break;
 
+            case 'updates':
+                // One tick's worth of updates, newest state per device
+                this.applyUpdates(data.devices);
+                break;
+
+            case 'positions':
+                // Snapshot of what is in view after a (re)subscribe
+                this.applyUpdates(data.positions);
+                break;
+
+            case 'summary':
+                // Fleet-wide counts, since updates outside the view are not sent
+                this.updateSummary(data);
+                break;
+
+            case 'presence':
+                // Devices that came online or went offline on the server's clock
+                this.applyPresence(data.devices);
+                break;
+
+            case 'history_changed':
+                // Backfilled fixes were stored; they are not sent as updates
+                this.refreshTrails(data.devices);
+                break;
+
             case 'heartbeat':
                 // Handle heartbeat if needed
                 break;
@@ -679,7 +756,75 @@ class GPSTrackerDashboard {
         }
     }
 
-    updateDevice(position) {
+    applyUpdates(positions) {
+        positions.forEach(position => {
+            this.updateDevice(position, false);
+        });
+        this.updateDeviceList();
+    }
+
+    // Binary update frame, see server/lib/update-frame.js for the layout.
+    // null for a type or version this page does not know (e.g. a server
+    // upgraded under an open tab); its columns would be misread.
+    decodeUpdateFrame(buffer) {
+        const view = new DataView(buffer);
+        if (buffer.byteLength < 24 || view.getUint8(0) !== UPDATE_FRAME_TYPE || view.getUint8(1) !== UPDATE_FRAME_VERSION) {
+            if (!this.warnedFrameVersion) {
+                console.warn('Ignoring binary update frame with unknown version', buffer.byteLength > 1 ? view.getUint8(1) : null);
+                this.warnedFrameVersion = true;
+            }
+            return null;
+        }
+        const count = view.getUint32(4, true);
+        let offset = 24;
+        const column = (Type) => {
+            const array = new Type(buffer, offset, count);
+            offset += count * Type.BYTES_PER_ELEMENT;
+            return array;
+        };
+
+        const lat = column(Float64Array);
+        const lng = column(Float64Array);
+        const timestamp = column(Float64Array);
+        const receivedAt = column(Float64Array);
+        const speed = column(Float32Array);
+        const heading = column(Float32Array);
+        const accuracy = column(Float32Array);
+        const satellites = column(Uint8Array);
+
+        const decoder = this.textDecoder || (this.textDecoder = new TextDecoder());
+        const ids = [];
+        for (let i = 0; i < count; i++) {
+            const length = view.getUint16(offset, true);
+            ids.push(decoder.decode(new Uint8Array(buffer, offset + 2, length)));
+            offset += 2 + length;
+        }
+
+        const positions = [];
+        for (let i = 0; i < count; i++) {
+            const length = view.getUint8(offset);
+            const position = {
+                device_id: ids[i],
+                lat: lat[i],
+                lng: lng[i],
+                speed: Math.round(speed[i] * 100) / 100,
+                heading: Math.round(heading[i] * 100) / 100,
+                satellites: satellites[i],
+                source: decoder.decode(new Uint8Array(buffer, offset + 1, length)),
+                timestamp: timestamp[i],
+                received_at: receivedAt[i]
+            };
+            // Cell fixes only; GNSS fixes carry no accuracy, as in the JSON form
+            if (accuracy[i] > 0) {
+                position.accuracy = accuracy[i];
+            }
+            positions.push(position);
+            offset += 1 + length;
+        }
+        return positions;
+    }
+
+    updateDevice(position, refreshList = true) {
         const deviceId = position.device_id;
 
         // Store device data
@@ -696,23 +841,29 @@ class GPSTrackerDashboard {
             this.updateTrail(deviceId, position);
         }
 
-        // Update device list
-        this.updateDeviceList();
+        // Update device list (batched callers refresh it once)
+        if (refreshList) {
+            this.updateDeviceList();
+        }
     }
 
-    updateMarker(position) {
+    updateMarker(position, isOnline = this.isDeviceOnline(position)) {
         const deviceId = position.device_id;
         const lat = position.lat;
         const lng = position.lng;
 
-        // Create custom icon based on status
-        const isOnline = this.isDeviceOnline(position);
+        if (this.fleetLayer) {
+            // Rewrites the device's slot in place; drawn on the next frame
+            this.fleetLayer.setDevice(deviceId, lat, lng, isOnline);
+            return;
+        }
+
         const icon = this.createDeviceIcon(deviceId, isOnline, position.source);
 
         // Remove existing marker
         if (this.markers.has(deviceId)) {
             const existingMarker = this.markers.get(deviceId);
-            if (this.clusterGroup.hasLayer(existingMarker)) {
+            if (this.clusterGroup && this.clusterGroup.hasLayer(existingMarker)) {
                 this.clusterGroup.removeLayer(existingMarker);
             }
             if (this.map.hasLayer(existingMarker)) {
@@ -725,7 +876,7 @@ class GPSTrackerDashboard {
             .bindPopup(this.createPopupContent(position));
 
         // Add to appropriate layer
-        if (this.isClustersEnabled) {
+        if (this.isClustersEnabled && this.clusterGroup) {
             this.clusterGroup.addLayer(marker);
         } else {
             marker.addTo(this.map);
@@ -768,6 +919,7 @@ class GPSTrackerDashboard {
                     <div><strong>Heading:</strong> ${heading}</div>
                     <div><strong>Satellites:</strong> ${satellites}</div>
                     <div><strong>Source:</strong> ${position.source}</div>
+                    ${position.accuracy ? `<div><strong>Accuracy:</strong> ±${Math.round(position.accuracy)} m (cell)</div>` : ''}
                     <div><strong>Last Seen:</strong> ${lastSeen}</div>
                 </div>
             </div>
@@ -780,6 +932,10 @@ class GPSTrackerDashboard {
         }
 
         const trail = this.trails.get(deviceId);
+        const last = trail[trail.length - 1];
+        if (last && last[0] === position.lat && last[1] === position.lng) {
+            return; // already the trail's newest point (e.g. seeded from init)
+        }
         trail.push([position.lat, position.lng]);
 
         // Limit trail length
@@ -787,8 +943,58 @@ class GPSTrackerDashboard {
             trail.shift();
         }
 
-        // Update polyline
-        this.updateTrailPolyline(deviceId, trail);
+        // Append one segment, or rebuild the polyline without the fleet layer
+        if (this.fleetLayer) {
+            this.fleetLayer.appendTrail(deviceId, position.lat, position.lng);
+        } else {
+            this.updateTrailPolyline(deviceId, trail);
+        }
+    }
+
+    // Recolour markers on online/offline transitions; without a fix nothing else would
+    applyPresence(changes) {
+        let changed = false;
+        changes.forEach(({ device_id: deviceId, online }) => {
+            const position = this.devices.get(deviceId);
+            if (position) {
+                this.updateMarker(position, online);
+                changed = true;
+            }
+        });
+        if (changed) {
+            this.updateDeviceList();
+        }
+    }
+
+    // Reload the trails of devices whose history gained backfilled fixes
+    async refreshTrails(changes) {
+        if (!this.isTrailsEnabled) {
+            return;
+        }
+
+        for (const { device_id: deviceId } of changes) {
+            if (!this.trails.has(deviceId)) {
+                continue;
+            }
+            try {
+                const response = await this.authenticatedFetch(
+                    `/api/history/${encodeURIComponent(deviceId)}?limit=${this.config.historyPoints}&fields=lat,lng`
+                );
+                if (!response || !response.ok) {
+                    continue;
+                }
+                const data = await response.json();
+                const trail = data.positions.reverse().map(point => [point.lat, point.lng]);
+                this.trails.set(deviceId, trail);
+                if (this.fleetLayer) {
+                    this.fleetLayer.setTrail(deviceId, trail);
+                } else {
+                    this.updateTrailPolyline(deviceId, trail);
+                }
+            } catch (error) {
+                console.error(`Error reloading trail for ${deviceId}:`, error);
+            }
+        }
     }
 
     updateTrailPolyline(deviceId, trail) {
@@ -880,20 +1086,23 @@ class GPSTrackerDashboard {
             return;
         }
 
-        const group = new L.featureGroup();
-        devices.forEach(device => {
-            if (this.markers.has(device.device_id)) {
-                group.addLayer(this.markers.get(device.device_id));
-            }
-        });
-
-        this.map.fitBounds(group.getBounds().pad(0.1));
+        const bounds = L.latLngBounds(devices.map(device => [device.lat, device.lng]));
+        this.map.fitBounds(bounds.pad(0.1));
     }
 
     toggleTrails() {
         this.isTrailsEnabled = !this.isTrailsEnabled;
         const btn = document.getElementById('trailsBtn');
 
+        if (this.fleetLayer) {
+            btn.classList.toggle('active', this.isTrailsEnabled);
+            if (this.isTrailsEnabled) {
+                this.trails.forEach((trail, deviceId) => this.fleetLayer.setTrail(deviceId, trail));
+            }
+            this.fleetLayer.setTrailsVisible(this.isTrailsEnabled);
+            return;
+        }
+
         if (this.isTrailsEnabled) {
             btn.classList.add('active');
             this.trailsLayer.addTo(this.map);
@@ -914,6 +1123,12 @@ class GPSTrackerDashboard {
         this.isClustersEnabled = !this.isClustersEnabled;
         const btn = document.getElementById('clustersBtn');
 
+        if (this.fleetLayer) {
+            btn.classList.toggle('active', this.isClustersEnabled);
+            this.fleetLayer.setClustering(this.isClustersEnabled);
+            return;
+        }
+
         if (this.isClustersEnabled) {
             btn.classList.add('active');
             this.clusterGroup.addTo(this.map);
@@ -945,6 +1160,15 @@ class GPSTrackerDashboard {
     }
 
     focusDevice(deviceId) {
+        if (this.fleetLayer) {
+            const device = this.devices.get(deviceId);
+            if (device) {
+                this.map.setView([device.lat, device.lng], Math.max(this.map.getZoom(), 15));
+                this.openDevicePopup(deviceId);
+            }
+            return;
+        }
+
         const marker = this.markers.get(deviceId);
         if (marker) {
             this.map.setView(marker.getLatLng(), Math.max(this.map.getZoom(), 15));
@@ -952,6 +1176,17 @@ class GPSTrackerDashboard {
         }
     }
 
+    // Fleet layer markers are not Leaflet layers, so popups are opened on the map
+    openDevicePopup(deviceId) {
+        const device = this.devices.get(deviceId);
+        if (device) {
+            L.popup()
+                .setLatLng([device.lat, device.lng])
+                .setContent(this.createPopupContent(device))
+                .openOn(this.map);
+        }
+    }
+
     filterDevices(searchTerm) {
         const deviceItems = document.querySelectorAll('.device-item');
         const term = searchTerm.toLowerCase();
@@ -975,6 +1210,34 @@ class GPSTrackerDashboard {
     }
 
     // Connection management
+    // Current map view as a bbox subscription (plus any explicitly watched devices)
+    currentSubscription() {
+        const bounds = this.map.getBounds().pad(0.2);
+        return {
+            bbox: [bounds.getWest(), bounds.getSouth(), bounds.getEast(), bounds.getNorth()].map(value => +value.toFixed(5)),
+            devices: Array.from(this.watchedDevices)
+        };
+    }
+
+    subscriptionQuery() {
+        const subscription = this.currentSubscription();
+        let query = `bbox=${subscription.bbox.join(',')}`;
+        if (subscription.devices.length > 0) {
+            query += `&devices=${subscription.devices.map(encodeURIComponent).join(',')}`;
+        }
+        return query;
+    }
+
+    // Re-subscribe once the map settles after a pan or zoom
+    updateSubscription() {
+        clearTimeout(this.subscriptionTimer);
+        this.subscriptionTimer = setTimeout(() => {
+            if (this.ws && this.ws.readyState === WebSocket.OPEN) {
+                this.ws.send(JSON.stringify({ type: 'subscribe', ...this.currentSubscription() }));
+            }
+        }, 250);
+    }
+
     updateConnectionStatus(connected) {
         const statusDot = document.getElementById('statusDot');
         const statusText = document.getElementById('statusText');
@@ -989,26 +1252,28 @@ class GPSTrackerDashboard {
     }
 
     scheduleReconnect() {
-        if (this.wsReconnectAttempts < this.maxReconnectAttempts) {
-            this.wsReconnectAttempts++;
-            const delay = this.reconnectDelay * Math.pow(2, this.wsReconnectAttempts - 1);
+        // Keep trying; polling covers the gap
+        this.wsReconnectAttempts++;
+        const delay = Math.min(this.reconnectDelay * Math.pow(2, this.wsReconnectAttempts - 1), 30000); // Max 30 seconds
+        const jitter = Math.random() * delay * 0.2; // spread reconnects after a server restart
 
-            console.log(`Scheduling WebSocket reconnect in ${delay}ms (attempt ${this.wsReconnectAttempts})`);
+        console.log(`Scheduling WebSocket reconnect in ${Math.round(delay + jitter)}ms (attempt ${this.wsReconnectAttempts})`);
 
-            setTimeout(() => {
-                this.connectWebSocket();
-            }, Math.min(delay, 30000)); // Max 30 seconds
-        } else {
-            console.log('Max WebSocket reconnect attempts reached, using polling fallback');
-        }
+        setTimeout(() => {
+            this.connectWebSocket();
+        }, delay + jitter);
     }
 
+    // Fallback while the WebSocket is down, stopped again when it reconnects
     startPolling() {
+        if (this.pollingInterval || this.pollingDisabled) {
+            return;
+        }
         this.pollingInterval = setInterval(async() => {
             if (!this.ws || this.ws.readyState !== WebSocket.OPEN) {
                 console.log('Polling for updates (WebSocket disconnected)');
                 try {
-                    await this.loadInitialData();
+                    await this.pollPositions();
                 } catch (error) {
                     console.error('Polling error:', error);
                 }
@@ -1016,6 +1281,35 @@ class GPSTrackerDashboard {
         }, this.config.pollIntervalMs);
     }
 
+    stopPolling() {
+        if (this.pollingInterval) {
+            clearInterval(this.pollingInterval);
+            this.pollingInterval = null;
+        }
+    }
+
+    // Positions changed since the last stream sequence number we saw
+    async pollPositions() {
+        const response = await this.authenticatedFetch(`/api/positions?${this.subscriptionQuery()}${this.resumeQuery()}`);
+        if (!response || !response.ok) {
+            throw new Error(`HTTP ${response && response.status}`);
+        }
+
+        const data = await response.json();
+        this.applyUpdates(data.positions);
+        this.trackStream(data);
+    }
+
+    // Fleet-wide counts pushed over the WebSocket, in place of polling /api/stats
+    updateSummary(summary) {
+        document.getElementById('totalDevices').textContent = summary.total_devices;
+        document.getElementById('onlineDevices').textContent = summary.online_devices;
+        const wsClients = document.getElementById('wsClients');
+        if (wsClients) {
+            wsClients.textContent = summary.ws_clients;
+        }
+    }
+
     // Utility functions
     isDeviceOnline(position) {
         const now = Date.now();
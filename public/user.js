@@ -30,13 +30,15 @@ class UserDashboard extends GPSTrackerDashboard {
             return;
         }
 
+        // Exports are admin-only until devices are tied to users (server answers 403)
+        this.userFeatures.dataExport = this.currentUser.role === 'admin';
+
         this.initMap();
         this.setupEventListeners();
         this.setupMobileNavigation();
         this.setupUserControls();
         await this.loadInitialData();
         this.connectWebSocket();
-        this.startPolling();
         console.log('User Dashboard initialized successfully');
     }
 
@@ -53,7 +55,9 @@ class UserDashboard extends GPSTrackerDashboard {
 
         // Export Data
         const exportDataBtn = document.getElementById('exportMyData');
-        if (exportDataBtn) {
+        if (exportDataBtn && !this.userFeatures.dataExport) {
+            exportDataBtn.style.display = 'none';
+        } else if (exportDataBtn) {
             exportDataBtn.addEventListener('click', () => {
                 this.exportMyData();
             });
@@ -180,7 +184,8 @@ class UserDashboard extends GPSTrackerDashboard {
         try {
             this.showNotification('Exporting your data...', 'info');
 
-            const response = await this.authenticatedFetch('/api/user/export-data', {
+            const devices = Array.from(this.myDevices.keys()).map(encodeURIComponent).join(',');
+            const response = await this.authenticatedFetch(`/api/user/export-data?format=csv&devices=${devices}`, {
                 method: 'GET'
             });
 
@@ -190,9 +195,11 @@ class UserDashboard extends GPSTrackerDashboard {
 
             const blob = await response.blob();
             const url = window.URL.createObjectURL(blob);
+            const disposition = response.headers.get('Content-Disposition') || '';
+            const filename = disposition.match(/filename="([^"]+)"/);
             const a = document.createElement('a');
             a.href = url;
-            a.download = `my-gps-data-${new Date().toISOString().split('T')[0]}.json`;
+            a.download = filename ? filename[1] : 'my-gps-data.csv.gz';
             document.body.appendChild(a);
             a.click();
             window.URL.revokeObjectURL(url);
@@ -316,6 +323,11 @@ class UserDashboard extends GPSTrackerDashboard {
         }
     }
 
+    // Polling fallback reloads the user's own devices rather than the fleet-wide delta
+    async pollPositions() {
+        await this.loadInitialData();
+    }
+
     // Override stats update for user-specific stats
     async updateStats() {
         try {
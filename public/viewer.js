@@ -9,7 +9,6 @@ class ViewerDashboard extends GPSTrackerDashboard {
             viewClusters: true,
             autoRefresh: true
         };
-        this.autoRefreshInterval = null;
         this.showLabels = false;
     }
 
@@ -36,9 +35,8 @@ class ViewerDashboard extends GPSTrackerDashboard {
         this.setupMobileNavigation();
         this.setupViewerControls();
         await this.loadInitialData();
-        this.connectWebSocket();
-        this.startPolling();
         this.setupAutoRefresh();
+        this.connectWebSocket();
         console.log('Viewer Dashboard initialized successfully');
     }
 
@@ -83,51 +81,37 @@ class ViewerDashboard extends GPSTrackerDashboard {
         }, 8000);
     }
 
+    // Live updates and stats come over the WebSocket; auto refresh only
+    // decides whether to poll while it is disconnected
     setupAutoRefresh() {
         const autoRefreshCheckbox = document.getElementById('autoRefresh');
-        if (autoRefreshCheckbox && autoRefreshCheckbox.checked) {
-            this.startAutoRefresh();
-        }
-    }
-
-    startAutoRefresh() {
-        if (this.autoRefreshInterval) {
-            clearInterval(this.autoRefreshInterval);
-        }
-
-        this.autoRefreshInterval = setInterval(() => {
-            this.refreshData();
-        }, 30000); // Refresh every 30 seconds
-    }
-
-    stopAutoRefresh() {
-        if (this.autoRefreshInterval) {
-            clearInterval(this.autoRefreshInterval);
-            this.autoRefreshInterval = null;
-        }
-    }
-
-    async refreshData() {
-        try {
-            await this.loadInitialData();
-            this.updateStats();
-            this.showNotification('Data refreshed', 'info');
-        } catch (error) {
-            console.error('Error refreshing data:', error);
-        }
+        this.pollingDisabled = Boolean(autoRefreshCheckbox && !autoRefreshCheckbox.checked);
     }
 
     toggleAutoRefresh(enabled) {
+        this.pollingDisabled = !enabled;
         if (enabled) {
-            this.startAutoRefresh();
+            if (!this.ws || this.ws.readyState !== WebSocket.OPEN) {
+                this.startPolling();
+            }
             this.showNotification('Auto refresh enabled', 'success');
         } else {
-            this.stopAutoRefresh();
+            this.stopPolling();
             this.showNotification('Auto refresh disabled', 'info');
         }
     }
 
     toggleTrails(enabled) {
+        if (this.fleetLayer) {
+            this.isTrailsEnabled = enabled;
+            if (enabled) {
+                this.trails.forEach((trail, deviceId) => this.fleetLayer.setTrail(deviceId, trail));
+            }
+            this.fleetLayer.setTrailsVisible(enabled);
+            this.showNotification(`Trails ${enabled ? 'enabled' : 'disabled'}`, enabled ? 'success' : 'info');
+            return;
+        }
+
         if (enabled) {
             this.showTrails = true;
             this.updateTrails();
@@ -140,6 +124,13 @@ class ViewerDashboard extends GPSTrackerDashboard {
     }
 
     toggleClusters(enabled) {
+        if (this.fleetLayer) {
+            this.isClustersEnabled = enabled;
+            this.fleetLayer.setClustering(enabled);
+            this.showNotification(`Clusters ${enabled ? 'enabled' : 'disabled'}`, enabled ? 'success' : 'info');
+            return;
+        }
+
         if (enabled) {
             this.showClusters = true;
             this.updateClusters();
@@ -154,6 +145,12 @@ class ViewerDashboard extends GPSTrackerDashboard {
     toggleLabels(enabled) {
         this.showLabels = enabled;
 
+        if (this.fleetLayer) {
+            this.fleetLayer.setLabels(enabled);
+            this.showNotification(`Labels ${enabled ? 'enabled' : 'disabled'}`, 'info');
+            return;
+        }
+
         // Update all markers to show/hide labels
         this.markers.forEach((marker, deviceId) => {
             if (enabled) {
@@ -238,6 +235,13 @@ class ViewerDashboard extends GPSTrackerDashboard {
         }
     }
 
+    updateSummary(summary) {
+        document.getElementById('totalDevices').textContent = summary.total_devices;
+        document.getElementById('onlineDevices').textContent = summary.online_devices;
+        document.getElementById('activeSessions').textContent = summary.ws_clients;
+        document.getElementById('systemStatus').textContent = summary.mqtt_connected ? 'Online' : 'Offline';
+    }
+
     // Override stats update for viewer-specific stats
     async updateStats() {
         try {
@@ -307,6 +311,11 @@ class ViewerDashboard extends GPSTrackerDashboard {
         
         if (!device) return;
 
+        // Keep following the selected device when it leaves the map view
+        this.watchedDevices.clear();
+        this.watchedDevices.add(deviceId);
+        this.updateSubscription();
+
         // Create a read-only popup
         const popupContent = `
             <div class="device-popup viewer">
@@ -329,6 +338,14 @@ class ViewerDashboard extends GPSTrackerDashboard {
             </div>
         `;
 
+        if (this.fleetLayer) {
+            const latlng = this.fleetLayer.getLatLng(deviceId);
+            if (latlng) {
+                L.popup().setLatLng(latlng).setContent(popupContent).openOn(this.map);
+            }
+            return;
+        }
+
         // Find the marker and show popup
         const marker = this.markers.get(deviceId);
         if (marker) {
@@ -339,7 +356,7 @@ class ViewerDashboard extends GPSTrackerDashboard {
     // Cleanup on destroy
     destroy() {
         super.destroy();
-        this.stopAutoRefresh();
+        this.stopPolling();
     }
 }
 
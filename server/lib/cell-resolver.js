@@ -0,0 +1,300 @@
+/*
+ * Cell Resolver
+ * Coarse positions from serving-cell IDs, backed by a local OpenCelliD file
+ *
+ * Devices without a GNSS fix (cold start, tunnels, car parks) send the cell
+ * their modem is camped on (radio, MCC, MNC, LAC/TAC, cell ID) instead of
+ * lat/lng. Here that is looked up in a cell tower CSV in OpenCelliD's
+ * layout (radio,mcc,net,area,cell,unit,lon,lat,range,...), plain or .gz.
+ * A known cell resolves to its position, with accuracy set to the tower's
+ * range. An unknown cell in a known LAC/TAC falls back to the centroid of
+ * that area, with accuracy set to the area's radius. Anything else does
+ * not resolve.
+ *
+ * The whole world is tens of millions of rows, so mccs can limit loading to
+ * the networks a fleet uses. Cells are held in parallel typed arrays sorted
+ * by (mcc, mnc, area, cell) and found by binary search. That costs about 25
+ * bytes a cell, where a Map of objects would cost several hundred. Cell IDs
+ * beyond 28 bits (5G NR) are skipped. Lookups before load() finishes return
+ * null.
+ */
+
+const fs = require('fs');
+const zlib = require('zlib');
+const readline = require('readline');
+const { haversine } = require('./geo');
+
+const RADIOS = { GSM: 1, UMTS: 2, LTE: 3, CDMA: 4 };
+const MAX_AREA = 0xffff;
+const MAX_CELL = 0x0fffffff;
+
+// mcc/mnc/area in one number (36 bits), cell ID alongside it
+function networkKey(mcc, mnc, area) {
+    return ((mcc * 1000 + mnc) * (MAX_AREA + 1)) + area;
+}
+
+class CellResolver {
+    constructor(options = {}) {
+        this.options = {
+            file: '',
+            mccs: [], // empty: load every network
+            defaultRange: 1000, // metres, for rows without a range
+            minAccuracy: 100, // metres; no cell position is better than this
+            ...options
+        };
+
+        this.count = 0;
+        this.high = new Float64Array(0); // networkKey
+        this.low = new Uint32Array(0); // cell ID
+        this.lat = new Float32Array(0);
+        this.lng = new Float32Array(0);
+        this.range = new Uint32Array(0);
+        this.radio = new Uint8Array(0);
+        this.areas = new Map(); // networkKey -> { lat, lng, range }
+        this.ready = false;
+
+        this.stats = { cells: 0, areas: 0, skipped: 0, loadMs: 0, resolved: 0, areaFallbacks: 0, unknown: 0 };
+    }
+
+    // Stream the file into sorted arrays; resolve() answers null until this settles
+    async load() {
+        const started = Date.now();
+        const mccs = new Set(this.options.mccs);
+        let input = fs.createReadStream(this.options.file);
+        if (this.options.file.endsWith('.gz')) {
+            input = input.pipe(zlib.createGunzip());
+        }
+
+        const columns = new Growable();
+        const sums = new Map(); // networkKey -> [latSum, lngSum, count]
+        const lines = readline.createInterface({ input, crlfDelay: Infinity });
+        let header = true;
+
+        for await (const line of lines) {
+            if (header) {
+                header = false;
+                if (!/^\d/.test(line.split(',')[1])) {
+                    continue; // column names
+                }
+            }
+            const fields = line.split(',');
+            const mcc = parseInt(fields[1]);
+            const mnc = parseInt(fields[2]);
+            const area = parseInt(fields[3]);
+            const cell = parseInt(fields[4]);
+            const lng = parseFloat(fields[6]);
+            const lat = parseFloat(fields[7]);
+            if (mccs.size > 0 && !mccs.has(mcc)) {
+                continue;
+            }
+            if (!(area >= 0 && area <= MAX_AREA && cell >= 0 && cell <= MAX_CELL && mnc >= 0 && mnc < 1000) ||
+                !Number.isFinite(lat) || !Number.isFinite(lng)) {
+                this.stats.skipped++;
+                continue;
+            }
+
+            const key = networkKey(mcc, mnc, area);
+            columns.push(key, cell, lat, lng, parseInt(fields[8]) || this.options.defaultRange, RADIOS[fields[0]] || 0);
+
+            const sum = sums.get(key);
+            if (sum) {
+                sum[0] += lat;
+                sum[1] += lng;
+                sum[2]++;
+            } else {
+                sums.set(key, [lat, lng, 1]);
+            }
+        }
+
+        this.index(columns, sums);
+        this.stats.loadMs = Date.now() - started;
+        this.ready = true;
+        return this.stats.cells;
+    }
+
+    // Sort the columns by (networkKey, cell) and work out each area's extent
+    index(columns, sums) {
+        const n = columns.count;
+        const order = new Uint32Array(n);
+        for (let i = 0; i < n; i++) {
+            order[i] = i;
+        }
+        order.sort((a, b) => (columns.high[a] - columns.high[b]) || (columns.low[a] - columns.low[b]));
+
+        this.count = n;
+        this.high = new Float64Array(n);
+        this.low = new Uint32Array(n);
+        this.lat = new Float32Array(n);
+        this.lng = new Float32Array(n);
+        this.range = new Uint32Array(n);
+        this.radio = new Uint8Array(n);
+        for (let i = 0; i < n; i++) {
+            const from = order[i];
+            this.high[i] = columns.high[from];
+            this.low[i] = columns.low[from];
+            this.lat[i] = columns.lat[from];
+            this.lng[i] = columns.lng[from];
+            this.range[i] = columns.range[from];
+            this.radio[i] = columns.radio[from];
+        }
+
+        // Area radius: farthest cell from the centroid plus that cell's own range
+        this.areas = new Map();
+        for (const [key, [latSum, lngSum, count]] of sums) {
+            this.areas.set(key, { lat: latSum / count, lng: lngSum / count, range: 0 });
+        }
+        for (let i = 0; i < n; i++) {
+            const area = this.areas.get(this.high[i]);
+            const reach = haversine(area.lat, area.lng, this.lat[i], this.lng[i]) + this.range[i];
+            area.range = Math.max(area.range, reach);
+        }
+
+        this.stats.cells = n;
+        this.stats.areas = this.areas.size;
+    }
+
+    // First index whose (high, low) is not below the given key
+    lowerBound(high, low) {
+        let lo = 0;
+        let hi = this.count;
+        while (lo < hi) {
+            const mid = (lo + hi) >>> 1;
+            if (this.high[mid] < high || (this.high[mid] === high && this.low[mid] < low)) {
+                lo = mid + 1;
+            } else {
+                hi = mid;
+            }
+        }
+        return lo;
+    }
+
+    // Index of the cell, preferring a row for the same radio; -1 if unknown
+    find(radio, high, low) {
+        let i = this.lowerBound(high, low);
+        let found = -1;
+        for (; i < this.count && this.high[i] === high && this.low[i] === low; i++) {
+            if (found < 0 || this.radio[i] === radio) {
+                found = i;
+            }
+        }
+        return found;
+    }
+
+    // cells: [{ radio, mcc, mnc, area, cid, sig }], serving cell first; sig in dBm.
+    // Returns { lat, lng, accuracy (m), match: 'cell' | 'area' } or null.
+    resolve(cells) {
+        if (!this.ready || !Array.isArray(cells) || cells.length === 0) {
+            this.stats.unknown++;
+            return null;
+        }
+
+        // Known cells, weighted by signal so the strongest pulls hardest
+        let weightSum = 0;
+        let lat = 0;
+        let lng = 0;
+        const found = [];
+        for (const cell of cells.slice(0, 8)) {
+            const query = parseCell(cell);
+            if (!query) {
+                continue;
+            }
+            const i = this.find(query.radio, query.high, query.cid);
+            if (i < 0) {
+                continue;
+            }
+            const weight = Number.isFinite(query.sig) ? Math.pow(10, (query.sig + 120) / 20) : 1;
+            weightSum += weight;
+            lat += this.lat[i] * weight;
+            lng += this.lng[i] * weight;
+            found.push(i);
+        }
+
+        if (found.length > 0) {
+            lat /= weightSum;
+            lng /= weightSum;
+            let accuracy = Infinity;
+            let spread = 0;
+            for (const i of found) {
+                accuracy = Math.min(accuracy, this.range[i]);
+                spread = Math.max(spread, haversine(lat, lng, this.lat[i], this.lng[i]));
+            }
+            this.stats.resolved++;
+            return { lat, lng, accuracy: Math.round(Math.max(accuracy, spread, this.options.minAccuracy)), match: 'cell' };
+        }
+
+        // Unknown tower in a known area: the area's centroid
+        const serving = parseCell(cells[0]);
+        const area = serving ? this.areas.get(serving.high) : null;
+        if (area) {
+            this.stats.areaFallbacks++;
+            return { lat: area.lat, lng: area.lng, accuracy: Math.round(Math.max(area.range, this.options.minAccuracy)), match: 'area' };
+        }
+
+        this.stats.unknown++;
+        return null;
+    }
+
+    getStats() {
+        return { ...this.stats, ready: this.ready, file: this.options.file };
+    }
+}
+
+// Device cell report -> lookup key; null when a field is missing or out of range
+function parseCell(cell) {
+    if (!cell || typeof cell !== 'object') {
+        return null;
+    }
+    const mcc = parseInt(cell.mcc);
+    const mnc = parseInt(cell.mnc);
+    const area = parseInt(cell.area);
+    const cid = parseInt(cell.cid);
+    if (!(mcc >= 0 && mcc < 1000 && mnc >= 0 && mnc < 1000 && area >= 0 && area <= MAX_AREA && cid >= 0 && cid <= MAX_CELL)) {
+        return null;
+    }
+    const radio = String(cell.radio || '').toUpperCase();
+    return {
+        radio: RADIOS[radio === 'WCDMA' ? 'UMTS' : radio] || 0,
+        high: networkKey(mcc, mnc, area),
+        cid,
+        sig: parseFloat(cell.sig)
+    };
+}
+
+// Typed columns that double in size as rows arrive
+class Growable {
+    constructor() {
+        this.count = 0;
+        this.allocate(65536);
+    }
+
+    allocate(size) {
+        const grow = (Type, old) => {
+            const array = new Type(size);
+            if (old) {
+                array.set(old.subarray(0, this.count));
+            }
+            return array;
+        };
+        this.high = grow(Float64Array, this.high);
+        this.low = grow(Uint32Array, this.low);
+        this.lat = grow(Float32Array, this.lat);
+        this.lng = grow(Float32Array, this.lng);
+        this.range = grow(Uint32Array, this.range);
+        this.radio = grow(Uint8Array, this.radio);
+    }
+
+    push(high, low, lat, lng, range, radio) {
+        if (this.count === this.high.length) {
+            this.allocate(this.count * 2);
+        }
+        const i = this.count++;
+        this.high[i] = high;
+        this.low[i] = low;
+        this.lat[i] = lat;
+        this.lng[i] = lng;
+        this.range[i] = range;
+        this.radio[i] = radio;
+    }
+}
+
+module.exports = CellResolver;
@@ -0,0 +1,175 @@
+/*
+ * Cluster Bus
+ * Cross-worker pub/sub over a localhost TCP hub
+ *
+ * PM2 cluster mode runs one server process per core, each with its own
+ * devicePositions map and WebSocket clients. Every worker tries to listen on
+ * the bus port: the one that succeeds becomes the hub and relays each message
+ * to every other connected worker, the rest connect to it. If the hub exits,
+ * the remaining workers race to take over. Messages are newline-delimited
+ * JSON; anything published while no hub is reachable is dropped, which is
+ * acceptable for live-view fan-out.
+ */
+
+const net = require('net');
+const EventEmitter = require('events');
+
+class ClusterBus extends EventEmitter {
+    constructor(options = {}) {
+        super();
+        this.options = {
+            host: '127.0.0.1',
+            port: 3900,
+            retryMs: 500,
+            ...options
+        };
+
+        this.hub = null; // net.Server when this worker is the hub
+        this.peers = new Set(); // sockets connected to our hub
+        this.upstream = null; // socket to the hub when we are a peer
+        this.closed = false;
+        this.retryTimer = null;
+
+        this.stats = { published: 0, received: 0, dropped: 0 };
+    }
+
+    start() {
+        if (this.closed) return;
+
+        const hub = net.createServer(socket => this.addPeer(socket));
+
+        hub.once('error', (error) => {
+            if (error.code === 'EADDRINUSE') {
+                this.connect();
+            } else {
+                this.emit('error', error);
+                this.scheduleRetry();
+            }
+        });
+
+        // exclusive: under the cluster module a plain listen() shares one handle
+        // across workers, so none would see EADDRINUSE and every one would be a hub
+        hub.listen({ port: this.options.port, host: this.options.host, exclusive: true }, () => {
+            this.hub = hub;
+            hub.on('error', error => this.emit('error', error));
+            this.emit('role', 'hub');
+        });
+    }
+
+    connect() {
+        const socket = net.createConnection(this.options.port, this.options.host);
+        socket.setNoDelay(true);
+
+        socket.on('connect', () => {
+            this.upstream = socket;
+            this.emit('role', 'peer');
+        });
+
+        this.readMessages(socket, (line) => this.deliver(line));
+
+        socket.on('error', () => {}); // 'close' follows and drives the retry
+        socket.on('close', () => {
+            if (this.upstream === socket) {
+                this.upstream = null;
+            }
+            this.scheduleRetry();
+        });
+    }
+
+    addPeer(socket) {
+        socket.setNoDelay(true);
+        this.peers.add(socket);
+
+        // Relay to every other worker, then handle locally
+        this.readMessages(socket, (line) => {
+            this.relay(line + '\n', socket);
+            this.deliver(line);
+        });
+
+        socket.on('error', () => {});
+        socket.on('close', () => this.peers.delete(socket));
+    }
+
+    readMessages(socket, onLine) {
+        let buffered = '';
+        socket.setEncoding('utf8');
+        socket.on('data', (chunk) => {
+            buffered += chunk;
+            let newline;
+            while ((newline = buffered.indexOf('\n')) >= 0) {
+                const line = buffered.slice(0, newline);
+                buffered = buffered.slice(newline + 1);
+                if (line.length > 0) {
+                    onLine(line);
+                }
+            }
+        });
+    }
+
+    relay(frame, except) {
+        this.peers.forEach((peer) => {
+            if (peer !== except && !peer.destroyed) {
+                peer.write(frame);
+            }
+        });
+    }
+
+    deliver(line) {
+        try {
+            const { type, payload } = JSON.parse(line);
+            this.stats.received++;
+            this.emit(type, payload);
+        } catch (error) {
+            this.emit('error', error);
+        }
+    }
+
+    // Send to every other worker (never delivered back to this one)
+    publish(type, payload) {
+        const frame = JSON.stringify({ type, payload }) + '\n';
+
+        if (this.hub) {
+            this.relay(frame, null);
+        } else if (this.upstream && !this.upstream.destroyed) {
+            this.upstream.write(frame);
+        } else {
+            this.stats.dropped++;
+            return;
+        }
+        this.stats.published++;
+    }
+
+    scheduleRetry() {
+        if (this.closed || this.retryTimer) return;
+
+        // Jitter so surviving workers do not all race for the port at once
+        const delay = this.options.retryMs * (0.5 + Math.random());
+        this.retryTimer = setTimeout(() => {
+            this.retryTimer = null;
+            this.start();
+        }, delay);
+    }
+
+    close() {
+        this.closed = true;
+        clearTimeout(this.retryTimer);
+
+        if (this.upstream) {
+            this.upstream.destroy();
+        }
+        this.peers.forEach(peer => peer.destroy());
+        if (this.hub) {
+            this.hub.close();
+        }
+    }
+
+    getStats() {
+        return {
+            ...this.stats,
+            role: this.hub ? 'hub' : (this.upstream ? 'peer' : 'disconnected'),
+            peers: this.peers.size
+        };
+    }
+}
+
+module.exports = ClusterBus;
@@ -0,0 +1,140 @@
+/*
+ * Dedup Window
+ * Per-device sliding window of recently seen sequence numbers
+ *
+ * Firmware numbers every fix with a per-device sequence that survives
+ * reboots. Offline replay and MQTT retransmits resend a fix with the same
+ * seq. Each device keeps the highest seq seen and a bitmap of the windowSize
+ * seqs below it, so a repeat is caught in memory with no database read.
+ * A seq older than the window cannot be judged here and is reported as
+ * 'stale'; the positions (device_id, seq, timestamp) unique key decides.
+ * The same applies after a restart, or when the repeat reached another
+ * worker first and the cluster bus has not passed it on yet.
+ *
+ * check() only looks; mark() records. A fix is marked once it is stored
+ * (here, or on another worker which then says so over the cluster bus), so
+ * one the ingest queue refused can be retried with the same seq. Two copies
+ * racing through before the first is stored both pass, and the unique key
+ * drops the second.
+ */
+
+class DedupWindow {
+    constructor(options = {}) {
+        this.options = {
+            windowSize: 1024, // seqs per device, a multiple of 32 (128 bytes each)
+            maxDevices: 100000,
+            ...options
+        };
+        this.words = this.options.windowSize / 32;
+
+        this.devices = new Map(); // device_id -> { high, bits }; Map order = least recently used first
+        this.stats = { checked: 0, duplicates: 0, stale: 0, resets: 0, storedDuplicates: 0 };
+    }
+
+    /*
+     * Look seq up for device_id without recording it. Returns 'new',
+     * 'duplicate' (seen within the window) or 'stale' (older than the window;
+     * let the unique key decide).
+     */
+    check(device_id, seq) {
+        this.stats.checked++;
+        const result = this.classify(device_id, seq);
+        if (result === 'duplicate') {
+            this.stats.duplicates++;
+        } else if (result === 'stale') {
+            this.stats.stale++;
+        }
+        return result;
+    }
+
+    classify(device_id, seq) {
+        const state = this.devices.get(device_id);
+        if (!state || seq > state.high) {
+            return 'new';
+        }
+        const offset = state.high - seq;
+        if (offset >= this.options.windowSize) {
+            return 'stale';
+        }
+        return state.bits[offset >>> 5] & (1 << (offset & 31)) ? 'duplicate' : 'new';
+    }
+
+    // Record seq as seen (stored here or on another worker); returns what check() would have
+    mark(device_id, seq) {
+        let state = this.devices.get(device_id);
+        if (state) {
+            this.devices.delete(device_id);
+        } else {
+            state = { high: -1, bits: new Uint32Array(this.words) };
+            if (this.devices.size >= this.options.maxDevices) {
+                this.devices.delete(this.devices.keys().next().value);
+            }
+        }
+        this.devices.set(device_id, state);
+
+        if (seq > state.high) {
+            this.advance(state, seq);
+            return 'new';
+        }
+
+        const offset = state.high - seq;
+        if (offset >= this.options.windowSize) {
+            // Far below the window: firmware whose sequence was reset starts over here
+            if (state.high - seq > this.options.windowSize * 64) {
+                this.stats.resets++;
+                state.high = -1;
+                state.bits.fill(0);
+                this.advance(state, seq);
+            }
+            return 'stale';
+        }
+
+        const word = offset >>> 5;
+        const bit = 1 << (offset & 31);
+        if (state.bits[word] & bit) {
+            return 'duplicate';
+        }
+        state.bits[word] |= bit;
+        return 'new';
+    }
+
+    // Slide the window up to seq; bit i means high - i was seen
+    advance(state, seq) {
+        const shift = state.high < 0 ? this.options.windowSize : seq - state.high;
+        const bits = state.bits;
+
+        if (shift >= this.options.windowSize) {
+            bits.fill(0);
+        } else {
+            const wordShift = shift >>> 5;
+            const bitShift = shift & 31;
+            for (let i = this.words - 1; i >= 0; i--) {
+                const from = i - wordShift;
+                let value = from >= 0 ? bits[from] << bitShift : 0;
+                if (bitShift > 0 && from - 1 >= 0) {
+                    value |= bits[from - 1] >>> (32 - bitShift);
+                }
+                bits[i] = value;
+            }
+        }
+
+        bits[0] |= 1;
+        state.high = seq;
+    }
+
+    // Duplicates the window let through and the unique key rejected
+    countStoredDuplicates(count) {
+        this.stats.storedDuplicates += count;
+    }
+
+    getStats() {
+        const caught = this.stats.duplicates + this.stats.storedDuplicates;
+        return {
+            ...this.stats,
+            devices: this.devices.size,
+            duplicateRate: this.stats.checked > 0 ? caught / this.stats.checked : 0
+        };
+    }
+}
+
+module.exports = DedupWindow;
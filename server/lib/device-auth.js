@@ -0,0 +1,170 @@
+/*
+ * Device Auth
+ * Per-device tokens with an in-memory cache of verified credentials
+ *
+ * Each device has its own random token. The device_credentials table stores
+ * only HMAC-SHA256(secret, token). Tokens are 192 random bits, so a keyed
+ * hash is enough and bcrypt's deliberate slowness would only cost CPU on
+ * every fix. A leaked table is useless without the secret.
+ *
+ * Checking a device loads its row once and caches it in an LRU. The cache
+ * also keeps the token that last passed, so in the steady state a fix costs
+ * one Map lookup and one constant-time compare: no query and no hash. A
+ * wrong token costs an HMAC but still no query. Devices without a row are
+ * cached as unknown for negativeTtlMs so bad credentials cannot hammer the
+ * database. issue() and revoke() drop the device from the cache. The server
+ * relays those changes to the other workers over the cluster bus. Entries
+ * also expire after ttlMs, which picks up rows edited directly in MySQL.
+ *
+ * While sharedToken is set, a device without a row of its own may still
+ * authenticate with it (the single DEVICE_TOKEN every device used before).
+ * This lets a fleet move to per-device tokens one device at a time.
+ */
+
+const crypto = require('crypto');
+
+class DeviceAuth {
+    constructor(db, options = {}) {
+        this.db = db;
+        this.options = {
+            secret: '',
+            sharedToken: null,
+            cacheSize: 100000,
+            ttlMs: 300000,
+            negativeTtlMs: 30000,
+            ...options
+        };
+
+        this.sharedToken = this.options.sharedToken ? Buffer.from(this.options.sharedToken) : null;
+        this.cache = new Map(); // device_id -> { hash, verified, expiresAt }; Map order = least recently used first
+        this.loading = new Map(); // device_id -> pending row lookup
+
+        this.stats = { hits: 0, misses: 0, verified: 0, rejected: 0, shared: 0, invalidations: 0 };
+    }
+
+    hash(token) {
+        return crypto.createHmac('sha256', this.options.secret).update(token).digest();
+    }
+
+    // Resolves true when token is device_id's credential
+    async verify(device_id, token) {
+        if (typeof device_id !== 'string' || !device_id || typeof token !== 'string' || !token) {
+            this.stats.rejected++;
+            return false;
+        }
+
+        const presented = Buffer.from(token);
+        let entry = this.cache.get(device_id);
+        if (entry && entry.expiresAt > Date.now()) {
+            this.stats.hits++;
+            this.cache.delete(device_id);
+            this.cache.set(device_id, entry);
+        } else {
+            this.stats.misses++;
+            entry = await this.load(device_id);
+        }
+
+        if (entry.verified && equal(entry.verified, presented)) {
+            this.stats.verified++;
+            return true;
+        }
+
+        if (entry.hash) {
+            if (equal(entry.hash, this.hash(presented))) {
+                entry.verified = presented;
+                this.stats.verified++;
+                return true;
+            }
+        } else if (this.sharedToken && equal(this.sharedToken, presented)) {
+            this.stats.shared++;
+            return true;
+        }
+
+        this.stats.rejected++;
+        return false;
+    }
+
+    // One query per device however many fixes arrive while it runs
+    load(device_id) {
+        let pending = this.loading.get(device_id);
+        if (!pending) {
+            pending = (async() => {
+                try {
+                    const [rows] = await this.db.execute(
+                        'SELECT token_hash FROM device_credentials WHERE device_id = ?', [device_id]
+                    );
+                    const hash = rows.length > 0 ? Buffer.from(rows[0].token_hash) : null;
+                    const entry = {
+                        hash,
+                        verified: null,
+                        expiresAt: Date.now() + (hash ? this.options.ttlMs : this.options.negativeTtlMs)
+                    };
+                    // Not cached if invalidate() ran while the query was out
+                    if (this.loading.get(device_id) === pending) {
+                        this.remember(device_id, entry);
+                    }
+                    return entry;
+                } finally {
+                    if (this.loading.get(device_id) === pending) {
+                        this.loading.delete(device_id);
+                    }
+                }
+            })();
+            this.loading.set(device_id, pending);
+        }
+        return pending;
+    }
+
+    remember(device_id, entry) {
+        this.cache.delete(device_id);
+        if (this.cache.size >= this.options.cacheSize) {
+            this.cache.delete(this.cache.keys().next().value);
+        }
+        this.cache.set(device_id, entry);
+    }
+
+    // Create or rotate device_id's token; the plain token is only returned here
+    async issue(device_id) {
+        const token = crypto.randomBytes(24).toString('base64url');
+        await this.db.execute(
+            `INSERT INTO device_credentials (device_id, token_hash) VALUES (?, ?)
+             ON DUPLICATE KEY UPDATE token_hash = VALUES(token_hash)`,
+            [device_id, this.hash(token)]
+        );
+        this.invalidate(device_id);
+        return token;
+    }
+
+    // Returns false when device_id had no token of its own
+    async revoke(device_id) {
+        const [result] = await this.db.execute('DELETE FROM device_credentials WHERE device_id = ?', [device_id]);
+        this.invalidate(device_id);
+        return result.affectedRows > 0;
+    }
+
+    // Forget device_id's cached credential (after a change here or on another worker)
+    invalidate(device_id) {
+        this.stats.invalidations++;
+        this.cache.delete(device_id);
+        this.loading.delete(device_id);
+    }
+
+    clear() {
+        this.cache.clear();
+        this.loading.clear();
+    }
+
+    getStats() {
+        return {
+            ...this.stats,
+            cached: this.cache.size,
+            sharedToken: this.sharedToken !== null
+        };
+    }
+}
+
+function equal(a, b) {
+    return a.length === b.length && crypto.timingSafeEqual(a, b);
+}
+
+module.exports = DeviceAuth;
@@ -0,0 +1,129 @@
+/*
+ * Device Stats Aggregator
+ * Incremental daily statistics for the device_stats table
+ *
+ * Replaces the update_device_stats trigger, which re-counted the whole day of
+ * positions on every insert. Each ingest batch is folded into one row per
+ * (device, day) carrying deltas: fix count, max speed, haversine distance from
+ * the previous fix and time spent online (gaps no longer than the online
+ * window). The previous fix per device is kept in memory and seeded from
+ * device_latest at boot, so segments continue across restarts. Cell fixes
+ * (those with an accuracy) count as fixes and online time but are too coarse
+ * to measure distance with, so segments run between GNSS fixes only.
+ */
+
+const { haversine } = require('./geo');
+
+class DeviceStatsAggregator {
+    constructor(options = {}) {
+        this.options = {
+            onlineWindowMs: 60000,
+            ...options
+        };
+
+        this.previous = new Map(); // device_id -> { lat, lng, timestamp, onlineRemainderMs }
+    }
+
+    // Track a fix counted by another worker so the next local segment starts from it
+    observe(position) {
+        const previous = this.previous.get(position.device_id);
+        if (!previous) {
+            this.previous.set(position.device_id, start(position));
+        } else if (position.timestamp > previous.timestamp) {
+            move(previous, position);
+        }
+    }
+
+    // Fold a batch of positions into device_stats delta rows:
+    // [device_id, date, total_positions, max_speed, total_distance (m), online_time (s)]
+    aggregate(positions) {
+        const buckets = new Map();
+
+        for (const position of positions) {
+            const date = formatDate(position.timestamp);
+            const key = `${position.device_id}|${date}`;
+
+            let bucket = buckets.get(key);
+            if (!bucket) {
+                bucket = { device_id: position.device_id, date, count: 0, maxSpeed: 0, distance: 0, onlineMs: 0 };
+                buckets.set(key, bucket);
+            }
+
+            bucket.count++;
+            bucket.maxSpeed = Math.max(bucket.maxSpeed, position.speed || 0);
+
+            const previous = this.previous.get(position.device_id);
+            if (!previous) {
+                this.previous.set(position.device_id, start(position));
+                continue;
+            }
+
+            // Late (out-of-order) fixes are counted but do not extend the track
+            if (position.timestamp <= previous.timestamp) {
+                continue;
+            }
+
+            if (previous.lat !== null && !position.accuracy) {
+                bucket.distance += haversine(previous.lat, previous.lng, position.lat, position.lng);
+            }
+
+            const gap = position.timestamp - previous.timestamp;
+            if (gap <= this.options.onlineWindowMs) {
+                bucket.onlineMs += gap;
+            }
+
+            move(previous, position);
+        }
+
+        // Whole seconds go to the row, the sub-second remainder carries over
+        const rows = [];
+        for (const bucket of buckets.values()) {
+            const previous = this.previous.get(bucket.device_id);
+            const onlineMs = bucket.onlineMs + previous.onlineRemainderMs;
+            const onlineSeconds = Math.floor(onlineMs / 1000);
+            previous.onlineRemainderMs = onlineMs - onlineSeconds * 1000;
+
+            rows.push([
+                bucket.device_id,
+                bucket.date,
+                bucket.count,
+                bucket.maxSpeed,
+                Math.round(bucket.distance * 100) / 100,
+                onlineSeconds
+            ]);
+        }
+
+        // Stable lock order keeps concurrent batches from deadlocking each other
+        rows.sort((a, b) => (a[0] < b[0] ? -1 : a[0] > b[0] ? 1 : a[1] < b[1] ? -1 : a[1] > b[1] ? 1 : 0));
+        return rows;
+    }
+}
+
+// A cell fix starts the clock but not the track (lat null until a GNSS fix)
+function start(position) {
+    const coarse = Boolean(position.accuracy);
+    return {
+        lat: coarse ? null : position.lat,
+        lng: coarse ? null : position.lng,
+        timestamp: position.timestamp,
+        onlineRemainderMs: 0
+    };
+}
+
+function move(previous, position) {
+    if (!position.accuracy) {
+        previous.lat = position.lat;
+        previous.lng = position.lng;
+    }
+    previous.timestamp = position.timestamp;
+}
+
+// Local calendar day, matching DATE(FROM_UNIXTIME(timestamp / 1000)) in the server time zone
+function formatDate(timestamp) {
+    const date = new Date(timestamp);
+    const month = String(date.getMonth() + 1).padStart(2, '0');
+    const day = String(date.getDate()).padStart(2, '0');
+    return `${date.getFullYear()}-${month}-${day}`;
+}
+
+module.exports = DeviceStatsAggregator;
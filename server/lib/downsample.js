@@ -0,0 +1,112 @@
+/*
+ * Track Downsampler
+ * Streaming Largest-Triangle-Three-Buckets over time buckets
+ *
+ * Reduces a time-ordered track to roughly a target number of points while
+ * keeping its shape. The range [first, last] is cut into equal time buckets;
+ * from each bucket the point forming the largest triangle with the previously
+ * kept point and the centroid of the next non-empty bucket is kept. Buckets
+ * are fixed by time rather than by row count so rows can be fed straight from
+ * a query stream: only two buckets are held in memory at once. Triangle areas
+ * are taken on lng/lat scaled by cos(lat), which is enough to rank candidates.
+ */
+
+class TrackDownsampler {
+    // first/last: timestamps bounding the input; emit(point) receives the output in order
+    constructor({ first, last, points }, emit) {
+        this.first = first;
+        this.span = Math.max(1, last - first);
+        this.buckets = Math.max(1, points - 2); // first and last point are always kept
+        this.emit = emit;
+
+        this.anchor = null; // last kept point
+        this.current = null; // complete bucket waiting for the next centroid
+        this.filling = null; // bucket receiving points
+        this.lastPoint = null;
+        this.kept = 0;
+    }
+
+    bucketOf(timestamp) {
+        const index = Math.floor(((timestamp - this.first) / this.span) * this.buckets);
+        return Math.min(this.buckets - 1, Math.max(0, index));
+    }
+
+    push(point) {
+        this.lastPoint = point;
+
+        if (!this.anchor) {
+            this.keep(point);
+            return;
+        }
+
+        const index = this.bucketOf(point.timestamp);
+        if (this.filling && this.filling.index === index) {
+            this.filling.points.push(point);
+            return;
+        }
+
+        if (this.filling) {
+            if (this.current) {
+                this.select(this.current, centroid(this.filling.points));
+            }
+            this.current = this.filling;
+        }
+        this.filling = { index, points: [point] };
+    }
+
+    finish() {
+        const last = this.lastPoint;
+        if (!last || last === this.anchor) {
+            return this.kept;
+        }
+
+        // The final point is kept as-is, so it is no candidate of its bucket
+        this.filling.points.pop();
+
+        if (this.current) {
+            this.select(this.current, this.filling.points.length > 0 ? centroid(this.filling.points) : last);
+        }
+        if (this.filling.points.length > 0) {
+            this.select(this.filling, last);
+        }
+        this.keep(last);
+        return this.kept;
+    }
+
+    select(bucket, next) {
+        const a = this.anchor;
+        const scale = Math.cos(a.lat * Math.PI / 180);
+        let best = bucket.points[0];
+        let bestArea = -1;
+
+        for (const point of bucket.points) {
+            const area = Math.abs(
+                (a.lng - next.lng) * scale * (point.lat - a.lat) -
+                (a.lng - point.lng) * scale * (next.lat - a.lat)
+            );
+            if (area > bestArea) {
+                bestArea = area;
+                best = point;
+            }
+        }
+        this.keep(best);
+    }
+
+    keep(point) {
+        this.anchor = point;
+        this.kept++;
+        this.emit(point);
+    }
+}
+
+function centroid(points) {
+    let lat = 0;
+    let lng = 0;
+    for (const point of points) {
+        lat += point.lat;
+        lng += point.lng;
+    }
+    return { lat: lat / points.length, lng: lng / points.length };
+}
+
+module.exports = TrackDownsampler;
@@ -0,0 +1,168 @@
+/*
+ * Geo helpers shared by the ingest pipeline and query endpoints
+ */
+
+const EARTH_RADIUS_M = 6371008.8;
+
+function toRadians(degrees) {
+    return degrees * Math.PI / 180;
+}
+
+// Great-circle distance in meters
+function haversine(lat1, lng1, lat2, lng2) {
+    const dLat = toRadians(lat2 - lat1);
+    const dLng = toRadians(lng2 - lng1);
+    const a = Math.sin(dLat / 2) ** 2 +
+        Math.cos(toRadians(lat1)) * Math.cos(toRadians(lat2)) * Math.sin(dLng / 2) ** 2;
+
+    return 2 * EARTH_RADIUS_M * Math.asin(Math.min(1, Math.sqrt(a)));
+}
+
+/*
+ * Spatial cells: the lat/lng plane split into a 2^24 x 2^24 grid (about
+ * 2.4 x 1.2 m at the equator), numbered along a Z-order (Morton) curve.
+ * Every quadtree node above the grid is then one contiguous range of cell
+ * numbers. A bounding box becomes a handful of ranges on an ordinary
+ * (cell, timestamp) B-tree index; partitioned tables cannot have a SPATIAL
+ * index.
+ */
+const CELL_LEVEL = 24;
+const CELL_GRID = 2 ** CELL_LEVEL;
+
+// Spread the low 12 bits of n to the even bit positions
+function spreadBits(n) {
+    n &= 0x00000fff;
+    n = (n | (n << 8)) & 0x00ff00ff;
+    n = (n | (n << 4)) & 0x0f0f0f0f;
+    n = (n | (n << 2)) & 0x33333333;
+    n = (n | (n << 1)) & 0x55555555;
+    return n;
+}
+
+// Morton code of grid coordinates below 2^24, as a number below 2^48
+function interleave(x, y) {
+    const low = (spreadBits(x) | (spreadBits(y) << 1)) >>> 0;
+    const high = (spreadBits(Math.floor(x / 4096)) | (spreadBits(Math.floor(y / 4096)) << 1)) >>> 0;
+    return high * 16777216 + low;
+}
+
+function gridX(lng) {
+    return Math.min(CELL_GRID - 1, Math.max(0, Math.floor((lng + 180) / 360 * CELL_GRID)));
+}
+
+function gridY(lat) {
+    return Math.min(CELL_GRID - 1, Math.max(0, Math.floor((lat + 90) / 180 * CELL_GRID)));
+}
+
+function cellId(lat, lng) {
+    return interleave(gridX(lng), gridY(lat));
+}
+
+/*
+ * Cell number ranges ([first, last], inclusive) covering bbox
+ * [west, south, east, north]. The quadtree is refined level by level while
+ * the range count stays within maxRanges, so the cover may include some
+ * area outside the box; callers still filter on lat/lng.
+ */
+function cellRanges(bbox, maxRanges = 64) {
+    const [west, south, east, north] = bbox;
+    if (west > east) {
+        // Crosses the antimeridian
+        return mergeRanges([
+            ...cellRanges([west, south, 180, north], Math.ceil(maxRanges / 2)),
+            ...cellRanges([-180, south, east, north], Math.ceil(maxRanges / 2))
+        ]);
+    }
+
+    const x0 = gridX(west);
+    const x1 = gridX(east);
+    const y0 = gridY(south);
+    const y1 = gridY(north);
+
+    const ranges = [];
+    let frontier = [{ level: 0, x: 0, y: 0 }];
+
+    while (frontier.length > 0) {
+        const partial = [];
+        frontier.forEach((node) => {
+            const size = 2 ** (CELL_LEVEL - node.level);
+            const nx0 = node.x * size;
+            const ny0 = node.y * size;
+            const nx1 = nx0 + size - 1;
+            const ny1 = ny0 + size - 1;
+
+            if (nx1 < x0 || nx0 > x1 || ny1 < y0 || ny0 > y1) {
+                return;
+            }
+            if ((nx0 >= x0 && nx1 <= x1 && ny0 >= y0 && ny1 <= y1) || node.level === CELL_LEVEL) {
+                ranges.push(nodeRange(node));
+            } else {
+                partial.push(node);
+            }
+        });
+
+        // Stop refining once the children would take the cover past the budget
+        const children = [];
+        partial.forEach((node) => {
+            for (let i = 0; i < 4; i++) {
+                const child = { level: node.level + 1, x: node.x * 2 + (i & 1), y: node.y * 2 + (i >> 1) };
+                const size = 2 ** (CELL_LEVEL - child.level);
+                if (child.x * size <= x1 && (child.x + 1) * size > x0 && child.y * size <= y1 && (child.y + 1) * size > y0) {
+                    children.push(child);
+                }
+            }
+        });
+        if (ranges.length + children.length > maxRanges) {
+            partial.forEach(node => ranges.push(nodeRange(node)));
+            break;
+        }
+        frontier = children;
+    }
+
+    return mergeRanges(ranges);
+}
+
+function nodeRange(node) {
+    const span = 4 ** (CELL_LEVEL - node.level);
+    const first = interleave(node.x, node.y) * span;
+    return [first, first + span - 1];
+}
+
+function mergeRanges(ranges) {
+    ranges.sort((a, b) => a[0] - b[0]);
+    const merged = [];
+    ranges.forEach((range) => {
+        const last = merged[merged.length - 1];
+        if (last && range[0] <= last[1] + 1) {
+            last[1] = Math.max(last[1], range[1]);
+        } else {
+            merged.push([range[0], range[1]]);
+        }
+    });
+    return merged;
+}
+
+// [west, south, east, north] enclosing a circle of radius meters (full longitude range near the poles)
+function bboxAround(lat, lng, radius) {
+    const dLat = (radius / EARTH_RADIUS_M) * 180 / Math.PI;
+    const south = Math.max(-90, lat - dLat);
+    const north = Math.min(90, lat + dLat);
+    const cos = Math.cos(toRadians(Math.max(Math.abs(south), Math.abs(north))));
+    const dLng = cos > 0 ? dLat / cos : 360;
+
+    if (dLng >= 180) {
+        return [-180, south, 180, north];
+    }
+    const wrap = value => ((value + 540) % 360) - 180;
+    return [wrap(lng - dLng), south, wrap(lng + dLng), north];
+}
+
+module.exports = {
+    EARTH_RADIUS_M,
+    CELL_LEVEL,
+    toRadians,
+    haversine,
+    cellId,
+    cellRanges,
+    bboxAround
+};
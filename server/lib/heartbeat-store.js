@@ -0,0 +1,226 @@
+/*
+ * Heartbeat Store
+ * Latest device status in memory, sampled history in the heartbeats table
+ *
+ * Devices send a heartbeat every minute over MQTT (heartbeat/<id>) or HTTP
+ * (/api/track with type "heartbeat"). The newest status per device is kept in
+ * memory and answers health queries. A row is only stored when a link or GPS
+ * flag flips, when the device rebooted (its uptime went backwards), or once
+ * per sampleMs as a keepalive. A device that stays healthy therefore costs
+ * one row per sample interval instead of one per minute. Rows are queued and
+ * written as one multi-row INSERT every flushMs. The data column holds only
+ * the extra fields that changed since the device's previous stored row.
+ */
+
+// Link flags reported by the two firmware variants (ESP32 over MQTT, Mega over HTTP)
+const LINK_FIELDS = ['wifi_connected', 'lte_connected', 'mqtt_connected', 'sim800l_ready', 'http_connected'];
+// Numeric extras; these ride along with the next stored row instead of forcing one
+const NUMERIC_FIELDS = ['offline_buffer_count'];
+
+function optionalInt(value) {
+    const number = parseInt(value);
+    return Number.isFinite(number) ? number : null;
+}
+
+// Map either firmware's payload onto the heartbeats columns plus extras
+function normalizeHeartbeat(device_id, data, transport, receivedAt, timestamp) {
+    const links = {};
+    for (const field of LINK_FIELDS) {
+        if (data[field] !== undefined) {
+            links[field] = data[field] === true || data[field] === 'true' || data[field] === 1;
+        }
+    }
+
+    const extra = { ...links };
+    for (const field of NUMERIC_FIELDS) {
+        const value = optionalInt(data[field]);
+        if (value !== null) {
+            extra[field] = value;
+        }
+    }
+
+    // Both firmwares send millis() rather than wall-clock time; keep it as uptime
+    const uptime = Number(data.timestamp);
+
+    return {
+        device_id,
+        transport,
+        timestamp,
+        received_at: receivedAt,
+        uptime_ms: Number.isFinite(uptime) && uptime >= 0 && uptime < timestamp ? uptime : null,
+        gps_valid: data.gps_valid === true || data.gps_valid === 'true',
+        network_connected: Object.values(links).some(Boolean),
+        battery_level: optionalInt(data.battery_level !== undefined ? data.battery_level : data.battery),
+        signal_strength: optionalInt(data.signal_strength !== undefined ? data.signal_strength : data.rssi),
+        free_memory: optionalInt(data.free_heap !== undefined ? data.free_heap : data.free_memory),
+        extra
+    };
+}
+
+class HeartbeatStore {
+    constructor(db, options = {}) {
+        this.db = db;
+        this.options = {
+            sampleMs: 900000,
+            flushMs: 5000,
+            maxPendingRows: 10000,
+            logger: console, // error(msg, fields)
+            ...options
+        };
+        this.logger = this.options.logger;
+
+        this.latest = new Map(); // device_id -> normalized status
+        this.stored = new Map(); // device_id -> last status written to heartbeats
+        this.pending = [];
+        this.timer = null;
+        this.flushing = null;
+
+        this.stats = { received: 0, stored: 0, coalesced: 0, dropped: 0, batches: 0, failedBatches: 0 };
+    }
+
+    start() {
+        if (!this.timer) {
+            this.timer = setInterval(() => this.flush(), this.options.flushMs);
+        }
+    }
+
+    /*
+     * Record a heartbeat ingested by this process. Returns true when it was
+     * queued for the heartbeats table, false when it only updated the latest
+     * status.
+     */
+    record(status) {
+        this.stats.received++;
+        const last = this.latest.get(status.device_id);
+        this.latest.set(status.device_id, status);
+
+        const previous = this.stored.get(status.device_id);
+        const reason = this.storeReason(previous, last, status);
+        if (!reason) {
+            this.stats.coalesced++;
+            return false;
+        }
+
+        if (this.pending.length >= this.options.maxPendingRows) {
+            // The database is behind; the latest status is still served from memory
+            this.stats.dropped++;
+            return false;
+        }
+
+        this.pending.push(this.row(previous, status, reason));
+        this.stored.set(status.device_id, status);
+        return true;
+    }
+
+    // A heartbeat ingested by another worker; stored says whether that worker wrote it
+    observe(status, stored) {
+        const latest = this.latest.get(status.device_id);
+        if (!latest || status.received_at >= latest.received_at) {
+            this.latest.set(status.device_id, status);
+        }
+        if (stored) {
+            this.stored.set(status.device_id, status);
+        }
+    }
+
+    get(device_id) {
+        return this.latest.get(device_id) || null;
+    }
+
+    // previous: last stored status, last: last received status
+    storeReason(previous, last, status) {
+        if (!previous) {
+            return 'first';
+        }
+        if (last && status.uptime_ms !== null && last.uptime_ms !== null && status.uptime_ms < last.uptime_ms) {
+            return 'reboot';
+        }
+        if (status.gps_valid !== previous.gps_valid || status.network_connected !== previous.network_connected ||
+            LINK_FIELDS.some(field => status.extra[field] !== previous.extra[field])) {
+            return 'change';
+        }
+        if (status.received_at - previous.received_at >= this.options.sampleMs) {
+            return 'sample';
+        }
+        return null;
+    }
+
+    row(previous, status, reason) {
+        const changed = {};
+        for (const [field, value] of Object.entries(status.extra)) {
+            if (!previous || previous.extra[field] !== value) {
+                changed[field] = value;
+            }
+        }
+        if (status.uptime_ms !== null) {
+            changed.uptime_ms = status.uptime_ms;
+        }
+        changed.transport = status.transport;
+        changed.reason = reason;
+
+        return [
+            status.device_id,
+            'status',
+            status.timestamp,
+            status.gps_valid,
+            status.network_connected,
+            status.battery_level,
+            status.signal_strength,
+            status.free_memory,
+            JSON.stringify(changed)
+        ];
+    }
+
+    async flush() {
+        // One INSERT at a time; a slow database makes rows pile up in pending
+        if (this.flushing || this.pending.length === 0) {
+            return this.flushing;
+        }
+
+        const rows = this.pending;
+        this.pending = [];
+
+        this.flushing = (async() => {
+            try {
+                await this.db.query(
+                    `INSERT INTO heartbeats
+                        (device_id, heartbeat_type, timestamp, gps_valid, network_connected,
+                         battery_level, signal_strength, free_memory, data)
+                     VALUES ?`, [rows]
+                );
+                this.stats.batches++;
+                this.stats.stored += rows.length;
+            } catch (error) {
+                this.stats.failedBatches++;
+                this.stats.dropped += rows.length;
+                this.logger.error('Error writing heartbeats', error);
+            } finally {
+                this.flushing = null;
+            }
+        })();
+
+        return this.flushing;
+    }
+
+    async close() {
+        if (this.timer) {
+            clearInterval(this.timer);
+            this.timer = null;
+        }
+        await this.flushing;
+        await this.flush();
+    }
+
+    getStats() {
+        return {
+            ...this.stats,
+            devices: this.latest.size,
+            pending: this.pending.length,
+            sampleMs: this.options.sampleMs
+        };
+    }
+}
+
+HeartbeatStore.normalize = normalizeHeartbeat;
+
+module.exports = HeartbeatStore;
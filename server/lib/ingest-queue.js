@@ -0,0 +1,151 @@
+/*
+ * Ingest Queue
+ * Group-commit buffer for position fixes
+ *
+ * Fixes are held in memory and handed to the batch writer when either
+ * maxBatchRows are pending or maxDelayMs has passed since the oldest queued
+ * fix. push() resolves once the batch containing the fix has been written, so
+ * transports can still ack after the data is durable. Memory is bounded by
+ * maxQueuedRows (pending + in-flight); beyond that push() rejects with
+ * code 'EINGESTFULL' so callers can shed load instead of queueing forever.
+ * admit() runs the same check up front, so a caller can refuse a fix before
+ * acting on it (e.g. showing it live).
+ */
+
+class IngestQueue {
+    constructor(writeBatch, options = {}) {
+        this.writeBatch = writeBatch;
+        this.options = {
+            maxBatchRows: 500,
+            maxDelayMs: 50,
+            maxQueuedRows: 20000,
+            maxInFlight: 2,
+            ...options
+        };
+
+        this.pending = []; // { item, resolve, reject }
+        this.queued = 0; // pending + in-flight rows
+        this.inFlight = 0;
+        this.timer = null;
+        this.closed = false;
+        this.waiters = [];
+
+        this.stats = {
+            accepted: 0,
+            rejected: 0,
+            batches: 0,
+            rows: 0,
+            failedBatches: 0,
+            maxBatch: 0
+        };
+    }
+
+    // Throws what push() would reject with right now; a push() in the same tick is then accepted
+    admit() {
+        if (this.closed) {
+            throw ingestError('Ingest queue is closed', 'EINGESTCLOSED');
+        }
+
+        if (this.queued >= this.options.maxQueuedRows) {
+            this.stats.rejected++;
+            throw ingestError('Ingest queue is full', 'EINGESTFULL');
+        }
+    }
+
+    push(item) {
+        try {
+            this.admit();
+        } catch (error) {
+            return Promise.reject(error);
+        }
+
+        return new Promise((resolve, reject) => {
+            this.pending.push({ item, resolve, reject });
+            this.queued++;
+            this.stats.accepted++;
+
+            if (this.pending.length >= this.options.maxBatchRows) {
+                this.drain();
+            } else if (!this.timer) {
+                this.timer = setTimeout(() => {
+                    this.timer = null;
+                    this.drain();
+                }, this.options.maxDelayMs);
+            }
+        });
+    }
+
+    drain() {
+        if (this.timer) {
+            clearTimeout(this.timer);
+            this.timer = null;
+        }
+
+        while (this.pending.length > 0 && this.inFlight < this.options.maxInFlight) {
+            const batch = this.pending.splice(0, this.options.maxBatchRows);
+            this.inFlight++;
+            this.commit(batch);
+        }
+
+        // Leftovers wait for the next deadline or a finishing batch
+        if (this.pending.length > 0 && !this.closed) {
+            this.timer = setTimeout(() => {
+                this.timer = null;
+                this.drain();
+            }, this.options.maxDelayMs);
+        }
+    }
+
+    async commit(batch) {
+        try {
+            await this.writeBatch(batch.map(entry => entry.item));
+
+            this.stats.batches++;
+            this.stats.rows += batch.length;
+            this.stats.maxBatch = Math.max(this.stats.maxBatch, batch.length);
+            batch.forEach(entry => entry.resolve());
+        } catch (error) {
+            this.stats.failedBatches++;
+            batch.forEach(entry => entry.reject(error));
+        } finally {
+            this.inFlight--;
+            this.queued -= batch.length;
+
+            // A full batch (or an expired deadline) may be waiting on a free slot
+            if (this.pending.length >= this.options.maxBatchRows || (this.pending.length > 0 && !this.timer)) {
+                this.drain();
+            }
+
+            const waiters = this.waiters;
+            this.waiters = [];
+            waiters.forEach(resolve => resolve());
+        }
+    }
+
+    // Stop accepting fixes and write out everything still queued
+    async close() {
+        this.closed = true;
+
+        while (this.pending.length > 0 || this.inFlight > 0) {
+            this.drain();
+            await new Promise(resolve => this.waiters.push(resolve));
+        }
+    }
+
+    getStats() {
+        return {
+            ...this.stats,
+            queued: this.queued,
+            pending: this.pending.length,
+            inFlight: this.inFlight
+        };
+    }
+}
+
+function ingestError(message, code) {
+    const error = new Error(message);
+    error.code = code;
+    return error;
+}
+
+module.exports = IngestQueue;
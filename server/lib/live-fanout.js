@@ -0,0 +1,196 @@
+/*
+ * Live Fan-out
+ * Tick-coalesced delivery of position updates to WebSocket clients
+ *
+ * Updates are collected per device (last write wins) and flushed every
+ * tickMs as one frame per client: JSON ({ type: 'updates', devices: [...] })
+ * or the binary layout from update-frame.js for clients that asked for it.
+ * A client whose socket still holds more than maxBufferedBytes is skipped
+ * for the tick; its updates wait in a per-client backlog that also keeps
+ * only the newest state per device, so a lagging dashboard jumps to the
+ * current picture instead of replaying every intermediate fix.
+ *
+ * Every pushed update gets the next stream sequence number, and each frame
+ * carries the sequence it is current up to. A reconnecting client passes
+ * back the epoch and last sequence it saw and is sent only the devices that
+ * changed since (changedSince); a new epoch (server restart) means its
+ * sequence numbers are meaningless and it needs the full snapshot.
+ */
+
+const crypto = require('crypto');
+const WebSocket = require('ws');
+const { encodeUpdateFrame } = require('./update-frame');
+
+class LiveFanout {
+    constructor(subscriptions, options = {}) {
+        this.subscriptions = subscriptions;
+        this.options = {
+            tickMs: 200,
+            maxBufferedBytes: 1024 * 1024,
+            sendLatency: null, // histogram of received_at -> first send, in seconds
+            ...options
+        };
+
+        this.clients = new Map(); // ws -> { binary, backlog: Map(device_id -> position) }
+        this.pending = new Map(); // device_id -> { position, previous }
+        this.timer = null;
+
+        this.epoch = crypto.randomBytes(6).toString('hex');
+        this.seq = 0;
+        this.deviceSeq = new Map(); // device_id -> seq of its latest update
+
+        this.stats = { ticks: 0, frames: 0, bytes: 0, updates: 0, lagging: 0 };
+    }
+
+    start() {
+        this.timer = setInterval(() => this.tick(), this.options.tickMs);
+    }
+
+    stop() {
+        clearInterval(this.timer);
+        this.timer = null;
+    }
+
+    add(ws, { binary = false } = {}) {
+        this.clients.set(ws, { binary, backlog: new Map() });
+    }
+
+    remove(ws) {
+        this.clients.delete(ws);
+    }
+
+    push(position, previous) {
+        this.deviceSeq.set(position.device_id, ++this.seq);
+
+        const existing = this.pending.get(position.device_id);
+        // Keep the position from before the tick so a device leaving a view is still routed there
+        this.pending.set(position.device_id, {
+            position,
+            previous: existing ? existing.previous : previous
+        });
+    }
+
+    // Whether a client's (epoch, since) can be answered with a delta
+    canResume(epoch, since) {
+        return epoch === this.epoch && Number.isInteger(since) && since >= 0 && since <= this.seq;
+    }
+
+    // Device ids updated after sequence number since
+    changedSince(since) {
+        const changed = new Set();
+        this.deviceSeq.forEach((seq, deviceId) => {
+            if (seq > since) {
+                changed.add(deviceId);
+            }
+        });
+        return changed;
+    }
+
+    encode(positions, binary, now) {
+        return binary
+            ? encodeUpdateFrame(positions, now, this.seq)
+            : JSON.stringify({ type: 'updates', devices: positions, seq: this.seq, timestamp: now });
+    }
+
+    tick() {
+        const updates = Array.from(this.pending.values());
+        this.pending = new Map();
+
+        let hasBacklog = false;
+        this.clients.forEach((state) => {
+            hasBacklog = hasBacklog || state.backlog.size > 0;
+        });
+        if (updates.length === 0 && !hasBacklog) {
+            return;
+        }
+
+        this.stats.ticks++;
+        const now = Date.now();
+        const everything = updates.map(update => update.position);
+
+        // Route each update once through the subscription index
+        const routed = new Map();
+        updates.forEach(({ position, previous }) => {
+            this.subscriptions.match(position, previous).forEach((ws) => {
+                if (!routed.has(ws)) {
+                    routed.set(ws, []);
+                }
+                routed.get(ws).push(position);
+            });
+        });
+
+        // Unfiltered clients without a backlog all get the same frame
+        const shared = {};
+        const framesBefore = this.stats.frames;
+
+        this.clients.forEach((state, ws) => {
+            if (ws.readyState !== WebSocket.OPEN) {
+                return;
+            }
+
+            const filtered = this.subscriptions.isFiltered(ws);
+            let positions = filtered ? (routed.get(ws) || []) : everything;
+            let reusable = !filtered;
+
+            if (state.backlog.size > 0) {
+                positions.forEach(position => state.backlog.set(position.device_id, position));
+                positions = Array.from(state.backlog.values());
+                reusable = false;
+            }
+            if (positions.length === 0) {
+                return;
+            }
+
+            if (ws.bufferedAmount > this.options.maxBufferedBytes) {
+                if (state.backlog.size === 0) {
+                    positions.forEach(position => state.backlog.set(position.device_id, position));
+                }
+                this.stats.lagging++;
+                return;
+            }
+            state.backlog.clear();
+
+            let frame;
+            if (reusable) {
+                const key = state.binary ? 'binary' : 'json';
+                frame = shared[key] || (shared[key] = this.encode(positions, state.binary, now));
+            } else {
+                frame = this.encode(positions, state.binary, now);
+            }
+
+            ws.send(frame);
+            ws.deliveredUpdates = (ws.deliveredUpdates || 0) + positions.length;
+            this.stats.frames++;
+            this.stats.bytes += typeof frame === 'string' ? Buffer.byteLength(frame) : frame.length;
+            this.stats.updates += positions.length;
+        });
+
+        if (this.options.sendLatency && this.stats.frames > framesBefore) {
+            const sentAt = Date.now();
+            everything.forEach((position) => {
+                this.options.sendLatency.observe([], (sentAt - position.received_at) / 1000);
+            });
+        }
+    }
+
+    getStats() {
+        let binary = 0;
+        let backlogged = 0;
+        this.clients.forEach((state) => {
+            if (state.binary) binary++;
+            if (state.backlog.size > 0) backlogged++;
+        });
+
+        return {
+            ...this.stats,
+            clients: this.clients.size,
+            binaryClients: binary,
+            backloggedClients: backlogged,
+            pending: this.pending.size,
+            epoch: this.epoch,
+            seq: this.seq
+        };
+    }
+}
+
+module.exports = LiveFanout;
@@ -0,0 +1,228 @@
+/*
+ * Logger
+ * Leveled JSON-line logging through an asynchronous buffered writer
+ *
+ * console.log writes to a pipe synchronously on Linux, and under PM2
+ * stdout is a pipe. At high ingest rates the per-request and per-fix lines
+ * took more CPU than the ingest itself. Here a call below the configured
+ * level costs one comparison. Anything else is formatted as one JSON line
+ * and appended to an in-memory buffer, which is written with fs.write from
+ * the libuv thread pool (the approach pino/sonic-boom take). The buffer is
+ * written once it holds bufferBytes or after flushMs, and only one write is
+ * in flight at a time. If the destination cannot keep up, lines past
+ * maxBufferBytes are dropped and counted instead of growing the heap. The
+ * next write reports how many were lost.
+ *
+ * Per-fix logs go through sample(every), which passes one call in every.
+ */
+
+const fs = require('fs');
+
+const LEVELS = { trace: 10, debug: 20, info: 30, warn: 40, error: 50, silent: Infinity };
+LEVELS.off = LEVELS.silent;
+
+function serializeError(error) {
+    return { type: error.name, message: error.message, code: error.code, stack: error.stack };
+}
+
+// Errors have no enumerable fields; everything else is stringified as is
+function replacer(key, value) {
+    return value instanceof Error ? serializeError(value) : value;
+}
+
+class Sampler {
+    constructor(logger, every) {
+        this.logger = logger;
+        this.every = Math.max(1, every);
+        this.count = 0;
+    }
+
+    log(level, msg, fields) {
+        if (!this.logger.enabled(level)) {
+            return;
+        }
+        if (this.count++ % this.every !== 0) {
+            this.logger.stats.sampledOut++;
+            return;
+        }
+        this.logger.write(level, msg, this.every > 1 ? { ...fields, sample: this.every } : fields);
+    }
+
+    debug(msg, fields) { this.log('debug', msg, fields); }
+    info(msg, fields) { this.log('info', msg, fields); }
+    warn(msg, fields) { this.log('warn', msg, fields); }
+}
+
+class Logger {
+    constructor(options = {}) {
+        this.options = {
+            level: 'info',
+            fd: 1, // stdout
+            base: {}, // fields added to every line
+            bufferBytes: 16384,
+            maxBufferBytes: 8 * 1024 * 1024,
+            flushMs: 100,
+            ...options
+        };
+
+        this.threshold = LEVELS[this.options.level] !== undefined ? LEVELS[this.options.level] : LEVELS.info;
+        this.base = JSON.stringify(this.options.base).slice(1, -1);
+        this.chunks = [];
+        this.buffered = 0;
+        this.writing = null; // Buffer being written, or null
+        this.timer = null;
+        this.dropped = 0; // since the last write
+        this.waiters = [];
+
+        this.stats = { lines: 0, bytes: 0, dropped: 0, sampledOut: 0, writes: 0, errors: 0 };
+    }
+
+    enabled(level) {
+        return LEVELS[level] >= this.threshold;
+    }
+
+    // A sampler that passes one call in every; use for logs that fire per fix
+    sample(every) {
+        return new Sampler(this, every);
+    }
+
+    trace(msg, fields) { if (LEVELS.trace >= this.threshold) this.write('trace', msg, fields); }
+    debug(msg, fields) { if (LEVELS.debug >= this.threshold) this.write('debug', msg, fields); }
+    info(msg, fields) { if (LEVELS.info >= this.threshold) this.write('info', msg, fields); }
+    warn(msg, fields) { if (LEVELS.warn >= this.threshold) this.write('warn', msg, fields); }
+    error(msg, fields) { if (LEVELS.error >= this.threshold) this.write('error', msg, fields); }
+
+    // fields: an object of extra keys, or an Error (logged as err)
+    write(level, msg, fields) {
+        if (fields instanceof Error) {
+            fields = { err: fields };
+        }
+        let line = `{"time":"${new Date().toISOString()}","level":"${level}"`;
+        if (this.base) {
+            line += `,${this.base}`;
+        }
+        line += `,"msg":${JSON.stringify(msg)}`;
+        if (fields) {
+            const extra = JSON.stringify(fields, replacer);
+            if (extra.length > 2) {
+                line += `,${extra.slice(1, -1)}`;
+            }
+        }
+        line += '}\n';
+
+        if (this.buffered + line.length > this.options.maxBufferBytes) {
+            this.dropped++;
+            this.stats.dropped++;
+            return;
+        }
+
+        this.chunks.push(line);
+        this.buffered += line.length;
+        this.stats.lines++;
+
+        if (this.buffered >= this.options.bufferBytes) {
+            this.flush();
+        } else if (!this.timer) {
+            this.timer = setTimeout(() => {
+                this.timer = null;
+                this.flush();
+            }, this.options.flushMs);
+            this.timer.unref();
+        }
+    }
+
+    take() {
+        if (this.dropped > 0) {
+            this.chunks.push(`{"time":"${new Date().toISOString()}","level":"warn"${this.base ? `,${this.base}` : ''},"msg":"log lines dropped","dropped":${this.dropped}}\n`);
+            this.dropped = 0;
+        }
+        const data = Buffer.from(this.chunks.join(''));
+        this.chunks = [];
+        this.buffered = 0;
+        return data;
+    }
+
+    // Start writing the buffer unless a write is already in flight
+    flush() {
+        if (this.timer) {
+            clearTimeout(this.timer);
+            this.timer = null;
+        }
+        if (this.writing || (this.chunks.length === 0 && this.dropped === 0)) {
+            return;
+        }
+        this.writeOut(this.take());
+    }
+
+    writeOut(data) {
+        this.writing = data;
+        fs.write(this.options.fd, data, 0, data.length, null, (error, written) => {
+            if (error) {
+                if (error.code === 'EAGAIN') {
+                    // Non-blocking pipe is full; try the same bytes again shortly
+                    setTimeout(() => this.writeOut(data), 10).unref();
+                    return;
+                }
+                this.stats.errors++;
+                written = data.length; // nothing sensible to do with it
+            } else {
+                this.stats.writes++;
+                this.stats.bytes += written;
+            }
+
+            if (written < data.length) {
+                this.writeOut(data.subarray(written));
+                return;
+            }
+
+            this.writing = null;
+            if (this.chunks.length > 0 || this.dropped > 0) {
+                this.flush();
+            } else {
+                this.waiters.splice(0).forEach(resolve => resolve());
+            }
+        });
+    }
+
+    // Resolves once everything logged so far has been written
+    close() {
+        this.flush();
+        if (!this.writing) {
+            return Promise.resolve();
+        }
+        return new Promise(resolve => this.waiters.push(resolve));
+    }
+
+    // For process 'exit', where no callback will run again. A write still in
+    // flight is repeated, since there is no telling how much of it landed.
+    flushSync() {
+        if (this.timer) {
+            clearTimeout(this.timer);
+            this.timer = null;
+        }
+        const data = this.writing ? Buffer.concat([this.writing, this.take()]) : this.take();
+        this.writing = null;
+        let offset = 0;
+        while (offset < data.length) {
+            try {
+                offset += fs.writeSync(this.options.fd, data, offset, data.length - offset);
+            } catch (error) {
+                if (error.code !== 'EAGAIN') {
+                    return;
+                }
+            }
+        }
+    }
+
+    getStats() {
+        return {
+            ...this.stats,
+            level: Object.keys(LEVELS).find(level => LEVELS[level] === this.threshold),
+            buffered: this.buffered
+        };
+    }
+}
+
+Logger.LEVELS = LEVELS;
+
+module.exports = Logger;
@@ -0,0 +1,225 @@
+/*
+ * Metrics
+ * Counters, gauges and fixed-bucket histograms in the Prometheus text format
+ *
+ * Everything is updated incrementally on the hot path (a counter add or one
+ * bucket search per observation) and only formatted when /metrics is
+ * scraped. Series that mirror state owned elsewhere (queue depth, socket
+ * buffers) take a collect callback that runs at scrape time. Each PM2 worker
+ * keeps its own registry; the worker label tells the series apart.
+ */
+
+const DEFAULT_LATENCY_BUCKETS = [0.001, 0.0025, 0.005, 0.01, 0.025, 0.05, 0.1, 0.25, 0.5, 1, 2.5, 5, 10];
+
+function escapeLabel(value) {
+    return String(value).replace(/\\/g, '\\\\').replace(/\n/g, '\\n').replace(/"/g, '\\"');
+}
+
+function formatLabels(labels) {
+    const entries = Object.entries(labels);
+    if (entries.length === 0) {
+        return '';
+    }
+    return `{${entries.map(([name, value]) => `${name}="${escapeLabel(value)}"`).join(',')}}`;
+}
+
+function formatValue(value) {
+    if (value === Infinity) return '+Inf';
+    if (value === -Infinity) return '-Inf';
+    return Number.isNaN(value) ? 'NaN' : String(value);
+}
+
+class Metric {
+    // collect(metric), when given, runs before each scrape and calls set()
+    constructor(type, name, help, labelNames = [], collect = null) {
+        this.type = type;
+        this.name = name;
+        this.help = help;
+        this.labelNames = labelNames;
+        this.collect = collect;
+        this.series = new Map(); // label values joined by \x00 -> series
+    }
+
+    // labels: values in labelNames order
+    key(labels) {
+        return labels.length === 0 ? '' : labels.join('\x00');
+    }
+
+    labelObject(key) {
+        const values = key === '' ? [] : key.split('\x00');
+        const labels = {};
+        this.labelNames.forEach((name, i) => {
+            labels[name] = values[i];
+        });
+        return labels;
+    }
+
+    header() {
+        return `# HELP ${this.name} ${this.help}\n# TYPE ${this.name} ${this.type}\n`;
+    }
+}
+
+class Counter extends Metric {
+    constructor(name, help, labelNames, collect) {
+        super('counter', name, help, labelNames, collect);
+    }
+
+    inc(labels = [], value = 1) {
+        const key = this.key(labels);
+        this.series.set(key, (this.series.get(key) || 0) + value);
+    }
+
+    // For totals counted elsewhere and mirrored by collect
+    set(labels, value) {
+        this.series.set(this.key(labels), value);
+    }
+
+    render(defaults) {
+        if (this.collect) {
+            this.collect(this);
+        }
+        let text = this.header();
+        this.series.forEach((value, key) => {
+            text += `${this.name}${formatLabels({ ...defaults, ...this.labelObject(key) })} ${formatValue(value)}\n`;
+        });
+        return text;
+    }
+}
+
+class Gauge extends Metric {
+    constructor(name, help, labelNames, collect) {
+        super('gauge', name, help, labelNames, collect);
+    }
+
+    set(labels, value) {
+        this.series.set(this.key(labels), value);
+    }
+
+    render(defaults) {
+        if (this.collect) {
+            this.collect(this);
+        }
+        let text = this.header();
+        this.series.forEach((value, key) => {
+            text += `${this.name}${formatLabels({ ...defaults, ...this.labelObject(key) })} ${formatValue(value)}\n`;
+        });
+        return text;
+    }
+}
+
+class Histogram extends Metric {
+    constructor(name, help, labelNames, buckets = DEFAULT_LATENCY_BUCKETS) {
+        super('histogram', name, help, labelNames);
+        this.buckets = buckets;
+    }
+
+    seriesFor(labels) {
+        const key = this.key(labels);
+        let series = this.series.get(key);
+        if (!series) {
+            // One slot per bucket plus +Inf; cumulated only when rendered
+            series = { counts: new Float64Array(this.buckets.length + 1), sum: 0, count: 0 };
+            this.series.set(key, series);
+        }
+        return series;
+    }
+
+    observe(labels, value) {
+        const series = this.seriesFor(labels);
+        let low = 0;
+        let high = this.buckets.length;
+        while (low < high) {
+            const mid = (low + high) >> 1;
+            if (value <= this.buckets[mid]) {
+                high = mid;
+            } else {
+                low = mid + 1;
+            }
+        }
+        series.counts[low]++;
+        series.sum += value;
+        series.count++;
+    }
+
+    render(defaults) {
+        let text = this.header();
+        this.series.forEach((series, key) => {
+            const labels = { ...defaults, ...this.labelObject(key) };
+            let cumulative = 0;
+            this.buckets.forEach((bound, i) => {
+                cumulative += series.counts[i];
+                text += `${this.name}_bucket${formatLabels({ ...labels, le: formatValue(bound) })} ${cumulative}\n`;
+            });
+            text += `${this.name}_bucket${formatLabels({ ...labels, le: '+Inf' })} ${series.count}\n`;
+            text += `${this.name}_sum${formatLabels(labels)} ${series.sum}\n`;
+            text += `${this.name}_count${formatLabels(labels)} ${series.count}\n`;
+        });
+        return text;
+    }
+}
+
+class MetricsRegistry {
+    constructor(defaultLabels = {}) {
+        this.defaultLabels = defaultLabels;
+        this.metrics = [];
+        this.lagTimer = null;
+    }
+
+    counter(name, help, labelNames = [], collect = null) {
+        return this.register(new Counter(name, help, labelNames, collect));
+    }
+
+    gauge(name, help, labelNames = [], collect = null) {
+        return this.register(new Gauge(name, help, labelNames, collect));
+    }
+
+    histogram(name, help, labelNames = [], buckets = DEFAULT_LATENCY_BUCKETS) {
+        return this.register(new Histogram(name, help, labelNames, buckets));
+    }
+
+    register(metric) {
+        this.metrics.push(metric);
+        return metric;
+    }
+
+    render() {
+        return this.metrics.map(metric => metric.render(this.defaultLabels)).join('');
+    }
+
+    // Event-loop lag: how late a timer set for intervalMs fires
+    monitorEventLoop(histogram, intervalMs = 100) {
+        let expected = Date.now() + intervalMs;
+        this.lagTimer = setInterval(() => {
+            const now = Date.now();
+            histogram.observe([], Math.max(0, now - expected) / 1000);
+            expected = now + intervalMs;
+        }, intervalMs);
+        this.lagTimer.unref();
+    }
+
+    /*
+     * Time spent waiting for a connection from a mysql2 pool. Wraps the core
+     * pool's getConnection, which pool.query() and pool.getConnection() both
+     * go through.
+     */
+    instrumentPool(promisePool, histogram, labels = []) {
+        const core = promisePool.pool;
+        const getConnection = core.getConnection.bind(core);
+        core.getConnection = (callback) => {
+            const start = process.hrtime.bigint();
+            getConnection((error, connection) => {
+                histogram.observe(labels, Number(process.hrtime.bigint() - start) / 1e9);
+                callback(error, connection);
+            });
+        };
+    }
+
+    stop() {
+        clearInterval(this.lagTimer);
+        this.lagTimer = null;
+    }
+}
+
+MetricsRegistry.DEFAULT_LATENCY_BUCKETS = DEFAULT_LATENCY_BUCKETS;
+
+module.exports = MetricsRegistry;
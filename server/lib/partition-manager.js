@@ -0,0 +1,184 @@
+/*
+ * Partition Manager
+ * Time-range partition upkeep and retention for the positions table
+ *
+ * positions is RANGE partitioned on its millisecond timestamp, one partition
+ * per UTC day (or ISO week). On a schedule this job makes sure partitions
+ * exist a few periods ahead by splitting the MAXVALUE catch-all, and drops
+ * every partition that lies entirely before the retention cutoff. Dropping a
+ * partition is a metadata operation, unlike DELETE ... WHERE over millions of
+ * rows. A named lock keeps cluster workers from running it concurrently.
+ */
+
+const DAY_MS = 24 * 60 * 60 * 1000;
+const WEEK_MS = 7 * DAY_MS;
+const MONDAY_OFFSET_MS = 4 * DAY_MS; // 1970-01-01 was a Thursday
+
+class PartitionManager {
+    constructor(db, options = {}) {
+        this.db = db;
+        this.options = {
+            table: 'positions',
+            granularity: 'day', // 'day' or 'week'
+            retentionDays: 90, // 0 keeps everything
+            aheadPeriods: 7,
+            intervalMs: 60 * 60 * 1000,
+            logger: console, // info/warn/error(msg, fields)
+            ...options
+        };
+
+        this.logger = this.options.logger;
+        this.timer = null;
+        this.warnedUnpartitioned = false;
+        this.lastRun = null;
+    }
+
+    start() {
+        this.run();
+        this.timer = setInterval(() => this.run(), this.options.intervalMs);
+    }
+
+    stop() {
+        clearInterval(this.timer);
+        this.timer = null;
+    }
+
+    periodStart(timestamp) {
+        if (this.options.granularity === 'week') {
+            return Math.floor((timestamp - MONDAY_OFFSET_MS) / WEEK_MS) * WEEK_MS + MONDAY_OFFSET_MS;
+        }
+        return Math.floor(timestamp / DAY_MS) * DAY_MS;
+    }
+
+    periodLength() {
+        return this.options.granularity === 'week' ? WEEK_MS : DAY_MS;
+    }
+
+    partitionName(lowerBound) {
+        return 'p' + new Date(lowerBound).toISOString().slice(0, 10).replace(/-/g, '');
+    }
+
+    async run() {
+        const connection = await this.db.getConnection().catch((error) => {
+            this.logger.error('Partition maintenance: no connection', error);
+            return null;
+        });
+        if (!connection) return;
+
+        const lockName = `${this.options.table}_partition_maintenance`;
+
+        try {
+            const [[{ locked }]] = await connection.query('SELECT GET_LOCK(?, 0) AS locked', [lockName]);
+            if (!locked) return; // another worker is on it
+
+            try {
+                const partitions = await this.listPartitions(connection);
+                if (partitions === null) return;
+
+                const now = Date.now();
+                const created = await this.ensureAhead(connection, partitions, now);
+                const dropped = await this.dropExpired(connection, partitions, now);
+
+                this.lastRun = { at: now, created, dropped };
+                if (created.length > 0 || dropped.length > 0) {
+                    this.logger.info('Partition maintenance', { table: this.options.table, created, dropped });
+                }
+            } finally {
+                await connection.query('SELECT RELEASE_LOCK(?)', [lockName]);
+            }
+        } catch (error) {
+            this.logger.error('Partition maintenance error', error);
+        } finally {
+            connection.release();
+        }
+    }
+
+    // [{ name, upperBound }] in order; upperBound is null for MAXVALUE
+    async listPartitions(connection) {
+        const [rows] = await connection.query(`
+            SELECT PARTITION_NAME AS name, PARTITION_DESCRIPTION AS description
+            FROM information_schema.PARTITIONS
+            WHERE TABLE_SCHEMA = DATABASE() AND TABLE_NAME = ?
+            ORDER BY PARTITION_ORDINAL_POSITION
+        `, [this.options.table]);
+
+        if (rows.length === 0 || rows[0].name === null) {
+            if (!this.warnedUnpartitioned) {
+                this.logger.warn(`${this.options.table} is not partitioned; retention disabled (see db/partition-positions.sql)`);
+                this.warnedUnpartitioned = true;
+            }
+            return null;
+        }
+
+        return rows.map(row => ({
+            name: row.name,
+            upperBound: row.description === 'MAXVALUE' ? null : Number(row.description)
+        }));
+    }
+
+    async ensureAhead(connection, partitions, now) {
+        const catchAll = partitions[partitions.length - 1];
+        if (catchAll.upperBound !== null) {
+            return []; // no MAXVALUE partition to split; inserts past the last bound fail loudly instead
+        }
+
+        const bounded = partitions.filter(partition => partition.upperBound !== null);
+        const period = this.periodLength();
+        const current = this.periodStart(now);
+        const horizon = current + (this.options.aheadPeriods + 1) * period;
+
+        let lower = bounded.length > 0 ? bounded[bounded.length - 1].upperBound : current;
+        const definitions = [];
+        const created = [];
+
+        while (lower < horizon) {
+            // After a long outage one partition absorbs the gap up to the current period
+            const upper = lower < current ? current + period : this.periodStart(lower) + period;
+            const name = this.partitionName(lower);
+            definitions.push(`PARTITION ${name} VALUES LESS THAN (${upper})`);
+            created.push(name);
+            lower = upper;
+        }
+
+        if (definitions.length === 0) {
+            return [];
+        }
+
+        definitions.push(`PARTITION ${catchAll.name} VALUES LESS THAN MAXVALUE`);
+        await connection.query(
+            `ALTER TABLE ${this.options.table} REORGANIZE PARTITION ${catchAll.name} INTO (${definitions.join(', ')})`
+        );
+        return created;
+    }
+
+    async dropExpired(connection, partitions, now) {
+        if (!this.options.retentionDays) {
+            return [];
+        }
+
+        const cutoff = now - this.options.retentionDays * DAY_MS;
+        const bounded = partitions.filter(partition => partition.upperBound !== null);
+
+        // Never drop the last bounded partition, REORGANIZE needs it as the anchor
+        const expired = bounded
+            .slice(0, -1)
+            .filter(partition => partition.upperBound <= cutoff)
+            .map(partition => partition.name);
+
+        if (expired.length > 0) {
+            await connection.query(`ALTER TABLE ${this.options.table} DROP PARTITION ${expired.join(', ')}`);
+        }
+        return expired;
+    }
+
+    getStatus() {
+        return {
+            table: this.options.table,
+            granularity: this.options.granularity,
+            retentionDays: this.options.retentionDays,
+            lastRun: this.lastRun
+        };
+    }
+}
+
+module.exports = PartitionManager;
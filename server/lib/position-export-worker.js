@@ -0,0 +1,59 @@
+/*
+ * Position Export Worker
+ * One export's query, serialization and gzip, off the main event loop
+ *
+ * Started by PositionExporter with { db, filters, format, gzipLevel,
+ * highWaterMark, maxUnacked } as workerData. Opens its own MySQL connection
+ * and runs streamExport() into a sink that transfers each compressed chunk
+ * to the main thread. Once maxUnacked chunks are waiting for an ack the sink
+ * holds its callback, which pauses gzip, the serializer and the cursor in
+ * turn. Ends with a 'done' or 'error' message.
+ */
+
+const { parentPort, workerData } = require('worker_threads');
+const { Writable } = require('stream');
+const mysql = require('mysql2');
+const { streamExport } = require('./position-export');
+
+let unacked = 0;
+let blocked = null; // write callback held until the main thread catches up
+
+parentPort.on('message', (message) => {
+    if (message.type === 'ack') {
+        unacked--;
+        if (blocked && unacked < workerData.maxUnacked) {
+            const callback = blocked;
+            blocked = null;
+            callback();
+        }
+    }
+});
+
+const sink = new Writable({
+    write(chunk, encoding, callback) {
+        // gzip output may be a view into a shared pool; copy into a buffer of its own to transfer it
+        const data = new Uint8Array(chunk.length);
+        data.set(chunk);
+        parentPort.postMessage({ type: 'chunk', data }, [data.buffer]);
+        unacked++;
+        if (unacked < workerData.maxUnacked) {
+            callback();
+        } else {
+            blocked = callback;
+        }
+    }
+});
+
+const connection = mysql.createConnection(workerData.db);
+
+streamExport(connection, workerData.filters, workerData.format, sink, workerData)
+    .then(({ rows, bytes }) => {
+        connection.end();
+        parentPort.postMessage({ type: 'done', rows, bytes });
+        parentPort.close();
+    })
+    .catch((error) => {
+        connection.destroy();
+        parentPort.postMessage({ type: 'error', message: error.message, code: error.code });
+        parentPort.close();
+    });
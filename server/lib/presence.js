@@ -0,0 +1,150 @@
+/*
+ * Presence Tracker
+ * Incremental online/offline state per device on a timer wheel
+ *
+ * A device is online for windowMs after its last received fix. Rather than
+ * scanning every device to count the online ones, each online device sits in
+ * the wheel slot of the second it expires in. A fix moves the device to a
+ * later slot, and every slotMs the slots that have come due are swept.
+ * Expiries are never more than windowMs ahead, so one lap of the wheel covers
+ * them all. Reading the online count is O(1). Touching a device or sweeping
+ * a slot costs O(devices changed).
+ *
+ * leave() takes a device offline at once, without waiting for its window to
+ * run out (the broker published its MQTT Last Will). A later fix brings it
+ * back as usual.
+ *
+ * Events:
+ *   'change' [{ device_id, online, last_seen }]  once per sweep with transitions
+ */
+
+const EventEmitter = require('events');
+
+class PresenceTracker extends EventEmitter {
+    constructor(options = {}) {
+        super();
+        this.options = {
+            windowMs: 60000,
+            slotMs: 1000,
+            ...options
+        };
+
+        this.size = Math.ceil(this.options.windowMs / this.options.slotMs) + 3;
+        this.slots = Array.from({ length: this.size }, () => new Set());
+        this.devices = new Map(); // device_id -> { lastSeen, slot } while online
+        this.cursor = Math.floor(Date.now() / this.options.slotMs) - 1; // last tick swept
+        this.transitions = [];
+        this.timer = null;
+
+        this.stats = { wentOnline: 0, wentOffline: 0, left: 0 };
+    }
+
+    start() {
+        if (!this.timer) {
+            this.timer = setInterval(() => this.sweep(Date.now()), this.options.slotMs);
+        }
+    }
+
+    stop() {
+        clearInterval(this.timer);
+        this.timer = null;
+    }
+
+    get onlineCount() {
+        return this.devices.size;
+    }
+
+    isOnline(device_id) {
+        return this.devices.has(device_id);
+    }
+
+    // Record that device_id was heard from at receivedAt (epoch ms)
+    touch(device_id, receivedAt, now = Date.now()) {
+        const expiresAt = Math.min(receivedAt, now) + this.options.windowMs;
+        if (expiresAt <= now) {
+            return; // already stale (e.g. warm start from the database)
+        }
+
+        const slot = this.slotFor(expiresAt);
+        const state = this.devices.get(device_id);
+
+        if (state) {
+            if (receivedAt <= state.lastSeen) {
+                return;
+            }
+            state.lastSeen = receivedAt;
+            if (state.slot !== slot) {
+                this.slots[state.slot].delete(device_id);
+                this.slots[slot].add(device_id);
+                state.slot = slot;
+            }
+            return;
+        }
+
+        this.devices.set(device_id, { lastSeen: receivedAt, slot });
+        this.slots[slot].add(device_id);
+        this.stats.wentOnline++;
+        this.transitions.push({ device_id, online: true, last_seen: receivedAt });
+    }
+
+    // Device announced it is gone; the transition goes out with the next sweep
+    leave(device_id) {
+        const state = this.devices.get(device_id);
+        if (!state) {
+            return false;
+        }
+        this.slots[state.slot].delete(device_id);
+        this.devices.delete(device_id);
+        this.stats.wentOffline++;
+        this.stats.left++;
+        this.transitions.push({ device_id, online: false, last_seen: state.lastSeen });
+        return true;
+    }
+
+    // Slot of the first tick not yet swept that ends after expiresAt
+    slotFor(expiresAt) {
+        const tick = Math.max(Math.floor(expiresAt / this.options.slotMs), this.cursor + 1);
+        return tick % this.size;
+    }
+
+    // Expire every tick that has fully passed and emit the transitions since the last sweep
+    sweep(now) {
+        const target = Math.floor(now / this.options.slotMs) - 1;
+
+        // After a stall longer than a lap, one pass over the wheel is enough
+        const from = Math.max(this.cursor + 1, target - this.size + 1);
+        this.cursor = Math.max(this.cursor, target);
+        for (let tick = from; tick <= target; tick++) {
+            const due = Array.from(this.slots[tick % this.size]);
+            this.slots[tick % this.size].clear();
+            due.forEach((device_id) => {
+                const state = this.devices.get(device_id);
+                if (state.lastSeen + this.options.windowMs <= now) {
+                    this.devices.delete(device_id);
+                    this.stats.wentOffline++;
+                    this.transitions.push({ device_id, online: false, last_seen: state.lastSeen });
+                } else {
+                    // Only after a stall; put it back where it belongs
+                    state.slot = this.slotFor(state.lastSeen + this.options.windowMs);
+                    this.slots[state.slot].add(device_id);
+                }
+            });
+        }
+
+        if (this.transitions.length > 0) {
+            const transitions = this.transitions;
+            this.transitions = [];
+            this.emit('change', transitions);
+        }
+    }
+
+    getStats() {
+        return {
+            ...this.stats,
+            online: this.devices.size,
+            windowMs: this.options.windowMs
+        };
+    }
+}
+
+module.exports = PresenceTracker;
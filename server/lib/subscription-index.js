@@ -0,0 +1,186 @@
+/*
+ * Subscription Index
+ * Routes live position updates to the WebSocket clients that can see them
+ *
+ * A client subscribes to a map bounding box and/or an explicit device list.
+ * Bounding boxes are registered in a uniform lat/lng grid, so an update only
+ * looks at the clients registered in the cells of its new and previous
+ * position before the exact bounds test. Boxes spanning more than maxCells
+ * cells (a zoomed-out map) skip the grid and are tested on every update.
+ * Clients that never subscribed receive everything, as before.
+ */
+
+class SubscriptionIndex {
+    constructor(options = {}) {
+        this.options = {
+            cellDeg: 1,
+            maxCells: 4096,
+            ...options
+        };
+
+        this.subscriptions = new Map(); // client -> { bbox, devices, cells }
+        this.grid = new Map(); // cell key -> Set of clients
+        this.wide = new Set(); // clients whose bbox is too large for the grid
+        this.byDevice = new Map(); // device_id -> Set of clients
+    }
+
+    cellKey(x, y) {
+        return `${x}:${y}`;
+    }
+
+    cellX(lng) {
+        return Math.floor((lng + 180) / this.options.cellDeg);
+    }
+
+    cellY(lat) {
+        return Math.floor((lat + 90) / this.options.cellDeg);
+    }
+
+    // bbox: [west, south, east, north] in degrees, or null; devices: array of ids, or null
+    subscribe(client, { bbox = null, devices = null } = {}) {
+        this.unsubscribe(client);
+
+        const subscription = { bbox: normalizeBbox(bbox), devices: new Set(devices || []), cells: [] };
+        this.subscriptions.set(client, subscription);
+
+        subscription.devices.forEach((deviceId) => {
+            if (!this.byDevice.has(deviceId)) {
+                this.byDevice.set(deviceId, new Set());
+            }
+            this.byDevice.get(deviceId).add(client);
+        });
+
+        const bounds = subscription.bbox;
+        if (!bounds) {
+            return;
+        }
+
+        const x0 = this.cellX(bounds[0]);
+        const x1 = this.cellX(bounds[2]);
+        const y0 = this.cellY(bounds[1]);
+        const y1 = this.cellY(bounds[3]);
+
+        if ((x1 - x0 + 1) * (y1 - y0 + 1) > this.options.maxCells) {
+            this.wide.add(client);
+            return;
+        }
+
+        for (let x = x0; x <= x1; x++) {
+            for (let y = y0; y <= y1; y++) {
+                const key = this.cellKey(x, y);
+                if (!this.grid.has(key)) {
+                    this.grid.set(key, new Set());
+                }
+                this.grid.get(key).add(client);
+                subscription.cells.push(key);
+            }
+        }
+    }
+
+    unsubscribe(client) {
+        const subscription = this.subscriptions.get(client);
+        if (!subscription) {
+            return;
+        }
+
+        subscription.cells.forEach((key) => {
+            const clients = this.grid.get(key);
+            clients.delete(client);
+            if (clients.size === 0) {
+                this.grid.delete(key);
+            }
+        });
+        subscription.devices.forEach((deviceId) => {
+            const clients = this.byDevice.get(deviceId);
+            clients.delete(client);
+            if (clients.size === 0) {
+                this.byDevice.delete(deviceId);
+            }
+        });
+        this.wide.delete(client);
+        this.subscriptions.delete(client);
+    }
+
+    isFiltered(client) {
+        return this.subscriptions.has(client);
+    }
+
+    // Whether a subscribed client wants this position (new position in view or a watched device)
+    wants(client, position) {
+        const subscription = this.subscriptions.get(client);
+        if (!subscription) {
+            return true;
+        }
+        return subscription.devices.has(position.device_id) || contains(subscription.bbox, position);
+    }
+
+    /*
+     * Subscribed clients interested in an update: the device is watched, or
+     * the new or previous position is inside the box (so markers leaving the
+     * view are moved out of it rather than frozen at the edge).
+     */
+    match(position, previous) {
+        const matched = new Set(this.byDevice.get(position.device_id));
+
+        const consider = (client) => {
+            if (matched.has(client)) return;
+            const bbox = this.subscriptions.get(client).bbox;
+            if (contains(bbox, position) || (previous && contains(bbox, previous))) {
+                matched.add(client);
+            }
+        };
+
+        const cells = [this.cellKey(this.cellX(position.lng), this.cellY(position.lat))];
+        if (previous) {
+            const previousCell = this.cellKey(this.cellX(previous.lng), this.cellY(previous.lat));
+            if (previousCell !== cells[0]) {
+                cells.push(previousCell);
+            }
+        }
+        cells.forEach((key) => {
+            const clients = this.grid.get(key);
+            if (clients) {
+                clients.forEach(consider);
+            }
+        });
+        this.wide.forEach(consider);
+
+        return matched;
+    }
+
+    getStats() {
+        return {
+            subscribed: this.subscriptions.size,
+            wide: this.wide.size,
+            cells: this.grid.size,
+            watchedDevices: this.byDevice.size
+        };
+    }
+}
+
+// Clamp to valid coordinates; a box wrapping the antimeridian becomes the full longitude range
+function normalizeBbox(bbox) {
+    if (!Array.isArray(bbox) || bbox.length !== 4 || !bbox.every(Number.isFinite)) {
+        return null;
+    }
+
+    let [west, south, east, north] = bbox;
+    if (east - west >= 360 || west < -180 || east > 180) {
+        west = -180;
+        east = 180;
+    }
+    south = Math.max(-90, south);
+    north = Math.min(90, north);
+    if (west > east || south > north) {
+        return null;
+    }
+    return [west, south, east, north];
+}
+
+function contains(bbox, position) {
+    return bbox !== null &&
+        position.lng >= bbox[0] && position.lng <= bbox[2] &&
+        position.lat >= bbox[1] && position.lat <= bbox[3];
+}
+
+module.exports = SubscriptionIndex;
@@ -0,0 +1,279 @@
+/*
+ * Track Cache
+ * Recent fixes per device in fixed-size typed-array rings
+ *
+ * Every live fix lands here, so trails for the WebSocket init message and
+ * recent /api/history windows are answered from memory instead of MySQL.
+ * Each device owns one ring stored as parallel typed arrays (no per-fix
+ * objects for the GC to trace), kept sorted by timestamp. Values are rounded
+ * to the precision of the positions columns so a cached answer matches the
+ * database one. `coveredFrom` is the timestamp from which the ring is known
+ * to hold every fix; requests reaching further back go to the database.
+ * Devices beyond maxDevices are evicted least recently updated first.
+ */
+
+const BYTES_PER_POINT = 8 * 4 + 4 * 2 + 1 + 2;
+
+// Fields a cached point can answer, matching positions columns
+const TRACK_FIELDS = ['device_id', 'lat', 'lng', 'speed', 'heading', 'satellites', 'source', 'timestamp', 'received_at'];
+
+class TrackRing {
+    constructor(capacity) {
+        this.capacity = capacity;
+        this.start = 0;
+        this.length = 0;
+        this.coveredFrom = null;
+
+        this.lat = new Float64Array(capacity);
+        this.lng = new Float64Array(capacity);
+        this.timestamp = new Float64Array(capacity);
+        this.receivedAt = new Float64Array(capacity);
+        this.speed = new Int32Array(capacity); // hundredths, DECIMAL(5, 2)
+        this.heading = new Int32Array(capacity); // hundredths, DECIMAL(5, 2)
+        this.satellites = new Uint8Array(capacity);
+        this.source = new Uint16Array(capacity); // index into TrackCache.sources
+    }
+
+    slot(i) {
+        return (this.start + i) % this.capacity;
+    }
+
+    // First logical index with timestamp >= value
+    lowerBound(value) {
+        let low = 0;
+        let high = this.length;
+        while (low < high) {
+            const mid = (low + high) >> 1;
+            if (this.timestamp[this.slot(mid)] < value) {
+                low = mid + 1;
+            } else {
+                high = mid;
+            }
+        }
+        return low;
+    }
+
+    copy(from, to) {
+        this.lat[to] = this.lat[from];
+        this.lng[to] = this.lng[from];
+        this.timestamp[to] = this.timestamp[from];
+        this.receivedAt[to] = this.receivedAt[from];
+        this.speed[to] = this.speed[from];
+        this.heading[to] = this.heading[from];
+        this.satellites[to] = this.satellites[from];
+        this.source[to] = this.source[from];
+    }
+
+    write(slot, position, sourceIndex) {
+        this.lat[slot] = Math.round(position.lat * 1e8) / 1e8;
+        this.lng[slot] = Math.round(position.lng * 1e8) / 1e8;
+        this.timestamp[slot] = position.timestamp;
+        this.receivedAt[slot] = position.received_at;
+        this.speed[slot] = Math.round((position.speed || 0) * 100);
+        this.heading[slot] = Math.round((position.heading || 0) * 100);
+        this.satellites[slot] = Math.min(255, position.satellites || 0);
+        this.source[slot] = sourceIndex;
+    }
+
+    // Returns 'appended', 'inserted', 'replaced' or 'dropped'
+    add(position, sourceIndex) {
+        if (this.coveredFrom === null) {
+            this.coveredFrom = position.timestamp;
+        }
+
+        // Older than what the ring vouches for: the database has the full picture
+        if (position.timestamp < this.coveredFrom) {
+            return 'dropped';
+        }
+
+        const index = this.lowerBound(position.timestamp);
+
+        // Same timestamp again (a retried upload): keep one copy
+        if (index < this.length && this.timestamp[this.slot(index)] === position.timestamp) {
+            this.write(this.slot(index), position, sourceIndex);
+            return 'replaced';
+        }
+
+        if (this.length === this.capacity) {
+            if (index === 0) {
+                return 'dropped'; // would be evicted straight away
+            }
+            // Evict the oldest; coverage now starts just after it
+            this.coveredFrom = this.timestamp[this.start] + 1;
+            this.start = (this.start + 1) % this.capacity;
+            this.length--;
+            return this.insertAt(index - 1, position, sourceIndex);
+        }
+
+        return this.insertAt(index, position, sourceIndex);
+    }
+
+    insertAt(index, position, sourceIndex) {
+        // Late fixes shift the newer tail up by one; in-order fixes shift nothing
+        for (let i = this.length; i > index; i--) {
+            this.copy(this.slot(i - 1), this.slot(i));
+        }
+        this.write(this.slot(index), position, sourceIndex);
+        this.length++;
+        return index === this.length - 1 ? 'appended' : 'inserted';
+    }
+}
+
+class TrackCache {
+    constructor(options = {}) {
+        this.options = {
+            pointsPerDevice: 500,
+            maxDevices: 2000,
+            ...options
+        };
+
+        this.rings = new Map(); // device_id -> TrackRing, least recently updated first
+        this.sources = [];
+        this.sourceIndex = new Map();
+
+        this.stats = { hits: 0, misses: 0, appended: 0, inserted: 0, replaced: 0, dropped: 0, evictedDevices: 0 };
+    }
+
+    internSource(source) {
+        const name = source || 'unknown';
+        let index = this.sourceIndex.get(name);
+        if (index === undefined) {
+            if (this.sources.length >= 65535) {
+                return this.internSource('unknown');
+            }
+            index = this.sources.length;
+            this.sources.push(name);
+            this.sourceIndex.set(name, index);
+        }
+        return index;
+    }
+
+    add(position) {
+        let ring = this.rings.get(position.device_id);
+        if (ring) {
+            // Map order doubles as the LRU list
+            this.rings.delete(position.device_id);
+        } else {
+            ring = new TrackRing(this.options.pointsPerDevice);
+            if (this.rings.size >= this.options.maxDevices) {
+                this.rings.delete(this.rings.keys().next().value);
+                this.stats.evictedDevices++;
+            }
+        }
+        this.rings.set(position.device_id, ring);
+
+        this.stats[ring.add(position, this.internSource(position.source))]++;
+    }
+
+    // Forget everything, e.g. after fixes may have been missed
+    clear() {
+        this.rings.clear();
+    }
+
+    canAnswer(fields) {
+        return fields.every(field => TRACK_FIELDS.includes(field));
+    }
+
+    point(device_id, ring, slot, fields) {
+        const point = {};
+        for (const field of fields) {
+            switch (field) {
+                case 'device_id': point.device_id = device_id; break;
+                case 'lat': point.lat = ring.lat[slot]; break;
+                case 'lng': point.lng = ring.lng[slot]; break;
+                case 'speed': point.speed = ring.speed[slot] / 100; break;
+                case 'heading': point.heading = ring.heading[slot] / 100; break;
+                case 'satellites': point.satellites = ring.satellites[slot]; break;
+                case 'source': point.source = this.sources[ring.source[slot]]; break;
+                case 'timestamp': point.timestamp = ring.timestamp[slot]; break;
+                case 'received_at': point.received_at = ring.receivedAt[slot]; break;
+            }
+        }
+        return point;
+    }
+
+    /*
+     * Answer a history page from memory, or return null when the ring cannot
+     * prove it holds every matching fix. from/to bound the timestamp (to
+     * exclusive), order is 'asc' or 'desc'. The page never ends inside a run
+     * of equal timestamps, so it can be continued past nextTimestamp with a
+     * timestamp-only cursor.
+     */
+    query(device_id, { from, to, order, limit, fields }) {
+        const ring = this.rings.get(device_id);
+        if (!ring || ring.length === 0) {
+            this.stats.misses++;
+            return null;
+        }
+
+        const lowIndex = from !== null ? ring.lowerBound(from) : 0;
+        const highIndex = to !== null ? ring.lowerBound(to) : ring.length;
+        const available = Math.max(0, highIndex - lowIndex);
+        const rangeCovered = from !== null && from >= ring.coveredFrom;
+
+        // Newest-first pages only need the newest `limit` fixes to be covered
+        const covered = rangeCovered || (order === 'desc' && available >= limit);
+        if (!covered) {
+            this.stats.misses++;
+            return null;
+        }
+
+        const take = Math.min(limit, available);
+        let indices = [];
+        for (let i = 0; i < take; i++) {
+            indices.push(order === 'desc' ? highIndex - 1 - i : lowIndex + i);
+        }
+
+        // Without full coverage older fixes may still exist in the database
+        const more = available > take || !rangeCovered;
+        if (more && take > 0) {
+            // Trim a timestamp tie straddling the page boundary
+            const nextIndex = order === 'desc' ? highIndex - 1 - take : lowIndex + take;
+            const boundary = ring.timestamp[ring.slot(indices[take - 1])];
+            if (nextIndex >= 0 && nextIndex < ring.length && ring.timestamp[ring.slot(nextIndex)] === boundary) {
+                indices = indices.filter(index => ring.timestamp[ring.slot(index)] !== boundary);
+                if (indices.length === 0) {
+                    this.stats.misses++;
+                    return null;
+                }
+            }
+        }
+
+        this.stats.hits++;
+        return {
+            positions: indices.map(index => this.point(device_id, ring, ring.slot(index), fields)),
+            nextTimestamp: more && indices.length > 0 ? ring.timestamp[ring.slot(indices[indices.length - 1])] : null
+        };
+    }
+
+    // Newest `count` points as [lat, lng] pairs, oldest first
+    trail(device_id, count) {
+        const ring = this.rings.get(device_id);
+        if (!ring) {
+            return [];
+        }
+
+        const trail = [];
+        for (let i = Math.max(0, ring.length - count); i < ring.length; i++) {
+            const slot = ring.slot(i);
+            trail.push([ring.lat[slot], ring.lng[slot]]);
+        }
+        return trail;
+    }
+
+    getStats() {
+        let points = 0;
+        this.rings.forEach(ring => {
+            points += ring.length;
+        });
+
+        return {
+            ...this.stats,
+            devices: this.rings.size,
+            points,
+            allocatedBytes: this.rings.size * this.options.pointsPerDevice * BYTES_PER_POINT
+        };
+    }
+}
+
+module.exports = TrackCache;
@@ -0,0 +1,83 @@
+/*
+ * Update Frame
+ * Compact binary encoding of a tick's worth of live position updates
+ *
+ * Layout (little-endian, columns so the browser can map them as typed arrays):
+ *   header      u8 type (1), u8 version (3), u16 reserved, u32 count, f64 server time,
+ *               f64 stream sequence number (see live-fanout.js)
+ *   columns     f64 lat[n], f64 lng[n], f64 timestamp[n], f64 received_at[n],
+ *               f32 speed[n], f32 heading[n], f32 accuracy[n] (metres, 0 for
+ *               GNSS fixes), u8 satellites[n]
+ *   strings     n x (u16 byte length + UTF-8 device_id), then
+ *               n x (u8 byte length + UTF-8 source)
+ *
+ * Every column starts at a multiple of its element size, so the decoder in
+ * public/main.js can use Float64Array/Float32Array views without copying.
+ * About 65 bytes per update against ~200 for the JSON form.
+ */
+
+const FRAME_UPDATES = 1;
+const FRAME_VERSION = 3;
+const HEADER_BYTES = 24;
+
+function encodeUpdateFrame(positions, now = Date.now(), seq = 0) {
+    const count = positions.length;
+    const ids = positions.map(position => Buffer.from(String(position.device_id)));
+    const sources = positions.map(position => Buffer.from(String(position.source || 'unknown')).subarray(0, 255));
+
+    const columnBytes = count * (8 * 4 + 4 * 3 + 1);
+    let stringBytes = 0;
+    for (let i = 0; i < count; i++) {
+        stringBytes += 2 + ids[i].length + 1 + sources[i].length;
+    }
+
+    const buffer = Buffer.alloc(HEADER_BYTES + columnBytes + stringBytes);
+    buffer.writeUInt8(FRAME_UPDATES, 0);
+    buffer.writeUInt8(FRAME_VERSION, 1);
+    buffer.writeUInt32LE(count, 4);
+    buffer.writeDoubleLE(now, 8);
+    buffer.writeDoubleLE(seq, 16);
+
+    // Buffer.alloc never slices the shared pool, so byteOffset is 0 and the
+    // columns are aligned; typed arrays are host-endian (little-endian here)
+    let offset = HEADER_BYTES;
+    const column = (Type) => {
+        const view = new Type(buffer.buffer, buffer.byteOffset + offset, count);
+        offset += count * Type.BYTES_PER_ELEMENT;
+        return view;
+    };
+
+    const lat = column(Float64Array);
+    const lng = column(Float64Array);
+    const timestamp = column(Float64Array);
+    const receivedAt = column(Float64Array);
+    const speed = column(Float32Array);
+    const heading = column(Float32Array);
+    const accuracy = column(Float32Array);
+    const satellites = column(Uint8Array);
+
+    for (let i = 0; i < count; i++) {
+        const position = positions[i];
+        lat[i] = position.lat;
+        lng[i] = position.lng;
+        timestamp[i] = position.timestamp;
+        receivedAt[i] = position.received_at;
+        speed[i] = position.speed || 0;
+        heading[i] = position.heading || 0;
+        accuracy[i] = position.accuracy || 0;
+        satellites[i] = Math.min(255, position.satellites || 0);
+    }
+
+    for (let i = 0; i < count; i++) {
+        offset = buffer.writeUInt16LE(ids[i].length, offset);
+        offset += ids[i].copy(buffer, offset);
+    }
+    for (let i = 0; i < count; i++) {
+        offset = buffer.writeUInt8(sources[i].length, offset);
+        offset += sources[i].copy(buffer, offset);
+    }
+
+    return buffer;
+}
+
+module.exports = { FRAME_UPDATES, FRAME_VERSION, encodeUpdateFrame };
@@ -4,24 +4,44 @@
 -- Use the database
 USE tracker_gps;
 
--- Create positions table
+-- Create positions table (range partitioned by timestamp, see db/migrate.sql)
 CREATE TABLE IF NOT EXISTS positions (
-    id INT AUTO_INCREMENT PRIMARY KEY,
+    id BIGINT NOT NULL AUTO_INCREMENT,
     device_id VARCHAR(255) NOT NULL,
     lat DECIMAL(10, 8) NOT NULL,
     lng DECIMAL(11, 8) NOT NULL,
+    cell BIGINT UNSIGNED,
     speed DECIMAL(5, 2) DEFAULT 0,
     heading DECIMAL(5, 2) DEFAULT 0,
     satellites INT DEFAULT 0,
     source VARCHAR(50) DEFAULT 'unknown',
     timestamp BIGINT NOT NULL,
     received_at BIGINT NOT NULL,
+    seq INT UNSIGNED,
     created_at TIMESTAMP DEFAULT CURRENT_TIMESTAMP,
-    INDEX idx_device_id (device_id),
-    INDEX idx_timestamp (timestamp),
+    PRIMARY KEY (id, timestamp),
+    UNIQUE KEY uniq_device_seq (device_id, seq, timestamp),
     INDEX idx_received_at (received_at),
     INDEX idx_device_timestamp (device_id, timestamp),
+    INDEX idx_cell_timestamp (cell, timestamp),
     INDEX idx_source (source)
+)
+PARTITION BY RANGE (timestamp) (
+    PARTITION pmax VALUES LESS THAN MAXVALUE
+);
+
+-- Create latest-position table (one row per device, see db/migrate.sql)
+CREATE TABLE IF NOT EXISTS device_latest (
+    device_id VARCHAR(255) PRIMARY KEY,
+    lat DECIMAL(10, 8) NOT NULL,
+    lng DECIMAL(11, 8) NOT NULL,
+    speed DECIMAL(5, 2) DEFAULT 0,
+    heading DECIMAL(5, 2) DEFAULT 0,
+    satellites INT DEFAULT 0,
+    source VARCHAR(50) DEFAULT 'unknown',
+    timestamp BIGINT NOT NULL,
+    received_at BIGINT NOT NULL,
+    INDEX idx_received_at (received_at)
 );
 
 -- Create devices table
@@ -72,6 +92,14 @@ CREATE TABLE IF NOT EXISTS heartbeats (
     INDEX idx_device_timestamp (device_id, timestamp)
 );
 
+-- Create device_credentials table (per-device token hashes, see db/migrate.sql)
+CREATE TABLE IF NOT EXISTS device_credentials (
+    device_id VARCHAR(255) PRIMARY KEY,
+    token_hash BINARY(32) NOT NULL,
+    created_at TIMESTAMP DEFAULT CURRENT_TIMESTAMP,
+    updated_at TIMESTAMP DEFAULT CURRENT_TIMESTAMP ON UPDATE CURRENT_TIMESTAMP
+);
+
 -- Insert sample devices for testing
 INSERT IGNORE INTO devices (device_id, name, description, device_type) VALUES
 ('test_01', 'Test Vehicle 1', 'Sample vehicle for testing', 'vehicle'),
@@ -24,8 +24,15 @@ module.exports = {
             DEVICE_TOKEN: 'default_token',
             HISTORY_POINTS: 500,
             ONLINE_WINDOW_S: 60,
+            POSITIONS_RETENTION_DAYS: 90,
             POLL_INTERVAL_MS: 5000,
+            INGEST_BATCH_ROWS: 500,
+            INGEST_FLUSH_MS: 50,
+            INGEST_MAX_QUEUED: 20000,
+            INGEST_MAX_IN_FLIGHT: 2,
             MQTT_ENABLED: false,
+            MQTT_SHARED_GROUP: 'ingest',
+            CLUSTER_BUS_PORT: 3900,
             RATE_LIMIT_WINDOW_MS: 900000,
             RATE_LIMIT_MAX_REQUESTS: 100,
             LOG_LEVEL: 'info'
@@ -43,17 +50,37 @@ module.exports = {
             DB_PASSWORD: process.env.DB_PASSWORD || 'abhayd95',
             DB_CONNECTION_LIMIT: parseInt(process.env.DB_CONNECTION_LIMIT) || 10,
             DEVICE_TOKEN: process.env.DEVICE_TOKEN || 'change_this_token',
+            DEVICE_SHARED_TOKEN: process.env.DEVICE_SHARED_TOKEN || 'true',
+            DEVICE_TOKEN_SECRET: process.env.DEVICE_TOKEN_SECRET || 'change_this_device_token_secret',
             HISTORY_POINTS: parseInt(process.env.HISTORY_POINTS) || 500,
+            HISTORY_MAX_LIMIT: parseInt(process.env.HISTORY_MAX_LIMIT) || 5000,
+            HISTORY_MAX_POINTS: parseInt(process.env.HISTORY_MAX_POINTS) || 10000,
+            TRACK_CACHE_POINTS: parseInt(process.env.TRACK_CACHE_POINTS) || 500,
+            TRACK_CACHE_DEVICES: parseInt(process.env.TRACK_CACHE_DEVICES) || 2000,
             ONLINE_WINDOW_S: parseInt(process.env.ONLINE_WINDOW_S) || 60,
+            POSITIONS_RETENTION_DAYS: parseInt(process.env.POSITIONS_RETENTION_DAYS) || 90,
+            POSITIONS_PARTITION: process.env.POSITIONS_PARTITION || 'day',
             POLL_INTERVAL_MS: parseInt(process.env.POLL_INTERVAL_MS) || 5000,
+            INGEST_BATCH_ROWS: parseInt(process.env.INGEST_BATCH_ROWS) || 500,
+            INGEST_FLUSH_MS: parseInt(process.env.INGEST_FLUSH_MS) || 50,
+            INGEST_MAX_QUEUED: parseInt(process.env.INGEST_MAX_QUEUED) || 20000,
+            INGEST_MAX_IN_FLIGHT: parseInt(process.env.INGEST_MAX_IN_FLIGHT) || 2,
             MQTT_ENABLED: process.env.MQTT_ENABLED === 'true',
             MQTT_BROKER_HOST: process.env.MQTT_BROKER_HOST || 'localhost',
             MQTT_PORT: parseInt(process.env.MQTT_PORT) || 1883,
             MQTT_USERNAME: process.env.MQTT_USERNAME || '',
             MQTT_PASSWORD: process.env.MQTT_PASSWORD || '',
+            MQTT_SHARED_GROUP: process.env.MQTT_SHARED_GROUP || 'ingest',
+            MQTT_AUTH_HOST: process.env.MQTT_AUTH_HOST || '127.0.0.1',
+            MQTT_AUTH_PORT: parseInt(process.env.MQTT_AUTH_PORT) || 3100,
+            CLUSTER_BUS_PORT: parseInt(process.env.CLUSTER_BUS_PORT) || 3900,
             RATE_LIMIT_WINDOW_MS: parseInt(process.env.RATE_LIMIT_WINDOW_MS) || 900000,
             RATE_LIMIT_MAX_REQUESTS: parseInt(process.env.RATE_LIMIT_MAX_REQUESTS) || 100,
-            LOG_LEVEL: process.env.LOG_LEVEL || 'info'
+            LOG_LEVEL: process.env.LOG_LEVEL || 'info',
+            LOG_SAMPLE_FIXES: parseInt(process.env.LOG_SAMPLE_FIXES) || 100,
+            CELL_DB_FILE: process.env.CELL_DB_FILE || '',
+            CELL_DB_MCC: process.env.CELL_DB_MCC || '',
+            CELL_DEFAULT_RANGE_M: parseInt(process.env.CELL_DEFAULT_RANGE_M) || 1000
         },
 
         // Process management
@@ -67,7 +94,7 @@ module.exports = {
         log_file: './logs/combined.log',
         out_file: './logs/out.log',
         error_file: './logs/error.log',
-        log_date_format: 'YYYY-MM-DD HH:mm:ss Z',
+        // No log_date_format: the server writes JSON lines with their own time
         merge_logs: true,
 
         // Advanced options
@@ -82,8 +109,8 @@ module.exports = {
         health_check_grace_period: 30000,
         health_check_fatal_exceptions: true,
 
-        // Cluster options
-        increment_var: 'PORT',
+        // Cluster options: all workers share PORT through the cluster module and
+        // exchange live updates over the cluster bus (CLUSTER_BUS_PORT)
 
         // Source map support
         source_map_support: true,
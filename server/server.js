@@ -22,6 +22,23 @@ const mqtt = require('mqtt');
 const bcrypt = require('bcryptjs');
 const jwt = require('jsonwebtoken');
 const { body, validationResult } = require('express-validator');
+const IngestQueue = require('./lib/ingest-queue');
+const DeviceStatsAggregator = require('./lib/device-stats');
+const ClusterBus = require('./lib/cluster-bus');
+const PartitionManager = require('./lib/partition-manager');
+const TrackDownsampler = require('./lib/downsample');
+const TrackCache = require('./lib/track-cache');
+const SubscriptionIndex = require('./lib/subscription-index');
+const LiveFanout = require('./lib/live-fanout');
+const HeartbeatStore = require('./lib/heartbeat-store');
+const DedupWindow = require('./lib/dedup-window');
+const MetricsRegistry = require('./lib/metrics');
+const PresenceTracker = require('./lib/presence');
+const Logger = require('./lib/logger');
+const DeviceAuth = require('./lib/device-auth');
+const CellResolver = require('./lib/cell-resolver');
+const { PositionExporter, EXPORT_FORMATS } = require('./lib/position-export');
+const { cellId, cellRanges, bboxAround } = require('./lib/geo');
 require('dotenv').config();
 
 // Configuration
@@ -34,11 +51,45 @@ const config = {
     dbUser: process.env.DB_USER || 'root',
     dbPassword: process.env.DB_PASSWORD || 'abhayd95',
     dbConnectionLimit: parseInt(process.env.DB_CONNECTION_LIMIT) || 10,
+    ingestBatchRows: parseInt(process.env.INGEST_BATCH_ROWS) || 500,
+    ingestFlushMs: parseInt(process.env.INGEST_FLUSH_MS) || 50,
+    ingestMaxQueued: parseInt(process.env.INGEST_MAX_QUEUED) || 20000,
+    ingestMaxInFlight: parseInt(process.env.INGEST_MAX_IN_FLIGHT) || 2,
+    dedupWindow: parseInt(process.env.DEDUP_WINDOW) || 1024,
+    backfillLagMs: parseInt(process.env.BACKFILL_LAG_MS) || 120000,
+    backfillNotifyMs: parseInt(process.env.BACKFILL_NOTIFY_MS) || 5000,
+    backfillBatchRows: parseInt(process.env.BACKFILL_BATCH_ROWS) || 2000,
+    heartbeatSampleMs: parseInt(process.env.HEARTBEAT_SAMPLE_MS) || 900000,
+    heartbeatFlushMs: parseInt(process.env.HEARTBEAT_FLUSH_MS) || 5000,
     deviceToken: process.env.DEVICE_TOKEN || 'test_token_123',
+    // Accept DEVICE_TOKEN from devices that have no token of their own yet
+    deviceSharedToken: process.env.DEVICE_SHARED_TOKEN !== 'false',
+    deviceTokenSecret: process.env.DEVICE_TOKEN_SECRET || 'your-device-token-secret-change-this-in-production',
+    deviceAuthCacheSize: parseInt(process.env.DEVICE_AUTH_CACHE_SIZE) || 100000,
+    // OpenCelliD-format cell tower CSV (.csv or .csv.gz) for devices without a GNSS fix ('' disables)
+    cellDbFile: process.env.CELL_DB_FILE || '',
+    cellDbMccs: (process.env.CELL_DB_MCC || '').split(',').map(mcc => parseInt(mcc)).filter(Number.isFinite),
+    cellDefaultRange: parseInt(process.env.CELL_DEFAULT_RANGE_M) || 1000,
     jwtSecret: process.env.JWT_SECRET || 'your-super-secret-jwt-key-change-this-in-production',
     jwtExpiresIn: process.env.JWT_EXPIRES_IN || '24h',
     sessionSecret: process.env.SESSION_SECRET || 'your-session-secret-change-this-in-production',
     historyPoints: parseInt(process.env.HISTORY_POINTS) || 500,
+    historyMaxLimit: parseInt(process.env.HISTORY_MAX_LIMIT) || 5000,
+    historyMaxPoints: parseInt(process.env.HISTORY_MAX_POINTS) || 10000,
+    trackCachePoints: parseInt(process.env.TRACK_CACHE_POINTS) || parseInt(process.env.HISTORY_POINTS) || 500,
+    trackCacheDevices: parseInt(process.env.TRACK_CACHE_DEVICES) || 2000,
+    wsGridDeg: parseFloat(process.env.WS_GRID_DEG) || 1,
+    wsSummaryMs: parseInt(process.env.WS_SUMMARY_MS) || 5000,
+    wsTickMs: parseInt(process.env.WS_TICK_MS) || 200,
+    wsMaxBufferedBytes: parseInt(process.env.WS_MAX_BUFFERED_BYTES) || 1048576,
+    areaMaxRadius: parseInt(process.env.AREA_MAX_RADIUS_M) || 100000,
+    exportMaxConcurrent: parseInt(process.env.EXPORT_MAX_CONCURRENT) || 1,
+    exportMaxDevices: parseInt(process.env.EXPORT_MAX_DEVICES) || 1000,
+    exportGzipLevel: process.env.EXPORT_GZIP_LEVEL !== undefined ? parseInt(process.env.EXPORT_GZIP_LEVEL) : 6,
+    initTrailPoints: process.env.INIT_TRAIL_POINTS !== undefined ? parseInt(process.env.INIT_TRAIL_POINTS) : 100,
+    positionsRetentionDays: process.env.POSITIONS_RETENTION_DAYS !== undefined ? parseInt(process.env.POSITIONS_RETENTION_DAYS) : 90,
+    positionsPartition: process.env.POSITIONS_PARTITION === 'week' ? 'week' : 'day',
+    partitionMaintenanceMs: parseInt(process.env.PARTITION_MAINTENANCE_MS) || 3600000,
     onlineWindowS: parseInt(process.env.ONLINE_WINDOW_S) || 60,
     pollIntervalMs: parseInt(process.env.POLL_INTERVAL_MS) || 5000,
     mqttEnabled: process.env.MQTT_ENABLED === 'true',
@@ -46,15 +97,41 @@ const config = {
     mqttPort: parseInt(process.env.MQTT_PORT) || 1883,
     mqttUsername: process.env.MQTT_USERNAME || '',
     mqttPassword: process.env.MQTT_PASSWORD || '',
+    // Broker auth hooks listen here, apart from the public port (0 disables)
+    mqttAuthPort: process.env.MQTT_AUTH_PORT !== undefined ? parseInt(process.env.MQTT_AUTH_PORT) : 3100,
+    mqttAuthHost: process.env.MQTT_AUTH_HOST || '127.0.0.1',
+    // Shared subscription group so each fix is ingested by one worker only ('' disables)
+    mqttSharedGroup: process.env.MQTT_SHARED_GROUP !== undefined ? process.env.MQTT_SHARED_GROUP : 'ingest',
+    // Cross-worker fan-out; on by default under PM2 (which sets NODE_APP_INSTANCE)
+    clusterBus: process.env.CLUSTER_BUS !== undefined ? process.env.CLUSTER_BUS === 'true' : process.env.NODE_APP_INSTANCE !== undefined,
+    clusterBusPort: parseInt(process.env.CLUSTER_BUS_PORT) || 3900,
     rateLimitWindowMs: parseInt(process.env.RATE_LIMIT_WINDOW_MS) || 60000, // 1 minute
     rateLimitMaxRequests: parseInt(process.env.RATE_LIMIT_MAX_REQUESTS) || 1000, // Much higher for development
-    logLevel: process.env.LOG_LEVEL || 'info'
+    logLevel: process.env.LOG_LEVEL || 'info', // trace, debug, info, warn, error or silent
+    // Per-fix log lines (track requests, fixes, MQTT messages): one in logSampleFixes is written
+    logSampleFixes: parseInt(process.env.LOG_SAMPLE_FIXES) || 100
 };
 
+// Structured logs on stdout; see lib/logger.js
+const logger = new Logger({ level: config.logLevel, base: { worker: process.env.NODE_APP_INSTANCE || '0' } });
+const fixLog = logger.sample(config.logSampleFixes);
+process.on('exit', () => logger.flushSync());
+
 // Global state
 let db;
+let positionCells = false; // positions.cell exists (db/add-position-cells.sql on older databases)
+let positionSeq = false; // positions.seq and its unique key exist (db/add-position-seq.sql on older databases)
+let positionExporter;
 let wss;
 let mqttClient;
+let ingestQueue;
+let backfillQueue;
+let heartbeatStore;
+let deviceAuth;
+let cellResolver;
+let deviceStats;
+let clusterBus;
+let partitionManager;
 
 // Authentication middleware
 const authenticateToken = (req, res, next) => {
@@ -82,7 +159,36 @@ const requireAuth = (req, res, next) => {
     next();
 };
 const devicePositions = new Map(); // device_id -> latest position
+const trackCache = new TrackCache({
+    pointsPerDevice: config.trackCachePoints,
+    maxDevices: config.trackCacheDevices
+});
+// Whole words only; the bitmap is kept in 32-seq words
+const dedupWindow = new DedupWindow({ windowSize: Math.max(32, Math.ceil(config.dedupWindow / 32) * 32) });
+const presence = new PresenceTracker({ windowMs: config.onlineWindowS * 1000 });
+const backfillPending = new Map(); // device_id -> { from, to, count, newest } since the last history_changed
+const backfillStats = { live: 0, backfill: 0, notifications: 0 };
 const wsClients = new Set();
+const subscriptions = new SubscriptionIndex({ cellDeg: config.wsGridDeg });
+// Prometheus metrics (/metrics); one registry per worker
+const metrics = new MetricsRegistry({ worker: process.env.NODE_APP_INSTANCE || '0' });
+const fixesReceived = metrics.counter('gps_fixes_received_total', 'Fixes received, by transport and how they were handled', ['transport', 'kind']);
+const fixDelay = metrics.histogram('gps_fix_delay_seconds', 'Device timestamp to server receipt', ['transport'],
+    [0.25, 0.5, 1, 2.5, 5, 10, 30, 60, 120, 300, 900, 3600]);
+const commitLatency = metrics.histogram('gps_ingest_commit_seconds', 'Server receipt to database commit', ['queue']);
+const sendLatency = metrics.histogram('gps_ws_send_seconds', 'Server receipt to WebSocket send');
+const dbPoolWait = metrics.histogram('gps_db_pool_wait_seconds', 'Wait for a MySQL pool connection', ['pool']);
+const eventLoopLag = metrics.histogram('gps_event_loop_lag_seconds', 'Event loop lag (late 100 ms timer)', [],
+    [0.001, 0.005, 0.01, 0.025, 0.05, 0.1, 0.25, 0.5, 1, 2.5]);
+const mqttReconnects = metrics.counter('gps_mqtt_reconnects_total', 'MQTT client reconnect attempts');
+const deviceStatus = metrics.counter('gps_device_status_total', 'Device online/offline status messages (offline includes MQTT Last Wills)', ['status']);
+const cellFixes = metrics.counter('gps_cell_fixes_total', 'Cell fixes from devices without GNSS, by how they resolved', ['match']);
+
+const liveFanout = new LiveFanout(subscriptions, {
+    tickMs: config.wsTickMs,
+    maxBufferedBytes: config.wsMaxBufferedBytes,
+    sendLatency
+});
 let serverStartTime = Date.now();
 
 // Express app setup
@@ -119,9 +225,26 @@ app.use(express.urlencoded({ extended: true }));
 // Serve static files
 app.use(express.static(path.join(__dirname, '../public')));
 
-// Logging middleware
+// Logging middleware; device posts are sampled like the other per-fix logs
 app.use((req, res, next) => {
-    console.log(`${new Date().toISOString()} - ${req.method} ${req.path} - ${req.ip}`);
+    if (!logger.enabled('info')) {
+        return next();
+    }
+    const started = process.hrtime.bigint();
+    res.on('finish', () => {
+        const fields = {
+            method: req.method,
+            path: req.path,
+            status: res.statusCode,
+            ms: Number(process.hrtime.bigint() - started) / 1e6,
+            ip: req.ip
+        };
+        if (req.path === '/api/track') {
+            fixLog.info('request', fields);
+        } else {
+            logger.info('request', fields);
+        }
+    });
     next();
 });
 
@@ -148,7 +271,7 @@ app.post('/api/auth/register', [
 
         const { username, email, password, full_name } = req.body;
 
-        console.log(`Registration attempt for username: ${username}, email: ${email}`);
+        logger.info('Registration attempt', { username, email });
 
         // Check if user already exists
         const [existingUsers] = await db.execute(
@@ -158,7 +281,7 @@ app.post('/api/auth/register', [
         if (existingUsers.length > 0) {
             const existingUser = existingUsers[0];
             const conflictField = existingUser.username === username ? 'username' : 'email';
-            console.log(`Registration failed - ${conflictField} already exists: ${existingUser[conflictField]}`);
+            logger.info('Registration failed: already exists', { field: conflictField, value: existingUser[conflictField] });
             return res.status(409).json({ 
                 error: `${conflictField === 'username' ? 'Username' : 'Email'} already exists`,
                 field: conflictField
@@ -167,7 +290,7 @@ app.post('/api/auth/register', [
 
         // Hash password with higher salt rounds for better security
         const passwordHash = await bcrypt.hash(password, 12);
-        console.log(`Password hashed successfully for user: ${username}`);
+        logger.debug('Password hashed', { username });
 
         // Create user with default role
         const [result] = await db.execute(
@@ -175,7 +298,7 @@ app.post('/api/auth/register', [
             [username, email, passwordHash, full_name || null, 'user', true]
         );
 
-        console.log(`User created successfully: ID ${result.insertId}, Username: ${username}`);
+        logger.info('User created', { user_id: result.insertId, username });
 
         res.status(201).json({
             message: 'User created successfully',
@@ -189,7 +312,7 @@ app.post('/api/auth/register', [
         });
 
     } catch (error) {
-        console.error('Registration error:', error);
+        logger.error('Registration error', error);
         res.status(500).json({ 
             error: 'Internal server error',
             message: 'Failed to create user account'
@@ -255,7 +378,7 @@ app.post('/api/auth/login', [
         });
 
     } catch (error) {
-        console.error('Login error:', error);
+        logger.error('Login error', error);
         res.status(500).json({ error: 'Internal server error' });
     }
 });
@@ -273,7 +396,7 @@ app.get('/api/auth/profile', authenticateToken, async(req, res) => {
 
         res.json({ user: users[0] });
     } catch (error) {
-        console.error('Profile error:', error);
+        logger.error('Profile error', error);
         res.status(500).json({ error: 'Internal server error' });
     }
 });
@@ -286,7 +409,7 @@ app.post('/api/auth/logout', authenticateToken, async (req, res) => {
         if (token) {
             // Add token to blacklist (in production, use Redis or database)
             // For now, we'll just log the logout
-            console.log(`User ${req.user.username} logged out at ${new Date().toISOString()}`);
+            logger.info('User logged out', { username: req.user.username });
             
             // In a production environment, you would:
             // 1. Store the token in a blacklist (Redis recommended)
@@ -305,7 +428,7 @@ app.post('/api/auth/logout', authenticateToken, async (req, res) => {
             timestamp: new Date().toISOString()
         });
     } catch (error) {
-        console.error('Logout error:', error);
+        logger.error('Logout error', error);
         res.status(500).json({ error: 'Internal server error' });
     }
 });
@@ -318,54 +441,167 @@ app.get('/api/health', (req, res) => {
         uptime: Date.now() - serverStartTime,
         wsClients: wsClients.size,
         devices: devicePositions.size,
-        mqttConnected: mqttClient ? mqttClient.connected : false
+        mqttConnected: mqttClient ? mqttClient.connected : false,
+        ingest: ingestQueue ? ingestQueue.getStats() : null,
+        backfill: backfillQueue ? { ...backfillStats, queue: backfillQueue.getStats() } : null,
+        heartbeats: heartbeatStore ? heartbeatStore.getStats() : null,
+        dedup: dedupWindow.getStats(),
+        presence: presence.getStats(),
+        clusterBus: clusterBus ? clusterBus.getStats() : null,
+        trackCache: trackCache.getStats(),
+        subscriptions: subscriptions.getStats(),
+        wsFanout: liveFanout.getStats(),
+        exports: positionExporter ? positionExporter.getStats() : null,
+        deviceAuth: deviceAuth ? deviceAuth.getStats() : null,
+        cellResolver: cellResolver ? cellResolver.getStats() : null,
+        logging: logger.getStats()
     });
 });
 
+// State owned elsewhere, read when /metrics is scraped
+metrics.gauge('gps_ws_clients', 'Connected WebSocket clients', [], (gauge) => {
+    gauge.set([], wsClients.size);
+});
+metrics.gauge('gps_ws_buffered_bytes', 'Bytes queued on WebSocket sockets (total and largest client)', ['stat'], (gauge) => {
+    let total = 0;
+    let max = 0;
+    wsClients.forEach((ws) => {
+        total += ws.bufferedAmount;
+        max = Math.max(max, ws.bufferedAmount);
+    });
+    gauge.set(['total'], total);
+    gauge.set(['max'], max);
+});
+metrics.gauge('gps_ingest_queued_rows', 'Fixes queued or in flight to MySQL', ['queue'], (gauge) => {
+    if (ingestQueue) {
+        gauge.set(['live'], ingestQueue.queued);
+        gauge.set(['backfill'], backfillQueue.queued);
+    }
+});
+metrics.counter('gps_ingest_rejected_total', 'Fixes shed because the ingest queue was full', ['queue'], (counter) => {
+    if (ingestQueue) {
+        counter.set(['live'], ingestQueue.stats.rejected);
+        counter.set(['backfill'], backfillQueue.stats.rejected);
+    }
+});
+metrics.counter('gps_duplicates_total', 'Repeated fixes dropped, by where they were caught', ['stage'], (counter) => {
+    counter.set(['memory'], dedupWindow.stats.duplicates);
+    counter.set(['database'], dedupWindow.stats.storedDuplicates);
+});
+metrics.gauge('gps_devices', 'Devices with a known position', [], (gauge) => {
+    gauge.set([], devicePositions.size);
+});
+metrics.gauge('gps_devices_online', 'Devices heard from within ONLINE_WINDOW_S', [], (gauge) => {
+    gauge.set([], presence.onlineCount);
+});
+metrics.gauge('gps_mqtt_connected', 'Whether the MQTT client is connected', [], (gauge) => {
+    gauge.set([], mqttClient && mqttClient.connected ? 1 : 0);
+});
+metrics.counter('gps_device_auth_total', 'Device credential checks, by outcome', ['outcome'], (counter) => {
+    if (deviceAuth) {
+        counter.set(['verified'], deviceAuth.stats.verified);
+        counter.set(['shared'], deviceAuth.stats.shared);
+        counter.set(['rejected'], deviceAuth.stats.rejected);
+    }
+});
+metrics.counter('gps_device_auth_lookups_total', 'Device credential cache lookups (a miss queries MySQL)', ['cache'], (counter) => {
+    if (deviceAuth) {
+        counter.set(['hit'], deviceAuth.stats.hits);
+        counter.set(['miss'], deviceAuth.stats.misses);
+    }
+});
+metrics.counter('gps_log_lines_total', 'Log lines written, dropped (writer behind) or sampled out', ['outcome'], (counter) => {
+    counter.set(['written'], logger.stats.lines);
+    counter.set(['dropped'], logger.stats.dropped);
+    counter.set(['sampled_out'], logger.stats.sampledOut);
+});
+
+app.get('/metrics', (req, res) => {
+    res.set('Content-Type', 'text/plain; version=0.0.4');
+    res.send(metrics.render());
+});
+
 // Device tracking endpoint
 app.post('/api/track', apiLimiter, async(req, res) => {
     try {
-        const { device_id, lat, lng, speed, heading, sats, ts, src } = req.body;
+        const { device_id, speed, heading, sats, ts, src, seq } = req.body;
+        let { lat, lng } = req.body;
         const deviceToken = req.headers['x-device-token'];
 
-        // Validate device token
-        if (deviceToken !== config.deviceToken) {
+        // Validate device token (a cache hit once the device has been seen)
+        if (!(await deviceAuth.verify(device_id, deviceToken))) {
             return res.status(401).json({ error: 'Invalid device token' });
         }
 
+        // The Mega posts its heartbeats here too; they carry no position
+        if (req.body.type === 'heartbeat') {
+            if (!device_id) {
+                return res.status(400).json({ error: 'Missing required field: device_id' });
+            }
+            const received_at = Date.now();
+            recordHeartbeat(device_id, req.body, 'http', received_at);
+            return res.json({ status: 'success', device_id, timestamp: received_at });
+        }
+
+        // No GNSS fix: the device sent its serving cell instead
+        let accuracy;
+        if (lat === undefined && lng === undefined && req.body.cells !== undefined) {
+            const fix = resolveCellFix(req.body.cells);
+            if (!fix) {
+                return res.status(422).json({ error: 'Unknown cell' });
+            }
+            ({ lat, lng, accuracy } = fix);
+        }
+
         // Validate required fields
         if (!device_id || lat === undefined || lng === undefined) {
             return res.status(400).json({ error: 'Missing required fields: device_id, lat, lng' });
         }
 
         // Validate coordinates
-        if (lat < -90 || lat > 90 || lng < -180 || lng > 180) {
+        const coordinates = parseCoordinates(lat, lng);
+        if (!coordinates) {
+            fixesReceived.inc(['http', 'invalid']);
             return res.status(400).json({ error: 'Invalid coordinates' });
         }
 
-        const timestamp = ts || Date.now();
+        const received_at = Date.now();
+        const timestamp = deviceTimestamp(ts, received_at);
         const position = {
             device_id,
-            lat: parseFloat(lat),
-            lng: parseFloat(lng),
+            lat: coordinates.lat,
+            lng: coordinates.lng,
             speed: parseFloat(speed) || 0,
             heading: parseFloat(heading) || 0,
             satellites: parseInt(sats) || 0,
             source: src || 'http',
+            seq: deviceSeq(seq),
             timestamp,
-            received_at: Date.now()
+            received_at
         };
+        if (accuracy !== undefined) {
+            position.accuracy = accuracy;
+        }
+
+        // A retransmit is acknowledged like the original so the device drops it
+        if (isDuplicate(position)) {
+            fixesReceived.inc(['http', 'duplicate']);
+            return res.json({ status: 'duplicate', device_id, timestamp: received_at });
+        }
+        observeFixDelay('http', position);
 
-        // Update in-memory state
-        devicePositions.set(device_id, position);
+        // A fix the queue will refuse (503) is never shown live
+        admitPosition(position);
 
-        // Save to database
-        await savePosition(position);
+        // Update in-memory state and WebSocket clients on every worker
+        // (live view does not wait for the group commit)
+        const live = publishPosition(position);
+        fixesReceived.inc(['http', live ? 'live' : 'backfill']);
 
-        // Broadcast to WebSocket clients
-        broadcastUpdate(position);
+        // Save to database; resolves once the batch holding this fix is committed
+        await savePosition(position, live);
 
-        console.log(`Position update from ${device_id}: ${lat}, ${lng}`);
+        fixLog.debug('Position update', { device_id, lat: position.lat, lng: position.lng, transport: 'http', live });
 
         res.json({
             status: 'success',
@@ -374,22 +610,38 @@ app.post('/api/track', apiLimiter, async(req, res) => {
         });
 
     } catch (error) {
-        console.error('Error processing tracking data:', error);
+        if (error.code === 'EINGESTFULL') {
+            res.set('Retry-After', '1');
+            return res.status(503).json({ error: 'Ingest queue full, retry later' });
+        }
+        logger.error('Error processing tracking data', error);
         res.status(500).json({ error: 'Internal server error' });
     }
 });
 
-// Get latest positions
+// Get latest positions (?bbox=west,south,east,north limits them to a map view,
+// ?epoch=&since= to what changed after a live stream sequence number)
 app.get('/api/positions', (req, res) => {
     try {
-        const positions = Array.from(devicePositions.values());
+        let positions = Array.from(devicePositions.values());
+        const bbox = parseBbox(req.query.bbox);
+        if (bbox) {
+            positions = positions.filter(position =>
+                position.lng >= bbox[0] && position.lng <= bbox[2] &&
+                position.lat >= bbox[1] && position.lat <= bbox[3]
+            );
+        }
+        const stream = resumePositions(positions, req.query.epoch, req.query.since);
         res.json({
-            positions,
+            positions: stream.positions,
             timestamp: Date.now(),
-            count: positions.length
+            count: stream.positions.length,
+            epoch: liveFanout.epoch,
+            seq: liveFanout.seq,
+            resync: stream.resync
         });
     } catch (error) {
-        console.error('Error fetching positions:', error);
+        logger.error('Error fetching positions', error);
         res.status(500).json({ error: 'Internal server error' });
     }
 });
@@ -398,16 +650,11 @@ app.get('/api/positions', (req, res) => {
 app.get('/api/stats', (req, res) => {
     try {
         const now = Date.now();
-        const onlineThreshold = config.onlineWindowS * 1000;
-
-        const positions = Array.from(devicePositions.values());
-        const onlineDevices = positions.filter(pos =>
-            (now - pos.received_at) <= onlineThreshold
-        );
 
+        // Both counts are maintained incrementally; nothing here scans the fleet
         const stats = {
-            total_devices: positions.length,
-            online_devices: onlineDevices.length,
+            total_devices: devicePositions.size,
+            online_devices: presence.onlineCount,
             ws_clients: wsClients.size,
             uptime: Date.now() - serverStartTime,
             mqtt_connected: mqttClient ? mqttClient.connected : false,
@@ -416,36 +663,633 @@ app.get('/api/stats', (req, res) => {
 
         res.json(stats);
     } catch (error) {
-        console.error('Error fetching stats:', error);
+        logger.error('Error fetching stats', error);
         res.status(500).json({ error: 'Internal server error' });
     }
 });
 
-// Get device history
-app.get('/api/history/:device_id', async(req, res) => {
+// Device health: latest heartbeat and position (?history=N adds the last N stored heartbeats)
+app.get('/api/devices/:device_id/health', async(req, res) => {
+    const { device_id } = req.params;
+    const historyLimit = req.query.history !== undefined ? parseInt(req.query.history) : 0;
+
+    if (!Number.isFinite(historyLimit) || historyLimit < 0) {
+        return res.status(400).json({ error: 'history must be a non-negative integer' });
+    }
+
+    try {
+        const now = Date.now();
+        const position = devicePositions.get(device_id) || null;
+        let heartbeat = heartbeatStore ? heartbeatStore.get(device_id) : null;
+        let history = [];
+
+        if (!heartbeat || historyLimit > 0) {
+            const [rows] = await db.query(
+                `SELECT timestamp, gps_valid, network_connected, battery_level, signal_strength, free_memory, data, created_at
+                 FROM heartbeats WHERE device_id = ? ORDER BY timestamp DESC LIMIT ?`,
+                [device_id, Math.max(1, Math.min(historyLimit, config.historyMaxLimit))]
+            );
+            history = rows.map(row => ({
+                timestamp: Number(row.timestamp),
+                gps_valid: Boolean(row.gps_valid),
+                network_connected: Boolean(row.network_connected),
+                battery_level: row.battery_level,
+                signal_strength: row.signal_strength,
+                free_memory: row.free_memory,
+                changed: typeof row.data === 'string' ? JSON.parse(row.data) : row.data
+            }));
+
+            // Nothing since this worker started: fall back to the last stored row
+            if (!heartbeat && history.length > 0) {
+                const { changed, ...stored } = history[0];
+                heartbeat = { ...stored, received_at: stored.timestamp, stored: true };
+            }
+        }
+
+        if (!position && !heartbeat) {
+            return res.status(404).json({ error: 'Unknown device' });
+        }
+
+        const lastSeen = Math.max(position ? position.received_at : 0, heartbeat ? heartbeat.received_at : 0);
+        res.json({
+            device_id,
+            online: now - lastSeen <= config.onlineWindowS * 1000,
+            last_seen: lastSeen,
+            heartbeat,
+            heartbeat_age_ms: heartbeat ? now - heartbeat.received_at : null,
+            position,
+            position_age_ms: position ? now - position.received_at : null,
+            history: historyLimit > 0 ? history : undefined,
+            timestamp: now
+        });
+    } catch (error) {
+        logger.error('Error fetching device health', error);
+        res.status(500).json({ error: 'Internal server error' });
+    }
+});
+
+// Device credentials (admin only). The token is returned once; only its HMAC is stored.
+function requireAdmin(req, res, next) {
+    if (req.user.role !== 'admin') {
+        return res.status(403).json({ error: 'Admin role required' });
+    }
+    next();
+}
+
+function credentialChanged(device_id) {
+    if (clusterBus) {
+        clusterBus.publish('credential', { device_id });
+    }
+}
+
+app.post('/api/devices/:device_id/token', authenticateToken, requireAdmin, async(req, res) => {
     try {
         const { device_id } = req.params;
-        const limit = parseInt(req.query.limit) || 100;
+        const token = await deviceAuth.issue(device_id);
+        credentialChanged(device_id);
+        logger.info('Device token issued', { device_id, username: req.user.username });
+        res.json({ device_id, token });
+    } catch (error) {
+        logger.error('Error issuing device token', error);
+        res.status(500).json({ error: 'Internal server error' });
+    }
+});
 
-        try {
-            const [rows] = await db.execute(
-                'SELECT * FROM positions WHERE device_id = ? ORDER BY timestamp DESC LIMIT ?', [device_id, limit]
-            );
+app.delete('/api/devices/:device_id/token', authenticateToken, requireAdmin, async(req, res) => {
+    try {
+        const { device_id } = req.params;
+        if (!(await deviceAuth.revoke(device_id))) {
+            return res.status(404).json({ error: 'Device has no token' });
+        }
+        credentialChanged(device_id);
+        logger.info('Device token revoked', { device_id, username: req.user.username });
+        res.json({ status: 'revoked', device_id });
+    } catch (error) {
+        logger.error('Error revoking device token', error);
+        res.status(500).json({ error: 'Internal server error' });
+    }
+});
+
+/*
+ * MQTT broker authentication (mosquitto-go-auth HTTP backend, JSON params,
+ * status response mode). These hooks are served on their own listener
+ * (MQTT_AUTH_HOST:MQTT_AUTH_PORT), never on the public port, so only the
+ * broker can reach them. Devices log in with their device_id and token. They
+ * may only publish their own track/, heartbeat/, ota/ (update acks), status/
+ * (retained presence and Last Will) and last/ (retained last fix) topics and
+ * read their own control/ and control/<id>/ota topics.
+ *
+ * The server's own MQTT_USERNAME logs in only with MQTT_PASSWORD, never with
+ * a device token. There is no superuser (auth_opt_disable_superuser); the
+ * server gets an explicit ACL: read what devices publish, write their
+ * control topics.
+ */
+const authApp = express();
+authApp.use(express.json());
 
-            res.json({
-                device_id,
-                positions: rows,
-                count: rows.length,
-                timestamp: Date.now()
+function isMqttServer(username, password) {
+    return !!config.mqttUsername && username === config.mqttUsername && password === config.mqttPassword;
+}
+
+authApp.post('/mqtt/auth/user', async(req, res) => {
+    try {
+        const { username, password } = req.body;
+        const allowed = config.mqttUsername && username === config.mqttUsername
+            ? isMqttServer(username, password)
+            : await deviceAuth.verify(username, password);
+        res.sendStatus(allowed ? 200 : 403);
+    } catch (error) {
+        logger.error('Error authenticating MQTT client', error);
+        res.sendStatus(500);
+    }
+});
+
+const MQTT_ACC_READ = 1;
+const MQTT_ACC_SUBSCRIBE = 4;
+
+// Topics the server reads (subscriptions may be shared or use a wildcard id)
+const MQTT_SERVER_READ = /^(track|heartbeat|status|last|ota)\/([^/#+]+|\+|#)$/;
+const MQTT_SERVER_WRITE = /^control\/[^/#+]+(\/ota)?$/;
+
+authApp.post('/mqtt/auth/acl', (req, res) => {
+    const { username, topic } = req.body;
+    const acc = parseInt(req.body.acc);
+    const read = acc === MQTT_ACC_READ || acc === MQTT_ACC_SUBSCRIBE;
+    let allowed;
+    if (config.mqttUsername && username === config.mqttUsername) {
+        allowed = read
+            ? MQTT_SERVER_READ.test(String(topic).replace(/^\$share\/[^/]+\//, ''))
+            : MQTT_SERVER_WRITE.test(topic);
+    } else {
+        allowed = read
+            ? topic === `control/${username}` || topic === `control/${username}/ota`
+            : topic === `track/${username}` || topic === `heartbeat/${username}` || topic === `ota/${username}` ||
+              topic === `status/${username}` || topic === `last/${username}`;
+    }
+    res.sendStatus(allowed ? 200 : 403);
+});
+
+// Columns a history request may project
+const HISTORY_FIELDS = ['id', 'device_id', 'lat', 'lng', 'speed', 'heading', 'satellites', 'source', 'timestamp', 'received_at', 'created_at'];
+const HISTORY_DEFAULT_FIELDS = ['lat', 'lng', 'speed', 'heading', 'satellites', 'source', 'timestamp', 'received_at'];
+const HISTORY_NUMERIC_FIELDS = new Set(['lat', 'lng', 'speed', 'heading']); // DECIMAL columns arrive as strings
+
+function parseHistoryQuery(query) {
+    const parsed = {
+        from: query.from !== undefined ? parseInt(query.from) : null,
+        to: query.to !== undefined ? parseInt(query.to) : null,
+        order: query.order === 'asc' ? 'asc' : 'desc',
+        limit: Math.min(parseInt(query.limit) || 100, config.historyMaxLimit),
+        points: query.points !== undefined ? Math.min(parseInt(query.points), config.historyMaxPoints) : null,
+        cursor: null,
+        fields: HISTORY_DEFAULT_FIELDS
+    };
+
+    if (Number.isNaN(parsed.from) || Number.isNaN(parsed.to)) {
+        return { error: 'from and to must be epoch milliseconds' };
+    }
+    if (parsed.points !== null && !(parsed.points >= 2)) {
+        return { error: 'points must be at least 2' };
+    }
+    if (parsed.limit < 1) {
+        return { error: 'limit must be positive' };
+    }
+
+    if (query.fields) {
+        const fields = String(query.fields).split(',').map(field => field.trim());
+        const unknown = fields.filter(field => !HISTORY_FIELDS.includes(field));
+        if (unknown.length > 0) {
+            return { error: `Unknown fields: ${unknown.join(', ')}` };
+        }
+        parsed.fields = fields;
+    }
+
+    if (query.cursor) {
+        // "timestamp:id", or "timestamp:" to continue strictly past that timestamp
+        const [timestamp, id] = Buffer.from(String(query.cursor), 'base64url').toString().split(':');
+        parsed.cursor = { timestamp: Number(timestamp), id: id === '' ? null : Number(id) };
+        if (!timestamp || !Number.isFinite(parsed.cursor.timestamp) || (parsed.cursor.id !== null && !Number.isFinite(parsed.cursor.id))) {
+            return { error: 'Invalid cursor' };
+        }
+    }
+
+    return parsed;
+}
+
+function encodeHistoryCursor(timestamp, id = '') {
+    return Buffer.from(`${timestamp}:${id}`).toString('base64url');
+}
+
+// WHERE clause over the (device_id, timestamp) index
+function historyRange(device_id, { from, to }) {
+    let where = 'device_id = ?';
+    const params = [device_id];
+    if (from !== null) {
+        where += ' AND timestamp >= ?';
+        params.push(from);
+    }
+    if (to !== null) {
+        where += ' AND timestamp < ?';
+        params.push(to);
+    }
+    return { where, params };
+}
+
+function projectHistoryRow(row, fields) {
+    const projected = {};
+    for (const field of fields) {
+        projected[field] = HISTORY_NUMERIC_FIELDS.has(field) ? Number(row[field]) : row[field];
+    }
+    return projected;
+}
+
+// One keyset page: newest first by default, next_cursor continues after the last row
+async function fetchHistoryPage(device_id, request) {
+    const { where, params } = historyRange(device_id, request);
+    const columns = [...new Set(['id', 'timestamp', ...request.fields])];
+    const descending = request.order === 'desc';
+
+    let keyset = '';
+    if (request.cursor && request.cursor.id === null) {
+        keyset = descending ? ' AND timestamp < ?' : ' AND timestamp > ?';
+        params.push(request.cursor.timestamp);
+    } else if (request.cursor) {
+        // Range on timestamp first so the index bounds the scan, id breaks ties
+        keyset = descending
+            ? ' AND timestamp <= ? AND (timestamp < ? OR id < ?)'
+            : ' AND timestamp >= ? AND (timestamp > ? OR id > ?)';
+        params.push(request.cursor.timestamp, request.cursor.timestamp, request.cursor.id);
+    }
+
+    const direction = descending ? 'DESC' : 'ASC';
+    const [rows] = await db.query(
+        `SELECT ${columns.join(', ')} FROM positions WHERE ${where}${keyset} ORDER BY timestamp ${direction}, id ${direction} LIMIT ?`,
+        [...params, request.limit + 1]
+    );
+
+    const more = rows.length > request.limit;
+    const page = more ? rows.slice(0, request.limit) : rows;
+    return {
+        positions: page.map(row => projectHistoryRow(row, request.fields)),
+        next_cursor: more ? encodeHistoryCursor(page[page.length - 1].timestamp, page[page.length - 1].id) : null
+    };
+}
+
+// The same page from the track cache, or null when it may be incomplete
+function fetchCachedHistoryPage(device_id, request) {
+    if ((request.cursor && request.cursor.id !== null) || !trackCache.canAnswer(request.fields)) {
+        return null;
+    }
+
+    // A timestamp-only cursor just narrows the range
+    let { from, to } = request;
+    if (request.cursor && request.order === 'desc') {
+        to = to === null ? request.cursor.timestamp : Math.min(to, request.cursor.timestamp);
+    } else if (request.cursor) {
+        from = from === null ? request.cursor.timestamp + 1 : Math.max(from, request.cursor.timestamp + 1);
+    }
+
+    const page = trackCache.query(device_id, { ...request, from, to });
+    if (!page) {
+        return null;
+    }
+    return {
+        positions: page.positions,
+        next_cursor: page.nextTimestamp !== null ? encodeHistoryCursor(page.nextTimestamp) : null
+    };
+}
+
+// Downsample a whole range, streaming rows from MySQL into a streamed JSON response
+async function streamDownsampledHistory(device_id, request, res) {
+    const { where, params } = historyRange(device_id, request);
+
+    const [[bounds]] = await db.query(
+        `SELECT MIN(timestamp) AS first, MAX(timestamp) AS last FROM positions WHERE ${where}`, params
+    );
+
+    res.type('application/json');
+    res.write(`{"device_id":${JSON.stringify(device_id)},"downsampled":true,"positions":[`);
+
+    let count = 0;
+    let source = 0;
+    const emit = (row) => {
+        res.write((count++ > 0 ? ',' : '') + JSON.stringify(projectHistoryRow(row, request.fields)));
+    };
+
+    if (bounds.first !== null) {
+        const downsampler = new TrackDownsampler({
+            first: Number(bounds.first),
+            last: Number(bounds.last),
+            points: request.points
+        }, emit);
+
+        const columns = [...new Set(['lat', 'lng', 'timestamp', ...request.fields])];
+        const connection = await db.getConnection();
+        let rows = null;
+        let aborted = false;
+
+        try {
+            await new Promise((resolve, reject) => {
+                rows = connection.connection
+                    .query(`SELECT ${columns.join(', ')} FROM positions WHERE ${where} ORDER BY timestamp ASC`, params)
+                    .stream({ highWaterMark: 1000 });
+
+                res.on('close', () => {
+                    if (!res.writableFinished) {
+                        aborted = true;
+                        reject(new Error('Client disconnected'));
+                    }
+                });
+
+                rows.on('data', (row) => {
+                    row.lat = Number(row.lat);
+                    row.lng = Number(row.lng);
+                    row.timestamp = Number(row.timestamp);
+                    source++;
+                    downsampler.push(row);
+
+                    // Respect socket backpressure instead of buffering the response
+                    if (res.writableNeedDrain && !rows.isPaused()) {
+                        rows.pause();
+                        res.once('drain', () => rows.resume());
+                    }
+                });
+                rows.on('error', reject);
+                rows.on('end', resolve);
             });
+            downsampler.finish();
         } catch (error) {
-            console.error('Database error:', error);
-            res.status(500).json({ error: 'Database error' });
+            if (aborted) {
+                // The result set may still be arriving; drop the connection rather than reuse it
+                rows.destroy();
+                connection.destroy();
+                return;
+            }
+            connection.release();
+            throw error;
         }
+        connection.release();
+    }
+
+    res.end(`],"count":${count},"source_count":${source},"timestamp":${Date.now()}}`);
+}
+
+// ?from=&to=&limit=&group=device for the area endpoints
+function parseAreaQuery(query) {
+    const parsed = {
+        from: query.from !== undefined ? parseInt(query.from) : null,
+        to: query.to !== undefined ? parseInt(query.to) : null,
+        limit: Math.min(parseInt(query.limit) || 1000, config.historyMaxLimit),
+        group: query.group === 'device' ? 'device' : null
+    };
+
+    if (Number.isNaN(parsed.from) || Number.isNaN(parsed.to)) {
+        return { error: 'from and to must be epoch milliseconds' };
+    }
+    if (parsed.limit < 1) {
+        return { error: 'limit must be positive' };
+    }
+    return parsed;
+}
+
+/*
+ * Stored positions inside bbox over [from, to), found through
+ * idx_cell_timestamp: the box becomes a few cell ranges, then lat/lng
+ * (and the circle for /near) filter the cover exactly. With
+ * group=device, one row per device that was inside instead.
+ */
+async function queryArea(bbox, request, circle = null) {
+    const ranges = cellRanges(bbox);
+    const conditions = [`(${ranges.map(() => 'cell BETWEEN ? AND ?').join(' OR ')})`];
+    const params = ranges.flat();
+
+    if (request.from !== null) {
+        conditions.push('timestamp >= ?');
+        params.push(request.from);
+    }
+    if (request.to !== null) {
+        conditions.push('timestamp < ?');
+        params.push(request.to);
+    }
+
+    conditions.push('lat BETWEEN ? AND ?');
+    params.push(bbox[1], bbox[3]);
+    if (bbox[0] <= bbox[2]) {
+        conditions.push('lng BETWEEN ? AND ?');
+        params.push(bbox[0], bbox[2]);
+    } else {
+        conditions.push('(lng >= ? OR lng <= ?)');
+        params.push(bbox[0], bbox[2]);
+    }
+
+    let distance = 'NULL';
+    const distanceParams = [];
+    if (circle) {
+        distance = 'ST_Distance_Sphere(POINT(lng, lat), POINT(?, ?))';
+        distanceParams.push(circle.lng, circle.lat);
+        conditions.push(`${distance} <= ?`);
+        params.push(circle.lng, circle.lat, circle.radius);
+    }
+
+    const where = conditions.join(' AND ');
+    if (request.group === 'device') {
+        const [rows] = await db.query(
+            `SELECT device_id, COUNT(*) AS count, MIN(timestamp) AS first_seen, MAX(timestamp) AS last_seen, MIN(${distance}) AS distance
+             FROM positions FORCE INDEX (idx_cell_timestamp) WHERE ${where}
+             GROUP BY device_id ORDER BY ${circle ? 'distance' : 'last_seen DESC'} LIMIT ?`,
+            [...distanceParams, ...params, request.limit]
+        );
+        return rows.map(row => ({
+            device_id: row.device_id,
+            count: row.count,
+            first_seen: Number(row.first_seen),
+            last_seen: Number(row.last_seen),
+            ...(circle ? { distance: Number(row.distance) } : {})
+        }));
+    }
+
+    const [rows] = await db.query(
+        `SELECT device_id, lat, lng, speed, heading, satellites, source, timestamp, received_at, ${distance} AS distance
+         FROM positions FORCE INDEX (idx_cell_timestamp) WHERE ${where}
+         ORDER BY ${circle ? 'distance' : 'timestamp DESC'} LIMIT ?`,
+        [...distanceParams, ...params, request.limit]
+    );
+    return rows.map(row => ({
+        device_id: row.device_id,
+        lat: Number(row.lat),
+        lng: Number(row.lng),
+        speed: Number(row.speed),
+        heading: Number(row.heading),
+        satellites: row.satellites,
+        source: row.source,
+        timestamp: Number(row.timestamp),
+        received_at: Number(row.received_at),
+        ...(circle ? { distance: Number(row.distance) } : {})
+    }));
+}
+
+async function sendArea(res, bbox, request, circle = null) {
+    if (!positionCells) {
+        return res.status(503).json({ error: 'Area queries need db/add-position-cells.sql applied' });
+    }
+    try {
+        const results = await queryArea(bbox, request, circle);
+        res.json({
+            [request.group === 'device' ? 'devices' : 'positions']: results,
+            count: results.length,
+            timestamp: Date.now()
+        });
     } catch (error) {
-        console.error('Error fetching device history:', error);
+        logger.error('Error querying area', error);
         res.status(500).json({ error: 'Internal server error' });
     }
+}
+
+// Stored positions inside ?bbox=west,south,east,north (west > east crosses the antimeridian)
+//   ?from=&to=        epoch ms range, to exclusive
+//   ?limit=           newest first, capped by HISTORY_MAX_LIMIT
+//   ?group=device     which devices were inside, with counts and first/last timestamps
+app.get('/api/positions/within', async(req, res) => {
+    const bbox = parseBbox(req.query.bbox);
+    const request = parseAreaQuery(req.query);
+    if (!bbox || bbox[1] > bbox[3] || bbox[1] < -90 || bbox[3] > 90) {
+        return res.status(400).json({ error: 'bbox must be west,south,east,north' });
+    }
+    if (request.error) {
+        return res.status(400).json({ error: request.error });
+    }
+    await sendArea(res, bbox, request);
+});
+
+// Stored positions within ?radius= meters of ?lat=&lng=, nearest first; same options as /within
+app.get('/api/positions/near', async(req, res) => {
+    const lat = parseFloat(req.query.lat);
+    const lng = parseFloat(req.query.lng);
+    const radius = parseFloat(req.query.radius);
+    const request = parseAreaQuery(req.query);
+
+    if (!(lat >= -90 && lat <= 90 && lng >= -180 && lng <= 180)) {
+        return res.status(400).json({ error: 'lat and lng are required' });
+    }
+    if (!(radius > 0 && radius <= config.areaMaxRadius)) {
+        return res.status(400).json({ error: `radius must be 1 to ${config.areaMaxRadius} meters` });
+    }
+    if (request.error) {
+        return res.status(400).json({ error: request.error });
+    }
+    await sendArea(res, bboxAround(lat, lng, radius), request, { lat, lng, radius });
+});
+
+// ?format=csv|geojsonseq|ndjson&from=&to=&devices=a,b
+function parseExportQuery(query) {
+    const parsed = {
+        format: query.format || 'csv',
+        from: query.from !== undefined ? parseInt(query.from) : null,
+        to: query.to !== undefined ? parseInt(query.to) : null,
+        devices: query.devices ? String(query.devices).split(',').map(id => id.trim()).filter(Boolean) : null
+    };
+
+    if (!EXPORT_FORMATS[parsed.format]) {
+        return { error: `format must be one of: ${Object.keys(EXPORT_FORMATS).join(', ')}` };
+    }
+    if (Number.isNaN(parsed.from) || Number.isNaN(parsed.to)) {
+        return { error: 'from and to must be epoch milliseconds' };
+    }
+    if (parsed.devices && (parsed.devices.length === 0 || parsed.devices.length > config.exportMaxDevices)) {
+        return { error: `devices must list 1 to ${config.exportMaxDevices} device ids` };
+    }
+    return parsed;
+}
+
+// Stream a gzip'd export as a download; rows never accumulate in memory
+async function sendExport(req, res, request, name) {
+    if (!positionExporter) {
+        return res.status(503).json({ error: 'Database unavailable' });
+    }
+    if (positionExporter.isBusy()) {
+        res.set('Retry-After', '30');
+        return res.status(429).json({ error: 'Another export is running, retry later' });
+    }
+
+    const date = new Date().toISOString().split('T')[0];
+    res.set({
+        'Content-Type': 'application/gzip',
+        'Content-Disposition': `attachment; filename="${name}-${date}.${EXPORT_FORMATS[request.format].extension}.gz"`
+    });
+
+    const started = Date.now();
+    try {
+        const result = await positionExporter.export(request, request.format, res);
+        logger.info('Export finished', { username: req.user.username, format: request.format, rows: result.rows, bytes: result.bytes, ms: Date.now() - started });
+    } catch (error) {
+        logger.error('Export failed', { username: req.user.username, err: error });
+        // Headers (and possibly data) are out already; a cut connection marks the download as failed
+        if (!res.headersSent) {
+            res.status(500).json({ error: 'Internal server error' });
+        } else {
+            res.destroy();
+        }
+    }
+}
+
+// Whole fleet, or ?devices=; admins only
+app.get('/api/admin/export-data', authenticateToken, requireAdmin, async(req, res) => {
+    const request = parseExportQuery(req.query);
+    if (request.error) {
+        return res.status(400).json({ error: request.error });
+    }
+    await sendExport(req, res, request, 'gps-tracker-export');
+});
+
+// The listed devices. There is no device ownership table yet, so nothing ties
+// a user to a device; until there is, this is admin-only like the fleet export.
+app.get('/api/user/export-data', authenticateToken, requireAdmin, async(req, res) => {
+    const request = parseExportQuery(req.query);
+    if (request.error) {
+        return res.status(400).json({ error: request.error });
+    }
+    if (!request.devices) {
+        return res.status(400).json({ error: 'devices is required' });
+    }
+    await sendExport(req, res, request, 'my-gps-data');
+});
+
+// Get device history
+//   ?from=&to=        epoch ms range, to exclusive
+//   ?limit=&cursor=   keyset pagination (next_cursor in the response)
+//   ?order=asc|desc   page order, newest first by default
+//   ?fields=lat,lng   column projection
+//   ?points=2000      downsample the whole range to about this many points
+app.get('/api/history/:device_id', async(req, res) => {
+    const { device_id } = req.params;
+    const request = parseHistoryQuery(req.query);
+
+    if (request.error) {
+        return res.status(400).json({ error: request.error });
+    }
+
+    try {
+        if (request.points !== null) {
+            await streamDownsampledHistory(device_id, request, res);
+            return;
+        }
+
+        const page = fetchCachedHistoryPage(device_id, request) || await fetchHistoryPage(device_id, request);
+        res.json({
+            device_id,
+            positions: page.positions,
+            count: page.positions.length,
+            next_cursor: page.next_cursor,
+            timestamp: Date.now()
+        });
+    } catch (error) {
+        logger.error('Error fetching device history', error);
+        if (res.headersSent) {
+            res.destroy(); // truncated JSON rather than a silently short track
+        } else {
+            res.status(500).json({ error: 'Database error' });
+        }
+    }
 });
 
 // WebSocket server
@@ -458,14 +1302,36 @@ function setupWebSocket() {
     wss.on('connection', (ws, req) => {
         const clientId = req.headers['sec-websocket-key'];
         wsClients.add(ws);
+        ws.deliveredUpdates = 0;
+
+        logger.info('WebSocket client connected', { client: clientId, clients: wsClients.size });
+
+        // /ws?bbox=west,south,east,north&devices=a,b subscribes before the init snapshot,
+        // ?binary=1 selects binary update frames, ?epoch=&since= resumes a previous stream
+        const query = new URL(req.url, 'http://localhost').searchParams;
+        liveFanout.add(ws, { binary: query.get('binary') === '1' });
+        if (query.has('bbox') || query.has('devices')) {
+            subscriptions.subscribe(ws, {
+                bbox: parseBbox(query.get('bbox')),
+                devices: query.get('devices') ? query.get('devices').split(',') : null
+            });
+        }
 
-        console.log(`WebSocket client connected: ${clientId} (${wsClients.size} total)`);
-
-        // Send initial positions
-        const positions = Array.from(devicePositions.values());
+        // Send initial positions (only changed ones when resuming), with recent trails from the track cache
+        const { positions, resync } = resumePositions(visiblePositions(ws), query.get('epoch'), query.get('since'));
+        const trails = {};
+        if (config.initTrailPoints > 0) {
+            positions.forEach(position => {
+                trails[position.device_id] = trackCache.trail(position.device_id, config.initTrailPoints);
+            });
+        }
         ws.send(JSON.stringify({
             type: 'init',
             positions,
+            trails,
+            epoch: liveFanout.epoch,
+            seq: liveFanout.seq,
+            resync,
             timestamp: Date.now()
         }));
 
@@ -473,7 +1339,7 @@ function setupWebSocket() {
         ws.on('message', (message) => {
             try {
                 const data = JSON.parse(message);
-                console.log(`Message from client ${clientId}:`, data);
+                logger.debug('WebSocket message', { client: clientId, data });
 
                 // Handle different message types
                 switch (data.type) {
@@ -483,26 +1349,47 @@ function setupWebSocket() {
                     case 'request_positions':
                         ws.send(JSON.stringify({
                             type: 'positions',
-                            positions: Array.from(devicePositions.values()),
+                            positions: visiblePositions(ws),
+                            seq: liveFanout.seq,
+                            timestamp: Date.now()
+                        }));
+                        break;
+                    case 'subscribe':
+                        // { bbox: [west, south, east, north], devices: [...] }; answered with what is now in view
+                        subscriptions.subscribe(ws, {
+                            bbox: data.bbox || null,
+                            devices: Array.isArray(data.devices) ? data.devices.map(String) : null
+                        });
+                        ws.send(JSON.stringify({
+                            type: 'positions',
+                            positions: visiblePositions(ws),
+                            seq: liveFanout.seq,
                             timestamp: Date.now()
                         }));
                         break;
+                    case 'unsubscribe':
+                        subscriptions.unsubscribe(ws);
+                        break;
                 }
             } catch (error) {
-                console.error('Error processing WebSocket message:', error);
+                logger.error('Error processing WebSocket message', error);
             }
         });
 
         // Handle client disconnect
         ws.on('close', () => {
             wsClients.delete(ws);
-            console.log(`WebSocket client disconnected: ${clientId} (${wsClients.size} total)`);
+            liveFanout.remove(ws);
+            subscriptions.unsubscribe(ws);
+            logger.info('WebSocket client disconnected', { client: clientId, clients: wsClients.size });
         });
 
         // Handle errors
         ws.on('error', (error) => {
-            console.error(`WebSocket error for client ${clientId}:`, error);
+            logger.error('WebSocket error', { client: clientId, err: error });
             wsClients.delete(ws);
+            liveFanout.remove(ws);
+            subscriptions.unsubscribe(ws);
         });
     });
 
@@ -517,12 +1404,162 @@ function setupWebSocket() {
             }
         });
     }, 30000); // Every 30 seconds
+
+    // Filtered clients get fleet-wide counts in place of the updates they skipped
+    setInterval(sendSubscriptionSummaries, config.wsSummaryMs);
+
+    // One history_changed per device for backfill that arrived since the last one
+    setInterval(flushBackfillNotifications, config.backfillNotifyMs);
+
+    // Online/offline transitions, swept once a second
+    presence.on('change', sendPresenceChanges);
+    presence.start();
+
+    // Coalesced update frames every tick
+    liveFanout.start();
 }
 
+// "west,south,east,north" -> [west, south, east, north], or null
+function parseBbox(value) {
+    if (!value) {
+        return null;
+    }
+    const bbox = String(value).split(',').map(Number);
+    return bbox.length === 4 && bbox.every(Number.isFinite) ? bbox : null;
+}
+
+function visiblePositions(ws) {
+    const positions = Array.from(devicePositions.values());
+    return subscriptions.isFiltered(ws) ? positions.filter(position => subscriptions.wants(ws, position)) : positions;
+}
+
+// Positions a client resuming from (epoch, since) is missing: the ones that changed since,
+// or all of them when the stream was restarted in between
+function resumePositions(positions, epoch, since) {
+    const seq = since !== undefined && since !== null ? Number(since) : NaN;
+    if (!liveFanout.canResume(epoch, seq)) {
+        return { positions, resync: false };
+    }
+    const changed = liveFanout.changedSince(seq);
+    return { positions: positions.filter(position => changed.has(position.device_id)), resync: true };
+}
+
+let updatesSinceSummary = 0;
+
+function sendSubscriptionSummaries() {
+    const now = Date.now();
+    const online = presence.onlineCount;
+
+    wsClients.forEach(ws => {
+        if (ws.readyState !== WebSocket.OPEN || !subscriptions.isFiltered(ws)) {
+            return;
+        }
+        ws.send(JSON.stringify({
+            type: 'summary',
+            total_devices: devicePositions.size,
+            online_devices: online,
+            updates: updatesSinceSummary,
+            delivered: ws.deliveredUpdates,
+            ws_clients: wsClients.size,
+            mqtt_connected: mqttClient ? mqttClient.connected : false,
+            timestamp: now
+        }));
+        ws.deliveredUpdates = 0;
+    });
+    updatesSinceSummary = 0;
+}
+
+// Devices that came online or went offline since the last sweep, to the clients viewing them
+function sendPresenceChanges(transitions) {
+    const now = Date.now();
+    const everything = JSON.stringify({ type: 'presence', devices: transitions, timestamp: now });
+
+    wsClients.forEach(ws => {
+        if (ws.readyState !== WebSocket.OPEN) {
+            return;
+        }
+        if (!subscriptions.isFiltered(ws)) {
+            ws.send(everything);
+            return;
+        }
+        const devices = transitions.filter(change => {
+            const position = devicePositions.get(change.device_id);
+            return position && subscriptions.wants(ws, position);
+        });
+        if (devices.length > 0) {
+            ws.send(JSON.stringify({ type: 'presence', devices, timestamp: now }));
+        }
+    });
+}
+
+// Tell clients which device histories gained backfilled fixes, and move a
+// device's marker once to the newest of them if that is newer than what it shows
+function flushBackfillNotifications() {
+    if (backfillPending.size === 0) {
+        return;
+    }
+
+    const changes = [];
+    backfillPending.forEach((change, deviceId) => {
+        const current = devicePositions.get(deviceId);
+        if (!current || change.newest.timestamp > current.timestamp) {
+            applyLiveUpdate(change.newest);
+        }
+        changes.push(change);
+    });
+    backfillPending.clear();
+    backfillStats.notifications++;
+
+    const now = Date.now();
+    const summary = changes.map(({ newest, from, to, count }) => ({ device_id: newest.device_id, from, to, count }));
+    const everything = JSON.stringify({ type: 'history_changed', devices: summary, timestamp: now });
+
+    wsClients.forEach(ws => {
+        if (ws.readyState !== WebSocket.OPEN) {
+            return;
+        }
+        if (!subscriptions.isFiltered(ws)) {
+            ws.send(everything);
+            return;
+        }
+        const devices = summary.filter((change, i) => subscriptions.wants(ws, changes[i].newest));
+        if (devices.length > 0) {
+            ws.send(JSON.stringify({ type: 'history_changed', devices, timestamp: now }));
+        }
+    });
+}
+
+function setupCellResolver() {
+    if (!config.cellDbFile) {
+        return;
+    }
+
+    cellResolver = new CellResolver({
+        file: config.cellDbFile,
+        mccs: config.cellDbMccs,
+        defaultRange: config.cellDefaultRange
+    });
+    cellResolver.load().then(() => {
+        logger.info('Cell database loaded', cellResolver.getStats());
+    }).catch((error) => {
+        logger.error('Cell database failed to load; cell fixes will not resolve', error);
+    });
+}
+
+// Coarse position for a cell report: { lat, lng, accuracy, match } or null
+function resolveCellFix(cells) {
+    const fix = cellResolver ? cellResolver.resolve(cells) : null;
+    cellFixes.inc([fix ? fix.match : 'unknown']);
+    return fix;
+}
+
+// Retained messages arrive right after the subscribe; this long without one means all are in
+const RETAINED_QUIET_MS = 2000;
+
 // MQTT client setup
 function setupMQTT() {
     if (!config.mqttEnabled) {
-        console.log('MQTT disabled in configuration');
+        logger.info('MQTT disabled in configuration');
         return;
     }
 
@@ -533,68 +1570,159 @@ function setupMQTT() {
         password: config.mqttPassword,
         keepalive: 60,
         reconnectPeriod: 5000,
-        connectTimeout: 30000
+        connectTimeout: 30000,
+        // MQTT 5 for shared subscriptions
+        protocolVersion: 5
     };
 
+    // With a shared subscription the broker hands each fix to one worker of
+    // the group instead of every worker inserting its own copy
+    const sharedPrefix = config.mqttSharedGroup ? `$share/${config.mqttSharedGroup}/` : '';
+    // Presence is per worker, so every worker takes every status/ message
+    const topics = [`${sharedPrefix}track/#`, `${sharedPrefix}heartbeat/#`, 'status/+'];
+
+    // Retained last/<id> fixes are read once per connection: subscribe, take
+    // what the broker holds, and unsubscribe once it has been quiet for a while
+    let lastWarmup = null;
+
     mqttClient = mqtt.connect(mqttOptions);
 
     mqttClient.on('connect', () => {
-        console.log('MQTT client connected to broker');
+        logger.info('MQTT client connected to broker');
 
-        // Subscribe to tracking topics
-        mqttClient.subscribe('track/#', (err) => {
+        // Subscribe to tracking, heartbeat and presence topics
+        mqttClient.subscribe(topics, (err) => {
             if (err) {
-                console.error('MQTT subscription error:', err);
+                logger.error('MQTT subscription error', err);
             } else {
-                console.log('Subscribed to track/# topics');
+                logger.info('MQTT subscribed', { topics });
+            }
+        });
+
+        const warmup = { restored: 0, timer: null };
+        warmup.rearm = () => {
+            clearTimeout(warmup.timer);
+            warmup.timer = setTimeout(() => {
+                lastWarmup = null;
+                mqttClient.unsubscribe('last/+');
+                logger.info('MQTT warm start: restored retained positions', { devices: warmup.restored });
+            }, RETAINED_QUIET_MS);
+        };
+        clearTimeout(lastWarmup && lastWarmup.timer);
+        lastWarmup = warmup;
+        mqttClient.subscribe('last/+', (err) => {
+            if (err) {
+                logger.error('MQTT subscription error', err);
+                lastWarmup = null;
+            } else if (lastWarmup === warmup) {
+                warmup.rearm();
             }
         });
     });
 
-    mqttClient.on('message', async(topic, message) => {
+    mqttClient.on('message', async(topic, message, packet) => {
         try {
+            if (message.length === 0) {
+                return; // a retained message being cleared
+            }
             const data = JSON.parse(message.toString());
-            console.log(`MQTT message from ${topic}:`, data);
+            fixLog.debug('MQTT message', { topic, data });
 
             // Process tracking data from MQTT
             if (topic.startsWith('track/')) {
                 const device_id = topic.split('/')[1];
+                const received_at = Date.now();
+
+                // No GNSS fix: the device sent its serving cell instead
+                let fix = null;
+                if (data.lat === undefined && data.lng === undefined && data.cells !== undefined) {
+                    fix = resolveCellFix(data.cells);
+                    if (!fix) {
+                        return;
+                    }
+                }
+
+                const coordinates = fix || parseCoordinates(data.lat, data.lng);
+                if (!coordinates) {
+                    fixesReceived.inc(['mqtt', 'invalid']);
+                    return;
+                }
+
                 const position = {
                     device_id,
-                    lat: parseFloat(data.lat),
-                    lng: parseFloat(data.lng),
+                    lat: coordinates.lat,
+                    lng: coordinates.lng,
                     speed: parseFloat(data.speed) || 0,
                     heading: parseFloat(data.heading) || 0,
                     satellites: parseInt(data.sats) || 0,
                     source: data.src || 'mqtt',
-                    timestamp: data.ts || Date.now(),
-                    received_at: Date.now()
+                    seq: deviceSeq(data.seq),
+                    timestamp: deviceTimestamp(data.ts, received_at),
+                    received_at
                 };
+                if (fix) {
+                    position.accuracy = fix.accuracy;
+                }
+
+                if (isDuplicate(position)) {
+                    fixesReceived.inc(['mqtt', 'duplicate']);
+                    return;
+                }
+                observeFixDelay('mqtt', position);
 
-                // Update in-memory state
-                devicePositions.set(device_id, position);
+                // Shed before it is shown live, not after
+                admitPosition(position);
 
-                // Save to database
-                await savePosition(position);
+                // Update in-memory state and WebSocket clients on every worker
+                const live = publishPosition(position);
+                fixesReceived.inc(['mqtt', live ? 'live' : 'backfill']);
 
-                // Broadcast to WebSocket clients
-                broadcastUpdate(position);
+                // Save to database
+                await savePosition(position, live);
+            } else if (topic.startsWith('heartbeat/')) {
+                recordHeartbeat(topic.split('/')[1], data, 'mqtt', Date.now());
+            } else if (topic.startsWith('status/')) {
+                // A retained "online" outlives the connection only until the
+                // broker replaces it with the device's Last Will
+                const device_id = topic.split('/')[1];
+                if (data.online === false) {
+                    deviceStatus.inc(['offline']);
+                    presence.leave(device_id);
+                } else if (data.online === true) {
+                    deviceStatus.inc(['online']);
+                    presence.touch(device_id, Date.now());
+                }
+            } else if (topic.startsWith('last/')) {
+                // Only what the broker held at subscribe time; live fixes come on track/
+                if (!packet.retain || !lastWarmup) {
+                    return;
+                }
+                lastWarmup.rearm();
+                const position = parseLastPosition(topic.split('/')[1], data);
+                if (position && restorePosition(position)) {
+                    lastWarmup.restored++;
+                }
             }
         } catch (error) {
-            console.error('Error processing MQTT message:', error);
+            if (error.code === 'EINGESTFULL') {
+                // MQTT QoS 0 cannot push back, so the fix is shed
+                return;
+            }
+            logger.error('Error processing MQTT message', { topic, err: error });
         }
     });
 
     mqttClient.on('error', (error) => {
-        console.error('MQTT client error:', error);
+        logger.error('MQTT client error', error);
     });
 
     mqttClient.on('close', () => {
-        console.log('MQTT client disconnected');
+        logger.warn('MQTT client disconnected');
     });
 
     mqttClient.on('reconnect', () => {
-        console.log('MQTT client reconnecting...');
+        mqttReconnects.inc();
+        logger.info('MQTT client reconnecting');
     });
 }
 
@@ -615,16 +1743,73 @@ async function setupDatabase() {
             charset: 'utf8mb4'
         });
 
+        metrics.instrumentPool(db, dbPoolWait, ['main']);
+
         // Test connection
         const connection = await db.getConnection();
-        console.log('Connected to MySQL database');
+        logger.info('Connected to MySQL database');
         connection.release();
 
         // Initialize database schema
         await initializeDatabase();
 
+        const [cellColumns] = await db.query("SHOW COLUMNS FROM positions LIKE 'cell'");
+        positionCells = cellColumns.length > 0;
+        if (!positionCells) {
+            logger.warn('positions.cell is missing: area queries are disabled until db/add-position-cells.sql is applied');
+        }
+
+        const [seqColumns] = await db.query("SHOW COLUMNS FROM positions LIKE 'seq'");
+        positionSeq = seqColumns.length > 0;
+        if (!positionSeq) {
+            logger.warn('positions.seq is missing: duplicates are only caught in memory until db/add-position-seq.sql is applied');
+        }
+
+        // Group-commit queue for incoming fixes
+        setupIngestQueue();
+
+        // Latest heartbeat per device, sampled into the heartbeats table
+        heartbeatStore = new HeartbeatStore(db, {
+            sampleMs: config.heartbeatSampleMs,
+            flushMs: config.heartbeatFlushMs,
+            logger
+        });
+        heartbeatStore.start();
+
+        // Per-device tokens for /api/track and the MQTT broker
+        deviceAuth = new DeviceAuth(db, {
+            secret: config.deviceTokenSecret,
+            sharedToken: config.deviceSharedToken ? config.deviceToken : null,
+            cacheSize: config.deviceAuthCacheSize
+        });
+
+        // Restore last known positions
+        await warmStart();
+
+        // Exports run on worker threads with a connection each, so they cannot starve ingest
+        positionExporter = new PositionExporter({
+            host: config.dbHost,
+            port: config.dbPort,
+            user: config.dbUser,
+            password: config.dbPassword,
+            database: config.dbName,
+            charset: 'utf8mb4'
+        }, {
+            maxConcurrent: config.exportMaxConcurrent,
+            gzipLevel: config.exportGzipLevel
+        });
+
+        // Partition upkeep and retention for positions
+        partitionManager = new PartitionManager(db, {
+            granularity: config.positionsPartition,
+            retentionDays: config.positionsRetentionDays,
+            intervalMs: config.partitionMaintenanceMs,
+            logger
+        });
+        partitionManager.start();
+
     } catch (error) {
-        console.error('Error connecting to MySQL database:', error);
+        logger.error('Error connecting to MySQL database', error);
         process.exit(1);
     }
 }
@@ -649,27 +1834,276 @@ async function initializeDatabase() {
             } catch (error) {
                 // Ignore "table already exists" errors
                 if (!error.message.includes('already exists') && !error.message.includes('Duplicate')) {
-                    console.warn('Migration warning:', error.message);
+                    logger.warn('Migration warning', { message: error.message });
                 }
             }
         }
 
-        console.log('Database schema initialized');
+        logger.info('Database schema initialized');
 
     } catch (error) {
-        console.error('Error initializing database:', error);
+        logger.error('Error initializing database', error);
         throw error;
     }
 }
 
-async function savePosition(position) {
-    try {
-        const query = `
-            INSERT INTO positions (device_id, lat, lng, speed, heading, satellites, source, timestamp, received_at)
-            VALUES (?, ?, ?, ?, ?, ?, ?, ?, ?)
-        `;
+// Device clocks are not trusted blindly: firmware without a time fix reports
+// millis() since boot, which would land fixes (and their stats) in 1970
+const MIN_DEVICE_TIMESTAMP = Date.UTC(2000, 0, 1);
+const MAX_DEVICE_CLOCK_SKEW_MS = 24 * 60 * 60 * 1000;
+
+function deviceTimestamp(ts, receivedAt) {
+    const value = Number(ts);
+    if (!Number.isFinite(value) || value < MIN_DEVICE_TIMESTAMP || value > receivedAt + MAX_DEVICE_CLOCK_SKEW_MS) {
+        return receivedAt;
+    }
+    return value;
+}
+
+// Firmware sequence number: an unsigned 32-bit counter, absent on older firmware
+function deviceSeq(value) {
+    const seq = Number(value);
+    return Number.isInteger(seq) && seq >= 0 && seq <= 0xffffffff ? seq : null;
+}
+
+// Only when the device sent its own time; otherwise timestamp is received_at
+function observeFixDelay(transport, position) {
+    if (position.timestamp !== position.received_at) {
+        fixDelay.observe([transport], Math.max(0, position.received_at - position.timestamp) / 1000);
+    }
+}
+
+// Both parsed and in range, or null; one NaN would fail the whole batch INSERT
+function parseCoordinates(lat, lng) {
+    const latitude = parseFloat(lat);
+    const longitude = parseFloat(lng);
+    if (!Number.isFinite(latitude) || !Number.isFinite(longitude) ||
+        latitude < -90 || latitude > 90 || longitude < -180 || longitude > 180) {
+        return null;
+    }
+    return { lat: latitude, lng: longitude };
+}
+
+// Throws EINGESTFULL when the queue savePosition() will pick is full
+function admitPosition(position) {
+    (isLive(position) ? ingestQueue : backfillQueue).admit();
+}
+
+function isDuplicate(position) {
+    return position.seq !== null && dedupWindow.check(position.device_id, position.seq) === 'duplicate';
+}
+
+function setupIngestQueue() {
+    deviceStats = new DeviceStatsAggregator({
+        onlineWindowMs: config.onlineWindowS * 1000
+    });
+
+    ingestQueue = new IngestQueue(positions => writePositionBatch(positions, 'live'), {
+        maxBatchRows: config.ingestBatchRows,
+        maxDelayMs: config.ingestFlushMs,
+        maxQueuedRows: config.ingestMaxQueued,
+        maxInFlight: Math.min(config.ingestMaxInFlight, config.dbConnectionLimit)
+    });
+
+    // Offline-queue replays go in large batches on one connection, so a
+    // draining device neither fills the live queue nor delays its commits
+    backfillQueue = new IngestQueue(positions => writePositionBatch(positions, 'backfill'), {
+        maxBatchRows: config.backfillBatchRows,
+        maxDelayMs: Math.max(config.ingestFlushMs, 500),
+        maxQueuedRows: config.ingestMaxQueued,
+        maxInFlight: 1
+    });
+}
+
+// Write a batch of positions and its device_stats deltas in one transaction
+async function writePositionBatch(positions, queue) {
+    if (positionSeq) {
+        positions = withoutBatchDuplicates(positions);
+    }
+    let rows = positionRows(positions);
+    let statsRows = null;
+    let latestRows = null;
+    let seenRows = null;
+
+    for (let attempt = 1; ; attempt++) {
+        const connection = await db.getConnection();
+        try {
+            await connection.beginTransaction();
 
-        await db.execute(query, [
+            // IGNORE skips rows whose (device_id, seq, timestamp) is already stored
+            const [result] = await connection.query(
+                `INSERT ${positionSeq ? 'IGNORE ' : ''}INTO positions (device_id, lat, lng, speed, heading, satellites, source, timestamp, received_at${positionCells ? ', cell' : ''}${positionSeq ? ', seq' : ''}) VALUES ?`, [rows]
+            );
+
+            // Repeats the dedup window could not judge (restart, other worker,
+            // older than the window); drop them before they reach device_stats.
+            // Only this rare path reads from positions.
+            if (result.affectedRows < rows.length) {
+                await connection.rollback();
+                const fresh = await withoutStoredDuplicates(connection, positions);
+                if (fresh.length === positions.length) {
+                    throw new Error(`positions insert skipped ${rows.length - result.affectedRows} rows that are not duplicates`);
+                }
+                dedupWindow.countStoredDuplicates(positions.length - fresh.length);
+                if (fresh.length === 0) {
+                    return;
+                }
+                positions = fresh;
+                rows = positionRows(positions);
+                attempt--;
+                continue;
+            }
+
+            // Aggregate once; a retried transaction reuses the same deltas
+            if (!statsRows) {
+                statsRows = deviceStats.aggregate(positions);
+                latestRows = latestPositionRows(positions);
+                seenRows = deviceSeenRows(positions);
+            }
+
+            await connection.query(`
+                INSERT INTO device_stats (device_id, date, total_positions, max_speed, total_distance, online_time)
+                VALUES ?
+                ON DUPLICATE KEY UPDATE
+                    total_positions = total_positions + VALUES(total_positions),
+                    max_speed = GREATEST(max_speed, VALUES(max_speed)),
+                    total_distance = total_distance + VALUES(total_distance),
+                    online_time = online_time + VALUES(online_time)
+            `, [statsRows]);
+
+            // Assignments run left to right, so timestamp must be updated last
+            await connection.query(`
+                INSERT INTO device_latest (device_id, lat, lng, speed, heading, satellites, source, timestamp, received_at)
+                VALUES ?
+                ON DUPLICATE KEY UPDATE
+                    lat = IF(VALUES(timestamp) >= timestamp, VALUES(lat), lat),
+                    lng = IF(VALUES(timestamp) >= timestamp, VALUES(lng), lng),
+                    speed = IF(VALUES(timestamp) >= timestamp, VALUES(speed), speed),
+                    heading = IF(VALUES(timestamp) >= timestamp, VALUES(heading), heading),
+                    satellites = IF(VALUES(timestamp) >= timestamp, VALUES(satellites), satellites),
+                    source = IF(VALUES(timestamp) >= timestamp, VALUES(source), source),
+                    received_at = IF(VALUES(timestamp) >= timestamp, VALUES(received_at), received_at),
+                    timestamp = GREATEST(timestamp, VALUES(timestamp))
+            `, [latestRows]);
+
+            // Replaces the update_device_last_seen trigger (one UPDATE and INSERT per row)
+            await connection.query(`
+                INSERT INTO devices (device_id, last_seen, total_positions)
+                VALUES ?
+                ON DUPLICATE KEY UPDATE
+                    last_seen = GREATEST(COALESCE(last_seen, 0), VALUES(last_seen)),
+                    total_positions = total_positions + VALUES(total_positions)
+            `, [seenRows]);
+
+            await connection.commit();
+
+            const committedAt = Date.now();
+            positions.forEach((position) => {
+                commitLatency.observe([queue], (committedAt - position.received_at) / 1000);
+            });
+            return;
+        } catch (error) {
+            await connection.rollback().catch(() => {});
+
+            // Concurrent batches touching the same device_stats rows may deadlock
+            if (error.code === 'ER_LOCK_DEADLOCK' && attempt < 3) {
+                continue;
+            }
+            throw error;
+        } finally {
+            connection.release();
+        }
+    }
+}
+
+function positionRows(positions) {
+    return positions.map((position) => {
+        const row = [
+            position.device_id,
+            position.lat,
+            position.lng,
+            position.speed,
+            position.heading,
+            position.satellites,
+            position.source,
+            position.timestamp,
+            position.received_at
+        ];
+        // Spatial cell for area queries, once the column exists
+        if (positionCells) {
+            row.push(cellId(position.lat, position.lng));
+        }
+        if (positionSeq) {
+            row.push(position.seq === undefined ? null : position.seq);
+        }
+        return row;
+    });
+}
+
+function seqKey(position) {
+    return `${position.device_id}|${position.seq}|${position.timestamp}`;
+}
+
+// Two copies of one fix in the same batch would collide on the unique key
+function withoutBatchDuplicates(positions) {
+    const seen = new Set();
+    return positions.filter((position) => {
+        if (position.seq === null || position.seq === undefined) {
+            return true;
+        }
+        const key = seqKey(position);
+        if (seen.has(key)) {
+            dedupWindow.countStoredDuplicates(1);
+            return false;
+        }
+        seen.add(key);
+        return true;
+    });
+}
+
+async function withoutStoredDuplicates(connection, positions) {
+    const keys = positions
+        .filter(position => position.seq !== null && position.seq !== undefined)
+        .map(position => [position.device_id, position.seq, position.timestamp]);
+    if (keys.length === 0) {
+        return positions;
+    }
+
+    const [stored] = await connection.query(
+        'SELECT device_id, seq, timestamp FROM positions WHERE (device_id, seq, timestamp) IN (?)', [keys]
+    );
+    const storedKeys = new Set(stored.map(row => `${row.device_id}|${row.seq}|${Number(row.timestamp)}`));
+    return positions.filter(position => position.seq === null || position.seq === undefined || !storedKeys.has(seqKey(position)));
+}
+
+// [device_id, last received_at, fix count] per device in a batch, in device_id order
+function deviceSeenRows(positions) {
+    const seen = new Map();
+    positions.forEach(position => {
+        const row = seen.get(position.device_id);
+        if (!row) {
+            seen.set(position.device_id, [position.device_id, position.received_at, 1]);
+        } else {
+            row[1] = Math.max(row[1], position.received_at);
+            row[2]++;
+        }
+    });
+    return Array.from(seen.values()).sort((a, b) => (a[0] < b[0] ? -1 : a[0] > b[0] ? 1 : 0));
+}
+
+// Newest fix per device in a batch, in device_id order (stable lock order)
+function latestPositionRows(positions) {
+    const newest = new Map();
+    positions.forEach(position => {
+        const current = newest.get(position.device_id);
+        if (!current || position.timestamp >= current.timestamp) {
+            newest.set(position.device_id, position);
+        }
+    });
+
+    return Array.from(newest.values())
+        .sort((a, b) => (a.device_id < b.device_id ? -1 : a.device_id > b.device_id ? 1 : 0))
+        .map(position => [
             position.device_id,
             position.lat,
             position.lng,
@@ -680,77 +2114,260 @@ async function savePosition(position) {
             position.timestamp,
             position.received_at
         ]);
+}
 
-        // Prune old positions to maintain history limit (temporarily disabled)
-        // await prunePositions(position.device_id);
+// Load the last known position of every device so the map is complete at boot
+async function warmStart() {
+    const [rows] = await db.query(
+        'SELECT device_id, lat, lng, speed, heading, satellites, source, timestamp, received_at FROM device_latest'
+    );
 
-    } catch (error) {
-        console.error('Error saving position:', error);
+    rows.forEach(row => {
+        const position = {
+            device_id: row.device_id,
+            lat: Number(row.lat),
+            lng: Number(row.lng),
+            speed: Number(row.speed),
+            heading: Number(row.heading),
+            satellites: row.satellites,
+            source: row.source,
+            timestamp: Number(row.timestamp),
+            received_at: Number(row.received_at)
+        };
+        devicePositions.set(position.device_id, position);
+        trackCache.add(position);
+        presence.touch(position.device_id, position.received_at);
+        // Next fix measures distance from here rather than starting a new segment
+        deviceStats.observe(position);
+    });
+
+    logger.info('Warm start: loaded latest positions', { devices: rows.length });
+}
+
+// Retained last/<id> payload [lat, lng, speed, heading, sats, ts, src] -> position, or null
+function parseLastPosition(device_id, data) {
+    if (!Array.isArray(data) || data.length < 6) {
+        return null;
     }
+    const [lat, lng, speed, heading, sats, ts, src] = data;
+    const timestamp = Number(ts);
+    if (!Number.isFinite(lat) || !Number.isFinite(lng) || !(timestamp > 0)) {
+        return null;
+    }
+    return {
+        device_id,
+        lat,
+        lng,
+        speed: parseFloat(speed) || 0,
+        heading: parseFloat(heading) || 0,
+        satellites: parseInt(sats) || 0,
+        source: src || 'mqtt',
+        timestamp,
+        received_at: timestamp
+    };
 }
 
-async function prunePositions(device_id) {
-    try {
-        // Get the IDs to keep (most recent positions)
-        const keepQuery = `
-            SELECT id FROM positions 
-            WHERE device_id = ? 
-            ORDER BY timestamp DESC 
-            LIMIT ?
-        `;
+// A last known position from the broker: live state only, and only when it is
+// newer than what warmStart() loaded. Nothing is written: the fix was stored
+// from track/ when it arrived, and the compact form has no seq to dedup it by.
+function restorePosition(position) {
+    const current = devicePositions.get(position.device_id);
+    if (current && position.timestamp <= current.timestamp) {
+        return false;
+    }
+    applyLiveUpdate(position);
+    deviceStats.observe(position);
+    return true;
+}
 
-        const [keepRows] = await db.execute(keepQuery, [device_id, parseInt(config.historyPoints)]);
-        const keepIds = keepRows.map(row => row.id);
+// Resolves once the fix is committed. Rejects when it was not (queue full,
+// batch write failed), so HTTP answers 5xx and the device keeps the fix.
+async function savePosition(position, live = true) {
+    await (live ? ingestQueue : backfillQueue).push(position);
+
+    // Only now is a repeat of this seq a duplicate, here or on any worker;
+    // a refused fix may come back
+    if (position.seq !== null) {
+        dedupWindow.mark(position.device_id, position.seq);
+        if (clusterBus) {
+            clusterBus.publish('stored', { device_id: position.device_id, seq: position.seq });
+        }
+    }
+}
 
-        if (keepIds.length === 0) return;
+// Live: the device's newest fix and recent by its own clock. Anything else
+// (offline-queue replay, late retransmits) is backfill: stored and cached for
+// history, but it neither moves the marker nor goes out as an update
+function isLive(position) {
+    const current = devicePositions.get(position.device_id);
+    if (current && position.timestamp < current.timestamp) {
+        return false;
+    }
+    return position.received_at - position.timestamp <= config.backfillLagMs;
+}
 
-        // Delete positions not in the keep list
-        const placeholders = keepIds.map(() => '?').join(',');
-        const deleteQuery = `
-            DELETE FROM positions 
-            WHERE device_id = ? AND id NOT IN (${placeholders})
-        `;
+// Apply a fix to this worker's state; returns whether it was live
+function applyPosition(position) {
+    trackCache.add(position);
+    presence.touch(position.device_id, position.received_at);
 
-        await db.execute(deleteQuery, [device_id, ...keepIds]);
+    if (isLive(position)) {
+        backfillStats.live++;
+        applyLiveUpdate(position);
+        return true;
+    }
 
-    } catch (error) {
-        console.error('Error pruning positions:', error);
+    backfillStats.backfill++;
+    const change = backfillPending.get(position.device_id);
+    if (!change) {
+        backfillPending.set(position.device_id, {
+            from: position.timestamp,
+            to: position.timestamp,
+            count: 1,
+            newest: position
+        });
+    } else {
+        change.from = Math.min(change.from, position.timestamp);
+        change.to = Math.max(change.to, position.timestamp);
+        change.count++;
+        if (position.timestamp > change.newest.timestamp) {
+            change.newest = position;
+        }
     }
+    return false;
+}
+
+// Move a device's live state and tell its WebSocket clients
+function applyLiveUpdate(position) {
+    const previous = devicePositions.get(position.device_id);
+    devicePositions.set(position.device_id, position);
+    broadcastUpdate(position, previous);
 }
 
-function broadcastUpdate(position) {
-    const message = JSON.stringify({
-        type: 'update',
-        device: position,
-        timestamp: Date.now()
+// Heartbeats ingested here; other workers learn the status over the cluster bus
+function recordHeartbeat(device_id, data, transport, received_at) {
+    if (!heartbeatStore) {
+        return;
+    }
+    const status = HeartbeatStore.normalize(device_id, data, transport, received_at, deviceTimestamp(data.ts, received_at));
+    const stored = heartbeatStore.record(status);
+
+    if (clusterBus) {
+        clusterBus.publish('heartbeat', { status, stored });
+    }
+}
+
+// Fixes ingested here are also pushed to the other cluster workers
+function publishPosition(position) {
+    const live = applyPosition(position);
+
+    if (clusterBus) {
+        clusterBus.publish('position', position);
+    }
+    return live;
+}
+
+function setupClusterBus() {
+    if (!config.clusterBus) {
+        return;
+    }
+
+    clusterBus = new ClusterBus({ port: config.clusterBusPort });
+
+    clusterBus.on('position', (position) => {
+        // Keep distance/online accounting continuous when fixes alternate between workers
+        deviceStats.observe(position);
+        applyPosition(position);
     });
 
-    wsClients.forEach(ws => {
-        if (ws.readyState === WebSocket.OPEN) {
-            ws.send(message);
+    // Committed on another worker: a retransmit landing here next is caught in memory too
+    clusterBus.on('stored', ({ device_id, seq }) => {
+        dedupWindow.mark(device_id, seq);
+    });
+
+    clusterBus.on('heartbeat', ({ status, stored }) => {
+        if (heartbeatStore) {
+            heartbeatStore.observe(status, stored);
+        }
+    });
+
+    clusterBus.on('credential', ({ device_id }) => {
+        if (deviceAuth) {
+            deviceAuth.invalidate(device_id);
         }
     });
+
+    clusterBus.on('role', (role) => {
+        logger.info('Cluster bus ready', { role, port: config.clusterBusPort });
+        // Fixes and credential changes published while the bus was down never reached this worker
+        trackCache.clear();
+        if (deviceAuth) {
+            deviceAuth.clear();
+        }
+    });
+
+    clusterBus.on('error', (error) => {
+        logger.error('Cluster bus error', { message: error.message });
+    });
+
+    clusterBus.start();
+}
+
+function broadcastUpdate(position, previous) {
+    updatesSinceSummary++;
+    // Delivered on the next fan-out tick, newest state per device
+    liveFanout.push(position, previous);
 }
 
 // Cleanup function
 async function cleanup() {
-    console.log('Shutting down server...');
+    logger.info('Shutting down server');
 
     if (mqttClient) {
         mqttClient.end();
     }
 
+    if (partitionManager) {
+        partitionManager.stop();
+    }
+
+    // Flush queued fixes before the pool goes away
+    for (const queue of [ingestQueue, backfillQueue]) {
+        if (queue) {
+            try {
+                await queue.close();
+            } catch (error) {
+                logger.error('Error flushing ingest queue', error);
+            }
+        }
+    }
+
+    if (heartbeatStore) {
+        await heartbeatStore.close();
+    }
+
     if (db) {
         await db.end();
     }
 
+    if (positionExporter) {
+        positionExporter.close();
+    }
+
+    if (clusterBus) {
+        clusterBus.close();
+    }
+
+    liveFanout.stop();
+    presence.stop();
+
     if (wss) {
         wss.close();
     }
 
     server.close(() => {
-        console.log('Server shut down');
-        process.exit(0);
+        logger.info('Server shut down');
+        logger.close().then(() => process.exit(0));
     });
 }
 
@@ -761,34 +2378,53 @@ process.on('SIGTERM', cleanup);
 // Start server
 async function startServer() {
     try {
-        console.log('Starting GPS Tracker Server...');
-        console.log('Configuration:', {
+        logger.info('Starting GPS Tracker Server', {
             port: config.port,
             publicOrigin: config.publicOrigin,
             mqttEnabled: config.mqttEnabled,
+            clusterBus: config.clusterBus,
             historyPoints: config.historyPoints,
-            onlineWindowS: config.onlineWindowS
+            onlineWindowS: config.onlineWindowS,
+            positionsRetentionDays: config.positionsRetentionDays
         });
 
+        // Event-loop lag for /metrics
+        metrics.monitorEventLoop(eventLoopLag);
+
         // Setup database
         await setupDatabase();
 
         // Setup WebSocket
         setupWebSocket();
 
+        // Setup cross-worker fan-out (cluster mode)
+        setupClusterBus();
+
+        // Cell database for devices without a GNSS fix (loads in the background)
+        setupCellResolver();
+
         // Setup MQTT (if enabled)
         setupMQTT();
 
         // Start HTTP server
         server.listen(config.port, () => {
-            console.log(`Server running on port ${config.port}`);
-            console.log(`WebSocket available at ws://localhost:${config.port}/ws`);
-            console.log(`API available at http://localhost:${config.port}/api`);
-            console.log(`Dashboard available at ${config.publicOrigin}`);
+            logger.info('Server running', {
+                port: config.port,
+                websocket: `ws://localhost:${config.port}/ws`,
+                api: `http://localhost:${config.port}/api`,
+                dashboard: config.publicOrigin
+            });
         });
 
+        // MQTT broker auth hooks, off the public port
+        if (config.mqttAuthPort) {
+            http.createServer(authApp).listen(config.mqttAuthPort, config.mqttAuthHost, () => {
+                logger.info('MQTT auth hooks listening', { host: config.mqttAuthHost, port: config.mqttAuthPort });
+            });
+        }
+
     } catch (error) {
-        console.error('Failed to start server:', error);
+        logger.error('Failed to start server', error);
         process.exit(1);
     }
 }
@@ -0,0 +1,138 @@
+#!/usr/bin/env node
+
+/*
+ * Cluster Bus Check
+ * Hub election and fan-out across real cluster workers
+ *
+ * Usage:
+ *   node tools/cluster-bus-check.js
+ *   node tools/cluster-bus-check.js --workers 4 --port 3990
+ *
+ * Forks --workers processes with the cluster module, the way PM2 cluster
+ * mode runs the server, and starts a ClusterBus in each. Every worker then
+ * publishes one message. The check passes when exactly one worker is the
+ * hub and every worker received the messages of all the others. The hub is
+ * then killed, and the survivors must elect a new hub and exchange a second
+ * round. Exits non-zero on failure.
+ */
+
+const cluster = require('cluster');
+const ClusterBus = require('../server/lib/cluster-bus');
+
+const SETTLE_MS = 1500;
+
+function parseArgs() {
+    const args = process.argv.slice(2);
+    const options = { workers: 3, port: 3990 };
+
+    for (let i = 0; i < args.length; i++) {
+        switch (args[i]) {
+            case '--workers':
+                options.workers = Math.max(2, parseInt(args[++i]));
+                break;
+            case '--port':
+                options.port = parseInt(args[++i]);
+                break;
+            case '--help':
+                console.log('Usage: node tools/cluster-bus-check.js [--workers 3] [--port 3990]');
+                process.exit(0);
+        }
+    }
+    return options;
+}
+
+// Worker: run a bus, publish on request, report what arrived
+function runWorker(port) {
+    const bus = new ClusterBus({ port, retryMs: 200 });
+    const received = new Set();
+
+    bus.on('ping', ({ from, round }) => received.add(`${round}:${from}`));
+    bus.on('error', () => {});
+    bus.start();
+
+    process.on('message', ({ command, round }) => {
+        if (command === 'publish') {
+            bus.publish('ping', { from: cluster.worker.id, round });
+        } else if (command === 'report') {
+            process.send({ id: cluster.worker.id, ...bus.getStats(), received: Array.from(received) });
+        }
+    });
+}
+
+function sleep(ms) {
+    return new Promise(resolve => setTimeout(resolve, ms));
+}
+
+// Primary: drive the rounds and judge the reports
+async function runPrimary(options) {
+    const workers = [];
+    for (let i = 0; i < options.workers; i++) {
+        workers.push(cluster.fork({ CLUSTER_BUS_CHECK_PORT: options.port }));
+    }
+
+    const report = async(alive) => {
+        const reports = [];
+        await new Promise((resolve) => {
+            alive.forEach((worker) => {
+                worker.once('message', (message) => {
+                    reports.push(message);
+                    if (reports.length === alive.length) {
+                        resolve();
+                    }
+                });
+                worker.send({ command: 'report' });
+            });
+        });
+        return reports;
+    };
+
+    const round = async(number, alive) => {
+        await sleep(SETTLE_MS);
+        alive.forEach(worker => worker.send({ command: 'publish', round: number }));
+        await sleep(SETTLE_MS / 3);
+
+        const reports = await report(alive);
+        const hubs = reports.filter(r => r.role === 'hub');
+        const failures = [];
+        if (hubs.length !== 1) {
+            failures.push(`${hubs.length} hubs (want 1)`);
+        } else if (hubs[0].peers !== alive.length - 1) {
+            failures.push(`hub has ${hubs[0].peers} peers (want ${alive.length - 1})`);
+        }
+        reports.forEach((r) => {
+            const got = r.received.filter(key => key.startsWith(`${number}:`)).length;
+            if (got !== alive.length - 1) {
+                failures.push(`worker ${r.id} (${r.role}) received ${got} of ${alive.length - 1}`);
+            }
+        });
+
+        console.log(`Round ${number}: ${alive.length} workers, ` +
+            reports.map(r => `${r.id}=${r.role}/${r.peers}`).join(' ') +
+            (failures.length ? ` FAIL: ${failures.join('; ')}` : ' ok'));
+        return { reports, ok: failures.length === 0 };
+    };
+
+    let alive = workers;
+    const first = await round(1, alive);
+
+    // Failover: the survivors race for the port again
+    const hub = first.reports.find(r => r.role === 'hub');
+    let second = { ok: false };
+    if (hub) {
+        const hubWorker = alive.find(worker => worker.id === hub.id);
+        hubWorker.kill();
+        alive = alive.filter(worker => worker !== hubWorker);
+        second = await round(2, alive);
+    }
+
+    alive.forEach(worker => worker.kill());
+    process.exit(first.ok && second.ok ? 0 : 1);
+}
+
+if (require.main === module) {
+    if (cluster.isPrimary) {
+        runPrimary(parseArgs());
+    } else {
+        runWorker(parseInt(process.env.CLUSTER_BUS_CHECK_PORT));
+    }
+}
@@ -0,0 +1,663 @@
+#!/usr/bin/env node
+
+/*
+ * Database Benchmarks
+ * Measures ingest-path SQL against a scratch MySQL database
+ *
+ * Usage:
+ *   node db-bench.js device-stats --fixes-per-day 50000 --inserts 5000
+ *   node db-bench.js history --days 30 --points 2000
+ *   node db-bench.js partitions --rows 10000000 --days 30 --devices 100
+ *   node db-bench.js export --rows 50000000 --days 30 --format csv
+ *   node db-bench.js spatial --rows 100000000 --days 30 --devices 10000
+ *
+ * The benchmark creates (and drops) its own database, so point it at a
+ * server where --database can be freely recreated. Requires mysql2, e.g.
+ * run with NODE_PATH=server/node_modules.
+ */
+
+const mysql = require('mysql2/promise');
+const DeviceStatsAggregator = require('../server/lib/device-stats');
+const TrackDownsampler = require('../server/lib/downsample');
+const { PositionExporter } = require('../server/lib/position-export');
+const { cellId, cellRanges } = require('../server/lib/geo');
+const { Writable } = require('stream');
+const { monitorEventLoopDelay } = require('perf_hooks');
+
+const POSITIONS_TABLE = `
+    CREATE TABLE positions (
+        id INT AUTO_INCREMENT PRIMARY KEY,
+        device_id VARCHAR(255) NOT NULL,
+        lat DECIMAL(10, 8) NOT NULL,
+        lng DECIMAL(11, 8) NOT NULL,
+        speed DECIMAL(5, 2) DEFAULT 0,
+        heading DECIMAL(5, 2) DEFAULT 0,
+        satellites INT DEFAULT 0,
+        source VARCHAR(50) DEFAULT 'unknown',
+        timestamp BIGINT NOT NULL,
+        received_at BIGINT NOT NULL,
+        created_at TIMESTAMP DEFAULT CURRENT_TIMESTAMP,
+        INDEX idx_device_timestamp (device_id, timestamp)
+    )
+`;
+
+const DEVICE_STATS_TABLE = `
+    CREATE TABLE device_stats (
+        id INT AUTO_INCREMENT PRIMARY KEY,
+        device_id VARCHAR(255) NOT NULL,
+        date DATE NOT NULL,
+        total_positions INT DEFAULT 0,
+        max_speed DECIMAL(5, 2) DEFAULT 0,
+        total_distance DECIMAL(10, 2) DEFAULT 0,
+        online_time INT DEFAULT 0,
+        UNIQUE KEY unique_device_date (device_id, date)
+    )
+`;
+
+// The trigger removed from db/migrate.sql, kept here as the baseline
+const LEGACY_STATS_TRIGGER = `
+    CREATE TRIGGER update_device_stats
+    AFTER INSERT ON positions
+    FOR EACH ROW
+    BEGIN
+        INSERT INTO device_stats (device_id, date, total_positions, max_speed)
+        SELECT NEW.device_id, CURDATE(), COUNT(*), MAX(speed)
+        FROM positions
+        WHERE device_id = NEW.device_id
+        AND DATE(FROM_UNIXTIME(timestamp/1000)) = CURDATE()
+        ON DUPLICATE KEY UPDATE
+            total_positions = VALUES(total_positions),
+            max_speed = GREATEST(max_speed, VALUES(max_speed));
+    END
+`;
+
+// Layout from db/migrate.sql, without and with daily RANGE partitions
+const POSITIONS_FLAT_TABLE = `
+    CREATE TABLE positions (
+        id BIGINT NOT NULL AUTO_INCREMENT,
+        device_id VARCHAR(255) NOT NULL,
+        lat DECIMAL(10, 8) NOT NULL,
+        lng DECIMAL(11, 8) NOT NULL,
+        cell BIGINT UNSIGNED,
+        speed DECIMAL(5, 2) DEFAULT 0,
+        heading DECIMAL(5, 2) DEFAULT 0,
+        satellites INT DEFAULT 0,
+        source VARCHAR(50) DEFAULT 'unknown',
+        timestamp BIGINT NOT NULL,
+        received_at BIGINT NOT NULL,
+        created_at TIMESTAMP DEFAULT CURRENT_TIMESTAMP,
+        PRIMARY KEY (id, timestamp),
+        INDEX idx_device_timestamp (device_id, timestamp),
+        INDEX idx_cell_timestamp (cell, timestamp)
+    )
+`;
+
+const DAY_MS = 24 * 60 * 60 * 1000;
+
+const INSERT_POSITIONS = 'INSERT INTO positions (device_id, lat, lng, speed, heading, satellites, source, timestamp, received_at) VALUES ?';
+const INSERT_POSITIONS_CELL = 'INSERT INTO positions (device_id, lat, lng, cell, speed, heading, satellites, source, timestamp, received_at) VALUES ?';
+
+const UPSERT_STATS = `
+    INSERT INTO device_stats (device_id, date, total_positions, max_speed, total_distance, online_time)
+    VALUES ?
+    ON DUPLICATE KEY UPDATE
+        total_positions = total_positions + VALUES(total_positions),
+        max_speed = GREATEST(max_speed, VALUES(max_speed)),
+        total_distance = total_distance + VALUES(total_distance),
+        online_time = online_time + VALUES(online_time)
+`;
+
+class DatabaseBench {
+    constructor(options) {
+        this.options = {
+            host: options.host || 'localhost',
+            port: options.port || 3306,
+            user: options.user || 'root',
+            password: options.password || '',
+            database: options.database || 'tracker_gps_bench',
+            fixesPerDay: options.fixesPerDay || 50000,
+            inserts: options.inserts || 5000,
+            batch: options.batch || 500,
+            rows: options.rows || 1000000,
+            days: options.days || 30,
+            devices: options.devices || 100,
+            points: options.points || 2000,
+            format: options.format || 'csv',
+            ...options
+        };
+        this.db = null;
+    }
+
+    async connect() {
+        const admin = await mysql.createConnection({
+            host: this.options.host,
+            port: this.options.port,
+            user: this.options.user,
+            password: this.options.password
+        });
+        await admin.query(`DROP DATABASE IF EXISTS \`${this.options.database}\``);
+        await admin.query(`CREATE DATABASE \`${this.options.database}\``);
+        await admin.end();
+
+        this.db = mysql.createPool({
+            host: this.options.host,
+            port: this.options.port,
+            user: this.options.user,
+            password: this.options.password,
+            database: this.options.database,
+            connectionLimit: 4
+        });
+    }
+
+    async close() {
+        if (this.db) {
+            await this.db.query(`DROP DATABASE IF EXISTS \`${this.options.database}\``);
+            await this.db.end();
+        }
+    }
+
+    // 1 Hz walk for one device, starting at local midnight today
+    generateFixes(deviceId, count, startTs) {
+        const fixes = [];
+        let lat = 40.7128;
+        let lng = -74.0060;
+
+        for (let i = 0; i < count; i++) {
+            lat += (Math.random() - 0.5) * 0.0002;
+            lng += (Math.random() - 0.5) * 0.0002;
+            const timestamp = startTs + i * 1000;
+            fixes.push({
+                device_id: deviceId,
+                lat,
+                lng,
+                speed: Math.random() * 80,
+                heading: Math.random() * 360,
+                satellites: 9,
+                source: 'bench',
+                timestamp,
+                received_at: timestamp
+            });
+        }
+        return fixes;
+    }
+
+    toRow(fix) {
+        return [fix.device_id, fix.lat, fix.lng, fix.speed, fix.heading, fix.satellites, fix.source, fix.timestamp, fix.received_at];
+    }
+
+    async resetTables() {
+        await this.db.query('DROP TABLE IF EXISTS positions');
+        await this.db.query('DROP TABLE IF EXISTS device_stats');
+        await this.db.query(POSITIONS_TABLE);
+        await this.db.query(DEVICE_STATS_TABLE);
+    }
+
+    async seed(fixes) {
+        for (let i = 0; i < fixes.length; i += 5000) {
+            await this.db.query(INSERT_POSITIONS, [fixes.slice(i, i + 5000).map(fix => this.toRow(fix))]);
+        }
+    }
+
+    // Baseline: one INSERT per fix with the per-row stats trigger
+    async runLegacy(seedFixes, fixes) {
+        await this.resetTables();
+        await this.seed(seedFixes);
+        await this.db.query(LEGACY_STATS_TRIGGER);
+
+        const start = process.hrtime.bigint();
+        for (const fix of fixes) {
+            await this.db.query(INSERT_POSITIONS, [[this.toRow(fix)]]);
+        }
+        return Number(process.hrtime.bigint() - start) / 1e6;
+    }
+
+    // Ingest pipeline: batched INSERT plus one device_stats delta upsert per batch
+    async runIncremental(seedFixes, fixes) {
+        await this.resetTables();
+        await this.seed(seedFixes);
+
+        const aggregator = new DeviceStatsAggregator();
+        aggregator.aggregate(seedFixes);
+
+        const start = process.hrtime.bigint();
+        for (let i = 0; i < fixes.length; i += this.options.batch) {
+            const batch = fixes.slice(i, i + this.options.batch);
+            const connection = await this.db.getConnection();
+            try {
+                await connection.beginTransaction();
+                await connection.query(INSERT_POSITIONS, [batch.map(fix => this.toRow(fix))]);
+                await connection.query(UPSERT_STATS, [aggregator.aggregate(batch)]);
+                await connection.commit();
+            } finally {
+                connection.release();
+            }
+        }
+        return Number(process.hrtime.bigint() - start) / 1e6;
+    }
+
+    async createPositions(partitionedFrom, days) {
+        await this.db.query('DROP TABLE IF EXISTS positions');
+
+        if (partitionedFrom === null) {
+            await this.db.query(POSITIONS_FLAT_TABLE);
+            return;
+        }
+
+        const partitions = [];
+        for (let day = 0; day < days; day++) {
+            const upper = partitionedFrom + (day + 1) * DAY_MS;
+            partitions.push(`PARTITION p${day} VALUES LESS THAN (${upper})`);
+        }
+        partitions.push('PARTITION pmax VALUES LESS THAN MAXVALUE');
+        await this.db.query(`${POSITIONS_FLAT_TABLE} PARTITION BY RANGE (timestamp) (${partitions.join(', ')})`);
+    }
+
+    // Spread rows evenly over devices and days, oldest first
+    async seedHistory(start, days) {
+        const { rows, devices } = this.options;
+        const perDevice = Math.ceil(rows / devices);
+        const step = (days * DAY_MS) / perDevice;
+        const chunk = [];
+
+        for (let i = 0; i < perDevice; i++) {
+            const timestamp = Math.floor(start + i * step);
+            for (let d = 0; d < devices; d++) {
+                chunk.push([`bench_${String(d).padStart(3, '0')}`, 40.7, -74.0, 10, 90, 9, 'bench', timestamp, timestamp]);
+            }
+            if (chunk.length >= 5000) {
+                await this.db.query(INSERT_POSITIONS, [chunk.splice(0)]);
+            }
+        }
+        if (chunk.length > 0) {
+            await this.db.query(INSERT_POSITIONS, [chunk]);
+        }
+    }
+
+    async timeQuery(sql, params, repeat) {
+        const start = process.hrtime.bigint();
+        for (let i = 0; i < repeat; i++) {
+            await this.db.query(sql, params);
+        }
+        return Number(process.hrtime.bigint() - start) / 1e6 / repeat;
+    }
+
+    async measureLayout(label, partitioned) {
+        const days = this.options.days;
+        const today = Math.floor(Date.now() / DAY_MS) * DAY_MS;
+        const start = today - (days - 1) * DAY_MS;
+
+        await this.createPositions(partitioned ? start : null, days);
+        await this.seedHistory(start, days);
+
+        const fixes = this.generateFixes('bench_000', this.options.inserts, today);
+        const insertStart = process.hrtime.bigint();
+        for (let i = 0; i < fixes.length; i += this.options.batch) {
+            await this.db.query(INSERT_POSITIONS, [fixes.slice(i, i + this.options.batch).map(fix => this.toRow(fix))]);
+        }
+        const insertMs = Number(process.hrtime.bigint() - insertStart) / 1e6;
+
+        const historyMs = await this.timeQuery(
+            'SELECT * FROM positions WHERE device_id = ? AND timestamp >= ? ORDER BY timestamp DESC LIMIT 500',
+            ['bench_001', today - 60 * 60 * 1000],
+            20
+        );
+        const rangeMs = await this.timeQuery(
+            'SELECT COUNT(*) FROM positions WHERE timestamp >= ? AND timestamp < ?',
+            [today, today + DAY_MS],
+            5
+        );
+
+        // Expire the oldest day the way each layout would
+        const retentionStart = process.hrtime.bigint();
+        if (partitioned) {
+            await this.db.query('ALTER TABLE positions DROP PARTITION p0');
+        } else {
+            await this.db.query('DELETE FROM positions WHERE timestamp < ?', [start + DAY_MS]);
+        }
+        const retentionMs = Number(process.hrtime.bigint() - retentionStart) / 1e6;
+
+        console.log(`  ${label}`);
+        console.log(`    insert (batch ${this.options.batch}):        ${(fixes.length / (insertMs / 1000)).toFixed(1)} fixes/s`);
+        console.log(`    device history (1h):     ${historyMs.toFixed(2)} ms`);
+        console.log(`    one-day range count:     ${rangeMs.toFixed(2)} ms`);
+        console.log(`    expire oldest day:       ${retentionMs.toFixed(1)} ms`);
+    }
+
+    // 1 Hz random walk for one device, inserted in chunks to bound memory
+    async seedTrack(deviceId, start, count) {
+        let lat = 40.7128;
+        let lng = -74.0060;
+        let chunk = [];
+
+        for (let i = 0; i < count; i++) {
+            lat += (Math.random() - 0.5) * 0.0002;
+            lng += (Math.random() - 0.5) * 0.0002;
+            const timestamp = start + i * 1000;
+            chunk.push([deviceId, lat, lng, Math.random() * 80, Math.random() * 360, 9, 'bench', timestamp, timestamp]);
+            if (chunk.length === 5000) {
+                await this.db.query(INSERT_POSITIONS, [chunk]);
+                chunk = [];
+            }
+        }
+        if (chunk.length > 0) {
+            await this.db.query(INSERT_POSITIONS, [chunk]);
+        }
+    }
+
+    async history() {
+        const count = this.options.days * 86400;
+        const end = Date.now();
+        const start = end - count * 1000;
+
+        await this.createPositions(null, 0);
+        console.log(`Seeding ${count} fixes (${this.options.days} days at 1 Hz) for bench_001`);
+        await this.seedTrack('bench_001', start, count);
+
+        const report = (label, ms, rows, bytes) => {
+            console.log(`  ${label.padEnd(34)} ${ms.toFixed(0).padStart(7)} ms  ${String(rows).padStart(8)} rows  ${(bytes / 1024).toFixed(0).padStart(8)} KiB`);
+        };
+
+        // Old endpoint: SELECT * with a limit large enough to cover the month
+        let begin = process.hrtime.bigint();
+        const [all] = await this.db.query(
+            'SELECT * FROM positions WHERE device_id = ? ORDER BY timestamp DESC LIMIT ?', ['bench_001', count]
+        );
+        let body = JSON.stringify({ device_id: 'bench_001', positions: all });
+        report('SELECT * (whole month)', Number(process.hrtime.bigint() - begin) / 1e6, all.length, Buffer.byteLength(body));
+
+        // One keyset page from the middle of the range
+        const middle = start + Math.floor(count / 2) * 1000;
+        begin = process.hrtime.bigint();
+        const [page] = await this.db.query(
+            'SELECT id, lat, lng, timestamp FROM positions WHERE device_id = ? AND timestamp <= ? AND (timestamp < ? OR id < ?) ORDER BY timestamp DESC, id DESC LIMIT 1000',
+            ['bench_001', middle, middle, Number.MAX_SAFE_INTEGER]
+        );
+        body = JSON.stringify({ device_id: 'bench_001', positions: page });
+        report('keyset page (1000, mid-range)', Number(process.hrtime.bigint() - begin) / 1e6, page.length, Buffer.byteLength(body));
+
+        // Downsampled: streamed rows through the LTTB used by /api/history?points=
+        begin = process.hrtime.bigint();
+        const kept = [];
+        const downsampler = new TrackDownsampler({ first: start, last: start + (count - 1) * 1000, points: this.options.points }, point => kept.push(point));
+        const connection = await this.db.getConnection();
+        try {
+            await new Promise((resolve, reject) => {
+                connection.connection
+                    .query('SELECT lat, lng, timestamp FROM positions WHERE device_id = ? AND timestamp >= ? ORDER BY timestamp ASC', ['bench_001', start])
+                    .stream({ highWaterMark: 1000 })
+                    .on('data', (row) => {
+                        downsampler.push({ lat: Number(row.lat), lng: Number(row.lng), timestamp: row.timestamp });
+                    })
+                    .on('error', reject)
+                    .on('end', resolve);
+            });
+        } finally {
+            connection.release();
+        }
+        downsampler.finish();
+        body = JSON.stringify({ device_id: 'bench_001', positions: kept });
+        report(`downsampled (points=${this.options.points})`, Number(process.hrtime.bigint() - begin) / 1e6, kept.length, Buffer.byteLength(body));
+    }
+
+    async partitions() {
+        console.log(`Seeding ${this.options.rows} rows over ${this.options.days} days for ${this.options.devices} devices per layout`);
+        await this.measureLayout('unpartitioned (DELETE retention)', false);
+        await this.measureLayout('daily partitions (DROP PARTITION retention)', true);
+    }
+
+    // Batched inserts while isRunning() holds, as a stand-in for live ingest;
+    // { rate (fixes/s), p99 (ms per batch insert) }
+    async insertLoad(isRunning) {
+        const fixes = this.generateFixes('bench_ingest', this.options.batch, Date.now());
+        const rows = fixes.map(fix => this.toRow(fix));
+        const latencies = [];
+        let inserted = 0;
+        const start = process.hrtime.bigint();
+        while (isRunning()) {
+            const began = process.hrtime.bigint();
+            await this.db.query(INSERT_POSITIONS, [rows]);
+            latencies.push(Number(process.hrtime.bigint() - began) / 1e6);
+            inserted += rows.length;
+        }
+        latencies.sort((a, b) => a - b);
+        return {
+            rate: inserted / (Number(process.hrtime.bigint() - start) / 1e9),
+            p99: latencies.length > 0 ? latencies[Math.floor(latencies.length * 0.99)] : 0
+        };
+    }
+
+    async export() {
+        const days = this.options.days;
+        const today = Math.floor(Date.now() / DAY_MS) * DAY_MS;
+        const start = today - (days - 1) * DAY_MS;
+
+        console.log(`Seeding ${this.options.rows} rows over ${days} days for ${this.options.devices} devices`);
+        await this.createPositions(start, days + 1);
+        await this.seedHistory(start, days);
+
+        // Baseline ingest rate with nothing else running
+        const idleUntil = Date.now() + 5000;
+        const idle = await this.insertLoad(() => Date.now() < idleUntil);
+
+        // The export itself runs on a worker thread with its own connection
+        const exporter = new PositionExporter({
+            host: this.options.host,
+            port: this.options.port,
+            user: this.options.user,
+            password: this.options.password,
+            database: this.options.database
+        });
+
+        let compressed = 0;
+        const sink = new Writable({
+            write(chunk, encoding, callback) {
+                compressed += chunk.length;
+                callback();
+            }
+        });
+
+        let peakRss = 0;
+        const sampler = setInterval(() => {
+            peakRss = Math.max(peakRss, process.memoryUsage().rss);
+        }, 100);
+
+        // Main-thread stalls are what ingest and WebSocket ticks would feel
+        const loopDelay = monitorEventLoopDelay({ resolution: 10 });
+        loopDelay.enable();
+
+        let exporting = true;
+        const begin = process.hrtime.bigint();
+        const exportRun = exporter.export({ from: null, to: today, devices: null }, this.options.format, sink)
+            .finally(() => { exporting = false; });
+        const [result, busy] = await Promise.all([exportRun, this.insertLoad(() => exporting)]);
+        const seconds = Number(process.hrtime.bigint() - begin) / 1e9;
+        clearInterval(sampler);
+        loopDelay.disable();
+
+        console.log(`  export (${this.options.format}.gz):`);
+        console.log(`    rows:                    ${result.rows} in ${seconds.toFixed(1)} s (${(result.rows / seconds).toFixed(0)} rows/s)`);
+        console.log(`    output:                  ${(result.bytes / 1048576).toFixed(0)} MiB raw, ${(compressed / 1048576).toFixed(1)} MiB gzip`);
+        console.log(`    peak RSS:                ${(peakRss / 1048576).toFixed(0)} MiB`);
+        console.log(`    ingest idle / exporting: ${idle.rate.toFixed(0)} / ${busy.rate.toFixed(0)} fixes/s`);
+        console.log(`    insert p99 idle / exp.:  ${idle.p99.toFixed(1)} / ${busy.p99.toFixed(1)} ms per batch`);
+        console.log(`    event-loop lag p99 / max: ${(loopDelay.percentile(99) / 1e6).toFixed(1)} / ${(loopDelay.max / 1e6).toFixed(1)} ms`);
+    }
+
+    // Devices random-walking over a ~200 km square around New York, oldest first
+    async seedSpatial(start, days) {
+        const { rows, devices } = this.options;
+        const perDevice = Math.ceil(rows / devices);
+        const step = (days * DAY_MS) / perDevice;
+        const lat = Array.from({ length: devices }, () => 40.7128 + (Math.random() - 0.5) * 1.8);
+        const lng = Array.from({ length: devices }, () => -74.0060 + (Math.random() - 0.5) * 2.4);
+        const chunk = [];
+
+        for (let i = 0; i < perDevice; i++) {
+            const timestamp = Math.floor(start + i * step);
+            for (let d = 0; d < devices; d++) {
+                lat[d] += (Math.random() - 0.5) * 0.002;
+                lng[d] += (Math.random() - 0.5) * 0.002;
+                chunk.push([`bench_${String(d).padStart(5, '0')}`, lat[d], lng[d], cellId(lat[d], lng[d]), 10, 90, 9, 'bench', timestamp, timestamp]);
+            }
+            if (chunk.length >= 5000) {
+                await this.db.query(INSERT_POSITIONS_CELL, [chunk.splice(0)]);
+            }
+        }
+        if (chunk.length > 0) {
+            await this.db.query(INSERT_POSITIONS_CELL, [chunk]);
+        }
+    }
+
+    // Area query the way /api/positions/within builds it, or as a plain lat/lng scan
+    areaQuery(bbox, from, to, useCells) {
+        const conditions = ['timestamp >= ? AND timestamp < ?', 'lat BETWEEN ? AND ?', 'lng BETWEEN ? AND ?'];
+        const params = [from, to, bbox[1], bbox[3], bbox[0], bbox[2]];
+        let hint = 'IGNORE INDEX (idx_cell_timestamp)';
+        if (useCells) {
+            const ranges = cellRanges(bbox);
+            conditions.unshift(`(${ranges.map(() => 'cell BETWEEN ? AND ?').join(' OR ')})`);
+            params.unshift(...ranges.flat());
+            hint = 'FORCE INDEX (idx_cell_timestamp)';
+        }
+        return {
+            sql: `SELECT device_id, COUNT(*) FROM positions ${hint} WHERE ${conditions.join(' AND ')} GROUP BY device_id`,
+            params
+        };
+    }
+
+    async spatial() {
+        const days = this.options.days;
+        const today = Math.floor(Date.now() / DAY_MS) * DAY_MS;
+        const start = today - (days - 1) * DAY_MS;
+
+        console.log(`Seeding ${this.options.rows} rows over ${days} days for ${this.options.devices} devices`);
+        await this.createPositions(start, days);
+        await this.seedSpatial(start, days);
+
+        const box = (km) => {
+            const dLat = km / 2 / 111.32;
+            const dLng = dLat / Math.cos(40.7128 * Math.PI / 180);
+            return [-74.0060 - dLng, 40.7128 - dLat, -74.0060 + dLng, 40.7128 + dLat];
+        };
+        const cases = [
+            ['1 km box, last hour', box(1), Date.now() - 3600000],
+            ['1 km box, last day', box(1), today],
+            ['1 km box, all days', box(1), start],
+            ['10 km box, last day', box(10), today],
+            ['10 km box, all days', box(10), start]
+        ];
+
+        console.log(`  ${'devices inside area'.padEnd(28)} ${'lat/lng scan'.padStart(14)} ${'cell index'.padStart(14)}`);
+        for (const [label, bbox, from] of cases) {
+            const scan = this.areaQuery(bbox, from, today + DAY_MS, false);
+            const cells = this.areaQuery(bbox, from, today + DAY_MS, true);
+            const scanMs = await this.timeQuery(scan.sql, scan.params, 3);
+            const cellMs = await this.timeQuery(cells.sql, cells.params, 3);
+            console.log(`  ${label.padEnd(28)} ${scanMs.toFixed(1).padStart(11)} ms ${cellMs.toFixed(1).padStart(11)} ms`);
+        }
+    }
+
+    async deviceStats() {
+        const midnight = new Date();
+        midnight.setHours(0, 0, 0, 0);
+
+        const all = this.generateFixes('bench_001', this.options.fixesPerDay + this.options.inserts, midnight.getTime());
+        const seedFixes = all.slice(0, this.options.fixesPerDay);
+        const fixes = all.slice(this.options.fixesPerDay);
+
+        console.log(`Seeded day: ${seedFixes.length} fixes, measuring ${fixes.length} more inserts`);
+
+        const legacyMs = await this.runLegacy(seedFixes, fixes);
+        console.log(`  trigger (per-row INSERT):     ${(fixes.length / (legacyMs / 1000)).toFixed(1)} fixes/s`);
+
+        const incrementalMs = await this.runIncremental(seedFixes, fixes);
+        console.log(`  incremental (batch ${this.options.batch}):     ${(fixes.length / (incrementalMs / 1000)).toFixed(1)} fixes/s`);
+
+        const [[stats]] = await this.db.query('SELECT total_positions, max_speed, total_distance, online_time FROM device_stats');
+        console.log('  device_stats after incremental run:', stats);
+    }
+}
+
+function parseArgs() {
+    const args = process.argv.slice(2);
+    const options = { scenario: args[0] };
+
+    for (let i = 1; i < args.length; i++) {
+        switch (args[i]) {
+            case '--host':
+                options.host = args[++i];
+                break;
+            case '--port':
+                options.port = parseInt(args[++i]);
+                break;
+            case '--user':
+                options.user = args[++i];
+                break;
+            case '--password':
+                options.password = args[++i];
+                break;
+            case '--database':
+                options.database = args[++i];
+                break;
+            case '--fixes-per-day':
+                options.fixesPerDay = parseInt(args[++i]);
+                break;
+            case '--inserts':
+                options.inserts = parseInt(args[++i]);
+                break;
+            case '--batch':
+                options.batch = parseInt(args[++i]);
+                break;
+            case '--rows':
+                options.rows = parseInt(args[++i]);
+                break;
+            case '--days':
+                options.days = parseInt(args[++i]);
+                break;
+            case '--points':
+                options.points = parseInt(args[++i]);
+                break;
+            case '--format':
+                options.format = args[++i];
+                break;
+            case '--devices':
+                options.devices = parseInt(args[++i]);
+                break;
+            default:
+                console.error(`Unknown option: ${args[i]}`);
+                process.exit(1);
+        }
+    }
+
+    return options;
+}
+
+const SCENARIOS = {
+    'device-stats': 'deviceStats',
+    'history': 'history',
+    'partitions': 'partitions',
+    'export': 'export',
+    'spatial': 'spatial'
+};
+
+if (require.main === module) {
+    const options = parseArgs();
+    const method = SCENARIOS[options.scenario];
+
+    if (!method) {
+        console.log(`Usage: node db-bench.js <${Object.keys(SCENARIOS).join('|')}> [--host h] [--user u] [--password p] [options]`);
+        process.exit(1);
+    }
+
+    const bench = new DatabaseBench(options);
+    bench.connect()
+        .then(() => bench[method]())
+        .then(() => bench.close())
+        .catch(async(error) => {
+            console.error('Benchmark failed:', error.message);
+            await bench.close().catch(() => {});
+            process.exit(1);
+        });
+}
+
+module.exports = DatabaseBench;
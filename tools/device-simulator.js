@@ -25,10 +25,18 @@ class DeviceSimulator {
             mqttPort: options.mqttPort || 1883,
             mqttUsername: options.mqttUsername || '',
             mqttPassword: options.mqttPassword || '',
+            qos: options.qos || 0,
             deviceToken: options.token || 'test_token_123',
             startLat: options.startLat || 40.7128,
             startLng: options.startLng || -74.0060,
             radius: options.radius || 1000, // meters
+            duration: options.duration || 0, // seconds, 0 = run until stopped
+            dupRate: options.dupRate || 0, // fraction of fixes sent twice (retransmit)
+            // Firmware seq survives reboots; so must ours across runs, or the server's
+            // dedup window calls the next run's fixes duplicates. Tenths of a second
+            // since the epoch stay ahead of up to 10 fixes/s per device. The u32 wrap
+            // lands far below the window, which the server treats as a reset.
+            seqStart: options.seqStart !== undefined ? options.seqStart : Math.floor(Date.now() / 100) % 0x100000000,
             verbose: options.verbose || false,
             ...options
         };
@@ -38,6 +46,22 @@ class DeviceSimulator {
         this.mqttClient = null;
         this.isRunning = false;
 
+        // Keep-alive agent so high-rate runs measure the server, not TCP setup
+        this.httpAgent = new http.Agent({ keepAlive: true, maxSockets: 256 });
+
+        // Throughput and ack latency measurement
+        this.metrics = {
+            sent: 0,
+            resent: 0,
+            acked: 0,
+            errors: 0,
+            latencies: [], // ack latency samples (ms) for the current report window
+            allLatencies: [],
+            windowStart: Date.now(),
+            windowAcked: 0,
+            startTime: 0
+        };
+
         this.init();
     }
 
@@ -87,6 +111,7 @@ class DeviceSimulator {
                 satellites: 8 + Math.floor(Math.random() * 5), // 8-12 satellites
                 source: 'simulator',
                 isMoving: true,
+                seq: this.options.seqStart,
                 lastUpdate: Date.now()
             };
 
@@ -178,10 +203,12 @@ class DeviceSimulator {
         const device = this.devices.get(deviceId);
         if (!device) return;
 
+        // Jitter of up to 1s, scaled down for sub-second intervals
+        const jitter = Math.random() * Math.min(1000, this.options.interval);
         const interval = setInterval(() => {
             this.updateDevice(deviceId);
             this.sendPosition(deviceId);
-        }, this.options.interval + Math.random() * 1000); // Add some jitter
+        }, this.options.interval + jitter);
 
         this.intervals.set(deviceId, interval);
 
@@ -245,13 +272,22 @@ class DeviceSimulator {
             heading: device.heading,
             sats: device.satellites,
             ts: Date.now(),
-            src: device.source
+            src: device.source,
+            seq: device.seq
         };
+        device.seq = (device.seq + 1) % 0x100000000;
 
-        if (this.options.mode === 'mqtt') {
-            this.sendMQTT(deviceId, payload);
-        } else {
-            this.sendHTTP(payload);
+        // A retransmit is the identical payload, as from firmware replaying its queue
+        const copies = Math.random() < this.options.dupRate ? 2 : 1;
+        for (let copy = 0; copy < copies; copy++) {
+            if (copy > 0) {
+                this.metrics.resent++;
+            }
+            if (this.options.mode === 'mqtt') {
+                this.sendMQTT(deviceId, payload);
+            } else {
+                this.sendHTTP(payload);
+            }
         }
     }
 
@@ -265,8 +301,12 @@ class DeviceSimulator {
 
         const topic = `track/${deviceId}`;
         const message = JSON.stringify(payload);
+        const sentAt = Date.now();
+        this.metrics.sent++;
 
-        this.mqttClient.publish(topic, message, (error) => {
+        this.mqttClient.publish(topic, message, { qos: this.options.qos }, (error) => {
+            // Broker ack only (QoS 0 resolves on write); server-side ack is HTTP only
+            this.recordAck(sentAt, !error);
             if (error) {
                 console.error(`❌ MQTT publish error for ${deviceId}:`, error.message);
             } else if (this.options.verbose) {
@@ -283,6 +323,7 @@ class DeviceSimulator {
             port: this.options.host.split(':')[1] || 3000,
             path: '/api/track',
             method: 'POST',
+            agent: this.httpAgent,
             headers: {
                 'Content-Type': 'application/json',
                 'Content-Length': Buffer.byteLength(postData),
@@ -290,7 +331,12 @@ class DeviceSimulator {
             }
         };
 
+        const sentAt = Date.now();
+        this.metrics.sent++;
+
         const req = http.request(options, (res) => {
+            res.resume();
+            this.recordAck(sentAt, res.statusCode === 200);
             if (res.statusCode === 200) {
                 if (this.options.verbose) {
                     const device = this.devices.get(payload.device_id);
@@ -302,6 +348,7 @@ class DeviceSimulator {
         });
 
         req.on('error', (error) => {
+            this.recordAck(sentAt, false);
             console.error(`❌ HTTP request error for ${payload.device_id}:`, error.message);
         });
 
@@ -309,13 +356,69 @@ class DeviceSimulator {
         req.end();
     }
 
+    recordAck(sentAt, ok) {
+        if (!ok) {
+            this.metrics.errors++;
+            return;
+        }
+
+        const latency = Date.now() - sentAt;
+        this.metrics.acked++;
+        this.metrics.windowAcked++;
+        this.metrics.latencies.push(latency);
+
+        // Bounded sample for the end-of-run summary
+        if (this.metrics.allLatencies.length < 200000) {
+            this.metrics.allLatencies.push(latency);
+        }
+    }
+
+    percentile(samples, p) {
+        if (samples.length === 0) return 0;
+        const sorted = samples.slice().sort((a, b) => a - b);
+        return sorted[Math.min(sorted.length - 1, Math.floor(sorted.length * p))];
+    }
+
     startStatusReporting() {
-        setInterval(() => {
+        this.metrics.startTime = Date.now();
+        this.metrics.windowStart = Date.now();
+
+        this.statusInterval = setInterval(() => {
             const activeDevices = Array.from(this.devices.values()).filter(d => d.isMoving).length;
-            const totalUpdates = Array.from(this.devices.values()).reduce((sum, d) => sum + d.lastUpdate, 0);
+            const now = Date.now();
+            const rate = this.metrics.windowAcked / ((now - this.metrics.windowStart) / 1000);
 
             console.log(`📊 Status: ${this.devices.size} devices, ${activeDevices} moving, mode: ${this.options.mode.toUpperCase()}`);
+            console.log(`   ${rate.toFixed(1)} fixes/s acked, p50 ${this.percentile(this.metrics.latencies, 0.5)}ms, ` +
+                `p99 ${this.percentile(this.metrics.latencies, 0.99)}ms, ${this.metrics.errors} errors`);
+
+            this.metrics.latencies = [];
+            this.metrics.windowAcked = 0;
+            this.metrics.windowStart = now;
         }, 10000); // Every 10 seconds
+
+        if (this.options.duration > 0) {
+            setTimeout(() => {
+                this.stopSimulation();
+                process.exit(0);
+            }, this.options.duration * 1000);
+        }
+    }
+
+    printSummary() {
+        if (!this.metrics.startTime) return;
+
+        const elapsed = (Date.now() - this.metrics.startTime) / 1000;
+        const samples = this.metrics.allLatencies;
+
+        console.log('📈 Summary:');
+        console.log(`   sent ${this.metrics.sent}, acked ${this.metrics.acked}, errors ${this.metrics.errors} in ${elapsed.toFixed(1)}s`);
+        if (this.metrics.resent > 0) {
+            console.log(`   ${this.metrics.resent} of those were retransmits; unique fixes ${this.metrics.sent - this.metrics.resent}`);
+        }
+        console.log(`   sustained ${(this.metrics.acked / elapsed).toFixed(1)} fixes/s`);
+        console.log(`   ack latency p50 ${this.percentile(samples, 0.5)}ms, p99 ${this.percentile(samples, 0.99)}ms, ` +
+            `max ${this.percentile(samples, 1)}ms`);
     }
 
     stopSimulation() {
@@ -330,6 +433,10 @@ class DeviceSimulator {
             clearInterval(interval);
         });
         this.intervals.clear();
+        clearInterval(this.statusInterval);
+
+        this.printSummary();
+        this.httpAgent.destroy();
 
         // Close MQTT connection
         if (this.mqttClient) {
@@ -401,6 +508,9 @@ function parseArgs() {
             case '--mqtt-password':
                 options.mqttPassword = args[++i];
                 break;
+            case '--qos':
+                options.qos = parseInt(args[++i]);
+                break;
             case '--token':
                 options.token = args[++i];
                 break;
@@ -413,6 +523,15 @@ function parseArgs() {
             case '--radius':
                 options.radius = parseFloat(args[++i]);
                 break;
+            case '--duration':
+                options.duration = parseInt(args[++i]);
+                break;
+            case '--dup':
+                options.dupRate = parseFloat(args[++i]);
+                break;
+            case '--seq-start':
+                options.seqStart = parseInt(args[++i]);
+                break;
             case '--verbose':
             case '-v':
                 options.verbose = true;
@@ -448,10 +567,14 @@ Options:
   --mqtt-port <port>          MQTT broker port (default: 1883)
   --mqtt-username <user>      MQTT username
   --mqtt-password <pass>      MQTT password
+  --qos <0|1|2>               MQTT publish QoS (default: 0)
   --token <token>             Device authentication token (default: default_token)
   --start-lat <lat>           Starting latitude (default: 40.7128)
   --start-lng <lng>           Starting longitude (default: -74.0060)
   --radius <meters>           Starting position radius in meters (default: 1000)
+  --duration <seconds>        Stop after this many seconds and print a summary
+  --dup <fraction>            Send this fraction of fixes twice, like a retransmit (default: 0)
+  --seq-start <n>             First fix sequence number (default: tenths of a second since the epoch)
   --verbose, -v               Enable verbose logging
   --help, -h                  Show this help message
 
@@ -465,6 +588,9 @@ Examples:
   # High-frequency simulation with custom location
   node device-simulator.js --n 3 --interval 1000 --speed 60 --start-lat 37.7749 --start-lng -122.4194
 
+  # Ingest benchmark: sustained fixes/s and p99 ack latency over 60s
+  node device-simulator.js --n 500 --interval 250 --mode http --duration 60
+
   # Verbose mode for debugging
   node device-simulator.js --n 2 --verbose --mode http --host 192.168.1.100:3000
 `);
@@ -0,0 +1,326 @@
+#!/usr/bin/env node
+
+/*
+ * NMEA Budget
+ * Models the SIM7600 GNSS output on the ESP32's modem UART
+ *
+ * Usage:
+ *   node nmea-budget.js
+ *   node nmea-budget.js --rate 10 --mask 3 --mode 15 --seconds 60
+ *   node nmea-budget.js --rate 10 --mask 511 --poll-ms 100 --baud 115200
+ *
+ * Generates the sentences the modem emits each epoch for a tracker driving
+ * at --speed, in the modem's order: GSV first, then GGA and RMC, then GSA,
+ * VTG and the rest. --mask uses the AT+CGPSNMEA bits and --mode the
+ * AT+CGNSSMODE constellations (firmware/gnss_config.h). The sentences are
+ * clocked out at 10 bits per byte. Output that arrives while the previous
+ * epoch is still on the wire waits in the modem. The receiving side frames
+ * lines the way uart_lines.h does, checks each checksum and treats an epoch
+ * as a fix once its RMC and GGA have both arrived, as TinyGPSPlus does.
+ * The tool reports:
+ *   bytes/fix     UART bytes per fix delivered
+ *   utilisation   share of the line's capacity in use; above 100% the
+ *                 modem falls further behind every epoch
+ *   latency       epoch to fix, either on arrival (a task blocked on the
+ *                 UART event queue) or at the next poll of a loop() that
+ *                 sleeps --poll-ms plus --loop-work-ms of other work
+ *   rx peak       most bytes waiting in the ESP32 ring buffer at a poll
+ *                 (UART_RX_BUFFER_SIZE must exceed it)
+ *
+ * With no --rate/--mask, the modem default (1 Hz, every sentence), 10 Hz with
+ * every sentence and the firmware setting (10 Hz, RMC+GGA) are compared.
+ */
+
+// AT+CGPSNMEA bits. Galileo and BeiDou GSV are counted with GPGSV.
+const NMEA = { GGA: 1, RMC: 2, GSV: 4, GSA: 8, VTG: 16, PQXFI: 32, GLGSV: 64, GNGSA: 128, GNGNS: 256 };
+const MASK_ALL = 511;
+// AT+CGNSSMODE bits: talker ID and typical satellites in view
+const CONSTELLATIONS = [
+    { bit: 1, talker: 'GP', prns: [2, 5, 6, 9, 12, 17, 19, 20, 25, 29] },
+    { bit: 2, talker: 'GL', prns: [65, 66, 72, 73, 74, 80, 81] },
+    { bit: 4, talker: 'GA', prns: [301, 303, 305, 311, 312, 326] },
+    { bit: 8, talker: 'GB', prns: [401, 403, 406, 409, 413, 416, 421, 422] }
+];
+const KNOTS_PER_KMH = 0.539957;
+
+function checksum(body) {
+    let sum = 0;
+    for (let i = 0; i < body.length; i++) {
+        sum ^= body.charCodeAt(i);
+    }
+    return sum.toString(16).toUpperCase().padStart(2, '0');
+}
+
+function sentence(body) {
+    return `$${body}*${checksum(body)}\r\n`;
+}
+
+// ddmm.mmmmmm / dddmm.mmmmmm as the SIM7600 prints them
+function nmeaCoord(value, degreeDigits) {
+    const abs = Math.abs(value);
+    const degrees = Math.floor(abs);
+    const minutes = (abs - degrees) * 60;
+    return `${String(degrees).padStart(degreeDigits, '0')}${minutes.toFixed(6).padStart(9, '0')}`;
+}
+
+function nmeaTime(date) {
+    const pad = value => String(value).padStart(2, '0');
+    return `${pad(date.getUTCHours())}${pad(date.getUTCMinutes())}${pad(date.getUTCSeconds())}.${pad(Math.floor(date.getUTCMilliseconds() / 10))}`;
+}
+
+function nmeaDate(date) {
+    const pad = value => String(value).padStart(2, '0');
+    return `${pad(date.getUTCDate())}${pad(date.getUTCMonth() + 1)}${pad(date.getUTCFullYear() % 100)}`;
+}
+
+// The sentences for one epoch, in output order
+function epochSentences(fix, options) {
+    const constellations = CONSTELLATIONS.filter(c => options.mode & c.bit);
+    const used = constellations.reduce((count, c) => count + c.prns.length, 0);
+    const lat = `${nmeaCoord(fix.lat, 2)},${fix.lat >= 0 ? 'N' : 'S'}`;
+    const lng = `${nmeaCoord(fix.lng, 3)},${fix.lng >= 0 ? 'E' : 'W'}`;
+    const time = nmeaTime(fix.time);
+    const knots = (fix.speed * KNOTS_PER_KMH).toFixed(1);
+    const course = fix.course.toFixed(1);
+    const out = [];
+
+    for (const c of constellations) {
+        const gsvBit = c.talker === 'GL' ? NMEA.GLGSV : NMEA.GSV;
+        if (!(options.mask & gsvBit)) {
+            continue;
+        }
+        const messages = Math.ceil(c.prns.length / 4);
+        for (let m = 0; m < messages; m++) {
+            const sats = c.prns.slice(m * 4, m * 4 + 4)
+                .map((prn, i) => `${prn},${20 + ((prn * 7 + i * 13) % 60)},${(prn * 37) % 360},${30 + (prn % 18)}`);
+            out.push({ type: 'GSV', text: sentence(`${c.talker}GSV,${messages},${m + 1},${c.prns.length},${sats.join(',')}`) });
+        }
+    }
+    if (options.mask & NMEA.GGA) {
+        out.push({ type: 'GGA', text: sentence(`GPGGA,${time},${lat},${lng},1,${String(used).padStart(2, '0')},0.7,${fix.alt.toFixed(1)},M,-34.0,M,,`) });
+    }
+    if (options.mask & NMEA.RMC) {
+        out.push({ type: 'RMC', text: sentence(`GPRMC,${time},A,${lat},${lng},${knots},${course},${nmeaDate(fix.time)},,,A`) });
+    }
+    for (const c of constellations) {
+        const bit = c.talker === 'GP' ? NMEA.GSA : NMEA.GNGSA;
+        if (options.mask & bit) {
+            const prns = c.prns.slice(0, 12).concat(new Array(12).fill('')).slice(0, 12);
+            out.push({ type: 'GSA', text: sentence(`${c.talker === 'GP' ? 'GP' : 'GN'}GSA,A,3,${prns.join(',')},1.1,0.7,0.9`) });
+        }
+    }
+    if (options.mask & NMEA.VTG) {
+        out.push({ type: 'VTG', text: sentence(`GPVTG,${course},T,,M,${knots},N,${fix.speed.toFixed(1)},K,A`) });
+    }
+    if (options.mask & NMEA.PQXFI) {
+        out.push({ type: 'PQXFI', text: sentence(`PQXFI,${time.slice(0, 8)},${lat},${lng},${fix.alt.toFixed(1)},2.4,3.1,0.1`) });
+    }
+    if (options.mask & NMEA.GNGNS) {
+        out.push({ type: 'GNS', text: sentence(`GNGNS,${time},${lat},${lng},${constellations.map(() => 'A').join('')},${String(used).padStart(2, '0')},0.7,${fix.alt.toFixed(1)},-34.0,,,V`) });
+    }
+    return out;
+}
+
+// Receiving side: split the byte stream into lines and validate them
+class LineChecker {
+    constructor() {
+        this.partial = '';
+        this.lines = 0;
+        this.bad = 0;
+    }
+
+    push(text) {
+        const lines = (this.partial + text).split('\n');
+        this.partial = lines.pop();
+        const types = [];
+        for (let line of lines) {
+            line = line.replace(/\r$/, '');
+            const star = line.lastIndexOf('*');
+            if (line[0] !== '$' || star < 0 || checksum(line.slice(1, star)) !== line.slice(star + 1)) {
+                this.bad++;
+                continue;
+            }
+            this.lines++;
+            types.push(line.slice(3, star).split(',')[0]);
+        }
+        return types;
+    }
+}
+
+function percentile(sorted, p) {
+    if (sorted.length === 0) {
+        return 0;
+    }
+    return sorted[Math.min(sorted.length - 1, Math.floor(p / 100 * sorted.length))];
+}
+
+function simulate(options) {
+    const byteMs = 10000 / options.baud; // start + 8 data + stop bits
+    const epochMs = 1000 / options.rate;
+    const epochs = Math.round(options.seconds * options.rate);
+    const loopMs = options.pollMs + options.loopWorkMs; // drifts against the epochs
+    const start = Date.UTC(2026, 0, 1, 12, 0, 0);
+    const checker = new LineChecker();
+
+    let lineFreeAt = 0; // when the UART finishes what the modem has queued
+    let bytes = 0;
+    let fixes = 0;
+    let rxPeak = 0;
+    const eventLatency = [];
+    const pollLatency = [];
+    const arrivals = []; // [time, bytes] for the rx buffer model
+
+    const fix = { lat: options.startLat, lng: options.startLng, alt: 12, speed: options.speed, course: 45, time: null };
+    for (let e = 0; e < epochs; e++) {
+        const epochAt = e * epochMs;
+        fix.time = new Date(start + epochAt);
+        fix.course = (45 + 30 * Math.sin(e / (options.rate * 20))) % 360;
+        const meters = options.speed / 3.6 * epochMs / 1000;
+        fix.lat += meters * Math.cos(fix.course * Math.PI / 180) / 111320;
+        fix.lng += meters * Math.sin(fix.course * Math.PI / 180) / (111320 * Math.cos(fix.lat * Math.PI / 180));
+
+        let sentAt = Math.max(epochAt + options.engineMs, lineFreeAt);
+        let haveGga = !(options.mask & NMEA.GGA);
+        let haveRmc = !(options.mask & NMEA.RMC);
+        let fixAt = null;
+
+        for (const s of epochSentences(fix, options)) {
+            sentAt += s.text.length * byteMs;
+            bytes += s.text.length;
+            arrivals.push([sentAt, s.text.length]);
+            for (const type of checker.push(s.text)) {
+                haveGga = haveGga || type === 'GGA';
+                haveRmc = haveRmc || type === 'RMC';
+            }
+            if (fixAt === null && haveGga && haveRmc) {
+                fixAt = sentAt;
+            }
+        }
+        lineFreeAt = sentAt;
+
+        if (fixAt !== null) {
+            fixes++;
+            eventLatency.push(fixAt - epochAt);
+            const pollAt = Math.ceil(fixAt / loopMs) * loopMs;
+            pollLatency.push(pollAt - epochAt);
+        }
+    }
+
+    // Bytes the ring buffer holds at each poll
+    let pending = 0;
+    let next = 0;
+    for (let poll = loopMs; next < arrivals.length; poll += loopMs) {
+        while (next < arrivals.length && arrivals[next][0] <= poll) {
+            pending += arrivals[next++][1];
+        }
+        rxPeak = Math.max(rxPeak, pending);
+        pending = 0;
+    }
+
+    eventLatency.sort((a, b) => a - b);
+    pollLatency.sort((a, b) => a - b);
+    const seconds = epochs * epochMs / 1000;
+    return {
+        rate: options.rate,
+        mask: options.mask,
+        fixes,
+        lines: checker.lines,
+        badLines: checker.bad,
+        bytesPerFix: bytes / Math.max(1, fixes),
+        bytesPerSecond: bytes / seconds,
+        utilisation: bytes * byteMs / (seconds * 1000),
+        event: { p50: percentile(eventLatency, 50), p99: percentile(eventLatency, 99), max: eventLatency[eventLatency.length - 1] || 0 },
+        poll: { p50: percentile(pollLatency, 50), p99: percentile(pollLatency, 99), max: pollLatency[pollLatency.length - 1] || 0 },
+        rxPeak
+    };
+}
+
+function maskName(mask) {
+    if (mask === MASK_ALL) {
+        return 'all';
+    }
+    return Object.keys(NMEA).filter(name => mask & NMEA[name]).join('+');
+}
+
+function report(results, options) {
+    console.log(`SIM7600 NMEA on ${options.baud} baud (${(options.baud / 10).toFixed(0)} B/s), mode ${options.mode}, ${options.seconds} s at ${options.speed} km/h, loop every ${options.pollMs + options.loopWorkMs} ms\n`);
+    console.log('  rate  sentences        bytes/fix     B/s   util   event p50/p99/max ms     poll p50/p99/max ms   rx peak');
+    for (const r of results) {
+        const ms = l => `${l.p50.toFixed(1)}/${l.p99.toFixed(1)}/${l.max.toFixed(1)}`;
+        console.log(
+            `  ${`${r.rate} Hz`.padEnd(5)} ${maskName(r.mask).padEnd(16)} ${r.bytesPerFix.toFixed(0).padStart(9)} ` +
+            `${r.bytesPerSecond.toFixed(0).padStart(7)} ${(r.utilisation * 100).toFixed(0).padStart(5)}%   ` +
+            `${ms(r.event).padEnd(22)} ${ms(r.poll).padEnd(21)} ${String(r.rxPeak).padStart(7)}`
+        );
+        if (r.badLines > 0) {
+            console.log(`        ${r.badLines} lines failed their checksum`);
+        }
+        if (r.utilisation > 1) {
+            console.log('        saturated: the modem falls further behind every epoch');
+        }
+    }
+}
+
+function parseArgs() {
+    const args = process.argv.slice(2);
+    const options = {
+        rate: null,
+        mask: null,
+        mode: 15,
+        baud: 115200,
+        seconds: 60,
+        pollMs: 100, // delay(100) in the sketch's loop()
+        loopWorkMs: 3, // the rest of loop(): publish, MQTT, heartbeat
+        engineMs: 0, // epoch to first byte on the wire
+        speed: 50,
+        startLat: 40.7128,
+        startLng: -74.0060
+    };
+
+    for (let i = 0; i < args.length; i++) {
+        switch (args[i]) {
+            case '--rate':
+                options.rate = parseInt(args[++i]);
+                break;
+            case '--mask':
+                options.mask = parseInt(args[++i]);
+                break;
+            case '--mode':
+                options.mode = parseInt(args[++i]);
+                break;
+            case '--baud':
+                options.baud = parseInt(args[++i]);
+                break;
+            case '--seconds':
+                options.seconds = parseFloat(args[++i]);
+                break;
+            case '--poll-ms':
+                options.pollMs = parseFloat(args[++i]);
+                break;
+            case '--loop-work-ms':
+                options.loopWorkMs = parseFloat(args[++i]);
+                break;
+            case '--engine-ms':
+                options.engineMs = parseFloat(args[++i]);
+                break;
+            case '--speed':
+                options.speed = parseFloat(args[++i]);
+                break;
+            default:
+                console.error(`Unknown option: ${args[i]}`);
+                process.exit(1);
+        }
+    }
+
+    return options;
+}
+
+if (require.main === module) {
+    const options = parseArgs();
+    const runs = options.rate === null && options.mask === null
+        ? [{ rate: 1, mask: MASK_ALL }, { rate: 10, mask: MASK_ALL }, { rate: 10, mask: NMEA.GGA | NMEA.RMC }]
+        : [{ rate: options.rate || 10, mask: options.mask === null ? NMEA.GGA | NMEA.RMC : options.mask }];
+    report(runs.map(run => simulate({ ...options, ...run })), options);
+}
+
+module.exports = { simulate, epochSentences, NMEA };
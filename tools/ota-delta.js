@@ -0,0 +1,690 @@
+#!/usr/bin/env node
+
+/*
+ * OTA Delta Tool
+ * Builds, applies and sends delta firmware updates for the ESP32 tracker
+ *
+ * Usage:
+ *   node ota-delta.js diff old.bin new.bin update.patch
+ *   node ota-delta.js apply old.bin update.patch out.bin [--chunk 1024]
+ *   node ota-delta.js bench [--size 1048576] [--chunk 1024]
+ *   node ota-delta.js push update.patch --device esp32_001 [--host localhost] [--username u] [--password p]
+ *
+ * diff matches the new image against the old one bsdiff-style: approximate
+ * matches are extended across small mismatches, so code that only moved
+ * (shifted call targets and literal pools) turns into diff bytes that are
+ * mostly zero. Those diff bytes are run-length coded, and bytes with no
+ * match are copied verbatim. apply is the device's decoder (firmware/
+ * ota_delta.h), byte for byte and with the same buffers. It reports the
+ * time taken and the flash traffic. bench runs both on a synthetic image
+ * pair. push streams a patch to one device over MQTT and resumes from the
+ * device's last acknowledged offset. It requires mqtt, e.g. run with
+ * NODE_PATH=server/node_modules.
+ *
+ * Patch format (integers little-endian):
+ *   header (80 bytes): "GOTA", version 1, 3 reserved, from_size u32,
+ *                      to_size u32, sha256(from) [32], sha256(to) [32]
+ *   records until to_size bytes are produced:
+ *     varint diff_len, varint extra_len, zigzag varint seek
+ *     diff:  (varint zeros, varint literals, literals bytes) pairs covering
+ *            diff_len bytes; out = from[pos++] + byte (zeros copy from)
+ *     extra: extra_len bytes copied to out
+ *     pos += seek
+ */
+
+const fs = require('fs');
+const crypto = require('crypto');
+
+const MAGIC = 'GOTA';
+const VERSION = 1;
+const HEADER_SIZE = 80;
+const SEED = 8; // bytes that must match exactly to start a match
+const CHAIN_DEPTH = 32;
+const MIN_ZERO_RUN = 4; // shorter zero runs stay inside a literal span
+// Device decoder buffers (firmware/ota_delta.h)
+const FLASH_PAGE = 256;
+const OUT_BLOCK = 512;
+
+function sha256(buffer) {
+    return crypto.createHash('sha256').update(buffer).digest();
+}
+
+class ByteWriter {
+    constructor() {
+        this.chunks = [];
+        this.current = Buffer.alloc(65536);
+        this.length = 0;
+    }
+
+    byte(value) {
+        if (this.length === this.current.length) {
+            this.chunks.push(this.current);
+            this.current = Buffer.alloc(65536);
+            this.length = 0;
+        }
+        this.current[this.length++] = value;
+    }
+
+    varint(value) {
+        while (value >= 0x80) {
+            this.byte((value & 0x7f) | 0x80);
+            value = Math.floor(value / 128);
+        }
+        this.byte(value);
+    }
+
+    bytes(buffer, start, end) {
+        for (let i = start; i < end; i++) {
+            this.byte(buffer[i]);
+        }
+    }
+
+    toBuffer() {
+        return Buffer.concat([...this.chunks, this.current.subarray(0, this.length)]);
+    }
+}
+
+function zigzag(value) {
+    return value >= 0 ? value * 2 : -value * 2 - 1;
+}
+
+// Hash chains over every SEED-byte window of the old image
+class MatchIndex {
+    constructor(old) {
+        this.old = old;
+        this.bits = 20;
+        this.head = new Int32Array(1 << this.bits).fill(-1);
+        this.prev = new Int32Array(Math.max(1, old.length));
+        for (let p = 0; p + SEED <= old.length; p++) {
+            const h = this.hash(old, p);
+            this.prev[p] = this.head[h];
+            this.head[h] = p;
+        }
+    }
+
+    hash(buffer, p) {
+        const a = buffer.readUInt32LE(p);
+        const b = buffer.readUInt32LE(p + 4);
+        return (Math.imul(a, 0x9e3779b1) ^ Math.imul(b, 0x85ebca6b)) >>> (32 - this.bits);
+    }
+
+    // Longest exact match for next[scan..] among the indexed windows
+    search(next, scan) {
+        const old = this.old;
+        if (scan + SEED > next.length) {
+            return { len: 0, pos: 0 };
+        }
+        let best = { len: 0, pos: 0 };
+        let depth = 0;
+        for (let p = this.head[this.hash(next, scan)]; p >= 0 && depth < CHAIN_DEPTH; p = this.prev[p], depth++) {
+            let len = 0;
+            while (p + len < old.length && scan + len < next.length && old[p + len] === next[scan + len]) {
+                len++;
+            }
+            if (len > best.len) {
+                best = { len, pos: p };
+            }
+        }
+        return best.len >= SEED ? best : { len: 0, pos: 0 };
+    }
+}
+
+// Diff bytes as (zeros, literals) runs
+function writeDiff(out, diff) {
+    let i = 0;
+    while (i < diff.length) {
+        let zeros = 0;
+        while (i + zeros < diff.length && diff[i + zeros] === 0) {
+            zeros++;
+        }
+        i += zeros;
+
+        let literals = 0;
+        while (i + literals < diff.length) {
+            if (diff[i + literals] === 0) {
+                let run = 0;
+                while (run < MIN_ZERO_RUN && i + literals + run < diff.length && diff[i + literals + run] === 0) {
+                    run++;
+                }
+                if (run === MIN_ZERO_RUN || i + literals + run === diff.length) {
+                    break;
+                }
+                literals += run;
+            } else {
+                literals++;
+            }
+        }
+
+        out.varint(zeros);
+        out.varint(literals);
+        out.bytes(diff, i, i + literals);
+        i += literals;
+    }
+}
+
+// bsdiff's scan loop with hash-chain search in place of the suffix array
+function createPatch(old, next) {
+    const index = new MatchIndex(old);
+    const out = new ByteWriter();
+
+    const header = Buffer.alloc(HEADER_SIZE);
+    header.write(MAGIC, 0, 'ascii');
+    header[4] = VERSION;
+    header.writeUInt32LE(old.length, 8);
+    header.writeUInt32LE(next.length, 12);
+    sha256(old).copy(header, 16);
+    sha256(next).copy(header, 48);
+    out.bytes(header, 0, HEADER_SIZE);
+
+    let scan = 0;
+    let len = 0;
+    let pos = 0;
+    let lastScan = 0;
+    let lastPos = 0;
+    let lastOffset = 0;
+    const records = { count: 0, diffBytes: 0, extraBytes: 0 };
+
+    while (scan < next.length) {
+        let oldScore = 0;
+        let scsc;
+        for (scsc = scan += len; scan < next.length; scan++) {
+            ({ len, pos } = index.search(next, scan));
+
+            for (; scsc < scan + len; scsc++) {
+                if (scsc + lastOffset < old.length && scsc + lastOffset >= 0 && old[scsc + lastOffset] === next[scsc]) {
+                    oldScore++;
+                }
+            }
+            if ((len === oldScore && len !== 0) || len > oldScore + 8) {
+                break;
+            }
+            if (scan + lastOffset < old.length && scan + lastOffset >= 0 && old[scan + lastOffset] === next[scan]) {
+                oldScore--;
+            }
+        }
+
+        if (len === oldScore && scan !== next.length) {
+            continue;
+        }
+
+        // Extend the previous match forward and this one backward over near-matches
+        let s = 0;
+        let best = 0;
+        let lenf = 0;
+        for (let i = 0; lastScan + i < scan && lastPos + i < old.length;) {
+            if (old[lastPos + i] === next[lastScan + i]) s++;
+            i++;
+            if (s * 2 - i > best * 2 - lenf) {
+                best = s;
+                lenf = i;
+            }
+        }
+
+        let lenb = 0;
+        if (scan < next.length) {
+            s = 0;
+            best = 0;
+            for (let i = 1; scan >= lastScan + i && pos >= i; i++) {
+                if (old[pos - i] === next[scan - i]) s++;
+                if (s * 2 - i > best * 2 - lenb) {
+                    best = s;
+                    lenb = i;
+                }
+            }
+        }
+
+        if (lastScan + lenf > scan - lenb) {
+            const overlap = lastScan + lenf - (scan - lenb);
+            s = 0;
+            best = 0;
+            let lens = 0;
+            for (let i = 0; i < overlap; i++) {
+                if (next[lastScan + lenf - overlap + i] === old[lastPos + lenf - overlap + i]) s++;
+                if (next[scan - lenb + i] === old[pos - lenb + i]) s--;
+                if (s > best) {
+                    best = s;
+                    lens = i + 1;
+                }
+            }
+            lenf += lens - overlap;
+            lenb -= lens;
+        }
+
+        const extraLen = scan - lenb - (lastScan + lenf);
+        const diff = Buffer.alloc(lenf);
+        for (let i = 0; i < lenf; i++) {
+            diff[i] = (next[lastScan + i] - old[lastPos + i]) & 0xff;
+        }
+
+        out.varint(lenf);
+        out.varint(extraLen);
+        out.varint(zigzag(pos - lenb - (lastPos + lenf)));
+        writeDiff(out, diff);
+        out.bytes(next, lastScan + lenf, lastScan + lenf + extraLen);
+
+        records.count++;
+        records.diffBytes += lenf;
+        records.extraBytes += extraLen;
+
+        lastScan = scan - lenb;
+        lastPos = pos - lenb;
+        lastOffset = pos - scan;
+    }
+
+    return { patch: out.toBuffer(), records };
+}
+
+/*
+ * The device decoder: fed the patch in arbitrary chunks, reads the running
+ * image through a FLASH_PAGE cache and writes the new one in OUT_BLOCK
+ * blocks, hashing as it goes. Mirrors OtaDelta in firmware/ota_delta.h.
+ */
+class PatchApplier {
+    constructor(from) {
+        this.from = from;
+        this.phase = 'header';
+        this.header = Buffer.alloc(HEADER_SIZE);
+        this.headerLen = 0;
+        this.varValue = 0;
+        this.varShift = 0;
+        this.diffLeft = 0;
+        this.extraLeft = 0;
+        this.litLeft = 0;
+        this.seek = 0;
+        this.fromPos = 0;
+        this.cacheStart = -FLASH_PAGE; // nothing cached yet
+        this.cache = Buffer.alloc(FLASH_PAGE);
+        this.block = Buffer.alloc(OUT_BLOCK);
+        this.blockLen = 0;
+        this.written = 0;
+        this.hash = crypto.createHash('sha256');
+        this.output = [];
+        this.stats = { flashReads: 0, flashWrites: 0 };
+    }
+
+    fail(reason) {
+        throw new Error(`patch rejected: ${reason}`);
+    }
+
+    varint(byte) {
+        if (this.varShift > 28) this.fail('corrupt varint');
+        this.varValue += (byte & 0x7f) * 2 ** this.varShift;
+        this.varShift += 7;
+        if (byte & 0x80) {
+            return null;
+        }
+        const value = this.varValue;
+        this.varValue = 0;
+        this.varShift = 0;
+        return value;
+    }
+
+    fromByte() {
+        if (this.fromPos < 0 || this.fromPos >= this.fromSize) this.fail('read past the old image');
+        if (this.fromPos < this.cacheStart || this.fromPos >= this.cacheStart + FLASH_PAGE) {
+            this.cacheStart = this.fromPos - (this.fromPos % FLASH_PAGE);
+            this.from.copy(this.cache, 0, this.cacheStart, this.cacheStart + FLASH_PAGE);
+            this.stats.flashReads++;
+        }
+        return this.cache[this.fromPos++ - this.cacheStart];
+    }
+
+    out(byte) {
+        if (this.written >= this.toSize) this.fail('output longer than to_size');
+        this.block[this.blockLen++] = byte;
+        this.written++;
+        if (this.blockLen === OUT_BLOCK) {
+            this.flushBlock();
+        }
+    }
+
+    flushBlock() {
+        if (this.blockLen > 0) {
+            const block = Buffer.from(this.block.subarray(0, this.blockLen));
+            this.hash.update(block);
+            this.output.push(block);
+            this.stats.flashWrites++;
+            this.blockLen = 0;
+        }
+    }
+
+    startHeader() {
+        const header = this.header;
+        if (header.toString('ascii', 0, 4) !== MAGIC || header[4] !== VERSION) this.fail('bad magic');
+        this.fromSize = header.readUInt32LE(8);
+        this.toSize = header.readUInt32LE(12);
+        if (this.fromSize !== this.from.length || !sha256(this.from).equals(header.subarray(16, 48))) {
+            this.fail('patch is for a different base image');
+        }
+        this.phase = this.toSize > 0 ? 'diffLen' : 'end';
+    }
+
+    endRecord() {
+        this.fromPos += this.seek;
+        this.phase = this.written === this.toSize ? 'end' : 'diffLen';
+    }
+
+    afterRun() {
+        if (this.diffLeft > 0) {
+            this.phase = 'zeros';
+        } else if (this.extraLeft > 0) {
+            this.phase = 'extra';
+        } else {
+            this.endRecord();
+        }
+    }
+
+    feed(chunk) {
+        for (let i = 0; i < chunk.length; i++) {
+            const byte = chunk[i];
+            let value;
+            switch (this.phase) {
+                case 'header':
+                    this.header[this.headerLen++] = byte;
+                    if (this.headerLen === HEADER_SIZE) this.startHeader();
+                    break;
+                case 'diffLen':
+                    if ((value = this.varint(byte)) !== null) {
+                        this.diffLeft = value;
+                        this.phase = 'extraLen';
+                    }
+                    break;
+                case 'extraLen':
+                    if ((value = this.varint(byte)) !== null) {
+                        this.extraLeft = value;
+                        this.phase = 'seek';
+                    }
+                    break;
+                case 'seek':
+                    if ((value = this.varint(byte)) !== null) {
+                        this.seek = value % 2 === 0 ? value / 2 : -(value + 1) / 2;
+                        if (this.written + this.diffLeft + this.extraLeft > this.toSize) this.fail('record past to_size');
+                        this.afterRun();
+                    }
+                    break;
+                case 'zeros':
+                    if ((value = this.varint(byte)) !== null) {
+                        if (value > this.diffLeft) this.fail('run past diff_len');
+                        for (let k = 0; k < value; k++) this.out(this.fromByte());
+                        this.diffLeft -= value;
+                        this.phase = 'literals';
+                    }
+                    break;
+                case 'literals':
+                    if ((value = this.varint(byte)) !== null) {
+                        if (value > this.diffLeft) this.fail('run past diff_len');
+                        this.litLeft = value;
+                        if (value > 0) {
+                            this.phase = 'literal';
+                        } else {
+                            this.afterRun();
+                        }
+                    }
+                    break;
+                case 'literal':
+                    this.out((this.fromByte() + byte) & 0xff);
+                    this.diffLeft--;
+                    if (--this.litLeft === 0) this.afterRun();
+                    break;
+                case 'extra':
+                    this.out(byte);
+                    if (--this.extraLeft === 0) this.endRecord();
+                    break;
+                default:
+                    this.fail('data after the end of the patch');
+            }
+        }
+    }
+
+    finish() {
+        if (this.phase !== 'end') this.fail('patch truncated');
+        this.flushBlock();
+        if (!this.hash.digest().equals(this.header.subarray(48, 80))) this.fail('new image hash mismatch');
+        return Buffer.concat(this.output);
+    }
+}
+
+function applyPatch(from, patch, chunkSize = 1024) {
+    const applier = new PatchApplier(from);
+    for (let offset = 0; offset < patch.length; offset += chunkSize) {
+        applier.feed(patch.subarray(offset, offset + chunkSize));
+    }
+    return { image: applier.finish(), stats: applier.stats };
+}
+
+/*
+ * A synthetic firmware pair for bench: 3-byte "instructions" where one in
+ * eight is a call carrying an absolute target, followed by a string table.
+ * The new version inserts a function early on (so every later call target
+ * shifts), changes some constants and appends strings. That is the shape of
+ * a typical point release.
+ */
+function syntheticImages(size) {
+    let seed = 12345;
+    const random = () => {
+        seed = (Math.imul(seed, 1103515245) + 12345) >>> 0;
+        return seed / 4294967296;
+    };
+
+    const codeSize = Math.floor(size * 0.8 / 3) * 3;
+    const instructions = [];
+    for (let i = 0; i < codeSize / 3; i++) {
+        if (random() < 0.125) {
+            instructions.push({ call: Math.floor(random() * codeSize / 3) * 3 });
+        } else {
+            instructions.push({ bytes: [random() * 256, random() * 256, random() * 256].map(Math.floor) });
+        }
+    }
+    const words = ['gps', 'fix', 'mqtt', 'lte', 'wifi', 'error', 'connect', 'publish', 'heartbeat', 'buffer', 'queue', 'ok'];
+    let strings = '';
+    while (strings.length < size - codeSize) {
+        strings += `${words[Math.floor(random() * words.length)]}_${Math.floor(random() * 1000)}\0`;
+    }
+
+    const build = (code, extraStrings) => {
+        const image = Buffer.alloc(code.length * 3 + size - codeSize + extraStrings.length);
+        code.forEach((instruction, i) => {
+            if (instruction.call !== undefined) {
+                image[i * 3] = 0xe5; // call opcode
+                image.writeUIntLE(instruction.call & 0xffff, i * 3 + 1, 2);
+            } else {
+                image.set(instruction.bytes, i * 3);
+            }
+        });
+        image.write(strings.slice(0, size - codeSize) + extraStrings, code.length * 3, 'latin1');
+        return image;
+    };
+
+    const old = build(instructions, '');
+
+    const insertAt = Math.floor(instructions.length * 0.3);
+    const inserted = Array.from({ length: 700 }, () => ({ bytes: [random() * 256, random() * 256, random() * 256].map(Math.floor) }));
+    const shift = inserted.length * 3;
+    const updated = instructions.map((instruction) => {
+        if (instruction.call !== undefined && instruction.call >= insertAt * 3) {
+            return { call: instruction.call + shift };
+        }
+        if (instruction.bytes && random() < 0.0005) {
+            return { bytes: [instruction.bytes[0], Math.floor(random() * 256), instruction.bytes[2]] };
+        }
+        return instruction;
+    });
+    updated.splice(insertAt, 0, ...inserted);
+    const next = build(updated, 'ota_delta_ready\0resume_offset\0');
+
+    return { old, next };
+}
+
+function report(old, next, chunkSize) {
+    let started = process.hrtime.bigint();
+    const { patch, records } = createPatch(old, next);
+    const diffMs = Number(process.hrtime.bigint() - started) / 1e6;
+
+    started = process.hrtime.bigint();
+    const { image, stats } = applyPatch(old, patch, chunkSize);
+    const applyMs = Number(process.hrtime.bigint() - started) / 1e6;
+    if (!image.equals(next)) {
+        throw new Error('applied image differs from the new image');
+    }
+
+    console.log(`old image:    ${old.length} bytes`);
+    console.log(`new image:    ${next.length} bytes`);
+    console.log(`patch:        ${patch.length} bytes (${(patch.length / next.length * 100).toFixed(1)}% of a full image), ${records.count} records`);
+    console.log(`              ${records.diffBytes} diff bytes, ${records.extraBytes} extra bytes`);
+    console.log(`chunks:       ${Math.ceil(patch.length / chunkSize)} x ${chunkSize} bytes`);
+    console.log(`diff:         ${diffMs.toFixed(0)} ms`);
+    console.log(`apply (host): ${applyMs.toFixed(0)} ms, ${stats.flashReads} page reads, ${stats.flashWrites} block writes`);
+    console.log(`decoder RAM:  ${HEADER_SIZE + FLASH_PAGE + OUT_BLOCK} bytes of buffers + SHA-256 context`);
+    return patch;
+}
+
+// Stream a patch to one device; the device's acks carry the next offset it wants
+function push(patchFile, options) {
+    const mqtt = require('mqtt');
+    const patch = fs.readFileSync(patchFile);
+    const patchId = sha256(patch).subarray(0, 8).toString('hex');
+    const chunkSize = options.chunk || 1024;
+    const windowChunks = options.window || 4;
+    const device = options.device;
+
+    const client = mqtt.connect(`mqtt://${options.host || 'localhost'}:${options.port || 1883}`, {
+        username: options.username,
+        password: options.password
+    });
+
+    let acked = 0;
+    let sent = 0;
+    let timer = null;
+    const started = Date.now();
+
+    const sendWindow = () => {
+        while (sent < patch.length && sent < acked + windowChunks * chunkSize) {
+            const data = patch.subarray(sent, sent + chunkSize);
+            const frame = Buffer.alloc(4 + data.length);
+            frame.writeUInt32LE(sent, 0);
+            data.copy(frame, 4);
+            client.publish(`control/${device}/ota`, frame);
+            sent += data.length;
+        }
+        clearTimeout(timer);
+        // No ack in time: start again from the last acknowledged offset
+        timer = setTimeout(() => {
+            sent = acked;
+            sendWindow();
+        }, 5000);
+    };
+
+    const start = () => {
+        client.publish(`control/${device}`, JSON.stringify({ command: 'ota', patch: patchId, size: patch.length, chunk: chunkSize }));
+    };
+
+    client.on('connect', () => {
+        client.subscribe(`ota/${device}`, () => start());
+        console.log(`Sending ${patch.length} byte patch ${patchId} to ${device}`);
+    });
+
+    client.on('message', (topic, message) => {
+        const ack = JSON.parse(message.toString());
+        if (ack.patch !== patchId) {
+            return;
+        }
+        if (ack.status === 'error') {
+            console.error(`Device rejected the update: ${ack.error}`);
+            process.exit(1);
+        }
+        if (ack.status === 'done') {
+            clearTimeout(timer);
+            console.log(`Update applied in ${((Date.now() - started) / 1000).toFixed(1)} s; device is rebooting into it`);
+            client.end();
+            return;
+        }
+        // 'ready' (start or resume after a reconnect) and 'progress' both say where to continue
+        acked = ack.offset;
+        if (ack.status === 'ready' || sent < acked) {
+            sent = acked;
+        }
+        if (options.verbose) {
+            console.log(`${ack.status} ${acked}/${patch.length}`);
+        }
+        sendWindow();
+    });
+
+    client.on('error', (error) => {
+        console.error('MQTT error:', error.message);
+    });
+}
+
+function parseArgs() {
+    const args = process.argv.slice(2);
+    const options = { command: args[0], files: [] };
+
+    for (let i = 1; i < args.length; i++) {
+        switch (args[i]) {
+            case '--chunk':
+                options.chunk = parseInt(args[++i]);
+                break;
+            case '--size':
+                options.size = parseInt(args[++i]);
+                break;
+            case '--device':
+                options.device = args[++i];
+                break;
+            case '--host':
+                options.host = args[++i];
+                break;
+            case '--port':
+                options.port = parseInt(args[++i]);
+                break;
+            case '--username':
+                options.username = args[++i];
+                break;
+            case '--password':
+                options.password = args[++i];
+                break;
+            case '--window':
+                options.window = parseInt(args[++i]);
+                break;
+            case '--verbose':
+                options.verbose = true;
+                break;
+            default:
+                if (args[i].startsWith('--')) {
+                    console.error(`Unknown option: ${args[i]}`);
+                    process.exit(1);
+                }
+                options.files.push(args[i]);
+        }
+    }
+
+    return options;
+}
+
+if (require.main === module) {
+    const options = parseArgs();
+    const [a, b, c] = options.files;
+
+    try {
+        if (options.command === 'diff' && c) {
+            const patch = report(fs.readFileSync(a), fs.readFileSync(b), options.chunk || 1024);
+            fs.writeFileSync(c, patch);
+        } else if (options.command === 'apply' && c) {
+            const started = process.hrtime.bigint();
+            const { image, stats } = applyPatch(fs.readFileSync(a), fs.readFileSync(b), options.chunk || 1024);
+            fs.writeFileSync(c, image);
+            console.log(`Applied in ${(Number(process.hrtime.bigint() - started) / 1e6).toFixed(0)} ms: ${image.length} bytes, ${stats.flashReads} page reads, ${stats.flashWrites} block writes, hash verified`);
+        } else if (options.command === 'bench') {
+            const { old, next } = syntheticImages(options.size || 1048576);
+            report(old, next, options.chunk || 1024);
+        } else if (options.command === 'push' && a && options.device) {
+            push(a, options);
+        } else {
+            console.log('Usage: node ota-delta.js <diff old new patch | apply old patch out | bench | push patch --device id> [options]');
+            process.exit(1);
+        }
+    } catch (error) {
+        console.error(error.message);
+        process.exit(1);
+    }
+}
+
+module.exports = { createPatch, applyPatch, PatchApplier };
@@ -0,0 +1,170 @@
+#!/usr/bin/env node
+
+/*
+ * WebSocket Fan-out Benchmark
+ * Measures outbound live-update traffic per dashboard client
+ *
+ * Usage:
+ *   node device-simulator.js --n 10000 --interval 1000 --radius 200000 --mode mqtt
+ *   node ws-fanout-bench.js --clients 50 --view-km 20 --duration 60
+ *   node ws-fanout-bench.js --clients 50 --unfiltered --duration 60
+ *   node ws-fanout-bench.js --clients 50 --unfiltered --binary --duration 60
+ *
+ * Each client subscribes to a random view-km square inside the simulator's
+ * area (or to everything with --unfiltered) and counts the bytes and
+ * messages it receives. Requires ws, e.g. run with NODE_PATH=server/node_modules.
+ */
+
+const WebSocket = require('ws');
+
+class FanoutBench {
+    constructor(options) {
+        this.options = {
+            url: options.url || 'ws://localhost:3000/ws',
+            clients: options.clients || 50,
+            viewKm: options.viewKm || 20,
+            unfiltered: options.unfiltered || false,
+            binary: options.binary || false,
+            centerLat: options.centerLat || 40.7128,
+            centerLng: options.centerLng || -74.0060,
+            radius: options.radius || 200000, // meters, as passed to the simulator
+            duration: options.duration || 60,
+            ...options
+        };
+
+        this.sockets = [];
+        this.totals = { bytes: 0, messages: 0, updates: 0, initBytes: 0, frames: 0 };
+    }
+
+    // Random square of viewKm inside the simulated area
+    randomBbox() {
+        const metersPerDegLat = 111320;
+        const metersPerDegLng = metersPerDegLat * Math.cos(this.options.centerLat * Math.PI / 180);
+        const halfLat = (this.options.viewKm * 500) / metersPerDegLat;
+        const halfLng = (this.options.viewKm * 500) / metersPerDegLng;
+
+        const angle = Math.random() * 2 * Math.PI;
+        const distance = Math.sqrt(Math.random()) * this.options.radius;
+        const lat = this.options.centerLat + (distance * Math.cos(angle)) / metersPerDegLat;
+        const lng = this.options.centerLng + (distance * Math.sin(angle)) / metersPerDegLng;
+
+        return [lng - halfLng, lat - halfLat, lng + halfLng, lat + halfLat].map(value => value.toFixed(5));
+    }
+
+    connect() {
+        for (let i = 0; i < this.options.clients; i++) {
+            const params = [];
+            if (this.options.binary) {
+                params.push('binary=1');
+            }
+            if (!this.options.unfiltered) {
+                params.push(`bbox=${this.randomBbox().join(',')}`);
+            }
+            const ws = new WebSocket(params.length > 0 ? `${this.options.url}?${params.join('&')}` : this.options.url);
+
+            ws.on('message', (data, isBinary) => {
+                const size = data.length;
+                if (isBinary) {
+                    // Binary update frame: u32 count at offset 4
+                    this.totals.bytes += size;
+                    this.totals.messages++;
+                    this.totals.frames++;
+                    this.totals.updates += data.readUInt32LE(4);
+                    return;
+                }
+
+                const message = JSON.parse(data);
+                if (message.type === 'init') {
+                    this.totals.initBytes += size;
+                    return;
+                }
+                this.totals.bytes += size;
+                this.totals.messages++;
+                if (message.type === 'update') {
+                    this.totals.updates++;
+                    this.totals.frames++;
+                } else if (message.type === 'updates') {
+                    this.totals.updates += message.devices.length;
+                    this.totals.frames++;
+                }
+            });
+            ws.on('error', error => console.error(`Client ${i} error:`, error.message));
+
+            this.sockets.push(ws);
+        }
+    }
+
+    run() {
+        console.log(`Connecting ${this.options.clients} ${this.options.unfiltered ? 'unfiltered' : `${this.options.viewKm} km view`} ${this.options.binary ? 'binary' : 'JSON'} clients to ${this.options.url}`);
+        this.connect();
+
+        const start = Date.now();
+        const report = setInterval(() => {
+            const seconds = (Date.now() - start) / 1000;
+            console.log(`  ${seconds.toFixed(0)}s: ${(this.totals.bytes / seconds / 1024).toFixed(1)} KiB/s total, ${(this.totals.updates / seconds).toFixed(0)} updates/s`);
+        }, 10000);
+
+        setTimeout(() => {
+            clearInterval(report);
+            const seconds = (Date.now() - start) / 1000;
+            const clients = this.options.clients;
+
+            console.log('\nSummary');
+            console.log(`  outbound:        ${(this.totals.bytes / seconds / 1024).toFixed(1)} KiB/s (${(this.totals.bytes / seconds / 1024 / clients).toFixed(1)} KiB/s per client)`);
+            console.log(`  messages:        ${(this.totals.messages / seconds).toFixed(0)}/s, updates ${(this.totals.updates / seconds / clients).toFixed(1)}/s per client`);
+            console.log(`  update frames:   ${(this.totals.frames / seconds / clients).toFixed(1)}/s per client, ${(this.totals.bytes / Math.max(1, this.totals.updates)).toFixed(0)} bytes per update`);
+            console.log(`  init snapshot:   ${(this.totals.initBytes / clients / 1024).toFixed(1)} KiB per client`);
+
+            this.sockets.forEach(ws => ws.close());
+            process.exit(0);
+        }, this.options.duration * 1000);
+    }
+}
+
+function parseArgs() {
+    const args = process.argv.slice(2);
+    const options = {};
+
+    for (let i = 0; i < args.length; i++) {
+        switch (args[i]) {
+            case '--url':
+                options.url = args[++i];
+                break;
+            case '--clients':
+                options.clients = parseInt(args[++i]);
+                break;
+            case '--view-km':
+                options.viewKm = parseFloat(args[++i]);
+                break;
+            case '--unfiltered':
+                options.unfiltered = true;
+                break;
+            case '--binary':
+                options.binary = true;
+                break;
+            case '--center-lat':
+                options.centerLat = parseFloat(args[++i]);
+                break;
+            case '--center-lng':
+                options.centerLng = parseFloat(args[++i]);
+                break;
+            case '--radius':
+                options.radius = parseFloat(args[++i]);
+                break;
+            case '--duration':
+                options.duration = parseInt(args[++i]);
+                break;
+            default:
+                console.error(`Unknown option: ${args[i]}`);
+                process.exit(1);
+        }
+    }
+
+    return options;
+}
+
+if (require.main === module) {
+    new FanoutBench(parseArgs()).run();
+}
+
+module.exports = FanoutBench;